@@ -0,0 +1,941 @@
+/* ========================================================================== */
+/* File: AMServer.c
+ *
+ * Author: Troy Palmer and Sean Cann
+ * Date: 6.4.2015
+ *
+ * Overview: Local loopback maze server speaking the amazing.h protocol, so
+ * the client can be run, timed and load-tested on a single machine.
+ *
+ * The main thread listens on AM_SERVER_PORT for AM_INIT and only accepts:
+ * each connection is handed to an init thread of its own, which waits for
+ * the AM_INIT, so a client that connects and says nothing holds up no one
+ * else's maze. Each AM_INIT gets a freshly generated perfect maze and its
+ * own listening MazePort, which is returned in AM_INIT_OK and served by a
+ * dedicated maze thread. The maze thread waits for nAvatars
+ * AM_AVATAR_READY messages, then hands out AM_AVATAR_TURN round-robin,
+ * validates each AM_AVATAR_MOVE against the maze and ends with
+ * AM_MAZE_SOLVED once every avatar shares a square. The MazePort speaks
+ * whichever wire protocol (v1 or the compact v2) the client asked for in
+ * AM_INIT, and the bytes and send/recv calls the server spends on each maze
+ * are reported next to its solve latency.
+ *
+ * With AM_FEATURE_PATH an avatar may answer its turn with AM_AVATAR_PATH.
+ * The server then plays the queued steps on that avatar's following turns
+ * without asking it again, dropping the rest of the path at the first step
+ * that hits a wall, and only broadcasts AM_AVATAR_TURN when the avatar whose
+ * turn it is has nothing queued.
+ *
+ * With AM_FEATURE_MUX one connection may send AM_AVATAR_READY for several
+ * avatars and then moves for any of them; broadcasts go out once per
+ * connection rather than once per avatar.
+ *
+ * Every port is also served on an AF_UNIX socket (see amtransport.h), which
+ * a co-located client may use as a plain stream or to set up a shared-memory
+ * ring pair. A maze thread whose connections are all shared memory sleeps on
+ * the region's doorbell futex instead of poll().
+ *
+ * Input/Command line options:
+ *
+ * 1. -p port: Management port to listen on (default AM_SERVER_PORT)
+ *
+ * 2. -s seed: Base seed; maze k is generated from seed + k (default 1)
+ *
+ * 3. -m maxMoves: Moves allowed per maze before AM_TOO_MANY_MOVES
+ *    (default AM_MAX_MOVES)
+ *
+ * 4. -q: Quiet, only print the summary on exit (SIGINT/SIGTERM)
+ *
+ */
+/* ========================================================================== */
+
+// ---------------- System includes
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <time.h>
+#include <pthread.h>
+
+// ---------------- Local includes
+
+#include "amazing.h"
+#include "mazegen.h"
+#include "amframe.h"
+#include "amtransport.h"
+
+// ---------------- Constant definitions
+
+#define INIT_RECV_TIMEOUT 5                  // seconds to wait for AM_INIT
+#define MAX_PENDING (AM_MAX_AVATAR * 2)      // connections awaiting READY
+
+// ---------------- Structures/Types
+
+/* One connection on a MazePort along with its receive buffer */
+typedef struct Connection {
+  Transport transport;
+  uint32_t avatars;                          // bit per avatar readied here
+  FrameReader reader;
+} Connection;
+
+/* A management connection accepted but not yet greeted, for RunInit */
+typedef struct InitRequest {
+  int fd;
+  int kind;                                  // TRANSPORT_TCP or TRANSPORT_UNIX
+} InitRequest;
+
+/* State for one maze from AM_INIT to AM_MAZE_SOLVED */
+typedef struct MazeSession {
+  int mazeId;
+  int nAvatars;
+  int difficulty;
+  int listenfd;
+  int unixfd;                                // AF_UNIX listener for the same port
+  int mazePort;
+  Maze *maze;
+  ShmHub hub;                                // shared-memory connections' region
+
+  Connection conns[MAX_PENDING];
+  int nConns;
+  int nReady;
+
+  FrameCodec codec;                          // MazePort protocol, turn deltas
+  unsigned long sendCalls;
+  unsigned long sendBytes;
+
+  int features;                               // AM_FEATURE_* granted
+
+  XYPos pos[AM_MAX_AVATAR];
+  uint8_t path[AM_MAX_AVATAR][AM_MAX_PATH];  // queued AM_AVATAR_PATH steps
+  int pathLength[AM_MAX_AVATAR];
+  int pathNext[AM_MAX_AVATAR];
+  int turnId;
+  int nMoves;
+  int nTurns;                                // AM_AVATAR_TURN broadcasts
+  int solved;
+  struct timespec started;
+} MazeSession;
+
+// ---------------- Private variables
+
+static uint64_t baseSeed = 1;
+static int maxMoves = AM_MAX_MOVES;
+static int quiet = 0;
+static volatile sig_atomic_t stopping = 0;
+
+static pthread_mutex_t statsLock = PTHREAD_MUTEX_INITIALIZER;
+static int mazesStarted = 0;
+static int mazesSolved = 0;
+static int mazesFailed = 0;
+static long totalMoves = 0;
+static long totalTurns = 0;
+static double totalBytes = 0;
+static double totalSyscalls = 0;
+static double totalSolveMs = 0;
+static struct timespec serverStarted;
+
+// ---------------- Private prototypes
+
+void Reply(MazeSession *session, Connection *conn, AM_Message *message);
+
+void Broadcast(MazeSession *session, AM_Message *message);
+
+void BroadcastTurn(MazeSession *session);
+
+int HandleMessage(MazeSession *session, Connection *conn, AM_Message *message);
+
+void *RunMaze(void *data);
+
+void MoveAvatar(MazeSession *session, int avatarId, int direction);
+
+int MazeOver(MazeSession *session);
+
+void CloseListeners(MazeSession *session);
+
+int NextTurn(MazeSession *session);
+
+void *RunInit(void *data);
+
+void HandleInit(int fd);
+
+double ElapsedMs(struct timespec *from);
+
+void OnSignal(int sig);
+
+/* ========================================================================== */
+
+
+/*
+ *
+ * Reply - sends a message to one connection in the session's protocol
+ *
+ */
+void Reply(MazeSession *session, Connection *conn, AM_Message *message) {
+
+  unsigned char frame[FRAME_MAX_BYTES];
+  size_t length = FrameEncode(&session->codec, message, frame);
+
+  TransportSendAll(&conn->transport, frame, length);
+  session->sendCalls++;
+  session->sendBytes += length;
+}
+
+
+/*
+ *
+ * Broadcast - sends a message to every connection with a ready avatar,
+ *   encoding it only once; a multiplexed connection gets a single copy
+ *
+ */
+void Broadcast(MazeSession *session, AM_Message *message) {
+
+  unsigned char frame[FRAME_MAX_BYTES];
+  size_t length = FrameEncode(&session->codec, message, frame);
+
+  for (int i = 0; i < session->nConns; i++) {
+    if (session->conns[i].avatars != 0) {
+      TransportSendAll(&session->conns[i].transport, frame, length);
+      session->sendCalls++;
+      session->sendBytes += length;
+    }
+  }
+}
+
+
+/*
+ *
+ * BroadcastTurn - tells every avatar whose turn it is and where everyone is
+ *
+ */
+void BroadcastTurn(MazeSession *session) {
+
+  AM_Message turn;
+  memset(&turn, 0, sizeof(turn));
+
+  turn.type = htonl(AM_AVATAR_TURN);
+  turn.avatar_turn.TurnId = htonl(session->turnId);
+  session->nTurns++;
+
+  for (int i = 0; i < session->nAvatars; i++) {
+    turn.avatar_turn.Pos[i].x = htonl(session->pos[i].x);
+    turn.avatar_turn.Pos[i].y = htonl(session->pos[i].y);
+  }
+
+  Broadcast(session, &turn);
+}
+
+
+/*
+ *
+ * MoveAvatar - takes one step for an avatar; M_NULL_MOVE and walls stay put.
+ *   A step that does not move (other than M_NULL_MOVE) also cancels the rest
+ *   of a queued path.
+ *
+ */
+void MoveAvatar(MazeSession *session, int avatarId, int direction) {
+
+  XYPos *pos = &session->pos[avatarId];
+
+  if (direction == M_NULL_MOVE) {
+    session->nMoves++;
+    return;
+  }
+
+  if (MazeIsOpen(session->maze, pos->x, pos->y, direction)) {
+    int dx, dy;
+    MazeStep(direction, &dx, &dy);
+    pos->x += dx;
+    pos->y += dy;
+  }
+  else {
+    session->pathLength[avatarId] = 0; // stop early on a failed step
+  }
+
+  session->nMoves++;
+}
+
+
+/*
+ *
+ * MazeOver - ends the maze with AM_MAZE_SOLVED once every avatar shares a
+ *   square, or with AM_TOO_MANY_MOVES once the move budget is spent
+ *
+ * Returns 1 if the maze has ended and 0 if play continues
+ *
+ */
+int MazeOver(MazeSession *session) {
+
+  AM_Message reply;
+  memset(&reply, 0, sizeof(reply));
+
+
+  /* Solved once every avatar shares a square */
+
+  int solved = 1;
+  for (int i = 1; i < session->nAvatars; i++) {
+    if (session->pos[i].x != session->pos[0].x || session->pos[i].y != session->pos[0].y) {
+      solved = 0;
+    }
+  }
+
+  if (solved) {
+    double solveMs = ElapsedMs(&session->started);
+    uint32_t hash = MazeHash(session->maze) ^ (session->nAvatars << 8) ^ session->difficulty;
+
+    reply.type = htonl(AM_MAZE_SOLVED);
+    reply.maze_solved.nAvatars = htonl(session->nAvatars);
+    reply.maze_solved.Difficulty = htonl(session->difficulty);
+    reply.maze_solved.nMoves = htonl(session->nMoves);
+    reply.maze_solved.Hash = htonl(hash);
+    Broadcast(session, &reply);
+    session->solved = 1;
+
+
+    /* Wire cost of the whole maze, both directions */
+
+    unsigned long bytes = session->sendBytes, syscalls = session->sendCalls;
+    for (int i = 0; i < session->nConns; i++) {
+      bytes += session->conns[i].reader.recvBytes;
+      syscalls += session->conns[i].reader.recvCalls;
+    }
+
+    pthread_mutex_lock(&statsLock);
+    mazesSolved++;
+    totalMoves += session->nMoves;
+    totalTurns += session->nTurns;
+    totalSolveMs += solveMs;
+    totalBytes += bytes;
+    totalSyscalls += syscalls;
+    pthread_mutex_unlock(&statsLock);
+
+    if (!quiet) {
+      printf("Maze %d (port %d): solved nAvatars=%d difficulty=%d nMoves=%d Hash=%u in %.3f ms"
+             " (v%d, %d turns sent, %lu bytes, %lu syscalls)\n",
+             session->mazeId, session->mazePort, session->nAvatars, session->difficulty,
+             session->nMoves, hash, solveMs, session->codec.version, session->nTurns, bytes, syscalls);
+    }
+    return(1);
+  }
+
+  if (session->nMoves >= maxMoves) {
+    reply.type = htonl(AM_TOO_MANY_MOVES);
+    Broadcast(session, &reply);
+    if (!quiet) {
+      printf("Maze %d (port %d): too many moves (%d)\n", session->mazeId, session->mazePort,
+             session->nMoves);
+    }
+    return(1);
+  }
+
+  return(0);
+}
+
+
+/*
+ *
+ * NextTurn - passes the turn on. Avatars with queued path steps take them
+ *   right here without a round trip; the first avatar with nothing queued
+ *   gets an AM_AVATAR_TURN broadcast (with everyone's current positions).
+ *
+ * Returns 1 while the maze is still running and 0 once it has ended
+ *
+ */
+int NextTurn(MazeSession *session) {
+
+  for (;;) {
+
+    session->turnId = (session->turnId + 1) % session->nAvatars;
+    int avatarId = session->turnId;
+
+    if (session->pathLength[avatarId] == 0) {
+      BroadcastTurn(session);
+      return(1);
+    }
+
+    int direction = session->path[avatarId][session->pathNext[avatarId]++];
+    session->pathLength[avatarId]--;
+
+    MoveAvatar(session, avatarId, direction);
+    if (MazeOver(session)) {
+      return(0);
+    }
+  }
+}
+
+
+/*
+ *
+ * HandleMessage - applies one message received on a MazePort connection
+ *
+ * Returns 1 while the maze is still running and 0 once it has ended
+ *
+ */
+int HandleMessage(MazeSession *session, Connection *conn, AM_Message *message) {
+
+  AM_Message reply;
+  memset(&reply, 0, sizeof(reply));
+
+  uint32_t type = ntohl(message->type);
+
+
+  /* Avatar reporting for duty */
+
+  if (type == AM_AVATAR_READY) {
+
+    int avatarId = ntohl(message->avatar_ready.AvatarId);
+    int taken = 0;
+
+    for (int i = 0; i < session->nConns; i++) {
+      if (avatarId >= 0 && avatarId < AM_MAX_AVATAR && (session->conns[i].avatars & (1u << avatarId))) {
+        taken = 1;
+      }
+    }
+
+    /* Only AM_FEATURE_MUX lets one connection carry several avatars */
+
+    int shared = conn->avatars != 0 && !(session->features & AM_FEATURE_MUX);
+
+    if (shared || avatarId < 0 || avatarId >= session->nAvatars || taken) {
+      reply.type = htonl(AM_NO_SUCH_AVATAR);
+      Reply(session, conn, &reply);
+      return(1);
+    }
+
+    conn->avatars |= 1u << avatarId;
+
+    /* Everyone is here, so start the first round */
+
+    if (++session->nReady == session->nAvatars) {
+      CloseListeners(session);
+      clock_gettime(CLOCK_MONOTONIC, &session->started);
+      BroadcastTurn(session);
+    }
+    return(1);
+  }
+
+
+  /* Avatar asking to move, either one step or a whole path */
+
+  if (type == AM_AVATAR_MOVE || type == AM_AVATAR_PATH) {
+
+    int avatarId = ntohl(message->avatar_move.AvatarId); // same slot in avatar_path
+    int direction;
+
+    if (avatarId < 0 || avatarId >= session->nAvatars) {
+      reply.type = htonl(AM_NO_SUCH_AVATAR);
+      Reply(session, conn, &reply);
+      return(1);
+    }
+
+    if (session->nReady < session->nAvatars || !(conn->avatars & (1u << avatarId)) ||
+        avatarId != session->turnId) {
+      reply.type = htonl(AM_AVATAR_OUT_OF_TURN);
+      Reply(session, conn, &reply);
+      return(1);
+    }
+
+    if (type == AM_AVATAR_MOVE) {
+      direction = ntohl(message->avatar_move.Direction);
+    }
+
+
+    /* Queue all but the first step; the first one is this turn's move */
+
+    else {
+      int nSteps = ntohl(message->avatar_path.nSteps);
+      if (!(session->features & AM_FEATURE_PATH) || nSteps < 1 || nSteps > AM_MAX_PATH) {
+        reply.type = htonl(AM_UNKNOWN_MSG_TYPE);
+        reply.unknown_msg_type.BadType = message->type;
+        Reply(session, conn, &reply);
+        return(1);
+      }
+      direction = message->avatar_path.Directions[0];
+      memcpy(session->path[avatarId], message->avatar_path.Directions + 1, nSteps - 1);
+      session->pathLength[avatarId] = nSteps - 1;
+      session->pathNext[avatarId] = 0;
+    }
+
+    MoveAvatar(session, avatarId, direction);
+    if (MazeOver(session)) {
+      return(0);
+    }
+    return NextTurn(session);
+  }
+
+
+  /* Anything else is not part of the MazePort protocol */
+
+  reply.type = htonl(AM_UNKNOWN_MSG_TYPE);
+  reply.unknown_msg_type.BadType = message->type;
+  Reply(session, conn, &reply);
+  return(1);
+}
+
+
+/*
+ *
+ * CloseListeners - stops taking connections on the MazePort (TCP and AF_UNIX)
+ *
+ */
+void CloseListeners(MazeSession *session) {
+
+  if (session->listenfd != -1) {
+    close(session->listenfd);
+    session->listenfd = -1;
+  }
+  if (session->unixfd != -1) {
+    char path[108];
+    TransportSocketPath(path, sizeof(path), session->mazePort);
+    close(session->unixfd);
+    unlink(path);
+    session->unixfd = -1;
+  }
+}
+
+
+/*
+ *
+ * RunMaze - maze thread: serves one MazePort until the maze ends
+ *
+ * Pseudocode: poll the listening sockets (until everyone is ready) and all
+ * connections; read whatever arrives into the connection's FrameReader and
+ * handle every whole message in it. Shared-memory connections cannot be
+ * polled: once only they are left the thread sleeps on the hub's doorbell,
+ * and while sockets remain it polls in 1 ms slices and checks their rings.
+ * Times out after AM_WAIT_TIME idle seconds.
+ *
+ */
+void *RunMaze(void *data) {
+
+  MazeSession *session = (MazeSession *) data;
+  int running = 1;
+
+  struct timespec lastActive;
+  clock_gettime(CLOCK_MONOTONIC, &lastActive);
+
+  while (running && !stopping) {
+
+    struct pollfd fds[MAX_PENDING + 2];
+    int nfds = 0, nShm = 0;
+
+    for (int i = 0; i < session->nConns; i++) {
+      fds[nfds].fd = session->conns[i].transport.fd; // a shm socket only reports hangup
+      fds[nfds++].events = POLLIN;
+      nShm += session->conns[i].transport.kind == TRANSPORT_SHM;
+    }
+    int tcpAt = -1, unixAt = -1;
+    if (session->listenfd != -1) {
+      tcpAt = nfds;
+      fds[nfds].fd = session->listenfd;
+      fds[nfds++].events = POLLIN;
+    }
+    if (session->unixfd != -1) {
+      unixAt = nfds;
+      fds[nfds].fd = session->unixfd;
+      fds[nfds++].events = POLLIN;
+    }
+
+    int ready;
+    if (nShm > 0 && nShm == nfds) {
+      ready = ShmHubWait(&session->hub, SHM_POLL_MS);
+      ready += poll(fds, nfds, 0) > 0;
+    }
+    else {
+      ready = poll(fds, nfds, nShm > 0 ? 1 : AM_WAIT_TIME * 1000);
+    }
+
+    if (ready == -1 && errno == EINTR) {
+      continue;
+    }
+
+    for (int i = 0; ready == 0 && i < session->nConns; i++) {
+      ready = TransportReadable(&session->conns[i].transport);
+    }
+
+    if (ready == 0 && ElapsedMs(&lastActive) < AM_WAIT_TIME * 1000.0) {
+      continue;
+    }
+
+    if (ready <= 0) {
+      AM_Message timeout;
+      memset(&timeout, 0, sizeof(timeout));
+      timeout.type = htonl(AM_SERVER_TIMEOUT);
+      Broadcast(session, &timeout);
+      break;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &lastActive);
+
+
+    /* Read from avatars */
+
+    for (int i = 0; running && i < session->nConns; i++) {
+
+      Connection *conn = &session->conns[i];
+
+      if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR)) && !TransportReadable(&conn->transport)) {
+        continue;
+      }
+
+      if (FrameReaderFill(&conn->reader) != FRAME_OK) {
+        running = 0; // an avatar hung up, so the maze cannot be solved
+        break;
+      }
+
+      AM_Message message;
+      while (running && FrameReaderNext(&conn->reader, &message)) {
+        running = HandleMessage(session, conn, &message);
+      }
+    }
+
+
+    /* Accept new avatar connections */
+
+    for (int at = 0; at < 2; at++) {
+
+      int index = at == 0 ? tcpAt : unixAt;
+      int listenfd = at == 0 ? session->listenfd : session->unixfd;
+
+      if (!running || index == -1 || listenfd == -1 || !(fds[index].revents & POLLIN)) {
+        continue;
+      }
+
+      Transport transport;
+      if (!TransportAccept(&transport, listenfd, at == 0 ? TRANSPORT_TCP : TRANSPORT_UNIX, &session->hub)) {
+        continue;
+      }
+      if (session->nConns == MAX_PENDING) {
+        TransportClose(&transport);
+        continue;
+      }
+
+      Connection *conn = &session->conns[session->nConns++];
+      conn->transport = transport;
+      conn->avatars = 0;
+      FrameReaderInitTransport(&conn->reader, &conn->transport);
+      FrameCodecInit(&conn->reader.codec, session->codec.version, session->nAvatars);
+    }
+  }
+
+  if (!session->solved) {
+    pthread_mutex_lock(&statsLock);
+    mazesFailed++;
+    pthread_mutex_unlock(&statsLock);
+  }
+
+  for (int i = 0; i < session->nConns; i++) {
+    TransportClose(&session->conns[i].transport);
+  }
+  CloseListeners(session);
+  ShmHubClose(&session->hub);
+  MazeFree(session->maze);
+  free(session);
+  return NULL;
+}
+
+
+/*
+ *
+ * RunInit - an init thread: reads one accepted connection's hello and
+ *   AM_INIT, giving up after INIT_RECV_TIMEOUT seconds of silence, answers
+ *   it and closes the connection
+ *
+ */
+void *RunInit(void *data) {
+
+  InitRequest *request = data;
+  Transport transport;
+
+  struct timeval timeout = { INIT_RECV_TIMEOUT, 0 };
+  setsockopt(request->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  if (TransportGreet(&transport, request->fd, request->kind, NULL)) {
+    HandleInit(transport.fd);
+    TransportClose(&transport);
+  }
+  free(request);
+  return NULL;
+}
+
+
+/*
+ *
+ * HandleInit - answers one AM_INIT on the management port and starts the
+ *   maze thread for it
+ *
+ */
+void HandleInit(int fd) {
+
+  AM_Message init, reply;
+  memset(&reply, 0, sizeof(reply));
+
+  FrameReader reader;
+  FrameReaderInit(&reader, fd);
+
+  if (FrameReaderRead(&reader, &init) != FRAME_OK) {
+    return;
+  }
+
+  if (ntohl(init.type) != AM_INIT) {
+    reply.type = htonl(AM_UNKNOWN_MSG_TYPE);
+    reply.unknown_msg_type.BadType = init.type;
+    FrameSend(fd, &reply);
+    return;
+  }
+
+  int nAvatars = ntohl(init.init.nAvatars);
+  int difficulty = ntohl(init.init.Difficulty);
+  int version = ntohl(init.init.Version) >= AM_PROTOCOL_V2 ? AM_PROTOCOL_V2 : AM_PROTOCOL_V1;
+  int features = ntohl(init.init.Features) & (AM_FEATURE_PATH | AM_FEATURE_MUX);
+
+  if (nAvatars < 1 || nAvatars > AM_MAX_AVATAR) {
+    reply.type = htonl(AM_INIT_FAILED);
+    reply.init_failed.ErrNum = htonl(AM_INIT_TOO_MANY_AVATARS);
+    FrameSend(fd, &reply);
+    return;
+  }
+
+  if (difficulty < 0 || difficulty > AM_MAX_DIFFICULTY) {
+    reply.type = htonl(AM_INIT_FAILED);
+    reply.init_failed.ErrNum = htonl(AM_INIT_BAD_DIFFICULTY);
+    FrameSend(fd, &reply);
+    return;
+  }
+
+
+  /* Build the maze and its MazePort */
+
+  MazeSession *session = calloc(1, sizeof(MazeSession));
+  if (session == NULL) {
+    reply.type = htonl(AM_SERVER_OUT_OF_MEM);
+    FrameSend(fd, &reply);
+    return;
+  }
+
+  pthread_mutex_lock(&statsLock);
+  session->mazeId = mazesStarted++;
+  pthread_mutex_unlock(&statsLock);
+
+  int size = MAZE_SIZE_FOR_DIFFICULTY(difficulty);
+  session->nAvatars = nAvatars;
+  session->difficulty = difficulty;
+  FrameCodecInit(&session->codec, version, nAvatars);
+  session->features = features;
+  session->maze = MazeGenerate(size, size, baseSeed + session->mazeId);
+  session->listenfd = TransportListen(TRANSPORT_TCP, 0, &session->mazePort);
+  session->unixfd = -1;
+  session->hub.memfd = -1;
+
+  if (session->maze == NULL || session->listenfd == -1) {
+    reply.type = htonl(AM_SERVER_OUT_OF_MEM);
+    FrameSend(fd, &reply);
+    CloseListeners(session);
+    MazeFree(session->maze);
+    free(session);
+    return;
+  }
+
+
+  /* Co-located clients may use the AF_UNIX socket instead; TCP still works without it */
+
+  session->unixfd = TransportListen(TRANSPORT_UNIX, session->mazePort, NULL);
+
+
+  /* Scatter the avatars */
+
+  MazeScatter(session->maze, nAvatars, session->pos);
+
+
+  /* Start the maze thread before replying so the port is being served */
+
+  pthread_t mazeThread;
+  if (pthread_create(&mazeThread, NULL, RunMaze, session)) {
+    reply.type = htonl(AM_SERVER_OUT_OF_MEM);
+    FrameSend(fd, &reply);
+    CloseListeners(session);
+    MazeFree(session->maze);
+    free(session);
+    return;
+  }
+  pthread_detach(mazeThread);
+
+  reply.type = htonl(AM_INIT_OK);
+  reply.init_ok.MazePort = htonl(session->mazePort);
+  reply.init_ok.MazeWidth = htonl(size);
+  reply.init_ok.MazeHeight = htonl(size);
+  reply.init_ok.Version = htonl(version);
+  reply.init_ok.Features = htonl(features);
+  FrameSend(fd, &reply);
+}
+
+
+/*
+ *
+ * ElapsedMs - milliseconds on the monotonic clock since from
+ *
+ */
+double ElapsedMs(struct timespec *from) {
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - from->tv_sec) * 1e3 + (now.tv_nsec - from->tv_nsec) / 1e6;
+}
+
+
+/*
+ *
+ * OnSignal - asks the accept loop to stop and print the summary
+ *
+ */
+void OnSignal(int sig) {
+  (void) sig;
+  stopping = 1;
+}
+
+
+int main(int argc, char* argv[]) {
+
+
+  /* Argument Checking */
+
+  char *program = argv[0];
+  char *port = AM_SERVER_PORT;
+  char *end;
+  int ch;
+
+  while ((ch = getopt(argc, argv, "p:s:m:q")) != -1)
+    switch(ch)
+    {
+      case 'p':
+        port = optarg;
+        break;
+
+      case 's':
+        baseSeed = strtoull(optarg, &end, 0);
+        if (strlen(end) != 0) {
+          fprintf(stderr, "[%s] Usage: [-s seed] requires an integer.\n", program);
+          return(1);
+        }
+        break;
+
+      case 'm':
+        maxMoves = strtol(optarg, &end, 0);
+        if (maxMoves <= 0 || strlen(end) != 0) {
+          fprintf(stderr, "[%s] Usage: [-m maxMoves] requires a positive integer.\n", program);
+          return(1);
+        }
+        break;
+
+      case 'q':
+        quiet = 1;
+        break;
+
+      default:
+        fprintf(stderr, "[%s] Usage: [-p port] [-s seed] [-m maxMoves] [-q]\n", program);
+        return(1);
+    }
+
+
+  /* Stop cleanly on Ctrl-C so the summary gets printed */
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = OnSignal;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  int serverPort;
+  int listenfd = TransportListen(TRANSPORT_TCP, atoi(port), &serverPort);
+  if (listenfd == -1) {
+    fprintf(stderr, "[%s] Error: Unable to listen on port %s: %s\n", program, port, strerror(errno));
+    return(1);
+  }
+
+  char unixPath[108];
+  TransportSocketPath(unixPath, sizeof(unixPath), serverPort);
+  int unixfd = TransportListen(TRANSPORT_UNIX, serverPort, NULL);
+  if (unixfd == -1) {
+    fprintf(stderr, "[%s] Warning: Unable to listen on %s: %s\n", program, unixPath, strerror(errno));
+  }
+
+  printf("[%s]: Listening on port %d and %s (seed %llu, maxMoves %d)\n", program, serverPort,
+         unixfd == -1 ? "no unix socket" : unixPath, (unsigned long long) baseSeed, maxMoves);
+  fflush(stdout);
+  clock_gettime(CLOCK_MONOTONIC, &serverStarted);
+
+
+  /* Serve AM_INIT requests until interrupted */
+
+  while (!stopping) {
+
+    struct pollfd fds[2] = { { listenfd, POLLIN, 0 }, { unixfd, POLLIN, 0 } };
+    if (poll(fds, unixfd == -1 ? 1 : 2, -1) <= 0) {
+      continue;
+    }
+
+    for (int i = 0; i < 2; i++) {
+
+      if (!(fds[i].revents & POLLIN)) {
+        continue;
+      }
+
+      int fd = accept(fds[i].fd, NULL, NULL);
+      if (fd == -1) {
+        continue;
+      }
+
+      InitRequest *request = malloc(sizeof(InitRequest));
+      pthread_t initThread;
+
+      if (request == NULL) {
+        close(fd);
+        continue;
+      }
+      request->fd = fd;
+      request->kind = i == 0 ? TRANSPORT_TCP : TRANSPORT_UNIX;
+
+      if (pthread_create(&initThread, NULL, RunInit, request)) {
+        close(fd);
+        free(request);
+        continue;
+      }
+      pthread_detach(initThread);
+    }
+  }
+
+  close(listenfd);
+  if (unixfd != -1) {
+    close(unixfd);
+    unlink(unixPath);
+  }
+
+
+  /* Summary */
+
+  double upSeconds = ElapsedMs(&serverStarted) / 1e3;
+
+  pthread_mutex_lock(&statsLock);
+  printf("\n[%s]: %d mazes started, %d solved, %d failed in %.2f s\n", program,
+         mazesStarted, mazesSolved, mazesFailed, upSeconds);
+  if (mazesSolved > 0) {
+    printf("[%s]: mean solve latency %.3f ms, mean nMoves %.1f, mean turns sent %.1f, throughput %.2f mazes/s\n",
+           program, totalSolveMs / mazesSolved, (double) totalMoves / mazesSolved,
+           (double) totalTurns / mazesSolved, mazesSolved / upSeconds);
+    printf("[%s]: per solved maze %.0f bytes and %.0f send/recv calls on the MazePort\n",
+           program, totalBytes / mazesSolved, totalSyscalls / mazesSolved);
+  }
+  pthread_mutex_unlock(&statsLock);
+
+  return(0);
+}
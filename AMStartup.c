@@ -9,6 +9,8 @@
  * AMStartup.c initializes avatar clients and avatar threads and carries out
  * communication with server to guide each avatar through the maze 
  * 
+ * The window is drawn, or frames recorded, by one drawing thread that
+ * avatars hand their moves to without waiting (amdraw.h).
  * 
  *
  * Input/Command line options:
@@ -20,6 +22,48 @@
  * 3. -h Hostname: A (char *) representing server hostname (either stowe.cs.d..
  *or carter.cs.dart..) 
  *
+ * 4. -e: Optional. Drive all avatars from one epoll event loop instead of
+ *    one blocking thread per avatar
+ *
+ * 5. -m: Optional. Like -e, but all avatars share a single maze port
+ *    connection when the server grants AM_FEATURE_MUX (else falls back to -e)
+ *
+ * 6. -v version: Optional. MazePort wire protocol to request in AM_INIT, 1
+ *    (default) or the compact 2; the server's AM_INIT_OK has the final say
+ *
+ * 7. -u: Optional. Like -e, but on io_uring: a multishot recv stays posted on
+ *    every maze socket and each pass's moves go out in one io_uring_enter.
+ *    Falls back to -e (epoll) where io_uring is unavailable
+ *
+ * 8. -t transport: Optional. tcp (default), or for a server on this machine
+ *    unix (AF_UNIX socket) or shm (shared-memory rings; with -e but not -m
+ *    the avatars run as threads, since rings cannot be watched by epoll)
+ *
+ * 9. -p strategy: Optional. follow (default): every avatar but avatar 0
+ *    follows the right-hand wall until known passages join it to avatar 0,
+ *    then walks the shortest of them. follow-left: the same with the left
+ *    hand on the wall. frontier: all
+ *    avatars explore the nearest unclaimed unknown edges of the shared map,
+ *    then converge on one square once known passages join them (amplanner.h).
+ *    rendezvous: as frontier, but the square they converge on is the one
+ *    the last of them can reach soonest
+ *
+ * 10. -k: Optional. Keep dead ends: do not seal off the dead-end branches
+ *    of the shared map (amprune.h), so every avatar may wander into them
+ *
+ * 11. -w: Optional. Wait for the turn: work out each move only once the
+ *    avatar's turn comes, rather than for both outcomes of its last move
+ *    while the others take theirs. The time from each turn to its move is
+ *    printed when the maze is solved, to compare the two
+ *
+ * 12. -r render: Optional. Where frames go: window (default) draws them in
+ *    a GTK window; off draws nothing; png:DIR writes each frame to
+ *    DIR/frame-NNNNNN.png and delta:FILE writes only what changed to FILE
+ *    (amrecord.h), without GTK or a display. A client built with
+ *    -DAM_NO_WINDOW (make amheadless) has no window and defaults to off
+ *
+ * 13. -f fps: Optional. At most this many frames a second (default 30)
+ *
  */
 /* ========================================================================== */
 
@@ -31,7 +75,9 @@
 #include <string.h>   
 #include <strings.h>                       // argument checking
 #include <unistd.h>
+#ifndef AM_NO_WINDOW
 #include <gtk/gtk.h>
+#endif
 #include <getopt.h> // argument parsing
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -40,16 +86,30 @@
 #include <netdb.h>// hostent structure 
 #include <time.h> // getting date/time
 #include <pthread.h>
+#include <sys/epoll.h> // event-driven avatar mode
 
 
 // ---------------- Local includes 
 
 #include "amazing.h"
+#include "amdraw.h"
+#include "amframe.h"
+#include "amnav.h"
+#include "amrecord.h"
+#include "amtransport.h"
+#include "amuring.h"
+#include "mazemap.h"
 
 // ---------------- Constant definitions
 
-#define MAX_SIZE 1000
 #define MAX_WINDOW_SIZE 800
+#define WALL_WIDTH 2                   // pixels, half either side of the line between squares
+
+/* io_uring user_data: avatarId << 1 | URING_OP_* */
+#define URING_OP_RECV 0
+#define URING_OP_SEND 1
+
+#define TURN_BUCKETS (4 * 64)          // quarter-octave buckets of nanoseconds, see TimeTurn
 
 // ---------------- Structures/Types
 
@@ -61,273 +121,680 @@ typedef struct AvatarInitData {
   AM_Message message;
 } AvatarInitData;
 
-typedef struct MazeSquareData {
-  int northSide;  // for the sides: -1 = unknown, 0 = blocked, 1 = open
-  int eastSide;
-  int southSide;
-  int westSide;
-} MazeSquareData;
+/* Connection and navigation state of one avatar, advanced one message at a time */
+typedef struct AvatarState {
+  int avatarId;
+  Transport *transport;                 // maze port connection (shared with -m)
+  Transport link;                       // the avatar's own connection, if any
+  AvatarNav nav;                        // how it chooses its moves, see amnav.h
+  int moveNumber;
+  Avatar *avatar;                       // for graphics updating
+  FrameReader reader;                   // buffered messages from the maze port
+  AM_Message outbox;                    // reused for every outgoing message
+  int features;                         // AM_FEATURE_* the server granted
+  Uring *uring;                         // queue sends here instead (-u)
+  unsigned char sendFrame[FRAME_MAX_BYTES]; // encoded outbox while a uring send is in flight
+  size_t sendLength;                    // bytes of it queued
+} AvatarState;
+
+#ifndef AM_NO_WINDOW
+/* What the drawing thread keeps between frames of the window, see DrawWindow */
+typedef struct WindowLayers {
+  cairo_surface_t *walls;               // every wall drawn so far, on white; NULL until the first frame
+  int width, height;                    // squares
+  int *dirty;                           // squares to copy to the window this frame
+  int nDirty;
+  unsigned long *stamp;                 // per square, 1 + the frame it was last listed in
+  int stale;                            // the window's pixmap was replaced: copy all of it
+} WindowLayers;
+#endif
 
 // ---------------- Private variables
 
 FILE *logfile;
-int mazeSolved = 0;
+_Atomic int mazeSolved = 0;
+int transportKind = TRANSPORT_TCP;
 int mazeWidth, mazeHeight;
-MazeSquareData maze[MAX_SIZE][MAX_SIZE];
-
+Navigator *navigator;                  // map, inference, planner and pruner, see amnav.h
+MazeMap *mazeMap;                      // walls found so far (the navigator's), see mazemap.h
+int thinkAhead = 1;                    // work out moves between turns, -w clears
+_Atomic unsigned long turnsTimed = 0;  // turns timed from broadcast to move, see TimeTurn
+_Atomic unsigned long turnNanos = 0, turnNanosMax = 0;
+_Atomic unsigned long turnBuckets[TURN_BUCKETS];
+
+#ifndef AM_NO_WINDOW
 static GdkPixmap *pixmap = NULL;
+static GtkWidget *mazeWindow = NULL;
+static WindowLayers layers;            // the drawing thread's, but for stale
+#endif
 int size_multiplier;
-static int currently_drawing = 0;
+Drawer *drawer;                        // the one drawing thread, fed moves, see amdraw.h; NULL with -r off
+Recorder *recorder;                    // frames to disk (-r png: or delta:), see amrecord.h
+pthread_once_t drawingStopped = PTHREAD_ONCE_INIT;
+_Atomic int runEnding = 0;             // a thread is ending the run, see ClaimEnd
+static _Thread_local int endingHere = 0;
 
 
 // ---------------- Private prototypes
 
-int SendMoveMessage(int avatarId, int directionToMove, int sockfd);
+int SendMoveMessage(AvatarState *state, int directionToMove);
+
+int SendPathMessage(AvatarState *state, const uint8_t *directions, int nSteps);
+
+int SendOutbox(AvatarState *state);
+
+static inline int SendTurnMovesAs(AvatarState *state, AM_Message *turn, long started, const int strategy);
+
+long NowNanos(void);
+
+void TimeTurn(long started);
+
+void PrintTurnTimes(void);
+
+void DrawAvatar(Avatar *avatar);
+
+int ConnectAvatar(AvatarState *state, int avatarId, struct hostent *server, AM_Message initMessage);
+
+int OpenMazeConnection(Transport *transport, int avatarId, struct hostent *server, AM_Message initMessage);
+
+int StartAvatar(AvatarState *state, int avatarId, Transport *transport, AM_Message initMessage);
+
+int HandleAvatarMessage(AvatarState *state, AM_Message *message);
+
+static inline int HandleAvatarMessageAs(AvatarState *state, AM_Message *message, const int strategy);
 
 void *InitiateAvatar(void *data);
 
+static inline void ListenAvatarAs(AvatarState *state, const int strategy);
+
+static inline void EventLoopAs(int epfd, int nAvatars, const int strategy);
+
+static inline void UringLoopAs(Uring *ring, AvatarState *states, int nAvatars, const int strategy);
+
+static inline void MuxLoopAs(FrameReader *reader, AvatarState *states, int nAvatars, const int strategy);
+
+void CloseAvatars(AvatarState *states, int nAvatars);
+
+int RunEventLoop(int nAvatars, AM_Message message, struct hostent *server);
+
+int RunMuxLoop(int nAvatars, AM_Message message, struct hostent *server);
+
+int RunUringLoop(int nAvatars, AM_Message message, struct hostent *server);
+
 int StartThreads(int nAvatars, int difficulty, AM_Message message, struct hostent *server);
 
 char* DetermineLogfile(int nAvatars, int difficulty);
 
-int SetMazeSquareSide(int x, int y, int direction, int mode);
+void StopDrawing(void);
+
+void StopDrawingOnce(void);
+
+void ClaimEnd(void);
 
-int ConvertDirection(int x, int y, int relativeDirection);
+void EndRun(void);
 
+#ifndef AM_NO_WINDOW
 gboolean on_window_configure_event(GtkWidget *da, GdkEventConfigure *event, gpointer user_data);
 
 gboolean on_window_expose_event(GtkWidget *da, GdkEventExpose *event, gpointer user_data);
 
-void *do_draw(void *ptr);
+int LayersReset(WindowLayers *layers, int width, int height);
+
+void MarkDirty(WindowLayers *layers, const DrawFrame *frame, int x, int y);
+
+void DrawLabel(cairo_t *cr, int avatarId, int x, int y);
+
+int DrawWindow(const DrawFrame *frame, void *context);
 
 int display_window(int *argc, char ***argv, int w, int h);
 
-gboolean timer_exe(GtkWidget * window);
+void *OpenFrame(void *data);
+#endif
+
 
 /* ========================================================================== */
 
 
 /*
  *
- * SetMazeSquareSide - sets a side (direction aka N/S/E/W) in the maze[x][y] 2D array to
- * be "mode." Mode is an int, either 0 for "blocked" or 1 for "open" (or -1 for "unknown").
- * It also sets the opposite side in the square adjacent to the given square to be "mode,"
- * but only if that square exists.
+ * SendMoveMessage - sends an AM_AVATAR_MOVE message to the server, encoded
+ *   in place in the avatar's own outgoing buffer (no allocation per move)
  *
- * Returns an boolean indicating success
+ * Returns 0 if the execution was unsuccessful (and returns 1 otherwise)
  *
  */
-int SetMazeSquareSide(int x, int y, int direction, int mode) {
+int SendMoveMessage(AvatarState *state, int directionToMove) {
 
-  if (direction == M_NORTH) {
-    maze[x][y].northSide = mode;
-    if (y - 1 >= 0) {
-      maze[x][y - 1].southSide = mode;
-    }
+  /* Encode message to send */
+  FrameEncodeMove(&state->outbox, state->avatarId, directionToMove);
+
+  /* Send message in the negotiated protocol */
+  if (!SendOutbox(state)) {
+    fprintf(stderr, "Error: Failed to send AM_AVATAR_MOVE message to server.\n");
+    return(0);
   }
 
-  else if (direction == M_EAST) {
-    maze[x][y].eastSide = mode;
-    if (x + 1 <= mazeWidth) {
-      maze[x + 1][y].westSide = mode;
-    }
+  return(1);
+}
+
+
+/*
+ *
+ * SendPathMessage - sends nSteps moves as one AM_AVATAR_PATH, or a single
+ *   step as a plain AM_AVATAR_MOVE. Only for servers that grant
+ *   AM_FEATURE_PATH when nSteps > 1.
+ *
+ * Returns 0 if the execution was unsuccessful (and returns 1 otherwise)
+ *
+ */
+int SendPathMessage(AvatarState *state, const uint8_t *directions, int nSteps) {
+
+  if (nSteps == 1) {
+    return SendMoveMessage(state, directions[0]);
   }
 
-  else if (direction == M_SOUTH) {
-    maze[x][y].southSide = mode;
-    if (y + 1 <= mazeHeight) {
-      maze[x][y + 1].northSide = mode;
-    }
+  FrameEncodePath(&state->outbox, state->avatarId, directions, nSteps);
+
+  if (!SendOutbox(state)) {
+    fprintf(stderr, "Error: Failed to send AM_AVATAR_PATH message to server.\n");
+    return(0);
   }
 
-  else { 
-    maze[x][y].westSide = mode;
-    if (x - 1 >= 0) {
-      maze[x - 1][y].eastSide = mode;
-    }
+  return(1);
+}
+
+
+/*
+ *
+ * SendOutbox - sends the avatar's encoded outbox over its transport, or with
+ *   -u queues it on the io_uring to go out with the rest of the pass. The
+ *   server answers every message before the avatar's next turn, so a single
+ *   in-flight frame per avatar is enough.
+ *
+ * Returns 0 if the execution was unsuccessful (and returns 1 otherwise)
+ *
+ */
+int SendOutbox(AvatarState *state) {
+
+  if (state->uring == NULL) {
+    return TransportWrite(state->transport, &state->reader.codec, &state->outbox);
   }
 
-  return 1;
+  state->sendLength = FrameEncode(&state->reader.codec, &state->outbox, state->sendFrame);
+
+  return UringSend(state->uring, state->transport->fd, state->sendFrame, state->sendLength,
+                   ((uint64_t) state->avatarId << 1) | URING_OP_SEND);
 }
 
 
 /*
  *
- * ConvertDirection - takes a relative direction (right/left/etc) as input
+ * SendTurnMovesAs - the turn holder's answer to its broadcast. The navigator
+ *   (amnav.h) learns from the broadcast and picks the moves, which go out
+ *   straight away. strategy is navigator->strategy as a constant, so each
+ *   message loop's copy calls straight into it (NavigatorMoveAs).
+ *
+ * Pseudocode: send first; pruning, printing, logging and redrawing wait
+ * until the moves are out. Then, while the others take their turns, have
+ * the navigator work out the next move for however this one turns out.
  *
- * Returns the status of a maze square direction (northSide/southSide/etc) at (x,y)
+ * Returns 1 (the avatar keeps listening)
  *
  */
-int ConvertDirection(int x, int y, int relativeDirection) {
+__attribute__((always_inline))
+static inline int SendTurnMovesAs(AvatarState *state, AM_Message *turn, long started, const int strategy) {
+
+  int avatarId = state->avatarId;
+  Avatar *avatar = state->avatar;
+  uint8_t moves[AM_MAX_PATH];
+
+  int x = ntohl(turn->avatar_turn.Pos[avatarId].x);
+  int y = ntohl(turn->avatar_turn.Pos[avatarId].y);
+
+
+  /* A whole route, or a hold, in one message where allowed */
 
-  if (relativeDirection == M_NORTH) {
-    return maze[x][y].northSide;
+  int maxMoves = (state->features & AM_FEATURE_PATH) ? AM_MAX_PATH : 1;
+  int nMoves = NavigatorMoveAs(navigator, &state->nav, turn, moves, maxMoves, strategy);
+
+  SendPathMessage(state, moves, nMoves);
+  TimeTurn(started);
+
+  NavigatorSettleAs(navigator, &state->nav, turn, strategy);
+  printf("Avatar %d (X,Y) = (%d,%d)\n", avatarId, x, y);
+
+
+  /* Redraw and log only when the last move went somewhere */
+
+  if (x != ntohl(avatar->pos.x) || y != ntohl(avatar->pos.y)) {
+    avatar->pos.x = htonl(x);
+    avatar->pos.y = htonl(y);
+    DrawAvatar(avatar);
+    fprintf(logfile, "Avatar ID: %d (x,y) Position: (%d,%d) Move Number: %d\n", avatarId, x, y, state->moveNumber++);
+  }
+
+  return(1);
+}
+
+
+/*
+ *
+ * NowNanos - monotonic clock reading in nanoseconds
+ *
+ */
+long NowNanos(void) {
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+
+/*
+ *
+ * TimeTurn - counts the time from the turn holder taking its broadcast,
+ *   started, to its move being sent: the time the server waits on us. Each
+ *   time goes in a bucket a quarter of an octave wide (2^e, 1.25 * 2^e, ...)
+ *   so the median and the tail can be read off at the end.
+ *
+ */
+void TimeTurn(long started) {
+
+  unsigned long nanos = NowNanos() - started;
+  int octave = 0, bucket;
+
+  while ((nanos >> (octave + 1)) != 0) {
+    octave++;
   }
+  bucket = octave < 2 ? (int) nanos : 4 * octave + (int) ((nanos >> (octave - 2)) & 3);
+
+  atomic_fetch_add(&turnsTimed, 1);
+  atomic_fetch_add(&turnNanos, nanos);
+  atomic_fetch_add(&turnBuckets[bucket], 1);
+
+  unsigned long longest = atomic_load(&turnNanosMax);
+  while (nanos > longest && !atomic_compare_exchange_weak(&turnNanosMax, &longest, nanos)) {
+    continue;
+  }
+}
+
+
+/*
+ *
+ * PrintTurnTimes - the turn-to-move times TimeTurn counted. Median and 99th
+ *   percentile are the top of the bucket they fall in, so within 25%.
+ *
+ */
+void PrintTurnTimes(void) {
+
+  unsigned long timed = atomic_load(&turnsTimed), seen = 0;
+  double median = 0, tail = 0;
 
-  else if (relativeDirection == M_EAST) {
-    return maze[x][y].eastSide;
+  if (timed == 0) {
+    return;
   }
 
-  else if (relativeDirection == M_SOUTH) {
-    return maze[x][y].southSide;
+  for (int bucket = 0; bucket < TURN_BUCKETS && seen * 100 < timed * 99; bucket++) {
+
+    int octave = bucket / 4;
+    double top = octave < 2 ? bucket + 1 : (double) ((4 + bucket % 4 + 1) << (octave - 2));
+
+    seen += atomic_load(&turnBuckets[bucket]);
+    if (median == 0 && seen * 2 >= timed) {
+      median = top;
+    }
+    if (seen * 100 >= timed * 99) {
+      tail = top;
+    }
   }
 
+  printf("Turn to move: %lu turns, mean %.1f us, median %.1f us, 99th %.1f us, max %.1f us",
+         timed, atomic_load(&turnNanos) / 1000.0 / timed, median / 1000, tail / 1000,
+         atomic_load(&turnNanosMax) / 1000.0);
+
+  Planner *planner = navigator->planner;
+
+  if (planner != NULL) {
+    printf("; %lu routes searched on turns, %lu ahead (%lu used).\n", planner->searches,
+           planner->searchesAhead, planner->aheadTaken);
+  }
   else {
-    return maze[x][y].westSide;
+    printf("; %lu moves worked out ahead.\n", atomic_load(&navigator->turnsAhead));
   }
+}
 
-  return -1;
+
+/*
+ *
+ * DrawAvatar - queues the avatar's new position for the drawing thread,
+ *   which shows it in its next frame; the avatar does not wait for it
+ *
+ */
+void DrawAvatar(Avatar *avatar) {
+
+  if (drawer != NULL) {
+    DrawerMove(drawer, avatar->id, ntohl(avatar->pos.x), ntohl(avatar->pos.y));
+  }
 }
 
 
 /*
  *
- * SendMoveMessage - sends an AM_AVATAR_MOVE message to the server
+ * StopDrawing - the last frame drawn (or recorded) and the recording
+ *   closed; once only, see StopDrawingOnce
  *
- * Returns 0 if the execution was unsuccessful (and returns 1 otherwise)
+ */
+void StopDrawing(void) {
+
+  if (drawer != NULL) {
+    DrawerStop(drawer);
+  }
+  if (recorder != NULL) {
+    printf("Recorded %lu frames, %llu bytes, to %s%s.\n", recorder->frames, recorder->bytes,
+           recorder->path, recorder->failed ? " (stopped by a failed write)" : "");
+    RecorderFree(recorder);
+    recorder = NULL;
+  }
+}
+
+
+/*
+ *
+ * StopDrawingOnce - StopDrawing for whichever thread gets here first; any
+ *   other waits until it is done. Also run at exit
  *
  */
-int SendMoveMessage(int avatarId, int directionToMove, int sockfd) {
+void StopDrawingOnce(void) {
 
-  /* Create message to send */
-  AM_Message *amAvatarMove = calloc(1, sizeof(AM_Message));
+  pthread_once(&drawingStopped, StopDrawing);
+}
 
-  amAvatarMove->type = htonl(AM_AVATAR_MOVE); // Message type (init)
-  amAvatarMove->avatar_move.AvatarId = htonl(avatarId); // id of current avatar
-  amAvatarMove->avatar_move.Direction = htonl(directionToMove); // direction of movement
 
-  /* Send message */
-  if (send(sockfd, amAvatarMove, sizeof(AM_Message), 0) == -1) {
-    fprintf(stderr, "Error: Failed to send AM_AVATAR_MOVE message to server.\n");
-    free(amAvatarMove);
-    return(0);
-  }
+/*
+ *
+ * ClaimEnd - with a thread per avatar every one of them gets the message
+ *   that ends the run. The first to claim the end goes on to report and
+ *   exit; any other waits here for that exit rather than report again, or
+ *   exit while the last frame is still being written
+ *
+ */
+void ClaimEnd(void) {
 
-  return(1);
+  if (endingHere) {
+    return;
+  }
+  if (atomic_exchange(&runEnding, 1)) {
+    for (;;) {
+      pause();
+    }
+  }
+  endingHere = 1;
 }
 
 
-void *OpenFrame(void *data) {
+/*
+ *
+ * EndRun - exits, once the drawing is finished
+ *
+ */
+void EndRun(void) {
 
+  ClaimEnd();
+  StopDrawingOnce();
+  exit(0);
+}
 
-  AM_Message *params = ((AM_Message *) data);
 
-  int mazeHeight = ntohl(params->init_ok.MazeHeight);
-  int mazeWidth = ntohl(params->init_ok.MazeWidth);
+/*
+ *
+ * ConnectAvatar - opens the avatar's connection to the maze port and sends
+ *   AM_AVATAR_READY, then resets its navigation state
+ *
+ * Returns 1 on success and 0 if the socket could not be created
+ *
+ */
+int ConnectAvatar(AvatarState *state, int avatarId, struct hostent *server, AM_Message initMessage) {
 
-  printf("Height %d Width %d\n", mazeHeight, mazeWidth);
-  size_multiplier = MAX_WINDOW_SIZE / mazeWidth;
-  display_window(NULL, NULL, mazeWidth, mazeHeight);
+  printf("Starting thread for Avatar number %d\n", avatarId);
 
-  return NULL;
+  if (!OpenMazeConnection(&state->link, avatarId, server, initMessage)) {
+    return(0);
+  }
 
+  return StartAvatar(state, avatarId, &state->link, initMessage);
 }
 
 
 /*
  *
- * InitiateAvatar - begins the execution of each Avatar thread
+ * OpenMazeConnection - connects to the maze port named in AM_INIT_OK over
+ *   the transport chosen with -t
  *
- * Pseudocode:
+ * Returns 1 on success and 0 if the connection could not be made
  *
  */
-void *InitiateAvatar(void *data) {
+int OpenMazeConnection(Transport *transport, int avatarId, struct hostent *server, AM_Message initMessage) {
 
+  int mazePort = ntohl(initMessage.init_ok.MazePort);
 
-  /* Parse thread parameters */
+  if (!TransportConnect(transport, transportKind, server, mazePort)) {
+    fprintf(stderr, "Error: Avatar number %d unable to connect to the server on maze port (%s). Errno: %s\n",
+            avatarId, TransportName(transportKind), strerror(errno));
+    return(0);
+  }
+  fprintf(stdout, "Connection to server on maze port established (%s).\n", TransportName(transportKind));
 
-  AvatarInitData *params = ((AvatarInitData *) data);
+  return(1);
+}
 
-  int avatarId = params->AvatarId;
-  // int nAvatars = params->nAvatars;
-  // int difficulty = params->difficulty;
-  struct hostent *server = params->server;
-  AM_Message initMessage = params->message;
 
-  printf("Starting thread for Avatar number %d\n", avatarId);
+/*
+ *
+ * StartAvatar - sends AM_AVATAR_READY for an avatar over transport and resets
+ *   its navigation state
+ *
+ * Returns 1 on success and 0 if the message could not be sent
+ *
+ */
+int StartAvatar(AvatarState *state, int avatarId, Transport *transport, AM_Message initMessage) {
+
+  state->avatarId = avatarId;
+  state->transport = transport;
+  FrameReaderInitTransport(&state->reader, transport);
+  FrameCodecInit(&state->reader.codec, ntohl(initMessage.init_ok.Version), 0);
+  state->features = ntohl(initMessage.init_ok.Features);
+  memset(&state->outbox, 0, sizeof(state->outbox));
 
 
 
-  /* Create Socket */
+  /* Send AM_AVATAR_READY message to server */
 
-  int sockfd2;
-  struct sockaddr_in servAddr2;
+  FrameEncodeReady(&state->outbox, avatarId);
 
-  if ((sockfd2 = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
-     fprintf(stderr, "Error: Unable to create socket for Avatar number %d.\n", avatarId);
-     return(0);
+  if (!TransportWrite(transport, &state->reader.codec, &state->outbox)) {
+    fprintf(stderr, "Error: Failed to send AM_AVATAR_READY message to server.\n");
+    TransportClose(transport);
+    return(0);
   }
 
-  // Initialize buffer to 0s
-  bzero((char *) &servAddr2, sizeof(servAddr2));
 
-  servAddr2.sin_family = AF_INET;
 
-  // Convert maze port to correct format
-  int mazePort = ntohl(initMessage.init_ok.MazePort);
-  servAddr2.sin_port = htons(mazePort);
+  /* Begin Navigation */
+
+  state->moveNumber = 1;
+  NavigatorStart(navigator, &state->nav, avatarId);
+
+
+  /* Avatar struct for graphics updating */
+
+  state->avatar = calloc(1, sizeof(Avatar));
+  state->avatar->id = avatarId;
+
 
-  // Copy address into sockaddr_in struct
-  bcopy((char *)server->h_addr_list[0], (char *)&servAddr2.sin_addr.s_addr, server->h_length);
+  FollowerStep *follow = &state->nav.follow;
 
+  printf(" AVATAR ID: %d\n sockfd: %d\n orientation: %d\n upcomingMove: %d\n straight: %d\n right: %d\n backward: %d\n left: %d\n", avatarId, transport->fd, follow->orientation, follow->upcomingMove, follow->straight, follow->right, follow->backward, follow->left);
+
+  return(1);
+}
+
+
+/*
+ *
+ * HandleAvatarMessage - advances one avatar's state machine with a message
+ *   received on its socket other than its own turn, which
+ *   HandleAvatarMessageAs answers
+ *
+ * Returns 1 while the avatar should keep listening and 0 once it is done
+ *
+ */
+int HandleAvatarMessage(AvatarState *state, AM_Message *message) {
 
+  AM_Message amAvatarTurn = *message;
 
-  /* Connect to server */
 
-  while (connect(sockfd2, (struct sockaddr *) &servAddr2, sizeof(servAddr2)) == -1) {
-    fprintf(stderr, "Error: Unable to connect to the server on maze port. Errno: %s\n", strerror(errno));
+  if (IS_AM_ERROR(amAvatarTurn.type)) {
+    fprintf(stderr, "Received error message from server. Exiting.\n");
+    return(0);
   }
-  fprintf(stdout, "Connection to server on maze port established.\n");
 
 
+  /* Another avatar's turn: nothing to do */
 
-  /* Send AM_AVATAR_READY message to server */
+  else if (ntohl(amAvatarTurn.type) == AM_AVATAR_TURN) {
+    return(1);
+  }
 
-  AM_Message *amAvatarReady = calloc(1, sizeof(AM_Message));
+  /* If there are no more turns remaining for the avatar */
 
-  amAvatarReady->type = htonl(AM_AVATAR_READY); // Message type (AM_AVATAR_READY)
-  amAvatarReady->avatar_ready.AvatarId = htonl(avatarId); // Avatar ID
+  else if (ntohl(amAvatarTurn.type) == AM_AVATAR_OUT_OF_TURN) {
+    printf("Avatar is out of turn.\n");
+    EndRun();
 
-  while (send(sockfd2, amAvatarReady, sizeof(AM_Message), 0) == -1) {
-    fprintf(stderr, "Error: Failed to send AM_AVATAR_READY message to server.\n");
   }
-  // free(amAvatarReady);
 
+  else if (ntohl(amAvatarTurn.type) == AM_TOO_MANY_MOVES) {
+    printf("Avatar has taken too many moves.\n");
+    EndRun();
 
+  }
 
-  /* Begin Navigation */
+  else if (ntohl(amAvatarTurn.type) == AM_SERVER_TIMEOUT) {
+    printf("Server timed out.\n");
+    EndRun();
 
-  int straight, right, backward, left;  // relative to avatar
-  int orientation, upcomingMove;        // relative to environment
-  int prevX, prevY;
-  int moveNumber = 1;
+  }
 
-  int firstIteration = 1; // true
+  else if (ntohl(amAvatarTurn.type) == AM_SERVER_DISK_QUOTA) {
+    printf("Server has reached disk quota.\n");
+    EndRun();
 
+  }
 
-  /* Avatar struct for graphics updating */
+  else if (ntohl(amAvatarTurn.type) == AM_SERVER_OUT_OF_MEM) {
+    printf("Server ran out of memory.\n");
+    EndRun();
 
-  Avatar *avatar = calloc(1, sizeof(Avatar));
-  avatar->id = avatarId;
+  }
 
+  /* If the maze has been solved */
+  else if (ntohl(amAvatarTurn.type) == AM_MAZE_SOLVED) {
+
+    ClaimEnd();
+    printf("Maze Solved!\n");
+
+    int hash = ntohl(amAvatarTurn.maze_solved.Hash);
+    int nMoves = ntohl(amAvatarTurn.maze_solved.nMoves);
+    int endDifficulty = ntohl(amAvatarTurn.maze_solved.Difficulty);
+    int endAvatars = ntohl(amAvatarTurn.maze_solved.nAvatars);
+
+    fprintf(logfile, "Hash: %d nMoves: %d Difficulty: %d nAvatars: %d\n", hash, nMoves, endDifficulty, endAvatars);
+    printf("Inferred %lu walls from %lu turn broadcasts.\n", atomic_load(&navigator->inference.learned),
+           atomic_load(&navigator->inference.turns));
+    if (navigator->pruner != NULL) {
+      printf("Sealed %lu dead-end squares (%lu never entered)", navigator->pruner->sealedSquares,
+             navigator->pruner->sealedUnknown);
+      if (navigator->planner == NULL) {
+        printf("; the wall follower skipped about %lu moves", atomic_load(&navigator->skippedMoves));
+      }
+      printf(".\n");
+    }
+    PrintTurnTimes();
+    EndRun();
+  }
 
-  orientation = M_NORTH;
+  return(1);
+}
 
-  straight = M_NORTH;
-  right = M_EAST;
-  backward = M_SOUTH;
-  left = M_WEST;
 
-  upcomingMove = right;
+/*
+ *
+ * HandleAvatarMessageAs - HandleAvatarMessage, but the avatar's own turn is
+ *   answered here, by strategy given as a constant
+ *
+ * Returns 1 while the avatar should keep listening and 0 once it is done
+ *
+ */
+__attribute__((always_inline))
+static inline int HandleAvatarMessageAs(AvatarState *state, AM_Message *message, const int strategy) {
 
-  printf(" AVATAR ID: %d\n sockfd: %d\n orientation: %d\n upcomingMove: %d\n straight: %d\n right: %d\n backward: %d\n left: %d\n",avatarId,  sockfd2, orientation, upcomingMove, straight, right, backward, left);
+  if (ntohl(message->type) == AM_AVATAR_TURN && ntohl(message->avatar_turn.TurnId) == state->avatarId) {
+    return SendTurnMovesAs(state, message, NowNanos(), strategy);
+  }
+  return HandleAvatarMessage(state, message);
+}
 
 
-  /* Keep first avatar stationary */
+/*
+ *
+ * InitiateAvatar - begins the execution of each Avatar thread
+ *
+ * Pseudocode: connect to the maze port, then listen with the loop for the
+ * navigator's strategy, picked once here.
+ *
+ */
+void *InitiateAvatar(void *data) {
+
+
+  /* Parse thread parameters */
+
+  AvatarInitData *params = ((AvatarInitData *) data);
+
+  AvatarState state;
+  memset(&state, 0, sizeof(state));
+
+  if (!ConnectAvatar(&state, params->AvatarId, params->server, params->message)) {
+    return(0);
+  }
 
-  if (avatarId == 0) {
-    upcomingMove = M_NULL_MOVE;
+  switch (navigator->strategy) {
+    case NAV_FOLLOW_LEFT:
+      ListenAvatarAs(&state, NAV_FOLLOW_LEFT);
+      break;
+    case NAV_FRONTIER:
+      ListenAvatarAs(&state, NAV_FRONTIER);
+      break;
+    case NAV_RENDEZVOUS:
+      ListenAvatarAs(&state, NAV_RENDEZVOUS);
+      break;
+    default:
+      ListenAvatarAs(&state, NAV_FOLLOW);
+      break;
   }
+  return NULL;
+}
+
+
+/*
+ *
+ * ListenAvatarAs - one avatar thread's loop: block on the avatar's socket
+ *   and feed every message to HandleAvatarMessageAs until the maze is
+ *   solved or the connection fails
+ *
+ */
+__attribute__((always_inline))
+static inline void ListenAvatarAs(AvatarState *state, const int strategy) {
 
 
   /* Navigate with the remaining avatars until maze is solved */
@@ -335,236 +802,418 @@ void *InitiateAvatar(void *data) {
   while (!mazeSolved) {
 
 
-    /* Listen for AM_AVATAR_TURN message from server */
+    /* Listen for AM_AVATAR_TURN messages from server */
+
+    int recvResponse = FrameReaderFill(&state->reader);
+
+    if (recvResponse == FRAME_CLOSED) {
+      fprintf(stderr, "Error: Avatar ID %d: Server closed the maze port connection.\n", state->avatarId);
+      return;
+    }
+
+    else if (recvResponse == FRAME_ERROR) {
+      fprintf(stderr, "Error: Avatar ID %d Failed to receive AM_AVATAR_TURN message from server.\n", state->avatarId);
+      return;
+    }
+
+
+    /* Handle every whole message that arrived with this read */
 
     AM_Message amAvatarTurn;
-    memset(&amAvatarTurn, 0, sizeof(amAvatarTurn));
 
-    int recvResponse = recv(sockfd2, &amAvatarTurn, sizeof(amAvatarTurn), 0);
+    while (FrameReaderNext(&state->reader, &amAvatarTurn)) {
+      if (!HandleAvatarMessageAs(state, &amAvatarTurn, strategy)) {
+        return;
+      }
+    }
+  }
+}
+
+
+/*
+ *
+ * CloseAvatars - undoes ConnectAvatar and StartAvatar for a loop that could
+ *   not be started: closes each avatar's own connection, if it opened one,
+ *   frees its Avatar and then the states. A shared connection is left to
+ *   its owner
+ *
+ */
+void CloseAvatars(AvatarState *states, int nAvatars) {
 
-    if (recvResponse == 0) {
-      fprintf(stderr, "Error: Avatar ID %d: No AM_AVATAR_TURN message available from server.\n", avatarId);
-      // free(amAvatarTurn);
-      continue;
+  for (int avatarId = 0; avatarId < nAvatars; avatarId++) {
+    if (states[avatarId].transport == &states[avatarId].link) {
+      TransportClose(&states[avatarId].link);
     }
+    free(states[avatarId].avatar);
+  }
+  free(states);
+}
+
+
+/*
+ *
+ * RunEventLoop - event-driven alternative to StartThreads: a single thread
+ *   owns every avatar socket through one epoll instance
+ *
+ * Pseudocode: connect all avatars, register each socket with its
+ * AvatarState as the epoll cookie, then wait for readiness and hand every
+ * message to the state machine that owns the socket it arrived on. Only the
+ * avatar named in TurnId does any work; the other copies of a turn broadcast
+ * are consumed in the same pass without waking any other thread.
+ *
+ * Returns 0 if the loop could not be started (and does not return once the
+ * maze ends, since the state machine exits the process)
+ *
+ */
+int RunEventLoop(int nAvatars, AM_Message message, struct hostent *server) {
+
+  AvatarState *states = calloc(nAvatars, sizeof(AvatarState));
+
+  int epfd = epoll_create1(0);
+  if (states == NULL || epfd == -1) {
+    fprintf(stderr, "Error: Unable to create event loop.\n");
+    free(states);
+    return(0);
+  }
+
+
+  /* Connect every avatar and watch its socket */
+
+  for (int avatarId = 0; avatarId < nAvatars; avatarId++) {
 
-    else if (recvResponse == -1) {
-      fprintf(stderr, "Error: Avatar ID %d Failed to receive AM_AVATAR_TURN message from server.\n", avatarId);
-      // free(amAvatarTurn);
-      continue;
+    if (!ConnectAvatar(&states[avatarId], avatarId, server, message)) {
+      CloseAvatars(states, nAvatars);
+      close(epfd);
+      return(0);
     }
 
-    else if (IS_AM_ERROR(amAvatarTurn.type)) {
-      fprintf(stderr, "Received error message from server. Exiting.\n");
-      return NULL;
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = &states[avatarId];
+
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, states[avatarId].transport->fd, &event) == -1) {
+      fprintf(stderr, "Error: Unable to watch socket for Avatar number %d.\n", avatarId);
+      CloseAvatars(states, nAvatars);
+      close(epfd);
+      return(0);
     }
+  }
 
 
-    /* Continue movement of avatars */
+  /* Dispatch messages until the maze is solved, in the strategy's loop */
+
+  switch (navigator->strategy) {
+    case NAV_FOLLOW_LEFT:
+      EventLoopAs(epfd, nAvatars, NAV_FOLLOW_LEFT);
+      break;
+    case NAV_FRONTIER:
+      EventLoopAs(epfd, nAvatars, NAV_FRONTIER);
+      break;
+    case NAV_RENDEZVOUS:
+      EventLoopAs(epfd, nAvatars, NAV_RENDEZVOUS);
+      break;
+    default:
+      EventLoopAs(epfd, nAvatars, NAV_FOLLOW);
+      break;
+  }
 
-    else if (ntohl(amAvatarTurn.type) == AM_AVATAR_TURN) {
+  close(epfd);
+  return(1);
+}
 
-      /* Set initial X,Y values */
 
-      if (firstIteration) {
-        prevX = ntohl(amAvatarTurn.avatar_turn.Pos[avatarId].x);
-        prevY = ntohl(amAvatarTurn.avatar_turn.Pos[avatarId].y);
-      }
+/*
+ *
+ * EventLoopAs - RunEventLoop's dispatch: wait on epfd and hand every
+ *   message to the state machine of the socket it arrived on, until the
+ *   maze is solved or every connection has closed
+ *
+ */
+__attribute__((always_inline))
+static inline void EventLoopAs(int epfd, int nAvatars, const int strategy) {
 
+  struct epoll_event events[AM_MAX_AVATAR];
+  int nActive = nAvatars;
 
-      /* Update position if it is this avatar's turn */
+  while (!mazeSolved && nActive > 0) {
 
-      if (ntohl(amAvatarTurn.avatar_turn.TurnId) == avatarId) {
+    int nEvents = epoll_wait(epfd, events, AM_MAX_AVATAR, -1);
 
+    if (nEvents == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      fprintf(stderr, "Error: Event loop failed. Errno: %s\n", strerror(errno));
+      break;
+    }
 
-        /* Store updated x and y values */
+    for (int i = 0; i < nEvents; i++) {
 
-        int x = ntohl(amAvatarTurn.avatar_turn.Pos[avatarId].x);
-        int y = ntohl(amAvatarTurn.avatar_turn.Pos[avatarId].y);
+      AvatarState *state = events[i].data.ptr;
 
-        printf("Avatar %d (X,Y) = (%d,%d)\n", avatarId, x, y);
+      /* One read, then every whole message it completed */
 
+      int recvResponse = FrameReaderFill(&state->reader);
+      int keepListening = (recvResponse == FRAME_OK);
 
-        /* Keep immobile ones from moving */
+      AM_Message amAvatarTurn;
 
-        if (upcomingMove == M_NULL_MOVE) {
-          SendMoveMessage(avatarId, upcomingMove, sockfd2);
-          continue;
-        }
+      while (keepListening && FrameReaderNext(&state->reader, &amAvatarTurn)) {
+        keepListening = HandleAvatarMessageAs(state, &amAvatarTurn, strategy);
+      }
 
+      if (!keepListening) {
+        fprintf(stderr, "Error: Avatar ID %d: connection to server closed.\n", state->avatarId);
+        epoll_ctl(epfd, EPOLL_CTL_DEL, state->transport->fd, NULL);
+        TransportClose(state->transport);
+        nActive--;
+      }
+    }
+  }
+}
 
-        /* If we haven't moved, make a different move */
 
-        if ((x == prevX) && (y == prevY)) { 
+/*
+ *
+ * RunUringLoop - io_uring alternative to RunEventLoop
+ *
+ * Pseudocode: connect all avatars and post one multishot recv per socket.
+ * Each pass makes a single io_uring_enter that submits the moves queued in
+ * the previous pass (SendOutbox) and waits for completions; every recv
+ * completion is pushed into the owning avatar's FrameReader and its buffer
+ * handed straight back to the kernel. A recv that stops being armed (e.g.
+ * buffers ran out) is posted again.
+ *
+ * Returns 0 if the loop could not be started, falling back to RunEventLoop
+ * if io_uring is not available (and does not return once the maze ends,
+ * since the state machine exits the process)
+ *
+ */
+int RunUringLoop(int nAvatars, AM_Message message, struct hostent *server) {
 
-          /* Update maze data structure */
-          if (!firstIteration) {
-            SetMazeSquareSide(prevX, prevY, upcomingMove, 0);
-          }
-          firstIteration = 0;
+  Uring *ring = calloc(1, sizeof(Uring));
 
-          // this if-ladder sets upcomingMove to be the next on the list (right -> straight -> left -> backward)
-          if (upcomingMove == right && (ConvertDirection(prevX, prevY, straight) == -1 || ConvertDirection(prevX, prevY, straight) == 1) ) {
-            upcomingMove = straight;
-          }
+  if (ring == NULL || !UringInit(ring)) {
+    fprintf(stderr, "io_uring unavailable, falling back to epoll.\n");
+    free(ring);
+    return RunEventLoop(nAvatars, message, server);
+  }
 
-          else if (upcomingMove == straight && (ConvertDirection(prevX, prevY, left) == -1 || ConvertDirection(prevX, prevY, left) == 1) ) {
-            upcomingMove = left;
-          }
+  AvatarState *states = calloc(nAvatars, sizeof(AvatarState));
+  if (states == NULL) {
+    fprintf(stderr, "Error: Unable to create event loop.\n");
+    UringClose(ring);
+    free(ring);
+    return(0);
+  }
 
-          else if (upcomingMove == backward) {
-            upcomingMove = right;
-          }
 
-          else {
-            upcomingMove = backward;
-          }
-        }
+  /* Connect every avatar and keep a receive posted on its socket */
 
+  for (int avatarId = 0; avatarId < nAvatars; avatarId++) {
 
-        /* If the move is successful, update orientation */
+    if (!ConnectAvatar(&states[avatarId], avatarId, server, message)) {
+      CloseAvatars(states, nAvatars);
+      UringClose(ring);
+      free(ring);
+      return(0);
+    }
+    states[avatarId].uring = ring;
+    UringRecvMultishot(ring, states[avatarId].transport->fd, ((uint64_t) avatarId << 1) | URING_OP_RECV);
+  }
 
-        else { 
 
-          /* Update maze data structure */
-          SetMazeSquareSide(prevX, prevY, upcomingMove, 1);
+  /* Dispatch messages until the maze is solved, in the strategy's loop */
+
+  switch (navigator->strategy) {
+    case NAV_FOLLOW_LEFT:
+      UringLoopAs(ring, states, nAvatars, NAV_FOLLOW_LEFT);
+      break;
+    case NAV_FRONTIER:
+      UringLoopAs(ring, states, nAvatars, NAV_FRONTIER);
+      break;
+    case NAV_RENDEZVOUS:
+      UringLoopAs(ring, states, nAvatars, NAV_RENDEZVOUS);
+      break;
+    default:
+      UringLoopAs(ring, states, nAvatars, NAV_FOLLOW);
+      break;
+  }
 
-          /* Freeze avatar if it finds the stationary one */
+  UringClose(ring);
+  return(1);
+}
 
-          if ((x == ntohl(amAvatarTurn.avatar_turn.Pos[0].x)) && (y == ntohl(amAvatarTurn.avatar_turn.Pos[0].y))) { 
-            upcomingMove = M_NULL_MOVE;
-          }
 
+/*
+ *
+ * UringLoopAs - RunUringLoop's dispatch: one io_uring_enter a pass, then
+ *   every completion, until the maze is solved or every connection has
+ *   closed
+ *
+ */
+__attribute__((always_inline))
+static inline void UringLoopAs(Uring *ring, AvatarState *states, int nAvatars, const int strategy) {
 
-          else {
+  int nActive = nAvatars;
 
-            prevX = x;
-            prevY = y;
+  while (!mazeSolved && nActive > 0) {
 
-            /* Update Avatar struct for graphics */
-            avatar->pos.x = htonl(x);
-            avatar->pos.y = htonl(y);
+    if (UringSubmit(ring, 1) == -1) {
+      fprintf(stderr, "Error: Event loop failed. Errno: %s\n", strerror(errno));
+      break;
+    }
 
+    UringCompletion completion;
 
-            pthread_t updateGraphics;
-            int updateFailed;
-            updateFailed = pthread_create(&updateGraphics, NULL, do_draw, avatar);
+    while (UringNext(ring, &completion)) {
 
-            if (updateFailed) {
-              fprintf(stderr, "Failed to update graphics window.\n");
-              exit(0);
-            }
+      AvatarState *state = &states[completion.userData >> 1];
+      int keepListening = 1;
 
-            fprintf(logfile, "Avatar ID: %d (x,y) Position: (%d,%d) Move Number: %d\n", avatarId, prevX, prevY, moveNumber++);
+      if ((completion.userData & 1) == URING_OP_SEND) {
+        /* Even with MSG_WAITALL a send can stop short (a signal, the peer
+         * going away); the rest of the frame is not sent, so the stream is
+         * out of step */
 
+        keepListening = completion.res >= 0 && (size_t) completion.res == state->sendLength;
+        if (completion.res >= 0 && !keepListening) {
+          fprintf(stderr, "Error: Avatar ID %d: sent %d of %zu bytes.\n", state->avatarId, completion.res,
+                  state->sendLength);
+        }
+      }
 
-            orientation = upcomingMove; // orients the agent in the direction it just moved 
+      else if (completion.res == -ENOBUFS) {
+        keepListening = UringRecvMultishot(ring, state->transport->fd, completion.userData);
+      }
 
-            /* Set relative direction variables */
+      else if (completion.res <= 0) {
+        keepListening = 0;
+      }
 
-            // printf("Updating orientation.\n");
-            if (orientation == M_NORTH) { //    N                                                                                                                     
-              straight = M_NORTH;         //  W   E                                                                                                                     
-              right = M_EAST;             //    S                                                                                                                           
-              backward = M_SOUTH;
-              left = M_WEST;
-            }
+      else {
+        /* Bytes landed in a provided buffer: take them, then give it back */
 
-            else if (orientation == M_EAST) {
-              straight = M_EAST;
-              right = M_SOUTH;
-              backward = M_WEST;
-              left = M_NORTH;
-            }
+        keepListening = FrameReaderPush(&state->reader, completion.buffer, completion.res) == FRAME_OK;
+        UringRecycle(ring, completion.bufferId);
 
-            else if (orientation == M_SOUTH) {
-              straight = M_SOUTH;
-              right = M_WEST;
-              backward = M_NORTH;
-              left = M_EAST;
-            }
+        AM_Message amAvatarTurn;
 
-            else {
-              straight = M_WEST;
-              right = M_NORTH;
-              backward = M_EAST;
-              left = M_SOUTH;
-            }
+        while (keepListening && FrameReaderNext(&state->reader, &amAvatarTurn)) {
+          keepListening = HandleAvatarMessageAs(state, &amAvatarTurn, strategy);
+        }
 
-            /* Determine relative direction */
-            
-            if ((ConvertDirection(prevX, prevY, right) == -1 || ConvertDirection(prevX, prevY, right) == 1) ) { // NOTE: also need to do this instead of just resetting move to just be "right" after successful
-              upcomingMove = right;
-            }
+        if (keepListening && !completion.more) {
+          keepListening = UringRecvMultishot(ring, state->transport->fd, completion.userData);
+        }
+      }
 
-            else if ((ConvertDirection(prevX, prevY, straight) == -1 || ConvertDirection(prevX, prevY, straight) == 1) ) {
-              upcomingMove = straight;
-            }
+      if (!keepListening && state->transport->fd != -1) {
+        fprintf(stderr, "Error: Avatar ID %d: connection to server closed.\n", state->avatarId);
+        TransportClose(state->transport);
+        nActive--;
+      }
+    }
+  }
+}
 
-            else if ((ConvertDirection(prevX, prevY, left) == -1 || ConvertDirection(prevX, prevY, left) == 1) ) {
-              upcomingMove = left;
-            }
 
-            else if (upcomingMove == backward) {
-              upcomingMove = right;
-            }
+/*
+ *
+ * RunMuxLoop - multiplexed alternative to RunEventLoop: every avatar shares
+ *   one maze port connection (AM_FEATURE_MUX), so each broadcast arrives once
+ *
+ * Pseudocode: open one connection, send AM_AVATAR_READY for every avatar on
+ * it, then read messages and give each turn only to the avatar named in its
+ * TurnId. Anything that is not a turn (solved, errors) goes to avatar 0.
+ *
+ * Returns 0 if the loop could not be started (and does not return once the
+ * maze ends, since the state machine exits the process)
+ *
+ */
+int RunMuxLoop(int nAvatars, AM_Message message, struct hostent *server) {
 
-            else {
-              upcomingMove = backward;
-            }
-          }
-        }
-        SendMoveMessage(avatarId, upcomingMove, sockfd2); // send AM_AVATAR_MOVE message to server with avatarId and upcomingMove (aka: move in direction)
-      }
-    }   
+  AvatarState *states = calloc(nAvatars, sizeof(AvatarState));
+  FrameReader *reader = calloc(1, sizeof(FrameReader));
+  Transport *link = calloc(1, sizeof(Transport));
 
-    /* If there are no more turns remaining for the avatar */
+  if (states == NULL || reader == NULL || link == NULL || !OpenMazeConnection(link, 0, server, message)) {
+    fprintf(stderr, "Error: Unable to open multiplexed maze connection.\n");
+    free(states);
+    free(reader);
+    free(link);
+    return(0);
+  }
 
-    else if (ntohl(amAvatarTurn.type) == AM_AVATAR_OUT_OF_TURN) {
-      printf("Avatar is out of turn.\n");
-      exit(0);
+  FrameReaderInitTransport(reader, link);
+  FrameCodecInit(&reader->codec, ntohl(message.init_ok.Version), nAvatars);
 
+  for (int avatarId = 0; avatarId < nAvatars; avatarId++) {
+    if (!StartAvatar(&states[avatarId], avatarId, link, message)) {
+      CloseAvatars(states, nAvatars);
+      TransportClose(link);
+      free(reader);
+      free(link);
+      return(0);
     }
+  }
 
-    else if (ntohl(amAvatarTurn.type) == AM_TOO_MANY_MOVES) {
-      printf("Avatar has taken too many moves.\n");
-      exit(0);
 
-    }
+  /* Dispatch messages until the maze is solved, in the strategy's loop */
+
+  switch (navigator->strategy) {
+    case NAV_FOLLOW_LEFT:
+      MuxLoopAs(reader, states, nAvatars, NAV_FOLLOW_LEFT);
+      break;
+    case NAV_FRONTIER:
+      MuxLoopAs(reader, states, nAvatars, NAV_FRONTIER);
+      break;
+    case NAV_RENDEZVOUS:
+      MuxLoopAs(reader, states, nAvatars, NAV_RENDEZVOUS);
+      break;
+    default:
+      MuxLoopAs(reader, states, nAvatars, NAV_FOLLOW);
+      break;
+  }
 
-    else if (ntohl(amAvatarTurn.type) == AM_SERVER_TIMEOUT) {
-      printf("Server timed out.\n");
-      exit(0);
+  TransportClose(link);
+  return(1);
+}
 
-    }
 
-    else if (ntohl(amAvatarTurn.type) == AM_SERVER_DISK_QUOTA) {
-      printf("Server has reached disk quota.\n");
-      exit(0);
+/*
+ *
+ * MuxLoopAs - RunMuxLoop's dispatch: read the shared connection and give
+ *   each turn only to the avatar it names, until the maze is solved or the
+ *   connection fails
+ *
+ */
+__attribute__((always_inline))
+static inline void MuxLoopAs(FrameReader *reader, AvatarState *states, int nAvatars, const int strategy) {
 
-    }
+  while (!mazeSolved) {
 
-    else if (ntohl(amAvatarTurn.type) == AM_SERVER_OUT_OF_MEM) {
-      printf("Server ran out of memory.\n");
-      exit(0);
+    int recvResponse = FrameReaderFill(reader);
 
+    if (recvResponse != FRAME_OK) {
+      fprintf(stderr, "Error: Multiplexed connection to server closed.\n");
+      break;
     }
 
-    /* If the maze has been solved */
-    else if (ntohl(amAvatarTurn.type) == AM_MAZE_SOLVED) {
+    AM_Message amAvatarTurn;
 
-      printf("Maze Solved!\n");
+    while (FrameReaderNext(reader, &amAvatarTurn)) {
 
-      int hash = ntohl(amAvatarTurn.maze_solved.Hash);
-      int nMoves = ntohl(amAvatarTurn.maze_solved.nMoves);
-      int endDifficulty = ntohl(amAvatarTurn.maze_solved.Difficulty);
-      int endAvatars = ntohl(amAvatarTurn.maze_solved.nAvatars);
+      int owner = 0;
+      if (ntohl(amAvatarTurn.type) == AM_AVATAR_TURN) {
+        owner = ntohl(amAvatarTurn.avatar_turn.TurnId);
+      }
 
-      fprintf(logfile, "Hash: %d nMoves: %d Difficulty: %d nAvatars: %d\n", hash, nMoves, endDifficulty, endAvatars);
-      exit(0);
+      if (owner < 0 || owner >= nAvatars || !HandleAvatarMessageAs(&states[owner], &amAvatarTurn, strategy)) {
+        return;
+      }
     }
   }
-  return NULL;
 }
 
 
@@ -646,6 +1295,7 @@ char* DetermineLogfile(int nAvatars, int difficulty) {
 
 
 
+#ifndef AM_NO_WINDOW
 gboolean on_window_configure_event(GtkWidget *da, GdkEventConfigure *event, gpointer user_data) {
   static int oldw = 0;
   static int oldh = 0;
@@ -662,6 +1312,7 @@ gboolean on_window_configure_event(GtkWidget *da, GdkEventConfigure *event, gpoi
     // get rid of old pixmap
     g_object_unref(pixmap);
     pixmap = tmppixmap;
+    layers.stale = 1;
   }
   oldw = event->width;
   oldh = event->height;
@@ -677,115 +1328,238 @@ gboolean on_window_expose_event(GtkWidget *da, GdkEventExpose *event, gpointer u
 }
 
 
-void *do_draw(void *ptr) {
-  currently_drawing = 1;
-  gdk_threads_enter();  
-  
-  int width, height;
-  
-  gdk_drawable_get_size(pixmap, &width, &height);
-  gdk_threads_leave();
+/*
+ *
+ * LayersReset - a white wall layer for a width x height maze and no square
+ *   listed yet, allocating on the first call
+ *
+ * Returns 1 on success, 0 otherwise
+ *
+ */
+int LayersReset(WindowLayers *layers, int width, int height) {
+
+  if (layers->walls == NULL) {
+    layers->dirty = calloc((size_t) width * height, sizeof(int));
+    layers->stamp = calloc((size_t) width * height, sizeof(unsigned long));
 
-  // create a surface to draw on
-  cairo_surface_t *cst = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
-  cairo_t *cr = cairo_create(cst);
+    if (layers->dirty == NULL || layers->stamp == NULL) {
+      free(layers->dirty);
+      free(layers->stamp);
+      layers->dirty = NULL;
+      layers->stamp = NULL;
+      return(0);
+    }
+
+    layers->walls = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width * size_multiplier,
+                                               height * size_multiplier);
+    layers->width = width;
+    layers->height = height;
+  }
 
-  //  static int i = 0;
-  // ++i; i = i % 300;
+  cairo_t *cr = cairo_create(layers->walls);
   cairo_set_source_rgb(cr, 1, 1, 1);
   cairo_paint(cr);
+  cairo_destroy(cr);
 
-    Avatar *avatar = ((Avatar *)ptr);
+  layers->nDirty = 0;
+  return(1);
+}
 
-  int av_id = avatar->id;
-  int av_x = ntohl(avatar->pos.x);
-  int av_y = ntohl(avatar->pos.y);
 
-  
-  int y, x;
-  for (x=0; x<(width + 1); x = x + size_multiplier) {
-    for (y=0; y<(height + 1); y = y + size_multiplier) { 
-      cairo_set_source_rgb(cr, 0.95, 0.95, 0.95);
-
-      // The wall is blocked
-      cairo_set_source_rgb(cr, 0, 0, 0);
-      if (maze[x / size_multiplier][y / size_multiplier].northSide == 0) { // A horizontal line
-        // printf("North border\n");  
-        cairo_move_to(cr, x, y);
-        cairo_line_to(cr, x + size_multiplier, y);      
-        cairo_stroke(cr);
+/*
+ *
+ * MarkDirty - lists square (x,y) to be copied to the window this frame,
+ *   once however often it changed; squares outside the maze are ignored
+ *
+ */
+void MarkDirty(WindowLayers *layers, const DrawFrame *frame, int x, int y) {
+
+  if (x < 0 || y < 0 || x >= layers->width || y >= layers->height) {
+    return;
+  }
+
+  int square = y * layers->width + x;
+  if (layers->stamp[square] != frame->number + 1) {
+    layers->stamp[square] = frame->number + 1;
+    layers->dirty[layers->nDirty++] = square;
+  }
+}
+
+
+/*
+ *
+ * DrawLabel - the avatar's number on square (x,y), kept clear of the walls
+ *   around it so that copying a neighbour's square never cuts into it
+ *
+ */
+void DrawLabel(cairo_t *cr, int avatarId, int x, int y) {
+
+  int left = x * size_multiplier, top = y * size_multiplier;
+  char id[16];
+
+  cairo_save(cr);
+  cairo_rectangle(cr, left + WALL_WIDTH/2, top + WALL_WIDTH/2,
+                  size_multiplier - WALL_WIDTH, size_multiplier - WALL_WIDTH);
+  cairo_clip(cr);
+  cairo_set_source_rgb(cr, 0, 0, 0);
+  cairo_move_to(cr, left + size_multiplier/2, top + size_multiplier/2);
+  sprintf(id, "%d", avatarId);
+  cairo_show_text(cr, id);
+  cairo_restore(cr);
+}
+
+
+/*
+ *
+ * DrawWindow - the drawing thread's frame (amdraw.h), at a cost that
+ *   follows what changed rather than the size of the maze
+ *
+ * Pseudocode:
+ *     a full frame (the first, or after one not drawn): wall layer from the
+ *         whole map, and every square is copied
+ *     else: walls learned since the last frame are added to the wall layer,
+ *         and the squares either side of them are listed
+ *     the squares avatars left and arrived on are listed
+ *     under the GDK lock, the listed squares (and a wall's width around
+ *     them) are copied from the wall layer to the window's pixmap, the
+ *     avatars on them are labelled again, and just those squares of the
+ *     window are redrawn
+ *
+ * All the walls of a frame go in one path, stroked once.
+ *
+ * Returns 0 if the window is not up yet, 1 otherwise
+ *
+ */
+int DrawWindow(const DrawFrame *frame, void *context) {
+
+  WindowLayers *layers = context;
+  int size = size_multiplier;
+  int x, y, direction, i;
+
+  gdk_threads_enter();
+  int ready = pixmap != NULL && mazeWindow != NULL;
+  gdk_threads_leave();
+
+  if (!ready) {
+    return(0);
+  }
+
+  int everything = frame->full || layers->walls == NULL;
+
+  if (everything && !LayersReset(layers, frame->width, frame->height)) {
+    return(0);
+  }
+  layers->nDirty = 0;
+
+  cairo_t *cr = cairo_create(layers->walls);
+  cairo_set_source_rgb(cr, 0, 0, 0);
+  cairo_set_line_width(cr, WALL_WIDTH);
+
+  if (everything) {
+
+    /* Every edge by its index, the maze's south and east sides being the
+     * north and west sides of the row and column past it */
+
+    for (long edge = 0; edge < MazeMapEdges(mazeMap); edge++) {
+      if (MazeMapEdgeGet(mazeMap, edge) != MAP_BLOCKED) {
+        continue;
       }
-      if (maze[x / size_multiplier][y / size_multiplier].westSide == 0) { 
-        // printf("East border\n");
-        cairo_move_to(cr, x, y);
-        cairo_line_to(cr, x, y + size_multiplier);
-        cairo_stroke(cr);
+
+      MazeMapEdgeSide(mazeMap, edge, &x, &y, &direction);
+      if (direction == M_NORTH) {
+        cairo_move_to(cr, x * size, y * size);
+        cairo_line_to(cr, (x + 1) * size, y * size);
       }
-      if (maze[x / size_multiplier][y / size_multiplier].southSide == 0) {
-        // printf("South border\n");
-        cairo_move_to(cr, x, y + size_multiplier);
-        cairo_line_to(cr, x + size_multiplier, y + size_multiplier);      
-        cairo_stroke(cr); 
+      else {
+        cairo_move_to(cr, x * size, y * size);
+        cairo_line_to(cr, x * size, (y + 1) * size);
       }
-      if (maze[x / size_multiplier][y / size_multiplier].eastSide == 0) {
-        cairo_move_to(cr, x + size_multiplier, y);
-        cairo_line_to(cr, x + size_multiplier, y + size_multiplier);
-        cairo_stroke(cr);
+    }
+  }
+  else {
+
+    /* Walls learned since the last frame; edges learned open draw nothing */
+
+    for (size_t e = 0; e < frame->nEdges; e++) {
+      if (MazeMapEdgeGet(mazeMap, frame->edges[e]) != MAP_BLOCKED) {
+        continue;
       }
 
-      // The avatar is in the position
-      if (((x / size_multiplier) == av_x) && ((y / size_multiplier) == av_y)) { 
-        printf("Avatar\n");
-        cairo_move_to(cr, x + size_multiplier/2, y + size_multiplier/2);
-        char id[25];
-        sprintf(id, "%d", av_id);
-        cairo_show_text(cr, id);
+      MazeMapEdgeSide(mazeMap, frame->edges[e], &x, &y, &direction);
+
+      if (direction == M_NORTH) {
+        cairo_move_to(cr, x * size, y * size);
+        cairo_line_to(cr, (x + 1) * size, y * size);
+        MarkDirty(layers, frame, x, y - 1);
+      }
+      else {
+        cairo_move_to(cr, x * size, y * size);
+        cairo_line_to(cr, x * size, (y + 1) * size);
+        MarkDirty(layers, frame, x - 1, y);
       }
+      MarkDirty(layers, frame, x, y);
+    }
 
+    for (i = 0; i < frame->nAvatars; i++) {
+      if (frame->pos[i].x != frame->last[i].x || frame->pos[i].y != frame->last[i].y) {
+        MarkDirty(layers, frame, frame->last[i].x, frame->last[i].y);
+        MarkDirty(layers, frame, frame->pos[i].x, frame->pos[i].y);
+      }
     }
   }
+  cairo_stroke(cr);
+  cairo_destroy(cr);
 
-  //do not access gdkPixmap outside gtk_main()
-  gdk_threads_enter();
-
-  cairo_t *cr_pixmap = gdk_cairo_create(pixmap);
-  cairo_set_source_surface(cr_pixmap, cst, 0, 0);
-  cairo_paint(cr_pixmap);
-  cairo_destroy(cr_pixmap);
+  if (!everything && layers->nDirty == 0) {
+    return(1);
+  }
 
-  gdk_threads_leave();
 
-  cairo_surface_destroy(cst);
+  /* Onto the window: the listed squares only, unless its pixmap is new */
 
-  currently_drawing = 0;
-  return NULL;
-}
+  //do not access gdkPixmap outside gtk_main()
+  gdk_threads_enter();
 
-gboolean timer_exe(GtkWidget * window) {
+  everything = everything || layers->stale;
+  layers->stale = 0;
 
-  static gboolean first_execution = TRUE;
+  cairo_t *cr_pixmap = gdk_cairo_create(pixmap);
 
-  int drawing_status = g_atomic_int_get(&currently_drawing);
-  
-  if (drawing_status == 0) {
-    static pthread_t thread_info;
-    int iret;
-    if(first_execution != TRUE) {
-      pthread_join(thread_info, NULL);
-    }
-    iret = pthread_create( &thread_info, NULL, do_draw, NULL);
-    if (iret) {
-      fprintf(stderr, "Unable to create thread to draw canvas.\n");
+  if (!everything) {
+    for (i = 0; i < layers->nDirty; i++) {
+      x = layers->dirty[i] % layers->width;
+      y = layers->dirty[i] / layers->width;
+      cairo_rectangle(cr_pixmap, x * size - WALL_WIDTH/2, y * size - WALL_WIDTH/2,
+                      size + WALL_WIDTH, size + WALL_WIDTH);
     }
+    cairo_clip(cr_pixmap);
   }
+  cairo_set_source_surface(cr_pixmap, layers->walls, 0, 0);
+  cairo_paint(cr_pixmap);
 
-  int width, height;
-  gdk_drawable_get_size(pixmap, &width, &height);
-  gtk_widget_queue_draw_area(window, 0, 0, width, height);
+  for (i = 0; i < frame->nAvatars; i++) {
+    x = frame->pos[i].x;
+    y = frame->pos[i].y;
+    if (x >= 0 && (everything || layers->stamp[y * layers->width + x] == frame->number + 1)) {
+      DrawLabel(cr_pixmap, i, x, y);
+    }
+  }
+  cairo_destroy(cr_pixmap);
 
-  first_execution = FALSE;
-  return TRUE;
+  if (everything) {
+    gtk_widget_queue_draw_area(mazeWindow, 0, 0, frame->width * size, frame->height * size);
+  }
+  else {
+    for (i = 0; i < layers->nDirty; i++) {
+      x = layers->dirty[i] % layers->width;
+      y = layers->dirty[i] / layers->width;
+      gtk_widget_queue_draw_area(mazeWindow, x * size - WALL_WIDTH/2, y * size - WALL_WIDTH/2,
+                                 size + WALL_WIDTH, size + WALL_WIDTH);
+    }
+  }
 
+  gdk_threads_leave();
+  return(1);
 }
 
 
@@ -812,7 +1586,8 @@ int display_window(int *argc, char ***argv, int w, int h) {
   gtk_widget_set_app_paintable(window, TRUE);
   gtk_widget_set_double_buffered(window, FALSE);
 
-  (void)g_timeout_add(33, (GSourceFunc)timer_exe, window);
+  // the drawing thread redraws the parts of the window it changes
+  mazeWindow = window;
 
   gtk_main();
   gdk_threads_leave();
@@ -821,6 +1596,23 @@ int display_window(int *argc, char ***argv, int w, int h) {
 }
 
 
+void *OpenFrame(void *data) {
+
+
+  AM_Message *params = ((AM_Message *) data);
+
+  int mazeHeight = ntohl(params->init_ok.MazeHeight);
+  int mazeWidth = ntohl(params->init_ok.MazeWidth);
+
+  printf("Height %d Width %d\n", mazeHeight, mazeWidth);
+  display_window(NULL, NULL, mazeWidth, mazeHeight);
+
+  return NULL;
+
+}
+#endif
+
+
 int main(int argc, char* argv[]) {
 
 
@@ -831,13 +1623,27 @@ int main(int argc, char* argv[]) {
   int nAvatars, difficulty;
   nAvatars = difficulty = -1;
   char *hostname = NULL;
+  int eventMode = 0;
+  int muxMode = 0;
+  int strategy = NAV_FOLLOW;
+  int pruneMode = 1;
+  int uringMode = 0;
+  int protocolVersion = AM_PROTOCOL_V1;
+#ifndef AM_NO_WINDOW
+  int renderKind = RECORD_WINDOW;
+#else
+  int renderKind = RECORD_OFF;
+#endif
+  const char *renderPath = NULL;
+  int frameRate = 1000 / DRAW_TICK_MILLIS;
+  Transport mgmt;
 
 
   int ch;
   char *end;
   long val = -1;
-  struct hostent *server;
-  while ((ch = getopt(argc, argv, "n:d:h:")) != -1)
+  struct hostent *server = NULL;
+  while ((ch = getopt(argc, argv, "n:d:h:emukwv:t:p:r:f:")) != -1)
     switch(ch)
     {
 
@@ -890,8 +1696,88 @@ int main(int argc, char* argv[]) {
 
         break;
 
+      /* Single-threaded epoll event loop instead of one thread per avatar */
+      case 'e':
+        eventMode = 1;
+        break;
+
+      /* All avatars on one maze port connection, falling back to -e */
+      case 'm':
+        muxMode = 1;
+        eventMode = 1;
+        break;
+
+      /* Leave dead ends open */
+      case 'k':
+        pruneMode = 0;
+        break;
+
+      /* Work out moves only on the avatar's turn */
+      case 'w':
+        thinkAhead = 0;
+        break;
+
+      /* Event loop on io_uring, falling back to -e */
+      case 'u':
+        uringMode = 1;
+        eventMode = 1;
+        break;
+
+      /* MazePort wire protocol to ask the server for */
+      case 'v':
+        val = strtol(optarg, &end, 0);
+        if (val < AM_PROTOCOL_V1 || val > AM_PROTOCOL_V2 || strlen(end) != 0) {
+          fprintf(stderr, "[%s] Usage: [-v version] requires 1 or 2.\n", program);
+          return(0);
+        }
+        protocolVersion = val;
+        break;
+
+      /* Byte transport for co-located servers */
+      case 't':
+        transportKind = TransportParse(optarg);
+        if (transportKind == -1) {
+          fprintf(stderr, "[%s] Usage: [-t transport] requires tcp, unix or shm.\n", program);
+          return(0);
+        }
+        break;
+
+      /* How avatars choose their moves */
+      case 'p':
+        strategy = NavigatorParse(optarg);
+        if (strategy == -1) {
+          fprintf(stderr, "[%s] Usage: [-p strategy] requires follow, follow-left, frontier or rendezvous.\n", program);
+          return(0);
+        }
+        break;
+
+      /* Where frames go */
+      case 'r':
+        renderKind = RecordParse(optarg, &renderPath);
+#ifdef AM_NO_WINDOW
+        if (renderKind == RECORD_WINDOW) {
+          fprintf(stderr, "[%s] Usage: [-r render] window needs a client built with GTK (make amazing).\n", program);
+          return(0);
+        }
+#endif
+        if (renderKind == -1) {
+          fprintf(stderr, "[%s] Usage: [-r render] requires window, off, png:DIR or delta:FILE.\n", program);
+          return(0);
+        }
+        break;
+
+      /* Frames a second, at most */
+      case 'f':
+        val = strtol(optarg, &end, 0);
+        if (val < 1 || val > 1000 || strlen(end) != 0) {
+          fprintf(stderr, "[%s] Usage: [-f fps] requires an integer between 1 and 1000.\n", program);
+          return(0);
+        }
+        frameRate = val;
+        break;
+
       default:
-          fprintf(stderr, "[%s] Usage: [-n nAvatars] [-d difficulty] [-h hostname]\n", program);
+          fprintf(stderr, "[%s] Usage: [-n nAvatars] [-d difficulty] [-h hostname] [-e] [-m] [-u] [-v version] [-t transport] [-p strategy] [-k] [-w] [-r render] [-f fps]\n", program);
           return(0);
       }
 
@@ -910,51 +1796,33 @@ int main(int argc, char* argv[]) {
 
   fprintf(stdout, "Arguments successfully passed, attempting to establish connection...\n");
 
-  /* Create socket */
-
-  int sockfd;
-  struct sockaddr_in servAddr;
-
-  if ((sockfd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
-     fprintf(stderr, "[%s] Error: Unable to create socket.\n", program);
-     return(0);
-  }
-
-  bzero((char *) &servAddr, sizeof(servAddr)); // Initialize buffer to 0s
-
-  servAddr.sin_family = AF_INET; // Routine
-
-  printf("Server Port: %d\n", htons(atoi(AM_SERVER_PORT)));
-  servAddr.sin_port = htons(atoi(AM_SERVER_PORT)); // Convert port no. to network byte order
-
-  // Copy address into sockaddr_in struct
-  bcopy((char *)server->h_addr_list[0], (char *)&servAddr.sin_addr.s_addr, server->h_length); // Address
-
+  /* Connect to server; AM_INIT always goes over a plain socket (unix for -t unix/shm) */
 
+  printf("Server Port: %d\n", atoi(AM_SERVER_PORT));
 
-  /* Connect to server */
-
-  if (connect(sockfd, (struct sockaddr *) &servAddr, sizeof(servAddr)) == -1) {
+  if (!TransportConnect(&mgmt, transportKind == TRANSPORT_TCP ? TRANSPORT_TCP : TRANSPORT_UNIX,
+                        server, atoi(AM_SERVER_PORT))) {
      fprintf(stderr, "[%s] Error: Unable to connact to the server.\n", program);
      return(0);
   }
   else {
      fprintf(stdout, "[%s]: Connection to server established.\n", program);
   }
+  int sockfd = mgmt.fd;
 
 
 
   /* Generate AM_INIT message and write to server */
 
-  AM_Message *amInit = calloc(1, sizeof(AM_Message));
+  AM_Message amInit;
+  memset(&amInit, 0, sizeof(amInit));
 
-  amInit->type = htonl(AM_INIT); // Message type (init)
-  amInit->init.nAvatars = htonl(nAvatars); // Number of avatars
-  amInit->init.Difficulty = htonl(difficulty); // Maze difficulty
+  FrameEncodeInit(&amInit, nAvatars, difficulty); // Number of avatars, maze difficulty
+  amInit.init.Version = htonl(protocolVersion);    // MazePort protocol we would like
+  amInit.init.Features = htonl(AM_FEATURE_PATH | (muxMode ? AM_FEATURE_MUX : 0)); // if supported
 
-  if (send(sockfd, amInit, sizeof(AM_Message), 0) == -1) {
+  if (!FrameSend(sockfd, &amInit)) {
     fprintf(stderr, "[%s] Error: Failed to send AM_INIT message to server.\n", program);
-    free(amInit);
     return(0);
   }
 
@@ -964,16 +1832,17 @@ int main(int argc, char* argv[]) {
   AM_Message amInitOk;
   memset(&amInitOk, 0, sizeof(amInitOk));
 
-  int recvResponse = recv(sockfd, &amInitOk, sizeof(AM_Message), 0);
+  FrameReader initReader;
+  FrameReaderInit(&initReader, sockfd);
+
+  int recvResponse = FrameReaderRead(&initReader, &amInitOk);
 
-  if (recvResponse == 0) {
+  if (recvResponse == FRAME_CLOSED) {
     fprintf(stderr, "[%s] Error: No AM_INIT_OK message available from server.\n", program);
-    free(amInit);
     return(0);  
   }
-  if (recvResponse == -1) {
+  if (recvResponse == FRAME_ERROR) {
     fprintf(stderr, "[%s] Error: Failed to receive AM_INIT_OK message from server.\n", program);
-    free(amInit);
     return(0);
   }
 
@@ -985,19 +1854,43 @@ int main(int argc, char* argv[]) {
   mazeWidth = ntohl(amInitOk.init_ok.MazeWidth);
   mazeHeight = ntohl(amInitOk.init_ok.MazeHeight);
 
-  // initializes every maze square
-  for (int x = 0; x < mazeWidth; x++) {
-    for (int y = 0; y < mazeHeight; y++) {
-      maze[x][y].northSide = -1;
-      maze[x][y].eastSide = -1;
-      maze[x][y].southSide = -1;
-      maze[x][y].westSide = -1;
+  // every wall starts unknown
+  navigator = NavigatorNew(mazeWidth, mazeHeight, nAvatars, strategy, pruneMode, thinkAhead);
+  if (navigator == NULL) {
+    fprintf(stderr, "[%s] Error: Unable to allocate navigation for a %dx%d maze.\n", program, mazeWidth, mazeHeight);
+    return(0);
+  }
+  mazeMap = navigator->map;
+  printf("Maze map: %dx%d, %zu bytes\n", mazeWidth, mazeHeight, MazeMapBytes(mazeMap));
+
+  // set before any drawing thread can read it
+  size_multiplier = MAX_WINDOW_SIZE / mazeWidth;
+
+  // one drawing thread for the whole run, however many moves are made
+  int tickMillis = 1000 / frameRate;
+
+  if (renderKind == RECORD_PNG || renderKind == RECORD_DELTA) {
+    recorder = RecorderNew(renderKind, renderPath, mazeMap, nAvatars, size_multiplier, tickMillis);
+    if (recorder == NULL) {
+      fprintf(stderr, "[%s] Error: Unable to record frames to %s.\n", program, renderPath);
+      return(0);
     }
+    drawer = DrawerNew(mazeMap, nAvatars, tickMillis, RecordFrame, recorder);
+  }
+#ifndef AM_NO_WINDOW
+  if (renderKind == RECORD_WINDOW) {
+    drawer = DrawerNew(mazeMap, nAvatars, tickMillis, DrawWindow, &layers);
+  }
+#endif
+  if (renderKind != RECORD_OFF && (drawer == NULL || !DrawerStart(drawer))) {
+    fprintf(stderr, "[%s] Error: Unable to start the drawing thread.\n", program);
+    return(0);
   }
+  atexit(StopDrawingOnce);
 
 
-  fprintf(stdout, "Successfully communicated with server.\n");
-  free(amInit);
+  fprintf(stdout, "Successfully communicated with server (protocol v%d).\n",
+          ntohl(amInitOk.init_ok.Version) == AM_PROTOCOL_V2 ? AM_PROTOCOL_V2 : AM_PROTOCOL_V1);
 
   /* Create logfile for processes */
 
@@ -1015,27 +1908,61 @@ int main(int argc, char* argv[]) {
   time(&dateTime);
   fprintf(logfile, "Username: %s MazePort: %d Timestamp: %s", getenv("USER"), ntohl(amInitOk.init_ok.MazePort), asctime(localtime(&dateTime)));
 
-  close(sockfd);
+  TransportClose(&mgmt);
 
 
 
   /* Create thread for display of window */
 
-  AM_Message *frameMessage = calloc(1, sizeof(AM_Message));
-  frameMessage->type = htonl(AM_INIT_OK);
-  frameMessage->init_ok.MazeWidth = amInitOk.init_ok.MazeWidth;
-  frameMessage->init_ok.MazeHeight = amInitOk.init_ok.MazeHeight;
+#ifndef AM_NO_WINDOW
+  if (renderKind == RECORD_WINDOW) {
+    AM_Message *frameMessage = calloc(1, sizeof(AM_Message));
+    frameMessage->type = htonl(AM_INIT_OK);
+    frameMessage->init_ok.MazeWidth = amInitOk.init_ok.MazeWidth;
+    frameMessage->init_ok.MazeHeight = amInitOk.init_ok.MazeHeight;
+
+    pthread_t frame;
+    int frameFails;
+    frameFails = pthread_create(&frame, NULL, OpenFrame, frameMessage);
+
+    if (frameFails) {
+      fprintf(stderr, "Failed to open graphics frame.\n");
+      exit(0);
+    }
+  }
+#endif
+
+
+
+  /* Drive every avatar from this thread over one shared connection */
+
+  if (muxMode && (ntohl(amInitOk.init_ok.Features) & AM_FEATURE_MUX)) {
+    if (!RunMuxLoop(nAvatars, amInitOk, server)) {
+      fprintf(stderr, "[%s] Error: Unable to start multiplexed loop.\n", program);
+    }
+    return(0);
+  }
+
 
-  pthread_t frame;
-  int frameFails;
-  frameFails = pthread_create(&frame, NULL, OpenFrame, frameMessage);
+  /* Drive every avatar from this thread on io_uring */
 
-  if (frameFails) {
-    fprintf(stderr, "Failed to open graphics frame.\n");
-    exit(0);
+  if (uringMode && transportKind != TRANSPORT_SHM) {
+    if (!RunUringLoop(nAvatars, amInitOk, server)) {
+      fprintf(stderr, "[%s] Error: Unable to start io_uring loop.\n", program);
+    }
+    return(0);
   }
 
 
+  /* Drive every avatar from this thread in event mode (shm rings cannot be polled) */
+
+  if (eventMode && transportKind != TRANSPORT_SHM) {
+    if (!RunEventLoop(nAvatars, amInitOk, server)) {
+      fprintf(stderr, "[%s] Error: Unable to start event loop.\n", program);
+    }
+    return(0);
+  }
+
 
   /* Start avatar threads */
 
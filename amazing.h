@@ -25,6 +25,7 @@
 #define AM_MAX_AVATAR       10               // max # of avatars for any MazePort
 #define AM_MAX_MOVES      1000               // max # of moves for all Avatars
 #define AM_WAIT_TIME       600               // seconds waited before server dies
+#define AM_MAX_PATH         64               // max # of steps in an AM_AVATAR_PATH
 
 /* Avatar constants */
 #define M_WEST           0
@@ -42,6 +43,7 @@
 #define AM_AVATAR_READY           0x00000004
 #define AM_AVATAR_TURN            0x00000008
 #define AM_AVATAR_MOVE            0x00000010
+#define AM_AVATAR_PATH            0x00000800   // needs AM_FEATURE_PATH
 #define AM_INIT_FAILED           (0x00000020 | AM_ERROR_MASK)
 #define AM_AVATAR_OUT_OF_TURN    (0x00000040 | AM_ERROR_MASK)
 #define AM_NO_SUCH_AVATAR        (0x00000080 | AM_ERROR_MASK)
@@ -52,6 +54,19 @@
 #define AM_SERVER_TIMEOUT        (0x02000000 | AM_ERROR_MASK)
 #define AM_UNEXPECTED_MSG_TYPE   (0x04000000 | AM_ERROR_MASK)
 
+/* Wire protocol versions, requested in AM_INIT and chosen in AM_INIT_OK.
+ * AM_INIT/AM_INIT_OK are always v1; the choice applies to the MazePort. A
+ * Version of 0 (older peers leave it zeroed) means AM_PROTOCOL_V1.
+ */
+#define AM_PROTOCOL_V1             1         // fixed sizeof(AM_Message) frames
+#define AM_PROTOCOL_V2             2         // compact length-prefixed frames
+
+/* Optional protocol extensions, requested in AM_INIT Features and granted in
+ * AM_INIT_OK Features. Older peers leave Features zeroed.
+ */
+#define AM_FEATURE_PATH   0x00000001         // AM_AVATAR_PATH move batching
+#define AM_FEATURE_MUX    0x00000002         // many avatars on one MazePort connection
+
 /* AM_INIT failure ErrNums */
 #define AM_INIT_ERROR_MASK       (0x40000000 | AM_ERROR_MASK)
 #define AM_INIT_TOO_MANY_AVATARS (0x00000001 | AM_INIT_ERROR_MASK)
@@ -88,6 +103,8 @@ typedef struct AM_Message
         {
             uint32_t nAvatars;
             uint32_t Difficulty;
+            uint32_t Version;                // highest protocol the client speaks
+            uint32_t Features;               // AM_FEATURE_* wanted
         } init;
 
         /* AM_INIT_OK */
@@ -96,6 +113,8 @@ typedef struct AM_Message
             uint32_t MazePort;
             uint32_t MazeWidth;
             uint32_t MazeHeight;
+            uint32_t Version;                // protocol to use on the MazePort
+            uint32_t Features;               // AM_FEATURE_* granted
         } init_ok;
 
         /* AM_INIT_FAILED */
@@ -124,6 +143,15 @@ typedef struct AM_Message
             uint32_t Direction;
         } avatar_move;
 
+        /* AM_AVATAR_PATH: up to AM_MAX_PATH directions, played one per
+         * turn by the server until a step fails or the maze is solved */
+        struct
+        {
+            uint32_t AvatarId;
+            uint32_t nSteps;
+            uint8_t  Directions[AM_MAX_PATH];
+        } avatar_path;
+
         /* AM_MAZE_SOLVED */
         struct
         {
@@ -0,0 +1,1722 @@
+/* ========================================================================== */
+/* File: ambench.c
+ *
+ * Author: Troy Palmer and Sean Cann
+ * Date: 6.4.2015
+ *
+ * Overview: Micro-benchmarks for the client's message and maze code. Each
+ * benchmark is a subcommand and prints a small table to stdout.
+ *
+ * Usage: ambench <benchmark>
+ *
+ * 1. alloc: heap allocations made by the AM_AVATAR_MOVE send path, per move
+ *    and in total, as moves per session and concurrent sessions grow. The
+ *    old calloc-per-move path is run alongside for comparison.
+ *
+ * 2. transport: per-turn round trip over each Transport backend (tcp, unix,
+ *    shm). An echo thread answers every 4 byte v2 move with an 8 byte v2
+ *    delta turn, which is the steady-state exchange of a multiplexed client.
+ *
+ * 3. uring: client-side system calls per session-turn and p50/p99 turn
+ *    latency for the epoll loop and the io_uring loop (multishot recv,
+ *    batched sends) as the number of concurrent sessions grows. The main
+ *    thread plays the server: it sends a turn to every session and waits
+ *    for a move back from each.
+ *
+ * 4. replan: cost of replanning every move as the maze grows. REPLAN_AVATARS
+ *    avatars head for the centre of a generated maze, assuming any edge not
+ *    known to be a wall is open and finding out the four sides of each
+ *    square they stand on. Every move is planned again, once with a fresh
+ *    breadth-first search and once with the incremental PathEngine.
+ *
+ * 5. regions: "is avatar i joined to avatar 0 by known passages?" while
+ *    the open edges of a generated maze are learned in the order
+ *    REGION_SEEDS avatars exploring breadth-first would find them, answered
+ *    by the map's union-find and by a breadth-first search; then the rate
+ *    at which 1 to REGION_MAX_THREADS threads can merge those edges.
+ *
+ * 6. flood: distances from FLOOD_SOURCES squares to every square, as the
+ *    planners want them from every avatar, on mazes from 100x100 to
+ *    1000x1000 that are unknown, half known and fully known. One
+ *    breadth-first search per source is timed against one bit-parallel
+ *    flood of them all (amflood.c), and the distances are checked against
+ *    each other.
+ *
+ * 7. draw: what a move costs the avatar that makes it when the window is
+ *    redrawn after every move, on DRAW_AVATARS threads moving every
+ *    DRAW_PAUSE_MICROS on known 40x40 and 100x100 maps. The old way starts
+ *    a thread per move to draw; the new one pushes the move on the drawing
+ *    thread's queue (amdraw.c), which draws at most once a tick. Drawing
+ *    here is reading every wall of the map, as the window does, without
+ *    cairo.
+ *
+ * 8. record: what a recorded frame (amrecord.c) costs the drawing thread,
+ *    in time and bytes, as PNG and as deltas, on fully known 40x40 and
+ *    100x100 maps: a full frame, then frames of RECORD_MOVES moves each.
+ *    The PNG's walls are checked for a closed border, drawn both in one
+ *    full frame and learned edge by edge. The frames go in a directory
+ *    under /tmp that is removed at the end, unless "record keep" is given.
+ *
+ * 9. frames: every v2 frame code (amframe.h) one byte shorter than its
+ *    code needs, followed by a good FRAME_V2_READY. Each has to decode as
+ *    AM_UNKNOWN_MSG_TYPE without touching the codec's positions, and the
+ *    ready frame after it has to come through whole. Exits 1 if not.
+ *
+ */
+/* ========================================================================== */
+
+// ---------------- System includes
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+// ---------------- Local includes
+
+#include "amazing.h"
+#include "amdraw.h"
+#include "amframe.h"
+#include "amrecord.h"
+#include "amtransport.h"
+#include "amuring.h"
+#include "amflood.h"
+#include "ampath.h"
+#include "mazegen.h"
+#include "mazemap.h"
+
+// ---------------- Constant definitions
+
+#define TRANSPORT_ROUNDS 50000               // timed round trips per backend
+#define TRANSPORT_WARMUP  1000
+#define TURN_ROUNDS        2000              // turns per session count in 'uring'
+#define TURN_MAX_SESSIONS   256
+#define REPLAN_AVATARS       10
+#define REPLAN_MAX_MOVES   1000              // moves per maze size in 'replan'
+#define REGION_QUERY_EVERY   64              // edges learned between union-find queries
+#define REGION_SEARCH_EVERY 4096             // edges learned between timed searches
+#define REGION_MAX_THREADS     8
+#define REGION_SEEDS          10             // avatars whose regions grow in 'regions'
+#define FLOOD_SOURCES AM_MAX_AVATAR          // distance fields at once in 'flood'
+#define FLOOD_SQUARES   20000000             // source-squares timed per maze and method
+#define DRAW_AVATARS          10
+#define DRAW_MOVES          2000             // moves per avatar in 'draw'
+#define DRAW_PAUSE_MICROS    100             // between one avatar's moves, for the turns
+#define RECORD_FRAMES        200             // frames timed per maze and format in 'record'
+#define RECORD_MOVES           4             // avatars moving each frame
+#define FRAME_READY_ID         7             // avatar in the ready frame after each short one
+
+// ---------------- Structures/Types
+
+/* One simulated avatar session: a socket pair and its outgoing buffer */
+typedef struct BenchSession {
+  int fds[2];
+  AM_Message outbox;
+} BenchSession;
+
+/* Client end of the 'uring' benchmark: nSessions sockets, one loop */
+typedef struct TurnClient {
+  int nSessions;
+  int useUring;
+  int fds[TURN_MAX_SESSIONS];
+  int pending[TURN_MAX_SESSIONS];            // bytes of a turn frame received so far
+  unsigned long syscalls;
+} TurnClient;
+
+/* Breadth-first scratch for the fresh searches in 'replan' */
+typedef struct FreshSearch {
+  int *distance;
+  uint32_t *seen;
+  uint32_t stamp;
+  int *queue;
+  unsigned long visited;
+} FreshSearch;
+
+/* One thread's share of the edges in the concurrent part of 'regions' */
+typedef struct RegionFeed {
+  Regions *regions;
+  const uint32_t *edges;                     // pairs of squares
+  int first, last;
+} RegionFeed;
+
+/* One avatar thread of 'draw' */
+typedef struct DrawMover {
+  int avatarId;
+  int spawn;                                 // 1 for a thread per move, 0 for the drawer
+  Drawer *drawer;
+  const MazeMap *map;
+  double *nanos;                             // DRAW_MOVES samples
+} DrawMover;
+
+/* Server end of a transport benchmark */
+typedef struct EchoServer {
+  int kind;
+  int listenfd;
+  ShmHub hub;
+} EchoServer;
+
+// ---------------- Private variables
+
+/* Heap traffic seen by the malloc family since the last reset */
+static long allocCount = 0;
+static long allocBytes = 0;
+
+/* Drawing threads alive and the most seen at once, in 'draw' */
+static _Atomic int drawLive = 0;
+static _Atomic int drawPeak = 0;
+
+// ---------------- Private prototypes
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+int BenchAlloc(void);
+
+int BenchTransport(void);
+
+int BenchUring(void);
+
+int BenchReplan(void);
+
+int BenchRegions(void);
+
+int BenchFlood(void);
+
+int BenchDraw(void);
+
+/* ========================================================================== */
+
+
+/*
+ *
+ * malloc, calloc, realloc - glibc interposers that count every allocation
+ *
+ */
+void *malloc(size_t size) {
+  allocCount++;
+  allocBytes += size;
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+  allocCount++;
+  allocBytes += count * size;
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  allocCount++;
+  allocBytes += size;
+  return __libc_realloc(ptr, size);
+}
+
+
+/*
+ *
+ * DrainSession - discards whatever has queued up on the receiving end
+ *
+ */
+static void DrainSession(BenchSession *session) {
+
+  char sink[4096];
+  while (recv(session->fds[1], sink, sizeof(sink), MSG_DONTWAIT) > 0) {
+    continue;
+  }
+}
+
+
+/*
+ *
+ * BenchAlloc - counts allocations for nSessions x nMoves moves on both the
+ *   old calloc-per-move path and the in-place FrameEncodeMove/FrameSend path
+ *
+ * Returns 0 on success
+ *
+ */
+int BenchAlloc(void) {
+
+  int sessionCounts[] = { 1, 10, 100 };
+  int moveCounts[] = { AM_MAX_MOVES, AM_MAX_MOVES * 10 };
+
+  printf("%-9s %9s %9s %12s %12s %14s\n", "path", "sessions", "moves", "allocs", "allocs/move", "bytes");
+
+  for (int s = 0; s < 3; s++) {
+    for (int m = 0; m < 2; m++) {
+
+      int nSessions = sessionCounts[s];
+      int nMoves = moveCounts[m];
+
+      BenchSession *sessions = calloc(nSessions, sizeof(BenchSession));
+      for (int i = 0; i < nSessions; i++) {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sessions[i].fds) == -1) {
+          perror("socketpair");
+          return(1);
+        }
+      }
+
+      for (int inPlace = 0; inPlace <= 1; inPlace++) {
+
+        allocCount = allocBytes = 0;
+
+        for (int move = 0; move < nMoves; move++) {
+          for (int i = 0; i < nSessions; i++) {
+
+            if (inPlace) {
+              FrameEncodeMove(&sessions[i].outbox, i % AM_MAX_AVATAR, move % M_NUM_DIRECTIONS);
+              FrameSend(sessions[i].fds[0], &sessions[i].outbox);
+            }
+            else {
+              /* What SendMoveMessage used to do: calloc, send, never free */
+              AM_Message *amAvatarMove = calloc(1, sizeof(AM_Message));
+              amAvatarMove->type = AM_AVATAR_MOVE;
+              amAvatarMove->avatar_move.AvatarId = i % AM_MAX_AVATAR;
+              amAvatarMove->avatar_move.Direction = move % M_NUM_DIRECTIONS;
+              send(sessions[i].fds[0], amAvatarMove, sizeof(AM_Message), 0);
+            }
+
+            if (move % 64 == 63) {
+              DrainSession(&sessions[i]);
+            }
+          }
+        }
+
+        long count = allocCount, bytes = allocBytes;
+        long total = (long) nMoves * nSessions;
+
+        printf("%-9s %9d %9d %12ld %12.3f %14ld\n", inPlace ? "in-place" : "calloc",
+               nSessions, nMoves, count, (double) count / total, bytes);
+
+        for (int i = 0; i < nSessions; i++) {
+          DrainSession(&sessions[i]);
+        }
+      }
+
+      for (int i = 0; i < nSessions; i++) {
+        close(sessions[i].fds[0]);
+        close(sessions[i].fds[1]);
+      }
+      free(sessions);
+    }
+  }
+
+  return(0);
+}
+
+
+/*
+ *
+ * RunEcho - echo thread: accepts one connection and answers every move
+ *   frame with a delta turn frame until the client closes
+ *
+ */
+static void *RunEcho(void *data) {
+
+  EchoServer *echo = data;
+  Transport transport;
+  unsigned char move[4];
+  unsigned char turn[8] = { 8, FRAME_V2_TURN_DELTA, 0, 0, 0, 1, 0, 2 };
+
+  if (!TransportAccept(&transport, echo->listenfd, echo->kind == TRANSPORT_TCP ? TRANSPORT_TCP : TRANSPORT_UNIX,
+                       &echo->hub)) {
+    return NULL;
+  }
+
+  for (;;) {
+    size_t have = 0;
+    while (have < sizeof(move)) {
+      ssize_t n = TransportRecv(&transport, move + have, sizeof(move) - have);
+      if (n <= 0) {
+        TransportClose(&transport);
+        return NULL;
+      }
+      have += n;
+    }
+    turn[3] = move[2];
+    TransportSendAll(&transport, turn, sizeof(turn));
+  }
+}
+
+
+/*
+ *
+ * CompareDouble - qsort order for latency samples
+ *
+ */
+static int CompareDouble(const void *a, const void *b) {
+
+  double x = *(const double *) a, y = *(const double *) b;
+  return (x > y) - (x < y);
+}
+
+
+/*
+ *
+ * BenchTransport - times TRANSPORT_ROUNDS move/turn round trips over each
+ *   backend and prints mean, median and tail latency
+ *
+ * Returns 0 on success
+ *
+ */
+int BenchTransport(void) {
+
+  struct hostent *server = gethostbyname("localhost");
+  double *samples = calloc(TRANSPORT_ROUNDS, sizeof(double));
+  int kinds[] = { TRANSPORT_TCP, TRANSPORT_UNIX, TRANSPORT_SHM };
+
+  if (server == NULL || samples == NULL) {
+    fprintf(stderr, "Error: Unable to set up transport benchmark.\n");
+    return(1);
+  }
+
+  printf("%-6s %9s %10s %10s %10s %10s %12s\n", "kind", "rounds", "mean us", "p50 us", "p99 us", "max us", "turns/s");
+
+  for (int k = 0; k < 3; k++) {
+
+    EchoServer echo;
+    memset(&echo, 0, sizeof(echo));
+    echo.kind = kinds[k];
+    echo.hub.memfd = -1;
+
+    /* The unix path is keyed by port, so borrow a free TCP port number */
+    int port;
+    int tcpfd = TransportListen(TRANSPORT_TCP, 0, &port);
+    echo.listenfd = kinds[k] == TRANSPORT_TCP ? tcpfd : TransportListen(TRANSPORT_UNIX, port, NULL);
+
+    pthread_t thread;
+    Transport client;
+    if (echo.listenfd == -1 || pthread_create(&thread, NULL, RunEcho, &echo) != 0 ||
+        !TransportConnect(&client, kinds[k], server, port)) {
+      fprintf(stderr, "Error: Unable to connect over %s.\n", TransportName(kinds[k]));
+      return(1);
+    }
+
+    unsigned char move[4] = { 4, FRAME_V2_MOVE, 0, 0 };
+    unsigned char turn[8];
+    struct timespec start, end, first;
+
+    for (int round = -TRANSPORT_WARMUP; round < TRANSPORT_ROUNDS; round++) {
+
+      if (round == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &first);
+      }
+      clock_gettime(CLOCK_MONOTONIC, &start);
+
+      move[3] = round & 3;
+      TransportSendAll(&client, move, sizeof(move));
+      for (size_t have = 0; have < sizeof(turn); ) {
+        ssize_t n = TransportRecv(&client, turn + have, sizeof(turn) - have);
+        if (n <= 0) {
+          fprintf(stderr, "Error: %s echo closed early.\n", TransportName(kinds[k]));
+          return(1);
+        }
+        have += n;
+      }
+
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      if (round >= 0) {
+        samples[round] = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+      }
+    }
+
+    double seconds = (end.tv_sec - first.tv_sec) + (end.tv_nsec - first.tv_nsec) / 1e9;
+    double sum = 0;
+    for (int i = 0; i < TRANSPORT_ROUNDS; i++) {
+      sum += samples[i];
+    }
+    qsort(samples, TRANSPORT_ROUNDS, sizeof(double), CompareDouble);
+
+    printf("%-6s %9d %10.2f %10.2f %10.2f %10.2f %12.0f\n", TransportName(kinds[k]), TRANSPORT_ROUNDS,
+           sum / TRANSPORT_ROUNDS, samples[TRANSPORT_ROUNDS / 2], samples[TRANSPORT_ROUNDS * 99 / 100],
+           samples[TRANSPORT_ROUNDS - 1], TRANSPORT_ROUNDS / seconds);
+
+    TransportClose(&client);
+    pthread_join(thread, NULL);
+    ShmHubClose(&echo.hub);
+    close(tcpfd);
+    if (kinds[k] != TRANSPORT_TCP) {
+      char path[108];
+      TransportSocketPath(path, sizeof(path), port);
+      close(echo.listenfd);
+      unlink(path);
+    }
+  }
+
+  free(samples);
+  return(0);
+}
+
+
+/*
+ *
+ * RunTurnClient - answers every 8 byte turn on every session with a 4 byte
+ *   move, on epoll (recv/send per message) or io_uring (multishot recv and
+ *   one io_uring_enter per pass), counting the system calls it makes
+ *
+ */
+static void *RunTurnClient(void *data) {
+
+  TurnClient *client = data;
+  static const unsigned char move[4] = { 4, FRAME_V2_MOVE, 0, 0 };
+  int nOpen = client->nSessions;
+
+  if (client->useUring) {
+
+    Uring ring;
+    if (!UringInit(&ring)) {
+      return NULL;
+    }
+    for (int i = 0; i < client->nSessions; i++) {
+      UringRecvMultishot(&ring, client->fds[i], (uint64_t) i << 1);
+    }
+
+    while (nOpen > 0 && UringSubmit(&ring, 1) != -1) {
+      UringCompletion completion;
+      while (UringNext(&ring, &completion)) {
+        int i = completion.userData >> 1;
+        if (completion.userData & 1) {
+          continue;
+        }
+        if (completion.res == -ENOBUFS || (completion.res > 0 && !completion.more)) {
+          UringRecvMultishot(&ring, client->fds[i], completion.userData);
+        }
+        if (completion.res <= 0) {
+          nOpen -= completion.res != -ENOBUFS;
+          continue;
+        }
+        UringRecycle(&ring, completion.bufferId);
+        for (client->pending[i] += completion.res; client->pending[i] >= 8; client->pending[i] -= 8) {
+          UringSend(&ring, client->fds[i], move, sizeof(move), ((uint64_t) i << 1) | 1);
+        }
+      }
+    }
+
+    client->syscalls = ring.enterCalls;
+    UringClose(&ring);
+    return NULL;
+  }
+
+  int epfd = epoll_create1(0);
+  struct epoll_event events[TURN_MAX_SESSIONS];
+
+  for (int i = 0; i < client->nSessions; i++) {
+    struct epoll_event event = { EPOLLIN, { .u32 = i } };
+    epoll_ctl(epfd, EPOLL_CTL_ADD, client->fds[i], &event);
+  }
+
+  while (nOpen > 0) {
+    int nEvents = epoll_wait(epfd, events, TURN_MAX_SESSIONS, -1);
+    client->syscalls++;
+
+    for (int e = 0; e < nEvents; e++) {
+      int i = events[e].data.u32;
+      unsigned char buffer[URING_BUFFER_BYTES];
+      ssize_t n = recv(client->fds[i], buffer, sizeof(buffer), 0);
+      client->syscalls++;
+
+      if (n <= 0) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, client->fds[i], NULL);
+        nOpen--;
+        continue;
+      }
+      for (client->pending[i] += n; client->pending[i] >= 8; client->pending[i] -= 8) {
+        send(client->fds[i], move, sizeof(move), MSG_NOSIGNAL);
+        client->syscalls++;
+      }
+    }
+  }
+
+  close(epfd);
+  return NULL;
+}
+
+
+/*
+ *
+ * BenchUring - epoll vs io_uring client loops for 1 to TURN_MAX_SESSIONS
+ *   sessions, TURN_ROUNDS turns each
+ *
+ * Returns 0 on success
+ *
+ */
+int BenchUring(void) {
+
+  int sessionCounts[] = { 1, 8, 64, TURN_MAX_SESSIONS };
+  double *samples = calloc(TURN_ROUNDS, sizeof(double));
+  Uring probe;
+  int haveUring = UringInit(&probe);
+
+  if (haveUring) {
+    UringClose(&probe);
+  }
+  else {
+    printf("io_uring unavailable, epoll only\n");
+  }
+
+  printf("%-7s %9s %9s %16s %10s %10s\n", "loop", "sessions", "turns", "syscalls/turn", "p50 us", "p99 us");
+
+  for (int s = 0; s < 4; s++) {
+    for (int useUring = 0; useUring <= haveUring; useUring++) {
+
+      TurnClient client;
+      int serverFds[TURN_MAX_SESSIONS];
+      memset(&client, 0, sizeof(client));
+      client.nSessions = sessionCounts[s];
+      client.useUring = useUring;
+
+      for (int i = 0; i < client.nSessions; i++) {
+        int pair[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == -1) {
+          perror("socketpair");
+          return(1);
+        }
+        serverFds[i] = pair[0];
+        client.fds[i] = pair[1];
+      }
+
+      pthread_t thread;
+      pthread_create(&thread, NULL, RunTurnClient, &client);
+
+      unsigned char turn[8] = { 8, FRAME_V2_TURN_DELTA, 0, 0, 0, 1, 0, 2 };
+      unsigned char move[4];
+
+      for (int round = 0; round < TURN_ROUNDS; round++) {
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        for (int i = 0; i < client.nSessions; i++) {
+          send(serverFds[i], turn, sizeof(turn), MSG_NOSIGNAL);
+        }
+        for (int i = 0; i < client.nSessions; i++) {
+          recv(serverFds[i], move, sizeof(move), MSG_WAITALL);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        samples[round] = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+      }
+
+      for (int i = 0; i < client.nSessions; i++) {
+        close(serverFds[i]);
+      }
+      pthread_join(thread, NULL);
+      for (int i = 0; i < client.nSessions; i++) {
+        close(client.fds[i]);
+      }
+
+      qsort(samples, TURN_ROUNDS, sizeof(double), CompareDouble);
+      printf("%-7s %9d %9d %16.3f %10.1f %10.1f\n", useUring ? "uring" : "epoll", client.nSessions,
+             TURN_ROUNDS, (double) client.syscalls / ((double) TURN_ROUNDS * client.nSessions),
+             samples[TURN_ROUNDS / 2], samples[TURN_ROUNDS * 99 / 100]);
+    }
+  }
+
+  free(samples);
+  return(0);
+}
+
+
+/*
+ *
+ * FreshStep - plans one move from scratch: breadth-first from the root over
+ *   every edge not known to be a wall until (x,y) is reached
+ *
+ * Returns the first M_* direction of a shortest path, M_NULL_MOVE if none
+ *
+ */
+static int FreshStep(FreshSearch *search, const MazeMap *map, int root, int x, int y) {
+
+  int width = map->width, target = y * width + x;
+  int head = 0, tail = 0;
+
+  if (++search->stamp == 0) {
+    memset(search->seen, 0, (size_t) width * map->height * sizeof(uint32_t));
+    search->stamp = 1;
+  }
+
+  search->queue[tail++] = root;
+  search->seen[root] = search->stamp;
+  search->distance[root] = 0;
+
+  while (head < tail && search->seen[target] != search->stamp) {
+
+    int square = search->queue[head++];
+    int sx = square % width, sy = square / width;
+    search->visited++;
+
+    for (int direction = 0; direction < 4; direction++) {
+      int dx, dy;
+      MazeStep(direction, &dx, &dy);
+      int nx = sx + dx, ny = sy + dy, neighbour = ny * width + nx;
+
+      if (nx >= 0 && ny >= 0 && nx < width && ny < map->height &&
+          MazeMapGet(map, sx, sy, direction) != MAP_BLOCKED && search->seen[neighbour] != search->stamp) {
+        search->seen[neighbour] = search->stamp;
+        search->distance[neighbour] = search->distance[square] + 1;
+        search->queue[tail++] = neighbour;
+      }
+    }
+  }
+
+  if (search->seen[target] != search->stamp || target == root) {
+    return(M_NULL_MOVE);
+  }
+
+  for (int direction = 0; direction < 4; direction++) {
+    int dx, dy;
+    MazeStep(direction, &dx, &dy);
+    int nx = x + dx, ny = y + dy, neighbour = ny * width + nx;
+
+    if (nx >= 0 && ny >= 0 && nx < width && ny < map->height && MazeMapGet(map, x, y, direction) != MAP_BLOCKED &&
+        search->seen[neighbour] == search->stamp && search->distance[neighbour] == search->distance[target] - 1) {
+      return(direction);
+    }
+  }
+  return(M_NULL_MOVE);
+}
+
+
+/*
+ *
+ * RunReplan - walks the avatars to the centre of maze, planning every move
+ *   with a fresh search (incremental 0) or a PathEngine (incremental 1)
+ *
+ * Returns the number of moves made; the time taken and the squares the
+ * searches looked at go in seconds and work
+ *
+ */
+static long RunReplan(const Maze *maze, int incremental, double *seconds, unsigned long *work) {
+
+  int width = maze->width, height = maze->height;
+  int root = (height / 2) * width + width / 2;
+  int x[REPLAN_AVATARS], y[REPLAN_AVATARS];
+  long nMoves = 0;
+
+  MazeMap *map = MazeMapNew(width, height);
+  PathEngine *engine = incremental ? PathEngineNew(map, PATH_OPTIMISTIC) : NULL;
+  FreshSearch search = { calloc(width * height, sizeof(int)), calloc(width * height, sizeof(uint32_t)), 0,
+                         calloc(width * height, sizeof(int)), 0 };
+  MazeRng rng = { maze->seed };
+
+  for (int i = 0; i < REPLAN_AVATARS; i++) {
+    x[i] = MazeRngRange(&rng, width);
+    y[i] = MazeRngRange(&rng, height);
+  }
+  if (engine != NULL) {
+    PathEngineRoot(engine, root % width, root / width);
+  }
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for (int arrived = 0; arrived < REPLAN_AVATARS && nMoves < REPLAN_MAX_MOVES; ) {
+
+    arrived = 0;
+
+    for (int i = 0; i < REPLAN_AVATARS && nMoves < REPLAN_MAX_MOVES; i++) {
+
+      if (y[i] * width + x[i] == root) {
+        arrived++;
+        continue;
+      }
+
+      for (int direction = 0; direction < 4; direction++) {
+        MazeMapSet(map, x[i], y[i], direction, MazeIsOpen(maze, x[i], y[i], direction) ? MAP_OPEN : MAP_BLOCKED);
+      }
+
+      int direction = incremental ? PathEngineNextStep(engine, x[i], y[i]) : FreshStep(&search, map, root, x[i], y[i]);
+      int dx, dy;
+
+      MazeStep(direction, &dx, &dy);
+      x[i] += dx;
+      y[i] += dy;
+      nMoves++;
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  *seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  *work = incremental ? engine->expanded : search.visited;
+
+  PathEngineFree(engine);
+  free(search.distance);
+  free(search.seen);
+  free(search.queue);
+  MazeMapFree(map);
+  return(nMoves);
+}
+
+
+/*
+ *
+ * BenchReplan - fresh vs incremental replanning on square mazes from 50 to
+ *   1000 squares a side
+ *
+ * Returns 0 on success, 1 if a maze could not be generated or the fresh and
+ * incremental walks differed
+ *
+ */
+int BenchReplan(void) {
+
+  int sizes[] = { 50, 100, 200, 400, 1000 };
+  int failed = 0;
+
+  printf("%-9s %7s %16s %16s %14s %14s %9s\n", "maze", "moves", "fresh us/move", "incr us/move",
+         "fresh sq/move", "incr sq/move", "speedup");
+
+  for (int s = 0; s < 5; s++) {
+
+    Maze *maze = MazeGenerate(sizes[s], sizes[s], 1);
+    double seconds[2];
+    unsigned long work[2];
+    long nMoves[2];
+
+    if (maze == NULL) {
+      fprintf(stderr, "Unable to generate a %dx%d maze\n", sizes[s], sizes[s]);
+      return(1);
+    }
+
+    for (int incremental = 0; incremental <= 1; incremental++) {
+      nMoves[incremental] = RunReplan(maze, incremental, &seconds[incremental], &work[incremental]);
+    }
+
+    if (nMoves[0] != nMoves[1]) {
+      fprintf(stderr, "%dx%d: fresh and incremental walks differ (%ld vs %ld moves)\n", sizes[s], sizes[s],
+              nMoves[0], nMoves[1]);
+      failed = 1;
+    }
+
+    char label[16];
+    snprintf(label, sizeof(label), "%dx%d", sizes[s], sizes[s]);
+    printf("%-9s %7ld %16.2f %16.2f %14.1f %14.1f %8.1fx\n", label, nMoves[1], seconds[0] * 1e6 / nMoves[0],
+           seconds[1] * 1e6 / nMoves[1], (double) work[0] / nMoves[0], (double) work[1] / nMoves[1],
+           seconds[0] / seconds[1]);
+
+    MazeFree(maze);
+  }
+  return(failed);
+}
+
+
+/*
+ *
+ * SearchJoined - the search CheckConnected used to need: breadth-first from
+ *   a over known open edges until b turns up
+ *
+ */
+static int SearchJoined(FreshSearch *search, const MazeMap *map, int a, int b) {
+
+  int width = map->width, head = 0, tail = 0;
+
+  if (++search->stamp == 0) {
+    memset(search->seen, 0, (size_t) width * map->height * sizeof(uint32_t));
+    search->stamp = 1;
+  }
+
+  search->queue[tail++] = a;
+  search->seen[a] = search->stamp;
+
+  while (head < tail) {
+
+    int square = search->queue[head++];
+    int x = square % width, y = square / width;
+
+    if (square == b) {
+      return(1);
+    }
+
+    for (int direction = 0; direction < 4; direction++) {
+      int dx, dy;
+      MazeStep(direction, &dx, &dy);
+      int neighbour = (y + dy) * width + x + dx;
+
+      if (MazeMapGet(map, x, y, direction) == MAP_OPEN && search->seen[neighbour] != search->stamp) {
+        search->seen[neighbour] = search->stamp;
+        search->queue[tail++] = neighbour;
+      }
+    }
+  }
+  return(0);
+}
+
+
+/*
+ *
+ * RunRegionFeed - one thread's unions in the concurrent part of 'regions'
+ *
+ */
+static void *RunRegionFeed(void *data) {
+
+  RegionFeed *feed = data;
+
+  for (int i = feed->first; i < feed->last; i++) {
+    RegionsUnion(feed->regions, feed->edges[2 * i], feed->edges[2 * i + 1]);
+  }
+  return NULL;
+}
+
+
+/*
+ *
+ * BenchRegions - union-find against search for connectivity queries, then
+ *   concurrent merging, on mazes 100 to 1000 squares a side
+ *
+ * Returns 0 on success
+ *
+ */
+int BenchRegions(void) {
+
+  int sizes[] = { 100, 300, 1000 };
+
+  printf("%-9s %9s %14s %12s   %s\n", "maze", "queries", "union-find ns", "search us",
+         "ns per merged edge with 1, 2, 4, 8 threads");
+
+  for (int s = 0; s < 3; s++) {
+
+    int width = sizes[s], nSquares = width * width, nEdges = 0;
+    Maze *maze = MazeGenerate(width, width, 1);
+    uint32_t *edges = calloc(2 * (size_t) nSquares, sizeof(uint32_t));
+    uint8_t *directions = calloc(nSquares, sizeof(uint8_t));
+    MazeRng rng = { 2 };
+
+    if (maze == NULL || edges == NULL || directions == NULL) {
+      fprintf(stderr, "Unable to set up a %dx%d maze\n", width, width);
+      return(1);
+    }
+
+
+    /* Every open edge once, in the order REGION_SEEDS avatars exploring
+     * breadth-first would open them; the edges where their regions meet
+     * come last */
+
+    int seeds[REGION_SEEDS];
+    int *parent = calloc(nSquares, sizeof(int));
+    int *queue = calloc(nSquares, sizeof(int));
+    int head = 0, tail = 0;
+
+    for (int square = 0; square < nSquares; square++) {
+      parent[square] = -1;
+    }
+    for (int i = 0; i < REGION_SEEDS; i++) {
+      seeds[i] = MazeRngRange(&rng, nSquares);
+      if (parent[seeds[i]] == -1) {
+        parent[seeds[i]] = seeds[i];
+        queue[tail++] = seeds[i];
+      }
+    }
+
+    while (head < tail) {
+      int square = queue[head++];
+      for (int direction = 0; direction < 4; direction++) {
+        int dx, dy;
+        MazeStep(direction, &dx, &dy);
+        int neighbour = square + dy * width + dx;
+        if (MazeIsOpen(maze, square % width, square / width, direction) && parent[neighbour] == -1) {
+          parent[neighbour] = square;
+          queue[tail++] = neighbour;
+          edges[2 * nEdges] = square;
+          edges[2 * nEdges + 1] = neighbour;
+          directions[nEdges++] = direction;
+        }
+      }
+    }
+
+    for (int square = 0; square < nSquares; square++) {
+      for (int direction = 0; direction < 4; direction++) {
+        int dx, dy;
+        MazeStep(direction, &dx, &dy);
+        int neighbour = square + dy * width + dx;
+        if ((dx == 1 || dy == 1) && MazeIsOpen(maze, square % width, square / width, direction) &&
+            parent[neighbour] != square && parent[square] != neighbour) {
+          edges[2 * nEdges] = square;
+          edges[2 * nEdges + 1] = neighbour;
+          directions[nEdges++] = direction;
+        }
+      }
+    }
+    free(parent);
+    free(queue);
+
+    /* Learn them one by one, now and then asking whether another avatar is
+     * joined to the first, as CheckConnected asks about avatar 0 */
+
+    MazeMap *map = MazeMapNew(width, width);
+    MazeMapTrackRegions(map);
+    FreshSearch search = { NULL, calloc(nSquares, sizeof(uint32_t)), 0, calloc(nSquares, sizeof(int)), 0 };
+    double findSeconds = 0, searchSeconds = 0;
+    long nQueries = 0, nSearches = 0;
+
+    for (int i = 0; i < nEdges; i++) {
+
+      int square = edges[2 * i];
+      MazeMapSet(map, square % width, square / width, directions[i], MAP_OPEN);
+
+      if (i % REGION_QUERY_EVERY == 0) {
+
+        int a = seeds[0], b = seeds[1 + MazeRngRange(&rng, REGION_SEEDS - 1)];
+        struct timespec start, end;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int joined = MazeMapJoined(map, a % width, a / width, b % width, b / width);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        findSeconds += (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        nQueries++;
+
+        if (i % REGION_SEARCH_EVERY == 0) {
+          clock_gettime(CLOCK_MONOTONIC, &start);
+          if (SearchJoined(&search, map, a, b) != joined) {
+            fprintf(stderr, "%dx%d: union-find and search disagree after %d edges\n", width, width, i + 1);
+          }
+          clock_gettime(CLOCK_MONOTONIC, &end);
+          searchSeconds += (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+          nSearches++;
+        }
+      }
+    }
+
+
+    /* The same unions again on bare regions, split across threads */
+
+    char label[16];
+    snprintf(label, sizeof(label), "%dx%d", width, width);
+    printf("%-9s %9ld %14.1f %12.1f  ", label, nQueries, findSeconds * 1e9 / nQueries,
+           searchSeconds * 1e6 / nSearches);
+
+    for (int nThreads = 1; nThreads <= REGION_MAX_THREADS; nThreads *= 2) {
+
+      Regions *regions = RegionsNew(nSquares);
+      RegionFeed feeds[REGION_MAX_THREADS];
+      pthread_t threads[REGION_MAX_THREADS];
+      struct timespec start, end;
+
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      for (int t = 0; t < nThreads; t++) {
+        feeds[t] = (RegionFeed) { regions, edges, (int) ((long) nEdges * t / nThreads),
+                                  (int) ((long) nEdges * (t + 1) / nThreads) };
+        pthread_create(&threads[t], NULL, RunRegionFeed, &feeds[t]);
+      }
+      for (int t = 0; t < nThreads; t++) {
+        pthread_join(threads[t], NULL);
+      }
+      clock_gettime(CLOCK_MONOTONIC, &end);
+
+      double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+      if (atomic_load(&regions->merges) != (unsigned long) nSquares - 1) {
+        fprintf(stderr, "%dx%d: %d threads made %lu merges, expected %d\n", width, width, nThreads,
+                atomic_load(&regions->merges), nSquares - 1);
+      }
+      printf(" %7.1f", seconds * 1e9 / nEdges);
+      RegionsFree(regions);
+    }
+    printf("\n");
+
+    free(search.seen);
+    free(search.queue);
+    MazeMapFree(map);
+    free(edges);
+    free(directions);
+    MazeFree(maze);
+  }
+  return(0);
+}
+
+
+/*
+ *
+ * SearchDistances - one source's distances the way the planners measure
+ *   them: breadth-first over passable edges, -1 where unreached
+ *
+ */
+static void SearchDistances(FreshSearch *search, const MazeMap *map, int mode, XYPos source, int *distance) {
+
+  int width = map->width, head = 0, tail = 0;
+  int first = source.y * width + source.x;
+
+  for (int square = 0; square < width * map->height; square++) {
+    distance[square] = -1;
+  }
+
+  search->queue[tail++] = first;
+  distance[first] = 0;
+
+  while (head < tail) {
+
+    int square = search->queue[head++];
+    int x = square % width, y = square / width;
+
+    for (int direction = 0; direction < 4; direction++) {
+      int dx, dy;
+      MazeStep(direction, &dx, &dy);
+      int nx = x + dx, ny = y + dy, neighbour = ny * width + nx;
+      int state = MazeMapGet(map, x, y, direction);
+
+      if (nx >= 0 && ny >= 0 && nx < width && ny < map->height &&
+          (state == MAP_OPEN || (mode == FLOOD_OPTIMISTIC && state == MAP_UNKNOWN)) && distance[neighbour] < 0) {
+        distance[neighbour] = distance[square] + 1;
+        search->queue[tail++] = neighbour;
+      }
+    }
+  }
+}
+
+
+/*
+ *
+ * BenchFlood - FLOOD_SOURCES distance fields by breadth-first search and by
+ *   flood, over unknown, half known and known maps of square mazes from 100
+ *   to 1000 squares a side
+ *
+ * Returns 0 on success, 1 if a maze could not be set up or the flood and the
+ * searches disagreed
+ *
+ */
+int BenchFlood(void) {
+
+  int sizes[] = { 100, 200, 400, 1000 };
+  const char *known[] = { "unknown", "half", "known" };
+  int failed = 0;
+
+  printf("%-9s %-8s %7s %14s %14s %9s\n", "maze", "map", "steps", "bfs Mcells/s", "flood Mcells/s", "speedup");
+
+  for (int s = 0; s < 4; s++) {
+
+    int width = sizes[s], nSquares = width * width;
+    Maze *maze = MazeGenerate(width, width, 1);
+    Flood *flood = FloodNew(width, width, FLOOD_SOURCES);
+    int *distance = calloc(nSquares, sizeof(int));
+    FreshSearch search = { NULL, NULL, 0, calloc(nSquares, sizeof(int)), 0 };
+    XYPos sources[FLOOD_SOURCES];
+    MazeRng rng = { 3 };
+
+    if (maze == NULL || flood == NULL || distance == NULL || search.queue == NULL) {
+      fprintf(stderr, "Unable to set up a %dx%d maze\n", width, width);
+      return(1);
+    }
+
+    for (int i = 0; i < FLOOD_SOURCES; i++) {
+      sources[i].x = MazeRngRange(&rng, width);
+      sources[i].y = MazeRngRange(&rng, width);
+    }
+
+    int rounds = 1 + FLOOD_SQUARES / (FLOOD_SOURCES * nSquares);
+
+    for (int k = 0; k < 3; k++) {
+
+
+      /* A map with none, about half or all of the maze's edges known; the
+       * unknown edges count as open */
+
+      MazeMap *map = MazeMapNew(width, width);
+      int mode = k == 2 ? FLOOD_KNOWN : FLOOD_OPTIMISTIC;
+
+      for (int y = 0; y < width && k > 0; y++) {
+        for (int x = 0; x < width; x++) {
+          for (int direction = 0; direction < 4; direction++) {
+            if (k == 2 || MazeRngRange(&rng, 2) == 0) {
+              MazeMapSet(map, x, y, direction, MazeIsOpen(maze, x, y, direction) ? MAP_OPEN : MAP_BLOCKED);
+            }
+          }
+        }
+      }
+
+      double seconds[2] = { 0, 0 };
+      int steps = 0;
+
+      for (int method = 0; method < 2; method++) {
+
+        struct timespec start, end;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int round = 0; round < rounds; round++) {
+          if (method == 0) {
+            for (int i = 0; i < FLOOD_SOURCES; i++) {
+              SearchDistances(&search, map, mode, sources[i], distance);
+            }
+          }
+          else {
+            FloodLoad(flood, map, mode);
+            steps = FloodRun(flood, sources, FLOOD_SOURCES);
+          }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        seconds[method] = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+      }
+
+
+      /* The flood has to agree with the searches, square for square */
+
+      for (int i = 0; i < FLOOD_SOURCES; i++) {
+        SearchDistances(&search, map, mode, sources[i], distance);
+        if (memcmp(distance, &flood->distance[(size_t) i * nSquares], nSquares * sizeof(int)) != 0) {
+          fprintf(stderr, "%dx%d %s: flood and search distances differ from source %d\n", width, width,
+                  known[k], i);
+          failed = 1;
+        }
+      }
+
+      double cells = (double) FLOOD_SOURCES * nSquares * rounds / 1e6;
+      char label[16];
+      snprintf(label, sizeof(label), "%dx%d", width, width);
+
+      printf("%-9s %-8s %7d %14.1f %14.1f %8.1fx\n", label, known[k], steps, cells / seconds[0],
+             cells / seconds[1], seconds[0] / seconds[1]);
+      MazeMapFree(map);
+    }
+
+    free(distance);
+    free(search.queue);
+    FloodFree(flood);
+    MazeFree(maze);
+  }
+  return(failed);
+}
+
+
+
+/*
+ *
+ * ScanWalls - reads every side of every square, as the window's full
+ *   redraw does; returns the walls, so the reads are not optimised away
+ *
+ */
+static long ScanWalls(const MazeMap *map) {
+
+  long walls = 0;
+
+  for (int y = 0; y < map->height; y++) {
+    for (int x = 0; x < map->width; x++) {
+      for (int direction = 0; direction < 4; direction++) {
+        walls += MazeMapGet(map, x, y, direction) == MAP_BLOCKED;
+      }
+    }
+  }
+  return(walls);
+}
+
+
+/*
+ *
+ * SpawnedDraw - the old drawing thread, one per move
+ *
+ */
+static void *SpawnedDraw(void *data) {
+
+  DrawMover *mover = data;
+  int live = atomic_fetch_add(&drawLive, 1) + 1;
+  int peak = atomic_load(&drawPeak);
+
+  while (live > peak && !atomic_compare_exchange_weak(&drawPeak, &peak, live)) {
+    continue;
+  }
+  (void) ScanWalls(mover->map);
+  atomic_fetch_sub(&drawLive, 1);
+  return NULL;
+}
+
+
+/*
+ *
+ * QueuedDraw - the drawing thread's frame
+ *
+ */
+static int QueuedDraw(const DrawFrame *frame, void *context) {
+
+  (void) frame;
+  (void) ScanWalls(context);
+  return(1);
+}
+
+
+/*
+ *
+ * RunMover - one avatar's moves in 'draw', each timed from the move to the
+ *   avatar being free to make the next
+ *
+ */
+static void *RunMover(void *data) {
+
+  DrawMover *mover = data;
+  struct timespec start, end, pause = { 0, DRAW_PAUSE_MICROS * 1000L };
+  pthread_attr_t detached;
+
+  pthread_attr_init(&detached);
+  pthread_attr_setdetachstate(&detached, PTHREAD_CREATE_DETACHED);
+
+  for (int i = 0; i < DRAW_MOVES; i++) {
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (mover->spawn) {
+      pthread_t thread;
+      if (pthread_create(&thread, &detached, SpawnedDraw, mover) != 0) {
+        fprintf(stderr, "Unable to start a drawing thread\n");
+      }
+    }
+    else {
+      DrawerMove(mover->drawer, mover->avatarId, i % mover->map->width, i / mover->map->width);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    mover->nanos[i] = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+    nanosleep(&pause, NULL);
+  }
+
+  pthread_attr_destroy(&detached);
+  return NULL;
+}
+
+
+/*
+ *
+ * BenchDraw - per-move cost to the avatars, drawing threads and frames for
+ *   a thread per move against one drawing thread
+ *
+ * Returns 0 on success, 1 if a maze could not be set up or the drawing
+ * thread's last frame did not have every avatar on its last square
+ *
+ */
+int BenchDraw(void) {
+
+  int sizes[] = { 40, 100 };
+  int nMoves = DRAW_AVATARS * DRAW_MOVES;
+  int failed = 0;
+  double *nanos = calloc(nMoves, sizeof(double));
+
+  if (nanos == NULL) {
+    return(1);
+  }
+
+  printf("%-7s %-8s %9s %12s %12s %9s %8s %9s\n", "maze", "drawing", "moves", "mean ns/move",
+         "p99 ns/move", "threads", "frames", "seconds");
+
+  for (int s = 0; s < 2; s++) {
+
+    int width = sizes[s];
+    Maze *maze = MazeGenerate(width, width, 1);
+    MazeMap *map = MazeMapNew(width, width);
+
+    if (maze == NULL || map == NULL) {
+      fprintf(stderr, "Unable to set up a %dx%d maze\n", width, width);
+      return(1);
+    }
+
+    for (int y = 0; y < width; y++) {
+      for (int x = 0; x < width; x++) {
+        for (int direction = 0; direction < 4; direction++) {
+          MazeMapSet(map, x, y, direction, MazeIsOpen(maze, x, y, direction) ? MAP_OPEN : MAP_BLOCKED);
+        }
+      }
+    }
+
+    for (int spawn = 1; spawn >= 0; spawn--) {
+
+      Drawer *drawer = NULL;
+      DrawMover movers[DRAW_AVATARS];
+      pthread_t threads[DRAW_AVATARS];
+      struct timespec start, end;
+
+      if (!spawn) {
+        drawer = DrawerNew(map, DRAW_AVATARS, DRAW_TICK_MILLIS, QueuedDraw, map);
+        if (drawer == NULL || !DrawerStart(drawer)) {
+          fprintf(stderr, "Unable to start the drawing thread\n");
+          return(1);
+        }
+      }
+      atomic_store(&drawPeak, 0);
+
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      for (int i = 0; i < DRAW_AVATARS; i++) {
+        movers[i] = (DrawMover) { i, spawn, drawer, map, nanos + i * DRAW_MOVES };
+        pthread_create(&threads[i], NULL, RunMover, &movers[i]);
+      }
+      for (int i = 0; i < DRAW_AVATARS; i++) {
+        pthread_join(threads[i], NULL);
+      }
+
+
+      /* Done once the last frame is drawn */
+
+      unsigned long frames = 0;
+      int peak = 1;
+
+      if (spawn) {
+        while (atomic_load(&drawLive) > 0) {
+          sched_yield();
+        }
+        frames = nMoves;
+        peak = atomic_load(&drawPeak);
+      }
+      else {
+        DrawerStop(drawer);
+        frames = drawer->frames;
+        for (int i = 0; i < DRAW_AVATARS; i++) {
+          if (drawer->last[i].x != (DRAW_MOVES - 1) % width || drawer->last[i].y != (DRAW_MOVES - 1) / width) {
+            fprintf(stderr, "%dx%d: avatar %d was last drawn on the wrong square\n", width, width, i);
+            failed = 1;
+          }
+        }
+        DrawerFree(drawer);
+      }
+      clock_gettime(CLOCK_MONOTONIC, &end);
+
+      double total = 0;
+      for (int i = 0; i < nMoves; i++) {
+        total += nanos[i];
+      }
+      qsort(nanos, nMoves, sizeof(double), CompareDouble);
+
+      char label[16];
+      snprintf(label, sizeof(label), "%dx%d", width, width);
+      printf("%-7s %-8s %9d %12.0f %12.0f %9d %8lu %9.2f\n", label, spawn ? "spawn" : "queue", nMoves,
+             total / nMoves, nanos[nMoves * 99 / 100], peak, frames,
+             (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+    }
+
+    MazeMapFree(map);
+    MazeFree(maze);
+  }
+
+  free(nanos);
+  return(failed);
+}
+
+
+/*
+ *
+ * BorderClosed - whether every pixel along the edge of the PNG recorder's
+ *   wall bitmap is black, as it is once the whole maze is known
+ *
+ */
+static int BorderClosed(const Recorder *recorder) {
+
+  for (int y = 0; y < recorder->pixelHeight; y++) {
+    const uint8_t *row = recorder->walls + (size_t) y * recorder->rowBytes + 1;
+    int last = recorder->pixelWidth - 1;
+
+    if ((row[0] & 0x80) || (row[last >> 3] & (0x80 >> (last & 7)))) {
+      return(0);
+    }
+    for (int x = 0; (y == 0 || y == recorder->pixelHeight - 1) && x < recorder->pixelWidth; x++) {
+      if (row[x >> 3] & (0x80 >> (x & 7))) {
+        return(0);
+      }
+    }
+  }
+  return(1);
+}
+
+
+/*
+ *
+ * RecordMazes - time and bytes per recorded frame for each format, and the
+ *   PNG border check, with the frames written under dir
+ *
+ * Pseudocode: for each maze size, learn the whole maze into a tracked map,
+ * as a run that explored it all would have. For each format, record one
+ * full frame, then RECORD_FRAMES frames in which RECORD_MOVES avatars each
+ * step to a neighbouring square, and time them. For PNG, also record the
+ * maze into a second recorder whose map is learned after its first frame,
+ * so every wall goes through the incremental path, and check both borders.
+ *
+ * Returns 0 on success, 1 if a maze or recorder could not be set up, a
+ * border had gaps or a write failed
+ *
+ */
+static int RecordMazes(const char *dir) {
+
+  int sizes[] = { 40, 100 };
+  const char *formats[] = { "png", "delta" };
+  int failed = 0;
+
+  printf("%-7s %-6s %7s %13s %13s %12s\n", "maze", "format", "frames", "full us", "us/frame", "bytes/frame");
+
+  for (int s = 0; s < 2; s++) {
+
+    int width = sizes[s], scale = 800 / width;
+    Maze *maze = MazeGenerate(width, width, 1);
+    MazeMap *map = MazeMapNew(width, width), *learning = MazeMapNew(width, width);
+
+    if (maze == NULL || map == NULL || learning == NULL || !MazeMapTrack(map) || !MazeMapTrack(learning)) {
+      fprintf(stderr, "Unable to set up a %dx%d maze\n", width, width);
+      return(1);
+    }
+
+    for (int y = 0; y < width; y++) {
+      for (int x = 0; x < width; x++) {
+        for (int direction = 0; direction < 4; direction++) {
+          MazeMapSet(map, x, y, direction, MazeIsOpen(maze, x, y, direction) ? MAP_OPEN : MAP_BLOCKED);
+        }
+      }
+    }
+
+    for (int f = 0; f < 2; f++) {
+
+      char path[64];
+      snprintf(path, sizeof(path), "%s/%s-%d", dir, formats[f], width);
+
+      Recorder *recorder = RecorderNew(f == 0 ? RECORD_PNG : RECORD_DELTA, path, map, RECORD_MOVES, scale,
+                                       DRAW_TICK_MILLIS);
+      if (recorder == NULL) {
+        fprintf(stderr, "Unable to record to %s\n", path);
+        return(1);
+      }
+
+      XYPos pos[AM_MAX_AVATAR], last[AM_MAX_AVATAR];
+      long *edges = malloc(2 * map->nWords * 32 * sizeof(long));
+      size_t nEdges = MazeMapChanges(map, 0, edges, 2 * map->nWords * 32);
+      DrawFrame frame = { width, width, RECORD_MOVES, pos, last, edges, nEdges, 1, 0 };
+      struct timespec start, end;
+
+      for (int i = 0; i < RECORD_MOVES; i++) {
+        pos[i].x = i * width / RECORD_MOVES;
+        pos[i].y = 0;
+        last[i] = pos[i];
+      }
+
+
+      /* One full frame, then frames of moves and no new edges */
+
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      RecordFrame(&frame, recorder);
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      double full = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+      unsigned long long fullBytes = recorder->bytes;
+
+      if (f == 0 && !BorderClosed(recorder)) {
+        fprintf(stderr, "%dx%d: the full PNG frame's outer border has gaps\n", width, width);
+        failed = 1;
+      }
+
+      frame.full = 0;
+      frame.nEdges = 0;
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      for (int k = 1; k <= RECORD_FRAMES; k++) {
+        memcpy(last, pos, sizeof(XYPos) * RECORD_MOVES);
+        for (int i = 0; i < RECORD_MOVES; i++) {
+          pos[i].y = k % width;
+        }
+        frame.number = k;
+        RecordFrame(&frame, recorder);
+      }
+      clock_gettime(CLOCK_MONOTONIC, &end);
+
+      if (recorder->failed) {
+        fprintf(stderr, "%dx%d %s: a write failed\n", width, width, formats[f]);
+        failed = 1;
+      }
+
+      char label[16];
+      snprintf(label, sizeof(label), "%dx%d", width, width);
+      printf("%-7s %-6s %7d %13.0f %13.1f %12.0f\n", label, formats[f], RECORD_FRAMES, full,
+             ((end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3) / RECORD_FRAMES,
+             (double) (recorder->bytes - fullBytes) / RECORD_FRAMES);
+      RecorderFree(recorder);
+
+
+      /* Every wall learned after the first frame instead */
+
+      if (f == 0) {
+        snprintf(path, sizeof(path), "%s/learned-%d", dir, width);
+        recorder = RecorderNew(RECORD_PNG, path, learning, RECORD_MOVES, scale, DRAW_TICK_MILLIS);
+        if (recorder == NULL) {
+          fprintf(stderr, "Unable to record to %s\n", path);
+          return(1);
+        }
+
+        frame.full = 1;
+        RecordFrame(&frame, recorder);
+        for (int y = 0; y < width; y++) {
+          for (int x = 0; x < width; x++) {
+            for (int direction = 0; direction < 4; direction++) {
+              MazeMapSet(learning, x, y, direction, MazeIsOpen(maze, x, y, direction) ? MAP_OPEN : MAP_BLOCKED);
+            }
+          }
+        }
+        frame.full = 0;
+        frame.nEdges = MazeMapChanges(learning, 0, edges, 2 * map->nWords * 32);
+        RecordFrame(&frame, recorder);
+
+        if (!BorderClosed(recorder)) {
+          fprintf(stderr, "%dx%d: the learned PNG frame's outer border has gaps\n", width, width);
+          failed = 1;
+        }
+        RecorderFree(recorder);
+      }
+      free(edges);
+    }
+
+    MazeMapFree(learning);
+    MazeMapFree(map);
+    MazeFree(maze);
+  }
+  return(failed);
+}
+
+
+/*
+ *
+ * RemoveFrame - nftw callback removing one file or emptied directory
+ *
+ */
+static int RemoveFrame(const char *path, const struct stat *status, int type, struct FTW *walk) {
+
+  return(remove(path));
+}
+
+
+/*
+ *
+ * BenchRecord - RecordMazes into a fresh directory under /tmp, removed
+ *   afterwards unless keep is set
+ *
+ * Returns 0 on success, 1 on failure
+ *
+ */
+int BenchRecord(int keep) {
+
+  char dir[] = "/tmp/ambench-XXXXXX";
+
+  if (mkdtemp(dir) == NULL) {
+    fprintf(stderr, "Unable to make a directory for the frames\n");
+    return(1);
+  }
+
+  int failed = RecordMazes(dir);
+
+  if (keep) {
+    printf("Frames are in %s\n", dir);
+  }
+  else if (nftw(dir, RemoveFrame, 16, FTW_DEPTH | FTW_PHYS) != 0) {
+    fprintf(stderr, "Unable to remove %s\n", dir);
+    failed = 1;
+  }
+  return(failed);
+}
+
+
+/*
+ *
+ * BenchFrames - decodes each v2 frame code one byte short of its shortest
+ *   frame, with the rest of the buffer poisoned and a good ready frame after
+ *
+ * Pseudocode: give the codec two avatars' positions with a full turn. For
+ * each case, write the frame's code, the n it claims and 0xA5 everywhere
+ * else, set its length one short of what V2Length wants, and append a
+ * ready frame. Decoding has to give AM_UNKNOWN_MSG_TYPE for the code with
+ * the codec unchanged (a short turn read anyway would pull the ready
+ * frame's bytes into the positions), then the ready frame.
+ *
+ * Returns 0 if every case passed, 1 otherwise
+ *
+ */
+int BenchFrames(void) {
+
+  static const struct { const char *name; int code, n; size_t shortest; } cases[] = {
+    { "ready", FRAME_V2_READY, 0, 3 },
+    { "move", FRAME_V2_MOVE, 0, 4 },
+    { "turn", FRAME_V2_TURN, 0, 4 },
+    { "turn", FRAME_V2_TURN, 2, 12 },
+    { "delta", FRAME_V2_TURN_DELTA, 0, 8 },
+    { "solved", FRAME_V2_SOLVED, 0, 12 },
+    { "other", FRAME_V2_OTHER, 0, 6 },
+    { "path", FRAME_V2_PATH, 0, 4 },
+    { "path", FRAME_V2_PATH, 5, 7 },
+  };
+  static const unsigned char turn[] = { 12, FRAME_V2_TURN, 1, 2, 0, 3, 0, 4, 0, 5, 0, 6 };
+  int failed = 0;
+
+  printf("%-7s %3s %7s %-10s %-7s %s\n", "code", "n", "length", "decoded", "codec", "next");
+
+  for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+
+    FrameReader reader;
+    AM_Message message;
+    unsigned char frame[16];
+    size_t length = cases[c].shortest - 1;
+
+    FrameReaderInit(&reader, -1);
+    FrameCodecInit(&reader.codec, AM_PROTOCOL_V2, 2);
+    FrameReaderPush(&reader, turn, sizeof(turn));
+    FrameReaderNext(&reader, &message);
+    FrameCodec codec = reader.codec;
+
+    memset(frame, 0xA5, sizeof(frame));
+    frame[0] = length;
+    frame[1] = cases[c].code;
+    frame[3] = cases[c].n;
+    frame[length] = 3;
+    frame[length + 1] = FRAME_V2_READY;
+    frame[length + 2] = FRAME_READY_ID;
+    FrameReaderPush(&reader, frame, length + 3);
+
+
+    /* The short frame, then the ready frame straight after it */
+
+    int decoded = FrameReaderNext(&reader, &message) && ntohl(message.type) == AM_UNKNOWN_MSG_TYPE &&
+                  ntohl(message.unknown_msg_type.BadType) == (uint32_t) cases[c].code;
+    int unchanged = memcmp(&codec, &reader.codec, sizeof(codec)) == 0;
+    int next = FrameReaderNext(&reader, &message) && ntohl(message.type) == AM_AVATAR_READY &&
+               ntohl(message.avatar_ready.AvatarId) == FRAME_READY_ID && reader.end == 0;
+
+    printf("%-7s %3d %7zu %-10s %-7s %s\n", cases[c].name, cases[c].n, length, decoded ? "unknown" : "WRONG",
+           unchanged ? "same" : "CHANGED", next ? "ready" : "LOST");
+    if (!decoded || !unchanged || !next) {
+      fprintf(stderr, "%s frame of %zu bytes was not rejected cleanly\n", cases[c].name, length);
+      failed = 1;
+    }
+  }
+  return(failed);
+}
+
+
+int main(int argc, char* argv[]) {
+
+  if (argc == 2 && strcmp(argv[1], "alloc") == 0) {
+    return BenchAlloc();
+  }
+  if (argc == 2 && strcmp(argv[1], "transport") == 0) {
+    return BenchTransport();
+  }
+  if (argc == 2 && strcmp(argv[1], "uring") == 0) {
+    return BenchUring();
+  }
+
+  if (argc == 2 && strcmp(argv[1], "replan") == 0) {
+    return BenchReplan();
+  }
+
+  if (argc == 2 && strcmp(argv[1], "regions") == 0) {
+    return BenchRegions();
+  }
+
+  if (argc == 2 && strcmp(argv[1], "flood") == 0) {
+    return BenchFlood();
+  }
+
+  if (argc == 2 && strcmp(argv[1], "draw") == 0) {
+    return BenchDraw();
+  }
+
+  if (argc == 2 && strcmp(argv[1], "record") == 0) {
+    return BenchRecord(0);
+  }
+  if (argc == 3 && strcmp(argv[1], "record") == 0 && strcmp(argv[2], "keep") == 0) {
+    return BenchRecord(1);
+  }
+
+  if (argc == 2 && strcmp(argv[1], "frames") == 0) {
+    return BenchFrames();
+  }
+
+  fprintf(stderr, "[%s] Usage: %s alloc|transport|uring|replan|regions|flood|draw|record [keep]|frames\n",
+          argv[0], argv[0]);
+  return(1);
+}
@@ -0,0 +1,330 @@
+/* ========================================================================== */
+/* File: amdraw.c
+ *
+ * Author: Troy Palmer and Sean Cann
+ * Date: 6.4.2015
+ *
+ * Overview: the move queue and drawing thread described in amdraw.h. A
+ * slot's sequence is its index while free for the producer that will
+ * claim that index, index + 1 once written, and index + slots once taken,
+ * ready for the producer one lap later; a producer that finds a sequence
+ * behind its index has caught up with the consumer and gives up.
+ *
+ */
+/* ========================================================================== */
+
+// ---------------- System includes
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// ---------------- Local includes
+
+#include "amdraw.h"
+
+// ---------------- Private prototypes
+
+static void *RunDrawer(void *data);
+static void DrawTick(Drawer *drawer);
+
+/* ========================================================================== */
+
+
+/*
+ *
+ * DrawQueueInit - every slot free for the first lap
+ *
+ * Returns 1 on success, 0 otherwise
+ *
+ */
+int DrawQueueInit(DrawQueue *queue, size_t slots) {
+
+  queue->slots = calloc(slots, sizeof(DrawSlot));
+  if (queue->slots == NULL) {
+    return(0);
+  }
+
+  queue->mask = slots - 1;
+  for (size_t i = 0; i < slots; i++) {
+    atomic_init(&queue->slots[i].sequence, i);
+  }
+  atomic_init(&queue->tail, 0);
+  queue->head = 0;
+  atomic_init(&queue->dropped, 0);
+  return(1);
+}
+
+
+/*
+ *
+ * DrawQueuePush - claims the tail slot and publishes event in it
+ *
+ * Pseudocode:
+ *     read the tail
+ *     while the tail's slot is free for this lap
+ *         claim it by moving the tail on, and on success write and publish
+ *         else another producer claimed it first: go again from its tail
+ *     the slot is still a lap behind: the queue is full
+ *
+ * Returns 1 if queued, 0 if dropped
+ *
+ */
+int DrawQueuePush(DrawQueue *queue, const DrawEvent *event) {
+
+  size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+
+  for (;;) {
+    DrawSlot *slot = &queue->slots[tail & queue->mask];
+    size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+    long behind = (long) (sequence - tail);
+
+    if (behind == 0) {
+      if (atomic_compare_exchange_weak_explicit(&queue->tail, &tail, tail + 1,
+                                                memory_order_relaxed, memory_order_relaxed)) {
+        slot->event = *event;
+        atomic_store_explicit(&slot->sequence, tail + 1, memory_order_release);
+        return(1);
+      }
+    }
+    else if (behind < 0) {
+      atomic_fetch_add_explicit(&queue->dropped, 1, memory_order_relaxed);
+      return(0);
+    }
+    else {
+      tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    }
+  }
+}
+
+
+/*
+ *
+ * DrawQueuePop - takes the head slot once its producer has published it
+ *
+ * Returns 1 with the event, 0 if the queue is empty (or its head is still
+ * being written)
+ *
+ */
+int DrawQueuePop(DrawQueue *queue, DrawEvent *event) {
+
+  DrawSlot *slot = &queue->slots[queue->head & queue->mask];
+  size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+
+  if (sequence != queue->head + 1) {
+    return(0);
+  }
+
+  *event = slot->event;
+  atomic_store_explicit(&slot->sequence, queue->head + queue->mask + 1, memory_order_release);
+  queue->head++;
+  return(1);
+}
+
+
+void DrawQueueFree(DrawQueue *queue) {
+
+  free(queue->slots);
+  queue->slots = NULL;
+}
+
+
+/*
+ *
+ * DrawerNew - a drawer with no avatar placed and a full first frame due
+ *
+ * Returns the drawer, or NULL on failure
+ *
+ */
+Drawer *DrawerNew(MazeMap *map, int nAvatars, int tickMillis, DrawFunction draw, void *context) {
+
+  if (nAvatars < 1 || nAvatars > AM_MAX_AVATAR || !MazeMapTrack(map)) {
+    return(NULL);
+  }
+
+  Drawer *drawer = calloc(1, sizeof(Drawer));
+  if (drawer == NULL) {
+    return(NULL);
+  }
+
+  drawer->map = map;
+  drawer->nAvatars = nAvatars;
+  drawer->tickMillis = tickMillis;
+  drawer->draw = draw;
+  drawer->context = context;
+  drawer->edgesMax = 2 * map->nWords * 32;
+  drawer->edges = malloc(drawer->edgesMax * sizeof(long));
+  drawer->full = 1;
+  atomic_init(&drawer->running, 0);
+
+  if (drawer->edges == NULL || !DrawQueueInit(&drawer->queue, DRAW_QUEUE_SLOTS)) {
+    free(drawer->edges);
+    free(drawer);
+    return(NULL);
+  }
+
+  for (int i = 0; i < AM_MAX_AVATAR; i++) {
+    atomic_init(&drawer->latest[i], UINT64_MAX);
+    drawer->pos[i].x = drawer->pos[i].y = (uint32_t) -1;
+    drawer->last[i] = drawer->pos[i];
+  }
+  return(drawer);
+}
+
+
+/*
+ *
+ * DrawerStart - starts RunDrawer
+ *
+ * Returns 1 on success, 0 otherwise
+ *
+ */
+int DrawerStart(Drawer *drawer) {
+
+  atomic_store(&drawer->running, 1);
+  if (pthread_create(&drawer->thread, NULL, RunDrawer, drawer) != 0) {
+    atomic_store(&drawer->running, 0);
+    return(0);
+  }
+  return(1);
+}
+
+
+/*
+ *
+ * DrawerMove - overwrites the avatar's latest square, which the next frame
+ *   draws whether or not the queue had room, then queues the move
+ *
+ */
+void DrawerMove(Drawer *drawer, int avatarId, int x, int y) {
+
+  DrawEvent event = { avatarId, x, y };
+
+  if (avatarId >= 0 && avatarId < drawer->nAvatars) {
+    atomic_store_explicit(&drawer->latest[avatarId], (uint64_t) (uint32_t) x << 32 | (uint32_t) y,
+                          memory_order_relaxed);
+  }
+  (void) DrawQueuePush(&drawer->queue, &event);
+}
+
+
+/*
+ *
+ * DrawTick - one frame's worth of changes, drawn if there are any
+ *
+ * Pseudocode:
+ *     count the queued moves, and the ones that did not fit
+ *     read every avatar's latest square; it moved if that is not where
+ *         the last frame drew it
+ *     read the map log from where the last tick stopped
+ *     nothing moved and no edge learned: no frame
+ *     draw, and remember this frame's squares for the next one
+ *
+ */
+static void DrawTick(Drawer *drawer) {
+
+  DrawEvent event;
+  int moved = 0;
+
+  while (DrawQueuePop(&drawer->queue, &event)) {
+    drawer->events++;
+  }
+  drawer->dropped += atomic_exchange_explicit(&drawer->queue.dropped, 0, memory_order_relaxed);
+
+  for (int i = 0; i < drawer->nAvatars; i++) {
+    uint64_t square = atomic_load_explicit(&drawer->latest[i], memory_order_relaxed);
+    drawer->pos[i].x = (uint32_t) (square >> 32);
+    drawer->pos[i].y = (uint32_t) square;
+    moved |= drawer->pos[i].x != drawer->last[i].x || drawer->pos[i].y != drawer->last[i].y;
+  }
+
+  size_t nEdges = MazeMapChanges(drawer->map, drawer->logged, drawer->edges, drawer->edgesMax);
+  drawer->logged += nEdges;
+
+  if (!moved && nEdges == 0 && !drawer->full) {
+    return;
+  }
+
+  DrawFrame frame = {
+    .width = drawer->map->width, .height = drawer->map->height,
+    .nAvatars = drawer->nAvatars,
+    .pos = drawer->pos, .last = drawer->last,
+    .edges = drawer->edges, .nEdges = nEdges,
+    .full = drawer->full,
+    .number = drawer->frames,
+  };
+
+  if (drawer->draw(&frame, drawer->context)) {
+    memcpy(drawer->last, drawer->pos, sizeof(drawer->last));
+    drawer->frames++;
+    drawer->full = 0;
+  }
+  else {
+    drawer->full = 1;
+  }
+}
+
+
+/*
+ *
+ * RunDrawer - the drawing thread: a tick every tickMillis on the monotonic
+ *   clock until DrawerStop, then one last tick so the final squares show
+ *
+ */
+static void *RunDrawer(void *data) {
+
+  Drawer *drawer = data;
+  struct timespec next;
+
+  clock_gettime(CLOCK_MONOTONIC, &next);
+
+  while (atomic_load(&drawer->running)) {
+    DrawTick(drawer);
+
+    next.tv_nsec += drawer->tickMillis * 1000000L;
+    while (next.tv_nsec >= 1000000000L) {
+      next.tv_nsec -= 1000000000L;
+      next.tv_sec++;
+    }
+
+    // a frame that overran its tick: start again from now rather than catch up
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec > next.tv_sec || (now.tv_sec == next.tv_sec && now.tv_nsec > next.tv_nsec)) {
+      next = now;
+    }
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR) {
+      continue;
+    }
+  }
+
+  DrawTick(drawer);
+  return(NULL);
+}
+
+
+/*
+ *
+ * DrawerStop - asks RunDrawer to stop and waits for its last tick
+ *
+ */
+void DrawerStop(Drawer *drawer) {
+
+  if (atomic_exchange(&drawer->running, 0)) {
+    pthread_join(drawer->thread, NULL);
+  }
+}
+
+
+void DrawerFree(Drawer *drawer) {
+
+  if (drawer == NULL) {
+    return;
+  }
+
+  DrawerStop(drawer);
+  DrawQueueFree(&drawer->queue);
+  free(drawer->edges);
+  free(drawer);
+}
@@ -0,0 +1,148 @@
+/* ========================================================================== */
+/* File: amdraw.h
+ *
+ * Author: Troy Palmer and Sean Cann
+ * Date: 6.4.2015
+ *
+ * What the maze window shows, handed from the avatars to one drawing
+ * thread. Avatars used to start a thread per move to redraw the window,
+ * and never joined it; now a move is an event pushed onto a queue and the
+ * avatar carries on.
+ *
+ * The queue is a ring of slots, each with a sequence number saying whose
+ * turn it is to use it (a bounded multi-producer queue with a single
+ * consumer). An avatar claims the next slot with a compare-and-swap on the
+ * tail, writes its event and publishes it by bumping the slot's sequence;
+ * the drawing thread takes events in order from the head and hands each
+ * slot back the same way. Nobody locks and nobody waits: if the ring is
+ * full the event is dropped and counted.
+ *
+ * A dropped event loses nothing the window needs, because where an avatar
+ * is comes from somewhere else. Each avatar also overwrites its own
+ * latest-square slot, one atomic word, before it pushes; the drawing
+ * thread reads every slot each tick. The queue is what the drawing thread
+ * counts moves by, and the slots are what it draws.
+ *
+ * Walls are not queued. The map already logs every edge it learns in order
+ * (MazeMapTrack, mazemap.h), a log any number of avatars append to without
+ * a lock, so the drawing thread keeps its own place in that log instead.
+ *
+ * A Drawer is the drawing thread. Once a tick it drains the queue, reads
+ * where each avatar is now, picks up the edges learned since the last
+ * frame, and if anything changed hands one DrawFrame to its draw
+ * function. However many moves the avatars make, there is one thread and
+ * at most one frame a tick.
+ *
+ */
+/* ========================================================================== */
+
+#ifndef AMDRAW_H
+#define AMDRAW_H
+
+// ---------------- Prerequisites e.g., Requires "math.h"
+#include <pthread.h>
+#include <stdatomic.h>                       // _Atomic
+#include <stddef.h>                          // size_t
+#include "amazing.h"
+#include "mazemap.h"
+
+// ---------------- Constants
+
+#define DRAW_QUEUE_SLOTS 1024                // a power of two
+#define DRAW_TICK_MILLIS   33                // about 30 frames a second
+
+// ---------------- Structures/Types
+
+/* An avatar arriving on a square */
+typedef struct DrawEvent {
+  int avatarId;
+  int x, y;
+} DrawEvent;
+
+typedef struct DrawSlot {
+  _Atomic size_t sequence;                   // slot index + 1 once written
+  DrawEvent event;
+} DrawSlot;
+
+typedef struct DrawQueue {
+  DrawSlot *slots;
+  size_t mask;                               // slots - 1
+  _Alignas(64) _Atomic size_t tail;          // next slot to claim, producers'
+  _Alignas(64) size_t head;                  // next slot to take, the consumer's
+  _Atomic unsigned long dropped;             // pushes that found the ring full
+} DrawQueue;
+
+/* What changed since the last frame the draw function drew */
+typedef struct DrawFrame {
+  int width, height;
+  int nAvatars;
+  const XYPos *pos;                          // each avatar's square now, x -1 if not seen yet
+  const XYPos *last;                         // and in the last frame drawn
+  const long *edges;                         // map edges learned since the last frame
+  size_t nEdges;
+  int full;                                  // 1 to redraw everything: first frame, or the last failed
+  unsigned long number;                      // frames drawn before this one
+} DrawFrame;
+
+/* Draws frame; returns 0 if it could not (the window is not up yet), and
+ * the next frame will be a full one */
+typedef int (*DrawFunction)(const DrawFrame *frame, void *context);
+
+typedef struct Drawer {
+  DrawQueue queue;
+  MazeMap *map;
+  int nAvatars;
+  int tickMillis;
+  DrawFunction draw;
+  void *context;
+  _Atomic uint64_t latest[AM_MAX_AVATAR];    // each avatar's square, x << 32 | y; all ones if not seen
+
+  XYPos pos[AM_MAX_AVATAR];                  // drawing thread only
+  XYPos last[AM_MAX_AVATAR];
+  long *edges;                               // room for the whole map log
+  size_t edgesMax;
+  size_t logged;                             // map log slots read so far
+  int full;
+
+  pthread_t thread;
+  _Atomic int running;
+  unsigned long frames;                      // frames drawn
+  unsigned long events;                      // moves taken off the queue
+  unsigned long dropped;                     // moves the queue had no room for
+} Drawer;
+
+// ---------------- Prototypes/Macros
+
+/* A queue of slots events, slots a power of two; 0 on failure */
+int DrawQueueInit(DrawQueue *queue, size_t slots);
+
+/* Adds an event without waiting; returns 0 and counts it dropped if the
+ * queue is full. Safe from any number of threads */
+int DrawQueuePush(DrawQueue *queue, const DrawEvent *event);
+
+/* Takes the oldest event into event; returns 0 if there is none. One
+ * consumer only */
+int DrawQueuePop(DrawQueue *queue, DrawEvent *event);
+
+void DrawQueueFree(DrawQueue *queue);
+
+/* A drawer for map and nAvatars avatars calling draw(frame, context) at
+ * most once every tickMillis; starts the map's edge log if it is not kept
+ * yet. NULL on failure */
+Drawer *DrawerNew(MazeMap *map, int nAvatars, int tickMillis, DrawFunction draw, void *context);
+
+/* Starts the drawing thread; returns 0 if it could not */
+int DrawerStart(Drawer *drawer);
+
+/* Avatar avatarId is now on (x,y): sets its latest square and queues the
+ * move. Never waits; from any thread */
+void DrawerMove(Drawer *drawer, int avatarId, int x, int y);
+
+/* Draws a last frame of whatever is queued and stops the drawing thread,
+ * if started */
+void DrawerStop(Drawer *drawer);
+
+/* DrawerStop, then frees the drawer */
+void DrawerFree(Drawer *drawer);
+
+#endif // AMDRAW_H
@@ -0,0 +1,364 @@
+/* ========================================================================== */
+/* File: amflood.c
+ *
+ * Author: Troy Palmer and Sean Cann
+ * Date: 6.4.2015
+ *
+ * Overview: the row-of-bits flood described in amflood.h. Every bitset is
+ * height + 2 rows of rowWords words, square (x,y) being bit x % 64 of word
+ * 1 + x / 64 of row y + 1. The zero rows above and below the maze and the
+ * zero word at each end of a row stand in for its outside, so a row's step
+ * reads its neighbours without checking for an edge of the maze.
+ *
+ * A wavefront is only non-zero on rows lo..hi and words left..right of its
+ * source, which is all a step touches: one more row and word each way of
+ * the next wavefront are written, then the box of this one is cleared and
+ * the two swap. So the next wavefront is all zero whenever a step begins.
+ *
+ * Known corridors make a thin wavefront, a few squares scattered over a box
+ * as big as the maze, where stepping words is mostly stepping zeros. So
+ * each wavefront's squares are also listed while there is room, and one
+ * with few squares for its box is stepped a square at a time, as a
+ * breadth-first search would, against the same masks and bitsets. Which
+ * way a wavefront goes is decided afresh at every step.
+ *
+ */
+/* ========================================================================== */
+
+// ---------------- System includes
+
+#include <limits.h>                          // INT_MAX
+#include <stdlib.h>
+#include <string.h>                          // memset
+
+// ---------------- Local includes
+
+#include "amazing.h"
+#include "amflood.h"
+
+// ---------------- Constant definitions
+
+#define FLOOD_SPARSE 4                       // words a listed square costs, roughly, to step
+
+// ---------------- Structures/Types
+
+/* One source's wavefront: the rows (1-based, as in the bitsets) and words
+ * its squares are on, and how many there are */
+typedef struct Wave {
+  int lo, hi;
+  int left, right;
+  int count;
+} Wave;
+
+// ---------------- Private prototypes
+
+static uint64_t StepWords(const uint64_t *up, const uint64_t *row, const uint64_t *down, const uint64_t *east,
+                          const uint64_t *southUp, const uint64_t *south, uint64_t *reached, uint64_t *next,
+                          int from, int to);
+static inline void Reach(Flood *flood, Wave *wave, int *list, int *distances, int x, int y, int distance);
+static Wave StepWave(Flood *flood, int source, const Wave *wave, const uint64_t *front, uint64_t *next,
+                     const int *list, int *nextList, int distance);
+
+/* ========================================================================== */
+
+
+/*
+ *
+ * StepWords - words from..to - 1 of one row's next wavefront, given the
+ *   wavefront on the row and the rows above and below; also adds them to
+ *   reached
+ *
+ * Returns the OR of the words written
+ *
+ */
+static uint64_t StepWords(const uint64_t *up, const uint64_t *row, const uint64_t *down, const uint64_t *east,
+                          const uint64_t *southUp, const uint64_t *south, uint64_t *reached, uint64_t *next,
+                          int from, int to) {
+
+  uint64_t any = 0;
+
+  for (int w = from; w < to; w++) {
+
+    uint64_t in = ((row[w] & east[w]) << 1) | ((row[w - 1] & east[w - 1]) >> 63) |
+                  (((row[w] >> 1) | (row[w + 1] << 63)) & east[w]) |
+                  (up[w] & southUp[w]) | (down[w] & south[w]);
+
+    in &= ~reached[w];
+    next[w] = in;
+    reached[w] |= in;
+    any |= in;
+  }
+  return(any);
+}
+
+
+/*
+ *
+ * FloodNew - allocates a flood's masks, bitsets and distances
+ *
+ * Returns the flood, or NULL on failure
+ *
+ */
+Flood *FloodNew(int width, int height, int maxSources) {
+
+  if (width <= 0 || height <= 0 || maxSources <= 0) {
+    return(NULL);
+  }
+
+  Flood *flood = calloc(1, sizeof(Flood));
+  if (flood == NULL) {
+    return(NULL);
+  }
+
+  flood->width = width;
+  flood->height = height;
+  flood->maxSources = maxSources;
+  flood->nWords = (width + 63) / 64;
+  flood->rowWords = flood->nWords + 2;
+
+  size_t plane = (size_t) (height + 2) * flood->rowWords;
+
+  flood->east = calloc(plane, sizeof(uint64_t));
+  flood->south = calloc(plane, sizeof(uint64_t));
+  flood->front[0] = calloc(plane * maxSources, sizeof(uint64_t));
+  flood->front[1] = calloc(plane * maxSources, sizeof(uint64_t));
+  flood->reached = calloc(plane * maxSources, sizeof(uint64_t));
+  flood->listMax = (int) plane;
+  flood->lists[0] = calloc(plane * maxSources, sizeof(int));
+  flood->lists[1] = calloc(plane * maxSources, sizeof(int));
+  flood->distance = calloc((size_t) width * height * maxSources, sizeof(int));
+
+  if (flood->east == NULL || flood->south == NULL || flood->front[0] == NULL || flood->front[1] == NULL ||
+      flood->reached == NULL || flood->lists[0] == NULL || flood->lists[1] == NULL || flood->distance == NULL) {
+    FloodFree(flood);
+    return(NULL);
+  }
+  return(flood);
+}
+
+
+/*
+ *
+ * FloodLoad - takes a copy of which sides of every square can be crossed
+ *
+ */
+void FloodLoad(Flood *flood, const MazeMap *map, int mode) {
+
+  for (int y = 0; y < flood->height; y++) {
+    size_t row = (size_t) (y + 1) * flood->rowWords + 1;
+    MazeMapRowMasks(map, y, mode == FLOOD_OPTIMISTIC, &flood->east[row], &flood->south[row]);
+  }
+}
+
+
+/*
+ *
+ * Reach - records a square a wavefront has just reached: its distance, its
+ *   place in the list while there is room, and the box around the wave
+ *
+ */
+static inline void Reach(Flood *flood, Wave *wave, int *list, int *distances, int x, int y, int distance) {
+
+  int square = y * flood->width + x;
+
+  distances[square] = distance;
+  if (wave->count < flood->listMax) {
+    list[wave->count] = square;
+  }
+  wave->count++;
+
+  wave->lo = y + 1 < wave->lo ? y + 1 : wave->lo;
+  wave->hi = y + 1 > wave->hi ? y + 1 : wave->hi;
+  wave->left = x / 64 < wave->left ? x / 64 : wave->left;
+  wave->right = x / 64 > wave->right ? x / 64 : wave->right;
+}
+
+
+/*
+ *
+ * StepWave - one source's wavefront one step on
+ *
+ * Pseudocode: a wavefront listed in full and small against its box steps a
+ * square at a time: for each square, each side whose mask bit says it can
+ * be crossed, onto a square not yet reached. Any other steps a word at a
+ * time over the rows and words around its box. Either way the new squares
+ * end up as bits of next, in the list while there is room, and counted.
+ *
+ * Returns the new wavefront's box and count
+ *
+ */
+static Wave StepWave(Flood *flood, int source, const Wave *wave, const uint64_t *front, uint64_t *next,
+                     const int *list, int *nextList, int distance) {
+
+  int width = flood->width, rowWords = flood->rowWords;
+  size_t plane = (size_t) (flood->height + 2) * rowWords;
+  uint64_t *reached = &flood->reached[source * plane];
+  int *distances = &flood->distance[(size_t) source * width * flood->height];
+  Wave out = { INT_MAX, 0, INT_MAX, 0, 0 };
+
+  front += source * plane;
+  next += source * plane;
+
+  if (wave->count <= flood->listMax &&
+      (long) wave->count * FLOOD_SPARSE < (long) (wave->hi - wave->lo + 3) * (wave->right - wave->left + 3)) {
+
+    for (int i = 0; i < wave->count; i++) {
+
+      int x = list[i] % width, y = list[i] / width;
+      size_t at = (size_t) (y + 1) * rowWords + 1;
+      int nx[4] = { x - 1, x, x, x + 1 }, ny[4] = { y, y - 1, y + 1, y };
+      uint64_t open[4] = { x > 0 ? flood->east[at + (x - 1) / 64] >> ((x - 1) % 64) : 0,
+                           flood->south[at - rowWords + x / 64] >> (x % 64),
+                           flood->south[at + x / 64] >> (x % 64),
+                           flood->east[at + x / 64] >> (x % 64) };
+
+      for (int direction = 0; direction < 4; direction++) {
+
+        if (!(open[direction] & 1)) {
+          continue;
+        }
+
+        size_t word = (size_t) (ny[direction] + 1) * rowWords + 1 + nx[direction] / 64;
+        uint64_t bit = 1ULL << (nx[direction] % 64);
+
+        if (!(reached[word] & bit)) {
+          reached[word] |= bit;
+          next[word] |= bit;
+          Reach(flood, &out, nextList, distances, nx[direction], ny[direction], distance);
+        }
+      }
+    }
+    return(out);
+  }
+
+  int first = wave->lo > 1 ? wave->lo - 1 : 1, last = wave->hi < flood->height ? wave->hi + 1 : flood->height;
+  int from = wave->left > 0 ? wave->left - 1 : 0;
+  int to = wave->right < flood->nWords - 1 ? wave->right + 2 : flood->nWords;
+
+  for (int y = first; y <= last; y++) {
+
+    size_t at = (size_t) y * rowWords + 1;
+    const uint64_t *row = &front[at];
+    uint64_t any = StepWords(row - rowWords, row, row + rowWords, &flood->east[at], &flood->south[at - rowWords],
+                             &flood->south[at], &reached[at], &next[at], from, to);
+    flood->rowsStepped++;
+
+    for (int w = from; w < to && any != 0; w++) {
+      for (uint64_t bits = next[at + w]; bits != 0; bits &= bits - 1) {
+        Reach(flood, &out, nextList, distances, w * 64 + __builtin_ctzll(bits), y - 1, distance);
+      }
+    }
+  }
+  return(out);
+}
+
+
+/*
+ *
+ * FloodRun - distances from every source at once
+ *
+ * Pseudocode: each source starts as its own square, reached at distance 0.
+ * Then, while any wavefront is non-empty, step every source's wavefront
+ * (StepWave), recording the step's count as the distance of every square
+ * that appears; clear each wavefront just stepped from (its listed squares'
+ * words, or its whole box) and swap the wavefronts with the new ones.
+ *
+ * Returns the largest distance found
+ *
+ */
+int FloodRun(Flood *flood, const XYPos *sources, int nSources) {
+
+  int width = flood->width, rowWords = flood->rowWords;
+  size_t nSquares = (size_t) width * flood->height;
+  size_t plane = (size_t) (flood->height + 2) * rowWords;
+  uint64_t *front = flood->front[0], *next = flood->front[1];
+  int *list = flood->lists[0], *nextList = flood->lists[1];
+  int distance = 0;
+
+  if (nSources <= 0 || nSources > flood->maxSources) {
+    return(-1);
+  }
+
+  Wave waves[nSources];
+
+  memset(front, 0, plane * nSources * sizeof(uint64_t));
+  memset(next, 0, plane * nSources * sizeof(uint64_t));
+  memset(flood->reached, 0, plane * nSources * sizeof(uint64_t));
+  memset(flood->distance, 0xff, nSquares * nSources * sizeof(int));
+
+  for (int s = 0; s < nSources; s++) {
+
+    size_t word = s * plane + (size_t) (sources[s].y + 1) * rowWords + 1 + sources[s].x / 64;
+    uint64_t bit = 1ULL << (sources[s].x % 64);
+
+    front[word] |= bit;
+    flood->reached[word] |= bit;
+    waves[s] = (Wave) { INT_MAX, 0, INT_MAX, 0, 0 };
+    Reach(flood, &waves[s], &list[s * flood->listMax], &flood->distance[s * nSquares], sources[s].x,
+          sources[s].y, 0);
+  }
+
+  for (int moving = nSources; moving > 0; ) {
+
+    distance++;
+    moving = 0;
+
+    for (int s = 0; s < nSources; s++) {
+
+      Wave *wave = &waves[s];
+      if (wave->count == 0) {
+        continue;
+      }
+
+      Wave stepped = StepWave(flood, s, wave, front, next, &list[s * flood->listMax],
+                              &nextList[s * flood->listMax], distance);
+
+      if (wave->count <= flood->listMax) {
+        for (int i = 0; i < wave->count; i++) {
+          int square = list[s * flood->listMax + i], x = square % width;
+          front[s * plane + (size_t) (square / width + 1) * rowWords + 1 + x / 64] = 0;
+        }
+      }
+      else {
+        for (int y = wave->lo; y <= wave->hi; y++) {
+          memset(&front[s * plane + (size_t) y * rowWords + 1 + wave->left], 0,
+                 (size_t) (wave->right - wave->left + 1) * sizeof(uint64_t));
+        }
+      }
+
+      *wave = stepped;
+      moving += stepped.count > 0;
+    }
+
+    uint64_t *swap = front;
+    front = next;
+    next = swap;
+
+    int *swapList = list;
+    list = nextList;
+    nextList = swapList;
+  }
+
+  return(distance - 1);
+}
+
+
+/*
+ *
+ * FloodFree - frees a flood returned by FloodNew
+ *
+ */
+void FloodFree(Flood *flood) {
+
+  if (flood != NULL) {
+    free(flood->east);
+    free(flood->south);
+    free(flood->front[0]);
+    free(flood->front[1]);
+    free(flood->reached);
+    free(flood->lists[0]);
+    free(flood->lists[1]);
+    free(flood->distance);
+    free(flood);
+  }
+}
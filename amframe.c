@@ -0,0 +1,607 @@
+/* ========================================================================== */
+/* File: amframe.c
+ *
+ * Author: Troy Palmer and Sean Cann
+ * Date: 6.4.2015
+ *
+ * Overview: Reassembles fixed-size AM_Messages from a byte stream. One
+ * FrameReaderFill pulls in as much as the socket has (up to
+ * FRAME_BUFFER_MESSAGES messages), after which FrameReaderNext decodes every
+ * complete message without further system calls. A trailing partial message
+ * stays buffered until the rest of it arrives.
+ *
+ * Outgoing messages are encoded directly into a buffer the caller allocated
+ * once (e.g. one per avatar) and sent with FrameSend.
+ *
+ * With AM_PROTOCOL_V2 (see amframe.h) frames are variable length, and
+ * FrameEncode/FrameReaderNext translate between them and v1 AM_Messages so
+ * the rest of the client and server only ever see AM_Message.
+ *
+ */
+/* ========================================================================== */
+
+// ---------------- System includes
+
+#include <errno.h>
+#include <string.h>
+#include <arpa/inet.h>                       // htonl
+#include <sys/socket.h>
+#include <sys/types.h>
+
+// ---------------- Local includes
+
+#include "amframe.h"
+#include "amtransport.h"                     // TransportRecv
+
+// ---------------- Private prototypes
+
+static void Put16(unsigned char *p, uint32_t value);
+
+static void Put32(unsigned char *p, uint32_t value);
+
+static uint32_t Get16(const unsigned char *p);
+
+static uint32_t Get32(const unsigned char *p);
+
+static size_t V2Length(const unsigned char *frame);
+
+static size_t DecodeV2(FrameCodec *codec, const unsigned char *frame, size_t available, AM_Message *message);
+
+/* ========================================================================== */
+
+
+/*
+ *
+ * Put16, Put32, Get16, Get32 - big-endian field access for v2 frames
+ *
+ */
+static void Put16(unsigned char *p, uint32_t value) {
+  p[0] = value >> 8;
+  p[1] = value;
+}
+
+static void Put32(unsigned char *p, uint32_t value) {
+  p[0] = value >> 24;
+  p[1] = value >> 16;
+  p[2] = value >> 8;
+  p[3] = value;
+}
+
+static uint32_t Get16(const unsigned char *p) {
+  return ((uint32_t) p[0] << 8) | p[1];
+}
+
+static uint32_t Get32(const unsigned char *p) {
+  return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+
+/*
+ *
+ * FrameCodecInit - selects a protocol version and forgets turn history
+ *
+ */
+void FrameCodecInit(FrameCodec *codec, int version, int nAvatars) {
+
+  memset(codec, 0, sizeof(FrameCodec));
+  codec->version = (version == AM_PROTOCOL_V2) ? AM_PROTOCOL_V2 : AM_PROTOCOL_V1;
+  codec->nAvatars = nAvatars;
+}
+
+
+/*
+ *
+ * FrameReaderInit - attaches an empty AM_PROTOCOL_V1 reader to a socket
+ *
+ */
+void FrameReaderInit(FrameReader *reader, int fd) {
+
+  reader->fd = fd;
+  reader->transport = NULL;
+  reader->start = 0;
+  reader->end = 0;
+  reader->recvCalls = 0;
+  reader->recvBytes = 0;
+  FrameCodecInit(&reader->codec, AM_PROTOCOL_V1, 0);
+}
+
+
+/*
+ *
+ * FrameReaderInitTransport - attaches an empty AM_PROTOCOL_V1 reader to a
+ *   transport (see amtransport.h)
+ *
+ */
+void FrameReaderInitTransport(FrameReader *reader, Transport *transport) {
+
+  FrameReaderInit(reader, transport->fd);
+  reader->transport = transport;
+}
+
+
+/*
+ *
+ * FrameReaderFill - receives whatever is available into the buffer, first
+ *   sliding any partial message back to the front to make room
+ *
+ * Returns FRAME_OK if bytes were read, FRAME_CLOSED on an orderly shutdown,
+ * FRAME_AGAIN if a non-blocking socket had nothing, and FRAME_ERROR otherwise
+ *
+ */
+int FrameReaderFill(FrameReader *reader) {
+
+  if (reader->start > 0) {
+    memmove(reader->buffer, reader->buffer + reader->start, reader->end - reader->start);
+    reader->end -= reader->start;
+    reader->start = 0;
+  }
+
+  for (;;) {
+    void *free = reader->buffer + reader->end;
+    size_t length = sizeof(reader->buffer) - reader->end;
+    ssize_t n = reader->transport ? TransportRecv(reader->transport, free, length)
+                                  : recv(reader->fd, free, length, 0);
+    reader->recvCalls++;
+
+    if (n > 0) {
+      reader->end += n;
+      reader->recvBytes += n;
+      return(FRAME_OK);
+    }
+    if (n == 0) {
+      return(FRAME_CLOSED);
+    }
+    if (errno == EINTR) {
+      continue;
+    }
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return(FRAME_AGAIN);
+    }
+    return(FRAME_ERROR);
+  }
+}
+
+
+/*
+ *
+ * FrameReaderPush - appends bytes that were received without FrameReaderFill,
+ *   sliding any partial message back to the front first
+ *
+ * Returns FRAME_OK, or FRAME_ERROR if the buffer cannot hold them
+ *
+ */
+int FrameReaderPush(FrameReader *reader, const void *bytes, size_t length) {
+
+  if (reader->start > 0) {
+    memmove(reader->buffer, reader->buffer + reader->start, reader->end - reader->start);
+    reader->end -= reader->start;
+    reader->start = 0;
+  }
+
+  if (length > sizeof(reader->buffer) - reader->end) {
+    return(FRAME_ERROR);
+  }
+
+  memcpy(reader->buffer + reader->end, bytes, length);
+  reader->end += length;
+  reader->recvCalls++;
+  reader->recvBytes += length;
+  return(FRAME_OK);
+}
+
+
+/*
+ *
+ * FrameReaderNext - decodes the next buffered message, if one is complete
+ *
+ * Returns 1 if a message was copied into message and 0 otherwise
+ *
+ */
+int FrameReaderNext(FrameReader *reader, AM_Message *message) {
+
+  size_t available = reader->end - reader->start;
+
+  if (reader->codec.version == AM_PROTOCOL_V2) {
+    size_t used = DecodeV2(&reader->codec, reader->buffer + reader->start, available, message);
+    if (used == 0) {
+      return(0);
+    }
+    reader->start += used;
+  }
+
+  else {
+    if (available < sizeof(AM_Message)) {
+      return(0);
+    }
+    memcpy(message, reader->buffer + reader->start, sizeof(AM_Message));
+    reader->start += sizeof(AM_Message);
+  }
+
+  if (reader->start == reader->end) {
+    reader->start = reader->end = 0;
+  }
+
+  return(1);
+}
+
+
+/*
+ *
+ * FrameReaderRead - returns the next message, reading until one is complete
+ *
+ * Returns FRAME_OK, or the FrameReaderFill result that stopped the read
+ *
+ */
+int FrameReaderRead(FrameReader *reader, AM_Message *message) {
+
+  while (!FrameReaderNext(reader, message)) {
+    int status = FrameReaderFill(reader);
+    if (status != FRAME_OK) {
+      return(status);
+    }
+  }
+
+  return(FRAME_OK);
+}
+
+
+/*
+ *
+ * FrameEncodeInit - fills message in place with an AM_INIT request
+ *
+ */
+void FrameEncodeInit(AM_Message *message, int nAvatars, int difficulty) {
+
+  message->type = htonl(AM_INIT);
+  message->init.nAvatars = htonl(nAvatars);
+  message->init.Difficulty = htonl(difficulty);
+}
+
+
+/*
+ *
+ * FrameEncodeReady - fills message in place with an AM_AVATAR_READY
+ *
+ */
+void FrameEncodeReady(AM_Message *message, int avatarId) {
+
+  message->type = htonl(AM_AVATAR_READY);
+  message->avatar_ready.AvatarId = htonl(avatarId);
+}
+
+
+/*
+ *
+ * FrameEncodeMove - fills message in place with an AM_AVATAR_MOVE
+ *
+ */
+void FrameEncodeMove(AM_Message *message, int avatarId, int direction) {
+
+  message->type = htonl(AM_AVATAR_MOVE);
+  message->avatar_move.AvatarId = htonl(avatarId);
+  message->avatar_move.Direction = htonl(direction);
+}
+
+
+/*
+ *
+ * FrameEncodePath - fills message in place with an AM_AVATAR_PATH of up to
+ *   AM_MAX_PATH directions
+ *
+ */
+void FrameEncodePath(AM_Message *message, int avatarId, const uint8_t *directions, int nSteps) {
+
+  if (nSteps > AM_MAX_PATH) {
+    nSteps = AM_MAX_PATH;
+  }
+
+  message->type = htonl(AM_AVATAR_PATH);
+  message->avatar_path.AvatarId = htonl(avatarId);
+  message->avatar_path.nSteps = htonl(nSteps);
+  memcpy(message->avatar_path.Directions, directions, nSteps);
+}
+
+
+/*
+ *
+ * FrameSend - writes a whole v1 message, continuing after partial sends and
+ *   signals; a closed peer is reported as a failure rather than SIGPIPE
+ *
+ * Returns 1 on success and 0 on failure
+ *
+ */
+int FrameSend(int fd, const AM_Message *message) {
+
+  return FrameSendBytes(fd, message, sizeof(AM_Message));
+}
+
+
+/*
+ *
+ * V2Length - the shortest frame its code can be decoded from (amframe.h):
+ *   a turn or path frame must also hold the n entries it claims, read from
+ *   its fourth byte once there is one. A type-only FRAME_V2_OTHER will do
+ *
+ * Returns the length, or 2 for an unknown code
+ *
+ */
+static size_t V2Length(const unsigned char *frame) {
+
+  switch (frame[1]) {
+    case FRAME_V2_READY:
+      return(3);
+    case FRAME_V2_MOVE:
+      return(4);
+    case FRAME_V2_TURN:
+      return frame[0] < 4 ? 4 : 4 + 4 * (size_t) frame[3];
+    case FRAME_V2_TURN_DELTA:
+      return(8);
+    case FRAME_V2_PATH:
+      return frame[0] < 4 ? 4 : 4 + ((size_t) frame[3] + 1) / 2;
+    case FRAME_V2_SOLVED:
+      return(12);
+    case FRAME_V2_OTHER:
+      return(6);
+    default:
+      return(2);
+  }
+}
+
+
+/*
+ *
+ * DecodeV2 - turns one complete v2 frame back into a v1 AM_Message,
+ *   replaying delta turns against the codec's last known positions
+ *
+ * Returns the frame length consumed, or 0 if the frame is incomplete. A
+ * frame too short for its code decodes as AM_UNKNOWN_MSG_TYPE, none of
+ * it read past its length
+ *
+ */
+static size_t DecodeV2(FrameCodec *codec, const unsigned char *frame, size_t available, AM_Message *message) {
+
+  if (available < 2 || available < frame[0]) {
+    return(0);
+  }
+
+  size_t length = frame[0];
+  const unsigned char *payload = frame + 2;
+
+  memset(message, 0, sizeof(AM_Message));
+
+  if (length < 2) {
+    /* Malformed; consume what we can and let the caller reject it */
+    message->type = htonl(AM_UNKNOWN_MSG_TYPE);
+    return(length ? length : 1);
+  }
+
+  if (length < V2Length(frame)) {
+    message->type = htonl(AM_UNKNOWN_MSG_TYPE);
+    message->unknown_msg_type.BadType = htonl(frame[1]);
+    return(length);
+  }
+
+  switch (frame[1]) {
+
+    case FRAME_V2_READY:
+      message->type = htonl(AM_AVATAR_READY);
+      message->avatar_ready.AvatarId = htonl(payload[0]);
+      break;
+
+    case FRAME_V2_MOVE:
+      message->type = htonl(AM_AVATAR_MOVE);
+      message->avatar_move.AvatarId = htonl(payload[0]);
+      message->avatar_move.Direction = htonl(payload[1]);
+      break;
+
+    case FRAME_V2_TURN: {
+      int n = payload[1] < AM_MAX_AVATAR ? payload[1] : AM_MAX_AVATAR;
+      codec->nAvatars = n;
+      for (int i = 0; i < n; i++) {
+        codec->pos[i].x = Get16(payload + 2 + 4 * i);
+        codec->pos[i].y = Get16(payload + 4 + 4 * i);
+      }
+      codec->havePositions = 1;
+    }
+      /* fall through */
+
+    case FRAME_V2_TURN_DELTA:
+      if (frame[1] == FRAME_V2_TURN_DELTA && payload[1] < codec->nAvatars) {
+        codec->pos[payload[1]].x = Get16(payload + 2);
+        codec->pos[payload[1]].y = Get16(payload + 4);
+      }
+      message->type = htonl(AM_AVATAR_TURN);
+      message->avatar_turn.TurnId = htonl(payload[0]);
+      for (int i = 0; i < codec->nAvatars; i++) {
+        message->avatar_turn.Pos[i].x = htonl(codec->pos[i].x);
+        message->avatar_turn.Pos[i].y = htonl(codec->pos[i].y);
+      }
+      break;
+
+    case FRAME_V2_PATH: {
+      int n = payload[1] < AM_MAX_PATH ? payload[1] : AM_MAX_PATH;
+      message->type = htonl(AM_AVATAR_PATH);
+      message->avatar_path.AvatarId = htonl(payload[0]);
+      message->avatar_path.nSteps = htonl(n);
+      for (int i = 0; i < n; i++) {
+        message->avatar_path.Directions[i] = (i % 2 == 0) ? payload[2 + i / 2] >> 4 : payload[2 + i / 2] & 0xF;
+      }
+      break;
+    }
+
+    case FRAME_V2_SOLVED:
+      message->type = htonl(AM_MAZE_SOLVED);
+      message->maze_solved.nAvatars = htonl(payload[0]);
+      message->maze_solved.Difficulty = htonl(payload[1]);
+      message->maze_solved.nMoves = htonl(Get32(payload + 2));
+      message->maze_solved.Hash = htonl(Get32(payload + 6));
+      break;
+
+    case FRAME_V2_OTHER:
+      message->type = htonl(Get32(payload));
+      if (length >= 10) {
+        message->init_failed.ErrNum = htonl(Get32(payload + 4)); // first word of any payload
+      }
+      break;
+
+    default:
+      message->type = htonl(AM_UNKNOWN_MSG_TYPE);
+      message->unknown_msg_type.BadType = htonl(frame[1]);
+      break;
+  }
+
+  return(length);
+}
+
+
+/*
+ *
+ * FrameEncode - encodes a v1 AM_Message for the codec's protocol version
+ *
+ * Pseudocode: v1 copies the message. v2 writes the compact frame for its
+ * type; a turn is sent as a delta when at most one avatar has moved since
+ * the last turn this codec encoded, and in full (nAvatars positions) else.
+ *
+ * Returns the number of bytes written to buffer
+ *
+ */
+size_t FrameEncode(FrameCodec *codec, const AM_Message *message, unsigned char *buffer) {
+
+  if (codec == NULL || codec->version != AM_PROTOCOL_V2) {
+    memcpy(buffer, message, sizeof(AM_Message));
+    return(sizeof(AM_Message));
+  }
+
+  unsigned char *payload = buffer + 2;
+  size_t length;
+
+  switch (ntohl(message->type)) {
+
+    case AM_AVATAR_READY:
+      buffer[1] = FRAME_V2_READY;
+      payload[0] = ntohl(message->avatar_ready.AvatarId);
+      length = 3;
+      break;
+
+    case AM_AVATAR_MOVE:
+      buffer[1] = FRAME_V2_MOVE;
+      payload[0] = ntohl(message->avatar_move.AvatarId);
+      payload[1] = ntohl(message->avatar_move.Direction);
+      length = 4;
+      break;
+
+    case AM_AVATAR_TURN: {
+      int mover = FRAME_V2_NO_MOVER;
+      int nChanged = 0;
+
+      for (int i = 0; i < codec->nAvatars; i++) {
+        uint32_t x = ntohl(message->avatar_turn.Pos[i].x);
+        uint32_t y = ntohl(message->avatar_turn.Pos[i].y);
+        if (!codec->havePositions || codec->pos[i].x != x || codec->pos[i].y != y) {
+          mover = i;
+          nChanged++;
+        }
+        codec->pos[i].x = x;
+        codec->pos[i].y = y;
+      }
+
+      payload[0] = ntohl(message->avatar_turn.TurnId);
+
+      if (codec->havePositions && nChanged <= 1) {
+        buffer[1] = FRAME_V2_TURN_DELTA;
+        payload[1] = mover;
+        Put16(payload + 2, mover == FRAME_V2_NO_MOVER ? 0 : codec->pos[mover].x);
+        Put16(payload + 4, mover == FRAME_V2_NO_MOVER ? 0 : codec->pos[mover].y);
+        length = 8;
+      }
+      else {
+        buffer[1] = FRAME_V2_TURN;
+        payload[1] = codec->nAvatars;
+        for (int i = 0; i < codec->nAvatars; i++) {
+          Put16(payload + 2 + 4 * i, codec->pos[i].x);
+          Put16(payload + 4 + 4 * i, codec->pos[i].y);
+        }
+        length = 4 + 4 * codec->nAvatars;
+      }
+      codec->havePositions = 1;
+      break;
+    }
+
+    case AM_AVATAR_PATH: {
+      int n = ntohl(message->avatar_path.nSteps);
+      n = n < AM_MAX_PATH ? n : AM_MAX_PATH;
+      buffer[1] = FRAME_V2_PATH;
+      payload[0] = ntohl(message->avatar_path.AvatarId);
+      payload[1] = n;
+      memset(payload + 2, 0, (n + 1) / 2);
+      for (int i = 0; i < n; i++) {
+        payload[2 + i / 2] |= (message->avatar_path.Directions[i] & 0xF) << ((i % 2 == 0) ? 4 : 0);
+      }
+      length = 4 + (n + 1) / 2;
+      break;
+    }
+
+    case AM_MAZE_SOLVED:
+      buffer[1] = FRAME_V2_SOLVED;
+      payload[0] = ntohl(message->maze_solved.nAvatars);
+      payload[1] = ntohl(message->maze_solved.Difficulty);
+      Put32(payload + 2, ntohl(message->maze_solved.nMoves));
+      Put32(payload + 6, ntohl(message->maze_solved.Hash));
+      length = 12;
+      break;
+
+    default:
+      buffer[1] = FRAME_V2_OTHER;
+      Put32(payload, ntohl(message->type));
+      Put32(payload + 4, ntohl(message->init_failed.ErrNum));
+      length = 10;
+      break;
+  }
+
+  buffer[0] = length;
+  return(length);
+}
+
+
+/*
+ *
+ * FrameSendBytes - writes a whole encoded frame, continuing after partial
+ *   sends and signals
+ *
+ * Returns 1 on success and 0 on failure
+ *
+ */
+int FrameSendBytes(int fd, const void *buffer, size_t length) {
+
+  const char *data = (const char *) buffer;
+  size_t sent = 0;
+
+  while (sent < length) {
+    ssize_t n = send(fd, data + sent, length - sent, MSG_NOSIGNAL);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return(0);
+    }
+    sent += n;
+  }
+
+  return(1);
+}
+
+
+/*
+ *
+ * FrameWrite - encodes a message for codec and sends it
+ *
+ * Returns 1 on success and 0 on failure
+ *
+ */
+int FrameWrite(int fd, FrameCodec *codec, const AM_Message *message) {
+
+  unsigned char buffer[FRAME_MAX_BYTES];
+  size_t length = FrameEncode(codec, message, buffer);
+
+  return FrameSendBytes(fd, buffer, length);
+}
@@ -0,0 +1,136 @@
+/* ========================================================================== */
+/* File: amframe.h
+ *
+ * Author: Troy Palmer and Sean Cann
+ * Date: 6.4.2015
+ *
+ * Buffered AM_Message framing for stream sockets. TCP is free to split one
+ * message across several reads or to deliver several messages in one read;
+ * a FrameReader absorbs both and hands back whole messages. On the send side
+ * messages are encoded in place into caller-owned buffers and written with
+ * FrameSend, so the per-move path never touches the heap.
+ *
+ * Both MazePort wire protocols are handled here. AM_PROTOCOL_V1 sends every
+ * message as a whole AM_Message. AM_PROTOCOL_V2 frames are
+ *
+ *     [length:8][code:8][payload]      length counts the whole frame
+ *
+ * with payloads sized to the message (big-endian, coordinates as 16 bits):
+ *
+ *     FRAME_V2_READY       AvatarId:8                                    3 B
+ *     FRAME_V2_MOVE        AvatarId:8 Direction:8                        4 B
+ *     FRAME_V2_TURN        TurnId:8 n:8 n * (x:16 y:16)             4 + 4n B
+ *     FRAME_V2_TURN_DELTA  TurnId:8 Mover:8 x:16 y:16                    8 B
+ *     FRAME_V2_PATH        AvatarId:8 n:8 n * Direction:4      4 + (n+1)/2 B
+ *     FRAME_V2_SOLVED      nAvatars:8 Difficulty:8 nMoves:32 Hash:32    12 B
+ *     FRAME_V2_OTHER       type:32 first payload word:32                10 B
+ *
+ * A delta turn carries only the one avatar that moved since the previous
+ * turn (Mover 0xFF if none did), so both ends keep the last positions in a
+ * FrameCodec. Decoded messages are always handed back as v1 AM_Messages in
+ * network byte order, so callers do not care which version is in use. A
+ * frame shorter than its code and counts say comes back as
+ * AM_UNKNOWN_MSG_TYPE rather than read past its end.
+ *
+ */
+/* ========================================================================== */
+
+#ifndef AMFRAME_H
+#define AMFRAME_H
+
+// ---------------- Prerequisites e.g., Requires "math.h"
+#include <stddef.h>                          // size_t
+#include "amazing.h"                         // AM_Message
+
+// ---------------- Constants
+
+#define FRAME_BUFFER_MESSAGES 16             // whole messages buffered per read
+#define FRAME_MAX_BYTES sizeof(AM_Message)   // largest encoded frame, any version
+
+/* AM_PROTOCOL_V2 frame codes */
+#define FRAME_V2_READY        1
+#define FRAME_V2_MOVE         2
+#define FRAME_V2_TURN         3
+#define FRAME_V2_TURN_DELTA   4
+#define FRAME_V2_SOLVED       5
+#define FRAME_V2_OTHER        6
+#define FRAME_V2_PATH         7
+#define FRAME_V2_NO_MOVER  0xFF
+
+/* FrameReaderFill / FrameReaderRead results */
+#define FRAME_OK       1                     // data (or a message) available
+#define FRAME_CLOSED   0                     // peer shut the connection down
+#define FRAME_ERROR   -1                     // recv failed, see errno
+#define FRAME_AGAIN   -2                     // non-blocking socket has no data
+
+// ---------------- Structures/Types
+
+struct Transport;                            // amtransport.h
+
+/* Protocol version plus the turn positions v2 deltas are relative to */
+typedef struct FrameCodec {
+  int version;
+  int nAvatars;
+  int havePositions;
+  XYPos pos[AM_MAX_AVATAR];                  // host byte order
+} FrameCodec;
+
+/* Receive buffer for one socket; bytes [start, end) are not yet decoded */
+typedef struct FrameReader {
+  int fd;
+  struct Transport *transport;               // read through this instead of fd if set
+  size_t start;
+  size_t end;
+  unsigned long recvCalls;                   // FrameReaderFill recv calls
+  unsigned long recvBytes;                   // bytes received
+  FrameCodec codec;
+  unsigned char buffer[sizeof(AM_Message) * FRAME_BUFFER_MESSAGES];
+} FrameReader;
+
+// ---------------- Prototypes/Macros
+
+/* Attaches an empty AM_PROTOCOL_V1 reader to fd */
+void FrameReaderInit(FrameReader *reader, int fd);
+
+/* Attaches an empty AM_PROTOCOL_V1 reader to a transport */
+void FrameReaderInitTransport(FrameReader *reader, struct Transport *transport);
+
+/* Resets codec to version with no turn history */
+void FrameCodecInit(FrameCodec *codec, int version, int nAvatars);
+
+/* Performs a single recv (or TransportRecv) into the free part of the buffer */
+int FrameReaderFill(FrameReader *reader);
+
+/* Appends bytes received elsewhere (e.g. by io_uring); FRAME_ERROR if they
+ * do not fit */
+int FrameReaderPush(FrameReader *reader, const void *bytes, size_t length);
+
+/* Copies the next complete message out of the buffer; 1 if there was one */
+int FrameReaderNext(FrameReader *reader, AM_Message *message);
+
+/* Blocks until one whole message has been read */
+int FrameReaderRead(FrameReader *reader, AM_Message *message);
+
+/* Encode a message into message, in network byte order */
+void FrameEncodeInit(AM_Message *message, int nAvatars, int difficulty);
+
+void FrameEncodeReady(AM_Message *message, int avatarId);
+
+void FrameEncodeMove(AM_Message *message, int avatarId, int direction);
+
+void FrameEncodePath(AM_Message *message, int avatarId, const uint8_t *directions, int nSteps);
+
+/* Writes one whole v1 message, resuming after short sends; 1 on success */
+int FrameSend(int fd, const AM_Message *message);
+
+/* Encodes a v1 message for codec's version into buffer (FRAME_MAX_BYTES
+ * long) and returns the frame length */
+size_t FrameEncode(FrameCodec *codec, const AM_Message *message, unsigned char *buffer);
+
+/* Writes length bytes, resuming after short sends; 1 on success */
+int FrameSendBytes(int fd, const void *buffer, size_t length);
+
+/* FrameEncode followed by FrameSendBytes */
+int FrameWrite(int fd, FrameCodec *codec, const AM_Message *message);
+
+#endif // AMFRAME_H
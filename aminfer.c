@@ -0,0 +1,151 @@
+/* ========================================================================== */
+/* File: aminfer.c
+ *
+ * Author: Troy Palmer and Sean Cann
+ * Date: 6.4.2015
+ *
+ * Overview: the turn-by-turn wall inference described in aminfer.h. Open
+ * edges come from the change of position between two broadcasts of every
+ * avatar not on a path, blocked ones from the previous turn holder's
+ * published attempt. All updates go through MazeMapSet, so an edge some
+ * avatar already recorded for itself is simply not counted again.
+ *
+ */
+/* ========================================================================== */
+
+// ---------------- System includes
+
+#include <string.h>
+#include <arpa/inet.h>                       // ntohl
+
+// ---------------- Local includes
+
+#include "aminfer.h"
+
+// ---------------- Private prototypes
+
+static int StepDirection(int dx, int dy);
+
+/* ========================================================================== */
+
+
+/*
+ *
+ * StepDirection - the compass direction of a one-square offset
+ *
+ * Returns M_NORTH/M_SOUTH/M_EAST/M_WEST, or M_NULL_MOVE for anything else
+ *
+ */
+static int StepDirection(int dx, int dy) {
+
+  if (dx == 0 && dy == -1) {
+    return(M_NORTH);
+  }
+  if (dx == 0 && dy == 1) {
+    return(M_SOUTH);
+  }
+  if (dx == 1 && dy == 0) {
+    return(M_EAST);
+  }
+  if (dx == -1 && dy == 0) {
+    return(M_WEST);
+  }
+  return(M_NULL_MOVE);
+}
+
+
+/*
+ *
+ * TurnInferenceInit - starts with no broadcast seen and no attempts made
+ *
+ */
+void TurnInferenceInit(TurnInference *inference, int nAvatars) {
+
+  memset(inference, 0, sizeof(TurnInference));
+  inference->nAvatars = nAvatars;
+
+  for (int i = 0; i < AM_MAX_AVATAR; i++) {
+    atomic_init(&inference->attempted[i], M_NULL_MOVE);
+  }
+  atomic_init(&inference->turns, 0);
+  atomic_init(&inference->learned, 0);
+}
+
+
+/*
+ *
+ * TurnInferenceAttempt - publishes the move avatarId is sending this turn
+ *
+ */
+void TurnInferenceAttempt(TurnInference *inference, int avatarId, int direction) {
+
+  if (avatarId >= 0 && avatarId < AM_MAX_AVATAR) {
+    atomic_store_explicit(&inference->attempted[avatarId], direction, memory_order_release);
+  }
+}
+
+
+/*
+ *
+ * TurnInferenceApply - folds one broadcast into the map
+ *
+ * Pseudocode: for every avatar not on a path that is one square from its
+ * last position, mark the edge it crossed open; if the previous turn holder
+ * tried a single move and did not go anywhere, mark that side of its square
+ * blocked. Then remember this broadcast's positions and turn holder for the
+ * next call.
+ *
+ * Returns the number of edges that were unknown until this call
+ *
+ */
+int TurnInferenceApply(TurnInference *inference, MazeMap *map, const AM_Message *turn) {
+
+  XYPos now[AM_MAX_AVATAR];
+  int learned = 0;
+  int nAvatars = inference->nAvatars;
+
+  unsigned long turns = atomic_load_explicit(&inference->turns, memory_order_acquire);
+
+  for (int i = 0; i < nAvatars; i++) {
+    now[i].x = ntohl(turn->avatar_turn.Pos[i].x);
+    now[i].y = ntohl(turn->avatar_turn.Pos[i].y);
+  }
+
+
+  /* Nothing to compare the first broadcast with */
+
+  if (turns > 0) {
+
+    for (int i = 0; i < nAvatars; i++) {
+      if (atomic_load_explicit(&inference->attempted[i], memory_order_acquire) == ATTEMPT_PATH) {
+        continue;
+      }
+
+      int direction = StepDirection(now[i].x - inference->last[i].x, now[i].y - inference->last[i].y);
+
+      if (direction != M_NULL_MOVE) {
+        learned += MazeMapSet(map, inference->last[i].x, inference->last[i].y, direction, MAP_OPEN);
+      }
+    }
+
+    int mover = inference->lastTurnId;
+    int tried = atomic_load_explicit(&inference->attempted[mover], memory_order_acquire);
+
+    if (tried != M_NULL_MOVE && tried != ATTEMPT_PATH && now[mover].x == inference->last[mover].x &&
+        now[mover].y == inference->last[mover].y) {
+      learned += MazeMapSet(map, now[mover].x, now[mover].y, tried, MAP_BLOCKED);
+    }
+  }
+
+  memcpy(inference->last, now, nAvatars * sizeof(XYPos));
+  inference->lastTurnId = ntohl(turn->avatar_turn.TurnId);
+
+  if (inference->lastTurnId < 0 || inference->lastTurnId >= nAvatars) {
+    inference->lastTurnId = 0;
+  }
+
+  atomic_fetch_add_explicit(&inference->learned, learned, memory_order_relaxed);
+  atomic_store_explicit(&inference->turns, turns + 1, memory_order_release);
+
+  return(learned);
+}
@@ -0,0 +1,65 @@
+/* ========================================================================== */
+/* File: aminfer.h
+ *
+ * Author: Troy Palmer and Sean Cann
+ * Date: 6.4.2015
+ *
+ * Wall inference from AM_AVATAR_TURN broadcasts. Every broadcast carries
+ * the position of every avatar, so comparing it with the previous one shows
+ * how the whole group moved, not just the avatar reading it:
+ *
+ *  - an avatar that made a single move and is now one square away from
+ *    where it was crossed that edge, so the edge is open
+ *  - the avatar that had the previous turn and answered it with a single
+ *    AM_AVATAR_MOVE but is still on the same square hit a wall
+ *
+ * Avatars playing out an AM_AVATAR_PATH are left alone: several steps can
+ * end next to the starting square without crossing the edge between them.
+ *
+ * The broadcast does not say which way the last avatar tried to go, so each
+ * avatar publishes its attempt with TurnInferenceAttempt before sending it.
+ *
+ * A broadcast is applied once, by the avatar whose turn it names, before it
+ * plans its move; the other copies of the broadcast are not looked at. Only
+ * one avatar holds the turn at a time, so the stage needs no lock: the turn
+ * counter is stored with release ordering after the last positions are
+ * written, and loaded with acquire ordering by the next avatar to apply.
+ *
+ */
+/* ========================================================================== */
+
+#ifndef AMINFER_H
+#define AMINFER_H
+
+// ---------------- Prerequisites e.g., Requires "math.h"
+#include <stdatomic.h>                       // _Atomic
+#include "amazing.h"
+#include "mazemap.h"
+
+// ---------------- Constants
+
+#define ATTEMPT_PATH  -1                     // TurnInferenceAttempt: multi-step path
+
+// ---------------- Structures/Types
+
+typedef struct TurnInference {
+  int nAvatars;
+  XYPos last[AM_MAX_AVATAR];                 // positions in the last broadcast applied
+  int lastTurnId;                            // avatar whose move the next broadcast shows
+  _Atomic int attempted[AM_MAX_AVATAR];      // each avatar's last move, M_NULL_MOVE or ATTEMPT_PATH
+  _Atomic unsigned long turns;               // broadcasts applied so far
+  _Atomic unsigned long learned;             // edges added to the map by this stage
+} TurnInference;
+
+// ---------------- Prototypes/Macros
+
+void TurnInferenceInit(TurnInference *inference, int nAvatars);
+
+/* Records the direction avatarId is about to send, or ATTEMPT_PATH for an
+ * AM_AVATAR_PATH of more than one step */
+void TurnInferenceAttempt(TurnInference *inference, int avatarId, int direction);
+
+/* Applies one AM_AVATAR_TURN to map; returns the number of edges learned */
+int TurnInferenceApply(TurnInference *inference, MazeMap *map, const AM_Message *turn);
+
+#endif // AMINFER_H
@@ -0,0 +1,631 @@
+/* ========================================================================== */
+/* File: amnav.c
+ *
+ * Author: Troy Palmer and Sean Cann
+ * Date: 6.4.2015
+ *
+ * Overview: the move decisions described in amnav.h, taken out of
+ * AMStartup.c so the client and the offline simulator run the same code.
+ * The planners decide in amplanner.c; the wall follower, its route to
+ * avatar 0 and the dead-end pruning around both are here. The follower's
+ * two hands differ only in the table of bearings it turns by.
+ *
+ */
+/* ========================================================================== */
+
+// ---------------- System includes
+
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>                       // ntohl
+
+// ---------------- Local includes
+
+#include "amnav.h"
+
+// ---------------- Private variables
+
+/* Straight, right, backward and left for an avatar facing each M_*
+ * direction, with its right hand on the wall [0] or its left [1], which
+ * swaps right and left:
+ *
+ *      N
+ *    W   E
+ *      S
+ */
+static const int Bearings[2][M_NUM_DIRECTIONS][4] = {
+  { { M_WEST, M_NORTH, M_EAST, M_SOUTH },    // facing M_WEST
+    { M_NORTH, M_EAST, M_SOUTH, M_WEST },    // M_NORTH
+    { M_SOUTH, M_WEST, M_NORTH, M_EAST },    // M_SOUTH
+    { M_EAST, M_SOUTH, M_WEST, M_NORTH } },  // M_EAST
+  { { M_WEST, M_SOUTH, M_EAST, M_NORTH },
+    { M_NORTH, M_WEST, M_SOUTH, M_EAST },
+    { M_SOUTH, M_EAST, M_NORTH, M_WEST },
+    { M_EAST, M_NORTH, M_WEST, M_SOUTH } }
+};
+
+const char *const NavigatorStrategies[NAV_STRATEGIES] = { "follow", "follow-left", "frontier", "rendezvous" };
+
+// ---------------- Private prototypes
+
+static void Face(FollowerStep *step, int orientation, int hand);
+static void FollowWall(Navigator *navigator, const FollowerStep *from, int x, int y, int x0, int y0,
+                       FollowerStep *step, int hand);
+static int FollowerStepHolds(Navigator *navigator, const FollowerStep *step, int x, int y, int x0, int y0);
+static void PruneDeadEnds(Navigator *navigator, const AM_Message *turn, const XYPos *heading);
+static int Passable(Navigator *navigator, int x, int y, int direction, unsigned long *skipped);
+static int RouteToAvatarZero(Navigator *navigator, int x, int y, int x0, int y0);
+
+/* ========================================================================== */
+
+
+/*
+ *
+ * NavigatorParse - looks a -p name up in NavigatorStrategies
+ *
+ */
+int NavigatorParse(const char *name) {
+
+  for (int strategy = 0; strategy < NAV_STRATEGIES; strategy++) {
+    if (strcmp(name, NavigatorStrategies[strategy]) == 0) {
+      return(strategy);
+    }
+  }
+  return(-1);
+}
+
+
+/*
+ *
+ * NavigatorNew - the map, every wall unknown, and what reads and plans on it
+ *
+ * Returns the navigator, or NULL if any part could not be allocated
+ *
+ */
+Navigator *NavigatorNew(int width, int height, int nAvatars, int strategy, int prune, int thinkAhead) {
+
+  Navigator *navigator = calloc(1, sizeof(Navigator));
+  if (navigator == NULL) {
+    return(NULL);
+  }
+
+  navigator->width = width;
+  navigator->height = height;
+  navigator->nAvatars = nAvatars;
+  navigator->strategy = strategy;
+  navigator->thinkAhead = thinkAhead;
+  pthread_mutex_init(&navigator->routeLock, NULL);
+  atomic_init(&navigator->skippedMoves, 0);
+  atomic_init(&navigator->turnsAhead, 0);
+  TurnInferenceInit(&navigator->inference, nAvatars);
+
+  navigator->map = MazeMapNew(width, height);
+  if (navigator->map == NULL || !MazeMapTrackRegions(navigator->map)) {
+    NavigatorFree(navigator);
+    return(NULL);
+  }
+
+  if (strategy == NAV_FRONTIER || strategy == NAV_RENDEZVOUS) {
+    navigator->planner = PlannerNew(navigator->map, nAvatars,
+                                    strategy == NAV_FRONTIER ? PLANNER_FRONTIER : PLANNER_RENDEZVOUS);
+  }
+  else {
+    navigator->toAvatarZero = PathEngineNew(navigator->map, PATH_KNOWN);
+  }
+
+  if (prune) {
+    navigator->pruner = PrunerNew(navigator->map);
+  }
+
+  if ((navigator->planner == NULL && navigator->toAvatarZero == NULL) || (prune && navigator->pruner == NULL)) {
+    NavigatorFree(navigator);
+    return(NULL);
+  }
+  return(navigator);
+}
+
+
+/*
+ *
+ * NavigatorStart - the wall follower starts facing north, trying the side
+ *   its hand is on first
+ *
+ */
+void NavigatorStart(Navigator *navigator, AvatarNav *avatar, int avatarId) {
+
+  memset(avatar, 0, sizeof(AvatarNav));
+  avatar->avatarId = avatarId;
+  avatar->firstIteration = 1; // true
+
+  FollowerStep *follow = &avatar->follow;
+
+  Face(follow, M_NORTH, navigator->strategy == NAV_FOLLOW_LEFT);
+  follow->upcomingMove = follow->right;
+
+
+  /* Keep first avatar stationary */
+
+  if (avatarId == 0 && navigator->planner == NULL) {
+    follow->upcomingMove = M_NULL_MOVE;
+  }
+}
+
+
+/*
+ *
+ * NavigatorMove - the turn holder's moves for the broadcast turn, from the
+ *   navigator's strategy
+ *
+ * Returns the number of moves written
+ *
+ */
+int NavigatorMove(Navigator *navigator, AvatarNav *avatar, const AM_Message *turn, uint8_t *moves, int maxMoves) {
+
+  switch (navigator->strategy) {
+    case NAV_FOLLOW_LEFT:
+      return NavigatorMoveAs(navigator, avatar, turn, moves, maxMoves, NAV_FOLLOW_LEFT);
+    case NAV_FRONTIER:
+      return NavigatorMoveAs(navigator, avatar, turn, moves, maxMoves, NAV_FRONTIER);
+    case NAV_RENDEZVOUS:
+      return NavigatorMoveAs(navigator, avatar, turn, moves, maxMoves, NAV_RENDEZVOUS);
+    default:
+      return NavigatorMoveAs(navigator, avatar, turn, moves, maxMoves, NAV_FOLLOW);
+  }
+}
+
+
+/*
+ *
+ * NavigatorSettle - what the turn holder does once its moves are out, for
+ *   the navigator's strategy
+ *
+ */
+void NavigatorSettle(Navigator *navigator, AvatarNav *avatar, const AM_Message *turn) {
+
+  switch (navigator->strategy) {
+    case NAV_FOLLOW_LEFT:
+      NavigatorSettleAs(navigator, avatar, turn, NAV_FOLLOW_LEFT);
+      break;
+    case NAV_FRONTIER:
+      NavigatorSettleAs(navigator, avatar, turn, NAV_FRONTIER);
+      break;
+    case NAV_RENDEZVOUS:
+      NavigatorSettleAs(navigator, avatar, turn, NAV_RENDEZVOUS);
+      break;
+    default:
+      NavigatorSettleAs(navigator, avatar, turn, NAV_FOLLOW);
+  }
+}
+
+
+/*
+ *
+ * NavigatorReset - every wall unknown again and nothing planned, for
+ *   another maze of the same size and avatars, without allocating
+ *
+ */
+void NavigatorReset(Navigator *navigator) {
+
+  TurnInferenceInit(&navigator->inference, navigator->nAvatars);
+  MazeMapReset(navigator->map);
+
+  if (navigator->planner != NULL) {
+    PlannerReset(navigator->planner);
+  }
+  if (navigator->toAvatarZero != NULL) {
+    PathEngineReset(navigator->toAvatarZero);
+  }
+  if (navigator->pruner != NULL) {
+    PrunerReset(navigator->pruner);
+  }
+  atomic_store(&navigator->skippedMoves, 0);
+  atomic_store(&navigator->turnsAhead, 0);
+}
+
+
+/*
+ *
+ * NavigatorFree - releases the navigator and everything it made
+ *
+ */
+void NavigatorFree(Navigator *navigator) {
+
+  if (navigator != NULL) {
+    PlannerFree(navigator->planner);
+    PrunerFree(navigator->pruner);
+    PathEngineFree(navigator->toAvatarZero);
+    MazeMapFree(navigator->map);
+    pthread_mutex_destroy(&navigator->routeLock);
+    free(navigator);
+  }
+}
+
+
+/*
+ *
+ * FollowerMoves - the turn holder's move as a wall follower. The step for
+ *   how its last move went was usually worked out while the others took
+ *   their turns, and is taken as it is if the map around the avatar still
+ *   reads as it did then. A held avatar gets maxMoves null moves, which
+ *   servers playing AM_AVATAR_PATH keep without asking.
+ *
+ * Pseudocode: record how the last move went in the map, then take the step
+ * worked out ahead for that outcome or work it out now.
+ *
+ * Returns the number of moves written
+ *
+ */
+int FollowerMoves(Navigator *navigator, AvatarNav *avatar, const AM_Message *turn, uint8_t *moves, int maxMoves,
+                  int hand) {
+
+  int avatarId = avatar->avatarId;
+  FollowerStep *follow = &avatar->follow;
+
+  int x = ntohl(turn->avatar_turn.Pos[avatarId].x);
+  int y = ntohl(turn->avatar_turn.Pos[avatarId].y);
+  int x0 = ntohl(turn->avatar_turn.Pos[0].x);
+  int y0 = ntohl(turn->avatar_turn.Pos[0].y);
+
+
+  /* Keep immobile ones from moving */
+
+  if (follow->upcomingMove == M_NULL_MOVE) {
+    memset(moves, M_NULL_MOVE, maxMoves);
+    return(maxMoves);
+  }
+
+
+  /* Update maze data structure; the first turn has no last move */
+
+  if (avatar->firstIteration) {
+    follow->prevX = x;
+    follow->prevY = y;
+  }
+
+  int moved = (x != follow->prevX || y != follow->prevY);
+
+  if (moved || !avatar->firstIteration) {
+    MazeMapSet(navigator->map, follow->prevX, follow->prevY, follow->upcomingMove, moved ? MAP_OPEN : MAP_BLOCKED);
+  }
+  avatar->firstIteration = 0;
+
+
+  /* The step worked out ahead if it still holds, else a fresh one */
+
+  FollowerStep step = avatar->ahead[moved];
+  avatar->ahead[0].ready = avatar->ahead[1].ready = 0;
+
+  if (FollowerStepHolds(navigator, &step, x, y, x0, y0)) {
+    atomic_fetch_add(&navigator->turnsAhead, 1);
+  }
+  else {
+    FollowWall(navigator, follow, x, y, x0, y0, &step, hand);
+  }
+
+  *follow = step;
+
+
+  /* Frozen on the stationary avatar */
+
+  if (step.upcomingMove == M_NULL_MOVE) {
+    memset(moves, M_NULL_MOVE, maxMoves);
+    return(maxMoves);
+  }
+
+  moves[0] = step.upcomingMove;
+  return(1);
+}
+
+
+/*
+ *
+ * FollowerSettle - once the wall follower's move is out, seals the dead
+ *   ends the broadcast uncovered and, unless thinkAhead is off, works out
+ *   the next step for either way the move can go
+ *
+ */
+void FollowerSettle(Navigator *navigator, AvatarNav *avatar, const AM_Message *turn, int hand) {
+
+  FollowerStep *follow = &avatar->follow;
+
+  if (follow->upcomingMove == M_NULL_MOVE) {
+    PruneDeadEnds(navigator, turn, NULL);
+    atomic_fetch_add(&navigator->skippedMoves, follow->skipped);
+    follow->skipped = 0;
+    return;
+  }
+
+
+  /* The follower's move has not been played yet, so keep the square it heads for */
+
+  XYPos heading;
+  heading.x = follow->prevX + (follow->upcomingMove == M_EAST ? 1 : follow->upcomingMove == M_WEST ? -1 : 0);
+  heading.y = follow->prevY + (follow->upcomingMove == M_SOUTH ? 1 : follow->upcomingMove == M_NORTH ? -1 : 0);
+
+  PruneDeadEnds(navigator, turn, &heading);
+  atomic_fetch_add(&navigator->skippedMoves, follow->skipped);
+  follow->skipped = 0;
+
+
+  /* Think ahead: the square the move just sent leaves the avatar on, either way */
+
+  if (navigator->thinkAhead) {
+
+    int x0 = ntohl(turn->avatar_turn.Pos[0].x);
+    int y0 = ntohl(turn->avatar_turn.Pos[0].y);
+
+    FollowWall(navigator, follow, follow->prevX, follow->prevY, x0, y0, &avatar->ahead[0], hand);
+
+    if (heading.x < (uint32_t) navigator->width && heading.y < (uint32_t) navigator->height) {
+      FollowWall(navigator, follow, heading.x, heading.y, x0, y0, &avatar->ahead[1], hand);
+    }
+  }
+}
+
+
+/*
+ *
+ * PlannedSettle - once a planner's moves are out, seals the dead ends the
+ *   broadcast uncovered and, unless thinkAhead is off, searches ahead for
+ *   the route after the try just sent
+ *
+ */
+void PlannedSettle(Navigator *navigator, AvatarNav *avatar, const AM_Message *turn) {
+
+  PruneDeadEnds(navigator, turn, NULL);
+
+  if (navigator->thinkAhead) {
+    PlannerThinkAhead(navigator->planner, avatar->avatarId, turn);
+  }
+}
+
+
+/*
+ *
+ * Face - turns a wall follower to orientation, with its hand on the wall
+ *
+ */
+static void Face(FollowerStep *step, int orientation, int hand) {
+
+  const int *bearing = Bearings[hand][orientation];
+
+  step->orientation = orientation;
+  step->straight = bearing[0];
+  step->right = bearing[1];
+  step->backward = bearing[2];
+  step->left = bearing[3];
+}
+
+
+/*
+ *
+ * FollowWall - the wall follower's next step from state from, once its last
+ *   move has left it on (x,y): not moved means that move was blocked. Reads
+ *   the map as it stands, so it serves both on the turn and between turns,
+ *   and notes down what it read (see FollowerStepHolds).
+ *
+ */
+static void FollowWall(Navigator *navigator, const FollowerStep *from, int x, int y, int x0, int y0,
+                       FollowerStep *step, int hand) {
+
+  *step = *from;
+  step->x = x;
+  step->y = y;
+  step->joined = 0;
+  step->skipped = 0;
+  step->ready = 1;
+
+  int moved = (x != from->prevX || y != from->prevY);
+  int prevX = from->prevX, prevY = from->prevY;
+  int straight = from->straight, right = from->right, backward = from->backward, left = from->left;
+  int upcomingMove = from->upcomingMove;
+
+
+  /* What the ladders below read, with the side the last move tried as it turned out */
+
+  for (int direction = 0; direction < 4; direction++) {
+    step->sides[direction] = MazeMapGet(navigator->map, x, y, direction);
+  }
+  if (moved) {
+    step->sides[3 - upcomingMove] = MAP_OPEN; // M_WEST/M_EAST and M_NORTH/M_SOUTH add up to 3
+  }
+  else {
+    step->sides[upcomingMove] = MAP_BLOCKED;
+  }
+
+
+  /* If we haven't moved, make a different move */
+
+  if (!moved) {
+
+    // this if-ladder sets upcomingMove to be the next on the list (right -> straight -> left -> backward),
+    // skipping known walls: backward may be a sealed dead end, so it is only taken when nothing else is left
+    if (upcomingMove == right && Passable(navigator, prevX, prevY, straight, &step->skipped)) {
+      upcomingMove = straight;
+    }
+
+    else if ((upcomingMove == right || upcomingMove == straight) &&
+             Passable(navigator, prevX, prevY, left, &step->skipped)) {
+      upcomingMove = left;
+    }
+
+    else if (upcomingMove == backward) {
+      upcomingMove = Passable(navigator, prevX, prevY, right, &step->skipped) ? right :
+                     Passable(navigator, prevX, prevY, straight, &step->skipped) ? straight : left;
+    }
+
+    else {
+      upcomingMove = backward;
+    }
+  }
+
+
+  /* Freeze avatar if it finds the stationary one */
+
+  else if (x == x0 && y == y0) {
+    upcomingMove = M_NULL_MOVE;
+  }
+
+
+  /* If the move is successful, update orientation */
+
+  else {
+
+    prevX = x;
+    prevY = y;
+
+    Face(step, upcomingMove, hand); // orients the agent in the direction it just moved
+    straight = step->straight;
+    right = step->right;
+    backward = step->backward;
+    left = step->left;
+
+    /* Determine relative direction */
+
+    if (Passable(navigator, prevX, prevY, right, &step->skipped)) {
+      upcomingMove = right;
+    }
+
+    else if (Passable(navigator, prevX, prevY, straight, &step->skipped)) {
+      upcomingMove = straight;
+    }
+
+    else if (Passable(navigator, prevX, prevY, left, &step->skipped)) {
+      upcomingMove = left;
+    }
+
+    else if (upcomingMove == backward) {
+      upcomingMove = right;
+    }
+
+    else {
+      upcomingMove = backward;
+    }
+  }
+
+
+  /* Known passages already lead to avatar 0: take them, not the wall */
+
+  if (upcomingMove != M_NULL_MOVE) {
+    int direction = RouteToAvatarZero(navigator, prevX, prevY, x0, y0);
+    if (direction != M_NULL_MOVE) {
+      upcomingMove = direction;
+      step->joined = 1;
+    }
+  }
+
+  step->straight = straight;
+  step->right = right;
+  step->backward = backward;
+  step->left = left;
+  step->upcomingMove = upcomingMove;
+  step->prevX = prevX;
+  step->prevY = prevY;
+}
+
+
+/*
+ *
+ * FollowerStepHolds - whether a step worked out ahead is still the one
+ *   FollowWall would work out now. It read nothing but the four sides of
+ *   (x,y) and whether (x,y) was joined to avatar 0 (x0,y0), and once joined,
+ *   the maze being a tree, the known route there never changes.
+ *
+ */
+static int FollowerStepHolds(Navigator *navigator, const FollowerStep *step, int x, int y, int x0, int y0) {
+
+  if (!step->ready || step->x != x || step->y != y) {
+    return(0);
+  }
+
+  for (int direction = 0; direction < 4; direction++) {
+    if (MazeMapGet(navigator->map, x, y, direction) != step->sides[direction]) {
+      return(0);
+    }
+  }
+  return step->joined || !MazeMapJoined(navigator->map, x, y, x0, y0);
+}
+
+
+/*
+ *
+ * PruneDeadEnds - seals the dead ends the turn holder's broadcast has
+ *   uncovered, keeping every avatar's square and every square the planner
+ *   is sending an avatar to. Runs once the holder's move is out, since it
+ *   is the turns after it that go by the seals; the wall follower's move
+ *   has not been played then, so the square it heads for, unless NULL, is
+ *   kept as well.
+ *
+ */
+static void PruneDeadEnds(Navigator *navigator, const AM_Message *turn, const XYPos *heading) {
+
+  XYPos keep[PRUNE_MAX_KEEP];
+  int nKeep = 0;
+
+  if (navigator->pruner == NULL) {
+    return;
+  }
+
+  for (int i = 0; i < navigator->nAvatars; i++) {
+    keep[nKeep].x = ntohl(turn->avatar_turn.Pos[i].x);
+    keep[nKeep].y = ntohl(turn->avatar_turn.Pos[i].y);
+    nKeep++;
+  }
+  if (navigator->planner != NULL) {
+    nKeep += PlannerKeep(navigator->planner, keep + nKeep);
+  }
+  if (heading != NULL) {
+    keep[nKeep++] = *heading;
+  }
+
+  PrunerUpdate(navigator->pruner, keep, nKeep);
+}
+
+
+/*
+ *
+ * Passable - whether the wall follower should try the side of (x,y) in
+ *   direction. A sealed side reads as a wall; the follower would have gone
+ *   in and out of the dead end behind it, two moves a square, so those
+ *   moves are added to skipped.
+ *
+ */
+static int Passable(Navigator *navigator, int x, int y, int direction, unsigned long *skipped) {
+
+  if (MazeMapGet(navigator->map, x, y, direction) != MAP_BLOCKED) {
+    return(1);
+  }
+  if (navigator->pruner != NULL) {
+    *skipped += 2 * PrunerSealedBehind(navigator->pruner, x, y, direction);
+  }
+  return(0);
+}
+
+
+/*
+ *
+ * RouteToAvatarZero - the wall follower's way out of exploring: as soon as
+ *   known passages join (x,y) to avatar 0 on (x0,y0), the next step along
+ *   the shortest of them. The engine is shared by every avatar, and one
+ *   thinking ahead may call while the turn holder does, so it is used under
+ *   a lock.
+ *
+ * Returns an M_* direction, or M_NULL_MOVE while (x,y) is not joined
+ *
+ */
+static int RouteToAvatarZero(Navigator *navigator, int x, int y, int x0, int y0) {
+
+  if (navigator->toAvatarZero == NULL || !MazeMapJoined(navigator->map, x, y, x0, y0)) {
+    return(M_NULL_MOVE);
+  }
+
+  pthread_mutex_lock(&navigator->routeLock);
+
+  if (navigator->toAvatarZero->root != y0 * navigator->width + x0) {
+    PathEngineRoot(navigator->toAvatarZero, x0, y0);
+  }
+  int direction = PathEngineNextStep(navigator->toAvatarZero, x, y);
+
+  pthread_mutex_unlock(&navigator->routeLock);
+  return(direction);
+}
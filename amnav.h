@@ -0,0 +1,178 @@
+/* ========================================================================== */
+/* File: amnav.h
+ *
+ * Author: Troy Palmer and Sean Cann
+ * Date: 6.4.2015
+ *
+ * How avatars choose their moves, apart from how the moves reach the
+ * server. A Navigator holds what every avatar of one maze shares: the map
+ * of walls found so far, the inference that reads walls off each turn
+ * broadcast, the planner or the wall follower's route to avatar 0, and the
+ * dead-end pruner. Each avatar keeps its own AvatarNav.
+ *
+ * The turn holder answers a broadcast in two calls. NavigatorMove learns
+ * from the broadcast and writes the moves to send; NavigatorSettle, once
+ * they are sent, seals the dead ends the broadcast uncovered and works out
+ * the avatar's next move for both outcomes of this one (unless thinkAhead
+ * is off). The client sends the moves over its transport in between; the
+ * offline simulator (amsim.c) plays them on a maze of its own.
+ *
+ * How the moves are picked is the navigator's strategy, chosen once with
+ * -p: the right-hand wall follower (avatar 0 stays put and the rest follow
+ * the wall until known passages lead to it), the same with the left hand,
+ * or one of the planners. Each strategy is a pair of calls, one for the
+ * moves and one to settle after them. NavigatorMoveAs and NavigatorSettleAs
+ * dispatch on a strategy given as a constant, so a loop written for one
+ * strategy compiles to direct calls with no branch or function pointer per
+ * move; NavigatorMove and NavigatorSettle pick the strategy at run time.
+ *
+ * Every avatar thread may share one Navigator. Only the turn holder calls
+ * NavigatorMove, and the parts a settling avatar shares with the next turn
+ * holder are lock-free or behind locks of their own.
+ *
+ */
+/* ========================================================================== */
+
+#ifndef AMNAV_H
+#define AMNAV_H
+
+// ---------------- Prerequisites e.g., Requires "math.h"
+#include <pthread.h>
+#include <stdatomic.h>                       // _Atomic
+#include <stdint.h>                          // uint8_t
+#include "amazing.h"
+#include "aminfer.h"
+#include "ampath.h"
+#include "amplanner.h"
+#include "amprune.h"
+#include "mazemap.h"
+
+// ---------------- Constants
+
+/* Strategies */
+#define NAV_FOLLOW       0                   // right-hand wall follower, avatar 0 stays put
+#define NAV_FOLLOW_LEFT  1                   // the same with the left hand on the wall
+#define NAV_FRONTIER     2                   // cooperative frontier exploration (amplanner.h)
+#define NAV_RENDEZVOUS   3                   // as frontier, meeting where the last avatar arrives soonest
+#define NAV_STRATEGIES   4
+
+// ---------------- Structures/Types
+
+/* The wall follower's navigation state after a turn, and what it was
+ * worked out from */
+typedef struct FollowerStep {
+  int straight, right, backward, left;  // relative to avatar, right and left swapped for the left hand
+  int orientation, upcomingMove;        // relative to environment
+  int prevX, prevY;
+  int x, y;                             // where the last move left the avatar
+  int sides[4];                         // the map around (x,y) as the step read it
+  int joined;                           // upcomingMove is on a known route to avatar 0
+  unsigned long skipped;                // sealed moves Passable passed over
+  int ready;                            // worked out ahead and not yet taken
+} FollowerStep;
+
+/* One avatar's own navigation state */
+typedef struct AvatarNav {
+  int avatarId;
+  int firstIteration;
+  FollowerStep follow;                  // wall follower state
+  FollowerStep ahead[2];                // next step if the last move is blocked [0] or goes through [1]
+} AvatarNav;
+
+/* Navigation shared by every avatar of one maze */
+typedef struct Navigator {
+  MazeMap *map;                              // walls found so far
+  int width, height, nAvatars;
+  int strategy;                              // NAV_*
+  TurnInference inference;                   // walls read off every broadcast
+  Planner *planner;                          // frontier/rendezvous, NULL for the wall follower
+  Pruner *pruner;                            // seals dead ends, NULL to keep them
+  PathEngine *toAvatarZero;                  // wall follower: known routes to avatar 0
+  pthread_mutex_t routeLock;
+  int thinkAhead;                            // work out moves between turns
+
+  _Atomic unsigned long skippedMoves;        // wall-follower moves not spent in sealed dead ends
+  _Atomic unsigned long turnsAhead;          // wall-follower moves that were worked out ahead
+} Navigator;
+
+// ---------------- Prototypes/Macros
+
+/* Names of the strategies for -p, indexed by NAV_* */
+extern const char *const NavigatorStrategies[NAV_STRATEGIES];
+
+/* The NAV_* strategy called name, -1 if there is none */
+int NavigatorParse(const char *name);
+
+/* Navigation for nAvatars in a width x height maze, every wall unknown,
+ * with a NAV_* strategy; prune seals dead ends. NULL on failure */
+Navigator *NavigatorNew(int width, int height, int nAvatars, int strategy, int prune, int thinkAhead);
+
+/* Resets avatarId's own state; avatar 0 of the wall follower stays put */
+void NavigatorStart(Navigator *navigator, AvatarNav *avatar, int avatarId);
+
+/* Learns from the AM_AVATAR_TURN in turn, which names avatar as the turn
+ * holder, and writes the moves it should answer with (at most maxMoves; 1
+ * unless the server plays AM_AVATAR_PATH). Returns how many */
+int NavigatorMove(Navigator *navigator, AvatarNav *avatar, const AM_Message *turn, uint8_t *moves, int maxMoves);
+
+/* Work left from NavigatorMove once its moves are sent: pruning, and with
+ * thinkAhead the next move for either outcome */
+void NavigatorSettle(Navigator *navigator, AvatarNav *avatar, const AM_Message *turn);
+
+/* Starts the navigator over, as NavigatorNew left it, for another maze of
+ * the same size. Call between mazes, with no turn in progress */
+void NavigatorReset(Navigator *navigator);
+
+void NavigatorFree(Navigator *navigator);
+
+/* The strategy interface: the wall follower's moves and settling, with
+ * the left hand on the wall if hand is 1, and the planners' settling (their
+ * moves are PlannerNextMoves) */
+int FollowerMoves(Navigator *navigator, AvatarNav *avatar, const AM_Message *turn, uint8_t *moves, int maxMoves,
+                  int hand);
+
+void FollowerSettle(Navigator *navigator, AvatarNav *avatar, const AM_Message *turn, int hand);
+
+void PlannedSettle(Navigator *navigator, AvatarNav *avatar, const AM_Message *turn);
+
+/* NavigatorMove for navigator->strategy given as a constant, which leaves a
+ * direct call to that strategy once inlined. Always inlined, as must be
+ * every caller passing strategy on: GCC would rather keep one copy that
+ * tests it at run time */
+__attribute__((always_inline))
+static inline int NavigatorMoveAs(Navigator *navigator, AvatarNav *avatar, const AM_Message *turn, uint8_t *moves,
+                                  int maxMoves, const int strategy) {
+
+  int nMoves;
+
+  /* Learn from everyone's last moves; only the turn holder does this */
+
+  TurnInferenceApply(&navigator->inference, navigator->map, turn);
+
+  if (strategy == NAV_FRONTIER || strategy == NAV_RENDEZVOUS) {
+    nMoves = PlannerNextMoves(navigator->planner, avatar->avatarId, turn, moves, maxMoves);
+  }
+  else {
+    nMoves = FollowerMoves(navigator, avatar, turn, moves, maxMoves, strategy == NAV_FOLLOW_LEFT);
+  }
+
+  /* So the next turn holder can tell how they went */
+
+  TurnInferenceAttempt(&navigator->inference, avatar->avatarId, nMoves == 1 ? moves[0] : ATTEMPT_PATH);
+  return(nMoves);
+}
+
+/* NavigatorSettle for navigator->strategy given as a constant */
+__attribute__((always_inline))
+static inline void NavigatorSettleAs(Navigator *navigator, AvatarNav *avatar, const AM_Message *turn,
+                                     const int strategy) {
+
+  if (strategy == NAV_FRONTIER || strategy == NAV_RENDEZVOUS) {
+    PlannedSettle(navigator, avatar, turn);
+  }
+  else {
+    FollowerSettle(navigator, avatar, turn, strategy == NAV_FOLLOW_LEFT);
+  }
+}
+
+#endif // AMNAV_H
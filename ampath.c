@@ -0,0 +1,415 @@
+/* ========================================================================== */
+/* File: ampath.c
+ *
+ * Author: Troy Palmer and Sean Cann
+ * Date: 6.4.2015
+ *
+ * Overview: the incremental search described in ampath.h. Squares are
+ * numbered y * width + x. Each square has g, its distance as last settled,
+ * and rhs, one more than the smallest g among its passable neighbours (0 at
+ * the root). A square whose two values differ is queued on a binary heap
+ * keyed by the smaller of them; settling the lowest key first is Dijkstra's
+ * order, and a learned edge only disturbs the squares on either side of it,
+ * whose changes then spread as far as they matter and no further.
+ *
+ */
+/* ========================================================================== */
+
+// ---------------- System includes
+
+#include <limits.h>                          // INT_MAX
+#include <stdlib.h>
+#include <string.h>                          // memset
+
+// ---------------- Local includes
+
+#include "amazing.h"
+#include "ampath.h"
+
+// ---------------- Constant definitions
+
+#define UNREACHED     (INT_MAX / 2)          // distance with room for + 1
+#define CHANGE_BATCH  256                    // log entries read at a time
+
+// ---------------- Private prototypes
+
+static int Neighbour(const PathEngine *engine, int square, int direction);
+static int Key(const PathEngine *engine, int square);
+static void HeapSwap(PathEngine *engine, int i, int j);
+static void HeapSift(PathEngine *engine, int i);
+static void HeapSet(PathEngine *engine, int square);
+static void HeapRemove(PathEngine *engine, int square);
+static void UpdateSquare(PathEngine *engine, int square);
+static void ApplyChanges(PathEngine *engine);
+static void Repair(PathEngine *engine, int square);
+
+/* ========================================================================== */
+
+
+/*
+ *
+ * Neighbour - the square across the side of square in direction, if that
+ *   edge is passable in the engine's mode
+ *
+ * Returns the neighbour, or -1
+ *
+ */
+static int Neighbour(const PathEngine *engine, int square, int direction) {
+
+  int x = square % engine->width, y = square / engine->width;
+  int nx = x + (direction == M_EAST ? 1 : direction == M_WEST ? -1 : 0);
+  int ny = y + (direction == M_SOUTH ? 1 : direction == M_NORTH ? -1 : 0);
+
+  if (nx < 0 || ny < 0 || nx >= engine->width || ny >= engine->height) {
+    return(-1);
+  }
+
+  int state = MazeMapGet(engine->map, x, y, direction);
+
+  if (state == MAP_OPEN || (engine->optimistic && state == MAP_UNKNOWN)) {
+    return ny * engine->width + nx;
+  }
+  return(-1);
+}
+
+
+/*
+ *
+ * Key - heap order of a square: the smaller of its g and rhs
+ *
+ */
+static int Key(const PathEngine *engine, int square) {
+
+  return engine->g[square] < engine->rhs[square] ? engine->g[square] : engine->rhs[square];
+}
+
+
+/*
+ *
+ * HeapSwap - exchanges two heap entries, keeping slot in step
+ *
+ */
+static void HeapSwap(PathEngine *engine, int i, int j) {
+
+  int a = engine->heap[i], b = engine->heap[j];
+
+  engine->heap[i] = b;
+  engine->heap[j] = a;
+  engine->slot[b] = i;
+  engine->slot[a] = j;
+}
+
+
+/*
+ *
+ * HeapSift - moves the entry at i up or down until its key is in order
+ *
+ */
+static void HeapSift(PathEngine *engine, int i) {
+
+  while (i > 0 && Key(engine, engine->heap[i]) < Key(engine, engine->heap[(i - 1) / 2])) {
+    HeapSwap(engine, i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+
+  for (;;) {
+    int smallest = i, left = 2 * i + 1, right = 2 * i + 2;
+
+    if (left < engine->nHeap && Key(engine, engine->heap[left]) < Key(engine, engine->heap[smallest])) {
+      smallest = left;
+    }
+    if (right < engine->nHeap && Key(engine, engine->heap[right]) < Key(engine, engine->heap[smallest])) {
+      smallest = right;
+    }
+    if (smallest == i) {
+      return;
+    }
+    HeapSwap(engine, i, smallest);
+    i = smallest;
+  }
+}
+
+
+/*
+ *
+ * HeapSet - queues square, or reorders it if its key changed
+ *
+ */
+static void HeapSet(PathEngine *engine, int square) {
+
+  if (engine->slot[square] == -1) {
+    engine->slot[square] = engine->nHeap;
+    engine->heap[engine->nHeap++] = square;
+  }
+  HeapSift(engine, engine->slot[square]);
+}
+
+
+/*
+ *
+ * HeapRemove - takes square off the heap if it is on it
+ *
+ */
+static void HeapRemove(PathEngine *engine, int square) {
+
+  int i = engine->slot[square];
+  if (i == -1) {
+    return;
+  }
+
+  HeapSwap(engine, i, --engine->nHeap);
+  engine->slot[square] = -1;
+
+  if (i < engine->nHeap) {
+    HeapSift(engine, i);
+  }
+}
+
+
+/*
+ *
+ * UpdateSquare - recomputes rhs from the neighbours and queues the square
+ *   if it no longer agrees with g
+ *
+ */
+static void UpdateSquare(PathEngine *engine, int square) {
+
+  if (square != engine->root) {
+
+    int best = UNREACHED;
+
+    for (int direction = 0; direction < 4; direction++) {
+      int neighbour = Neighbour(engine, square, direction);
+      if (neighbour != -1 && engine->g[neighbour] + 1 < best) {
+        best = engine->g[neighbour] + 1;
+      }
+    }
+    engine->rhs[square] = best;
+  }
+
+  if (engine->g[square] != engine->rhs[square]) {
+    HeapSet(engine, square);
+  }
+  else {
+    HeapRemove(engine, square);
+  }
+}
+
+
+/*
+ *
+ * ApplyChanges - updates the squares on both sides of every edge the map
+ *   has learned since the last call
+ *
+ */
+static void ApplyChanges(PathEngine *engine) {
+
+  size_t n;
+
+  while ((n = MazeMapChanges(engine->map, engine->cursor, engine->changes, CHANGE_BATCH)) > 0) {
+
+    engine->cursor += n;
+    engine->updates += n;
+
+    for (size_t i = 0; i < n; i++) {
+
+      int x, y, direction;
+      MazeMapEdgeSide(engine->map, engine->changes[i], &x, &y, &direction);
+
+      int ox = direction == M_WEST ? x - 1 : x;
+      int oy = direction == M_NORTH ? y - 1 : y;
+
+      if (x < engine->width && y < engine->height) {
+        UpdateSquare(engine, y * engine->width + x);
+      }
+      if (ox >= 0 && oy >= 0) {
+        UpdateSquare(engine, oy * engine->width + ox);
+      }
+    }
+  }
+}
+
+
+/*
+ *
+ * Repair - settles squares in key order until square is settled
+ *
+ * Pseudocode: while the lowest key is below square's, or square itself is
+ * queued, take the lowest square off the heap. If its g was too high, it
+ * takes rhs and its neighbours are rechecked against it; if too low (a
+ * path through it was cut), g is dropped to unreached so it and its
+ * neighbours find their next best way to the root.
+ *
+ */
+static void Repair(PathEngine *engine, int square) {
+
+  while (engine->nHeap > 0 &&
+         (Key(engine, engine->heap[0]) < Key(engine, square) || engine->g[square] != engine->rhs[square])) {
+
+    int top = engine->heap[0];
+    engine->expanded++;
+
+    if (engine->g[top] > engine->rhs[top]) {
+      engine->g[top] = engine->rhs[top];
+      HeapRemove(engine, top);
+    }
+    else {
+      engine->g[top] = UNREACHED;
+      UpdateSquare(engine, top);
+    }
+
+    for (int direction = 0; direction < 4; direction++) {
+      int neighbour = Neighbour(engine, top, direction);
+      if (neighbour != -1) {
+        UpdateSquare(engine, neighbour);
+      }
+    }
+  }
+}
+
+
+/*
+ *
+ * PathEngineNew - allocates an engine with no root
+ *
+ * Returns the engine, or NULL on failure
+ *
+ */
+PathEngine *PathEngineNew(MazeMap *map, int mode) {
+
+  PathEngine *engine = calloc(1, sizeof(PathEngine));
+  if (engine == NULL) {
+    return(NULL);
+  }
+
+  int nSquares = map->width * map->height;
+
+  engine->map = map;
+  engine->width = map->width;
+  engine->height = map->height;
+  engine->optimistic = (mode == PATH_OPTIMISTIC);
+  engine->root = -1;
+  engine->g = calloc(nSquares, sizeof(int));
+  engine->rhs = calloc(nSquares, sizeof(int));
+  engine->heap = calloc(nSquares, sizeof(int));
+  engine->slot = calloc(nSquares, sizeof(int));
+  engine->changes = calloc(CHANGE_BATCH, sizeof(long));
+
+  if (engine->g == NULL || engine->rhs == NULL || engine->heap == NULL || engine->slot == NULL ||
+      engine->changes == NULL || !MazeMapTrack(map)) {
+    PathEngineFree(engine);
+    return(NULL);
+  }
+  return(engine);
+}
+
+
+/*
+ *
+ * PathEngineRoot - forgets every distance and queues (x,y) as the root.
+ *   The map is read as it stands, so log entries so far are skipped.
+ *
+ */
+void PathEngineRoot(PathEngine *engine, int x, int y) {
+
+  int nSquares = engine->width * engine->height;
+
+  for (int square = 0; square < nSquares; square++) {
+    engine->g[square] = engine->rhs[square] = UNREACHED;
+    engine->slot[square] = -1;
+  }
+  engine->nHeap = 0;
+  engine->cursor = atomic_load_explicit(&engine->map->nLogged, memory_order_acquire);
+
+  engine->root = y * engine->width + x;
+  engine->rhs[engine->root] = 0;
+  HeapSet(engine, engine->root);
+}
+
+
+/*
+ *
+ * PathEngineDistance - brings the map up to date and settles (x,y)
+ *
+ * Returns the number of moves to the root, or -1 if it cannot be reached
+ *
+ */
+int PathEngineDistance(PathEngine *engine, int x, int y) {
+
+  if (engine->root == -1 || x < 0 || y < 0 || x >= engine->width || y >= engine->height) {
+    return(-1);
+  }
+
+  int square = y * engine->width + x;
+
+  ApplyChanges(engine);
+  Repair(engine, square);
+
+  return engine->g[square] >= UNREACHED ? -1 : engine->g[square];
+}
+
+
+/*
+ *
+ * PathEngineNextStep - the first move of a shortest path to the root. Once
+ *   (x,y) is settled, a neighbour with g one lower is settled too.
+ *
+ * Returns an M_* direction, M_NULL_MOVE if there is nowhere to go
+ *
+ */
+int PathEngineNextStep(PathEngine *engine, int x, int y) {
+
+  int distance = PathEngineDistance(engine, x, y);
+  int square = y * engine->width + x;
+
+  if (distance <= 0) {
+    return(M_NULL_MOVE);
+  }
+
+  for (int direction = 0; direction < 4; direction++) {
+    int neighbour = Neighbour(engine, square, direction);
+    if (neighbour != -1 && engine->g[neighbour] == distance - 1) {
+      return(direction);
+    }
+  }
+  return(M_NULL_MOVE);
+}
+
+
+/*
+ *
+ * PathEngineReset - back to no root and nothing read from the map's log,
+ *   as PathEngineNew leaves it
+ *
+ */
+void PathEngineReset(PathEngine *engine) {
+
+  size_t nSquares = (size_t) engine->width * engine->height;
+
+  memset(engine->g, 0, nSquares * sizeof(int));
+  memset(engine->rhs, 0, nSquares * sizeof(int));
+  memset(engine->slot, 0, nSquares * sizeof(int));
+  engine->root = -1;
+  engine->nHeap = 0;
+  engine->cursor = 0;
+  engine->expanded = 0;
+  engine->updates = 0;
+}
+
+
+/*
+ *
+ * PathEngineFree - frees an engine returned by PathEngineNew
+ *
+ */
+void PathEngineFree(PathEngine *engine) {
+
+  if (engine != NULL) {
+    free(engine->g);
+    free(engine->rhs);
+    free(engine->heap);
+    free(engine->slot);
+    free(engine->changes);
+    free(engine);
+  }
+}
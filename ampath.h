@@ -0,0 +1,83 @@
+/* ========================================================================== */
+/* File: ampath.h
+ *
+ * Author: Troy Palmer and Sean Cann
+ * Date: 6.4.2015
+ *
+ * Incremental shortest paths over the shared maze map (Lifelong Planning
+ * A* with a zero heuristic, the search D* Lite runs on). The engine keeps
+ * every square's distance to one root square, such as a meeting point, and
+ * when edges are learned it repairs only the squares whose distance they
+ * change instead of searching the maze again.
+ *
+ * Distances can be measured through known passages only, or optimistically,
+ * treating every edge not yet known to be a wall as open. Either way an
+ * edge only ever goes from unknown to known, so each learned edge is one
+ * update; the engine reads them from the map's log (MazeMapTrack) when it
+ * is next asked for a distance.
+ *
+ * Repairs are also lazy: a query stops as soon as the square asked about is
+ * settled, so an avatar near the root does not pay for squares far away.
+ *
+ * An engine is not thread safe: it is meant to sit behind the lock of
+ * whatever plans the moves (amplanner.h), or in one thread of its own.
+ *
+ */
+/* ========================================================================== */
+
+#ifndef AMPATH_H
+#define AMPATH_H
+
+// ---------------- Prerequisites e.g., Requires "math.h"
+#include <stddef.h>                          // size_t
+#include "mazemap.h"
+
+// ---------------- Constants
+
+#define PATH_KNOWN       0                   // only known open edges are passable
+#define PATH_OPTIMISTIC  1                   // every edge but a known wall is passable
+
+// ---------------- Structures/Types
+
+typedef struct PathEngine {
+  MazeMap *map;
+  int width, height;
+  int optimistic;
+  int root;                                  // square distances lead to, -1 if none
+
+  int *g;                                    // settled distance of each square
+  int *rhs;                                  // distance its neighbours' g values imply
+  int *heap;                                 // squares where the two differ, by key
+  int *slot;                                 // each square's heap index, -1 if not queued
+  int nHeap;
+
+  size_t cursor;                             // map log entries already applied
+  long *changes;                             // scratch for reading the log
+
+  unsigned long expanded;                    // squares taken off the heap
+  unsigned long updates;                     // learned edges applied
+} PathEngine;
+
+// ---------------- Prototypes/Macros
+
+/* Engine over map in mode PATH_KNOWN or PATH_OPTIMISTIC. Turns on the map's
+ * change log, so create it before the map is shared; NULL on failure */
+PathEngine *PathEngineNew(MazeMap *map, int mode);
+
+/* Measures distances to (x,y) from now on, starting over */
+void PathEngineRoot(PathEngine *engine, int x, int y);
+
+/* Moves from (x,y) to the root through passable edges, after applying any
+ * edges learned since the last call; -1 if there is no such path */
+int PathEngineDistance(PathEngine *engine, int x, int y);
+
+/* First M_* direction on a shortest path from (x,y) to the root;
+ * M_NULL_MOVE at the root or when there is no path */
+int PathEngineNextStep(PathEngine *engine, int x, int y);
+
+/* As PathEngineNew left it, for a map that has been reset (MazeMapReset) */
+void PathEngineReset(PathEngine *engine);
+
+void PathEngineFree(PathEngine *engine);
+
+#endif // AMPATH_H
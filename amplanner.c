@@ -0,0 +1,852 @@
+/* ========================================================================== */
+/* File: amplanner.c
+ *
+ * Author: Troy Palmer and Sean Cann
+ * Date: 6.4.2015
+ *
+ * Overview: the frontier planner described in amplanner.h. Squares are
+ * numbered y * width + x. Searches are breadth-first over edges the map
+ * knows to be open; a per-square stamp marks the squares the current search
+ * has reached, so nothing is cleared between searches.
+ *
+ * Since the maze is perfect, an unknown edge between two squares that are
+ * already joined by known passages would close a cycle, so a search that
+ * comes across one records it as a wall instead of trying it. The map's
+ * regions catch this even when the passage joining them is one the search
+ * has not reached yet.
+ *
+ * A search ahead reads the edge of the pending try as the outcome it plans
+ * for. Planning for a try that went through, the regions do not have that
+ * edge yet, so whether two squares are joined is asked through it as well;
+ * and since the cycles it finds may run through it, it only records the
+ * walls the regions confirm on their own.
+ *
+ */
+/* ========================================================================== */
+
+// ---------------- System includes
+
+#include <limits.h>                          // INT_MAX
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>                       // ntohl
+
+// ---------------- Local includes
+
+#include "amplanner.h"
+
+// ---------------- Constant definitions
+
+#define NO_DIRECTION 0xff
+
+// ---------------- Private prototypes
+
+static void Step(int direction, int *dx, int *dy);
+static long EdgeCode(const Planner *planner, int x, int y, int direction);
+static int Claimed(const Planner *planner, int avatarId, long code);
+static int Unknown(const Planner *planner, long code);
+static int Joined(const Planner *planner, int x, int y, int nx, int ny, long assumed, int assumedState);
+static int DistanceToOthers(const XYPos *pos, int nAvatars, int avatarId, int x, int y);
+static uint32_t NextStamp(Planner *planner, PlannerScratch *scratch);
+static int ScratchNew(PlannerScratch *scratch, size_t nSquares);
+static int Search(Planner *planner, PlannerScratch *scratch, int avatarId, const XYPos *pos, long assumed,
+                  int assumedState, PlannerRoute *route);
+static int TakeAhead(Planner *planner, int avatarId, XYPos at, int outcome);
+static void CheckConnected(Planner *planner, const XYPos *pos, int avatarId);
+static XYPos ChooseMeeting(Planner *planner, const XYPos *pos, int avatarId);
+static int Converge(Planner *planner, XYPos at, uint8_t *moves, int maxMoves);
+
+/* ========================================================================== */
+
+
+/*
+ *
+ * Step - converts an M_* direction into an (x,y) offset
+ *
+ */
+static void Step(int direction, int *dx, int *dy) {
+
+  *dx = direction == M_EAST ? 1 : direction == M_WEST ? -1 : 0;
+  *dy = direction == M_SOUTH ? 1 : direction == M_NORTH ? -1 : 0;
+}
+
+
+/*
+ *
+ * EdgeCode - one number for an edge whichever of its two squares it is seen
+ *   from: 2k for the north side of square k and 2k + 1 for its west side.
+ *   (x,y) and its neighbour in direction must both be inside the maze.
+ *
+ */
+static long EdgeCode(const Planner *planner, int x, int y, int direction) {
+
+  long square = (long) y * planner->width + x;
+
+  switch (direction) {
+    case M_NORTH:
+      return 2 * square;
+    case M_SOUTH:
+      return 2 * (square + planner->width);
+    case M_WEST:
+      return 2 * square + 1;
+    default:
+      return 2 * (square + 1) + 1;
+  }
+}
+
+
+/*
+ *
+ * Claimed - whether an avatar other than avatarId is headed for edge code
+ *
+ */
+static int Claimed(const Planner *planner, int avatarId, long code) {
+
+  for (int i = 0; i < planner->nAvatars; i++) {
+    if (i != avatarId && planner->routes[i].target == code) {
+      return(1);
+    }
+  }
+  return(0);
+}
+
+
+/*
+ *
+ * Unknown - whether the map has yet to learn edge code
+ *
+ */
+static int Unknown(const Planner *planner, long code) {
+
+  int square = code / 2, x = square % planner->width, y = square / planner->width;
+
+  return MazeMapGet(planner->map, x, y, code % 2 ? M_WEST : M_NORTH) == MAP_UNKNOWN;
+}
+
+
+/*
+ *
+ * Joined - whether known passages join (x,y) and (nx,ny), counting edge
+ *   assumed as one of them when assumedState is MAP_OPEN
+ *
+ */
+static int Joined(const Planner *planner, int x, int y, int nx, int ny, long assumed, int assumedState) {
+
+  MazeMap *map = planner->map;
+
+  if (MazeMapJoined(map, x, y, nx, ny)) {
+    return(1);
+  }
+  if (assumed == -1 || assumedState != MAP_OPEN) {
+    return(0);
+  }
+
+  int square = assumed / 2, ux = square % planner->width, uy = square / planner->width;
+  int vx = assumed % 2 ? ux - 1 : ux, vy = assumed % 2 ? uy : uy - 1;
+
+  return (MazeMapJoined(map, x, y, ux, uy) && MazeMapJoined(map, vx, vy, nx, ny)) ||
+         (MazeMapJoined(map, x, y, vx, vy) && MazeMapJoined(map, ux, uy, nx, ny));
+}
+
+
+/*
+ *
+ * DistanceToOthers - Manhattan distance from (x,y) to the closest other
+ *   avatar, used to break ties between equally near frontiers
+ *
+ */
+static int DistanceToOthers(const XYPos *pos, int nAvatars, int avatarId, int x, int y) {
+
+  int best = 0x7fffffff;
+
+  for (int i = 0; i < nAvatars; i++) {
+    if (i != avatarId) {
+      int distance = abs((int) pos[i].x - x) + abs((int) pos[i].y - y);
+      if (distance < best) {
+        best = distance;
+      }
+    }
+  }
+  return(best);
+}
+
+
+/*
+ *
+ * NextStamp - a fresh mark for the seen array, clearing it on wraparound
+ *
+ */
+static uint32_t NextStamp(Planner *planner, PlannerScratch *scratch) {
+
+  if (++scratch->stamp == 0) {
+    memset(scratch->seen, 0, (size_t) planner->width * planner->height * sizeof(uint32_t));
+    scratch->stamp = 1;
+  }
+  return(scratch->stamp);
+}
+
+
+/*
+ *
+ * ScratchNew - allocates search scratch for nSquares squares
+ *
+ * Returns 1 on success and 0 on failure (what was allocated is left for
+ * PlannerFree)
+ *
+ */
+static int ScratchNew(PlannerScratch *scratch, size_t nSquares) {
+
+  scratch->seen = calloc(nSquares, sizeof(uint32_t));
+  scratch->queue = calloc(nSquares, sizeof(int));
+  scratch->via = calloc(nSquares, sizeof(uint8_t));
+
+  return scratch->seen != NULL && scratch->queue != NULL && scratch->via != NULL;
+}
+
+
+/*
+ *
+ * Search - plans a route for avatarId to its nearest unclaimed frontier
+ *
+ * Pseudocode: breadth-first from the avatar over open edges, one distance
+ * at a time. Unknown edges to squares not yet reached are frontiers; within
+ * the first distance that has any, take the unclaimed one whose far square
+ * is closest to another avatar. If every frontier is claimed, share the
+ * nearest one. The route is the search's way back to the frontier's square
+ * followed by the try itself, written to route.
+ *
+ * Edge assumed, unless -1, is read as assumedState whatever the map says:
+ * that is a search ahead.
+ *
+ * Returns 1 if a route was planned and 0 if no frontier is reachable
+ *
+ */
+static int Search(Planner *planner, PlannerScratch *scratch, int avatarId, const XYPos *pos, long assumed,
+                  int assumedState, PlannerRoute *route) {
+
+  int width = planner->width, height = planner->height;
+  uint32_t stamp = NextStamp(planner, scratch);
+
+  int start = pos[avatarId].y * width + pos[avatarId].x;
+  int head = 0, tail = 0;
+
+  scratch->queue[tail++] = start;
+  scratch->seen[start] = stamp;
+  scratch->via[start] = NO_DIRECTION;
+
+  int bestSquare = -1, bestDirection = 0, bestScore = 0;
+  int sharedSquare = -1, sharedDirection = 0;
+
+  while (head < tail && bestSquare == -1) {
+
+    int levelEnd = tail;
+
+    while (head < levelEnd) {
+
+      int square = scratch->queue[head++];
+      int x = square % width, y = square / width;
+
+      for (int direction = 0; direction < 4; direction++) {
+
+        int dx, dy;
+        Step(direction, &dx, &dy);
+        int nx = x + dx, ny = y + dy;
+
+        if (nx < 0 || ny < 0 || nx >= width || ny >= height) {
+          continue;
+        }
+
+        int neighbour = ny * width + nx;
+        int state = MazeMapGet(planner->map, x, y, direction);
+
+        if (assumed != -1 && EdgeCode(planner, x, y, direction) == assumed) {
+          state = assumedState;
+        }
+
+        if (state == MAP_OPEN) {
+          if (scratch->seen[neighbour] != stamp) {
+            scratch->seen[neighbour] = stamp;
+            scratch->via[neighbour] = direction;
+            scratch->queue[tail++] = neighbour;
+          }
+        }
+
+        else if (state == MAP_UNKNOWN) {
+
+          /* Both ends already joined: would close a cycle, so it is a wall */
+          if (scratch->seen[neighbour] == stamp || Joined(planner, x, y, nx, ny, assumed, assumedState)) {
+            if (assumedState != MAP_OPEN || MazeMapJoined(planner->map, x, y, nx, ny)) {
+              MazeMapSet(planner->map, x, y, direction, MAP_BLOCKED);
+            }
+            continue;
+          }
+
+          if (Claimed(planner, avatarId, EdgeCode(planner, x, y, direction))) {
+            if (sharedSquare == -1) {
+              sharedSquare = square;
+              sharedDirection = direction;
+            }
+            continue;
+          }
+
+          int score = DistanceToOthers(pos, planner->nAvatars, avatarId, nx, ny);
+          if (bestSquare == -1 || score < bestScore) {
+            bestSquare = square;
+            bestDirection = direction;
+            bestScore = score;
+          }
+        }
+      }
+    }
+  }
+
+  if (bestSquare == -1) {
+    bestSquare = sharedSquare;
+    bestDirection = sharedDirection;
+  }
+
+  if (bestSquare == -1) {
+    route->target = -1;
+    route->nSteps = route->next = 0;
+    return(0);
+  }
+
+
+  /* Walk back to the avatar, then lay the steps out forwards */
+
+  int length = 0;
+  for (int square = bestSquare; square != start; length++) {
+    int dx, dy;
+    Step(scratch->via[square], &dx, &dy);
+    square -= dy * width + dx;
+  }
+
+  route->nSteps = length + 1;
+  route->next = 0;
+  route->steps[length] = bestDirection;
+
+  for (int square = bestSquare; square != start; ) {
+    int dx, dy;
+    route->steps[--length] = scratch->via[square];
+    Step(scratch->via[square], &dx, &dy);
+    square -= dy * width + dx;
+  }
+
+  route->target = EdgeCode(planner, bestSquare % width, bestSquare / width, bestDirection);
+  route->expect = pos[avatarId];
+  return(1);
+}
+
+
+/*
+ *
+ * TakeAhead - makes the route searched ahead for outcome (0 the try was
+ *   blocked, 1 it went through) avatarId's route, if the avatar is where
+ *   it starts and its frontier is still unknown and unclaimed. A route that
+ *   is only the try is not kept: a search finds one as soon as it looks at
+ *   the avatar's own square, and breaks ties on where the others are now.
+ *
+ * Returns 1 if the route was taken and 0 if it has to be searched again
+ *
+ */
+static int TakeAhead(Planner *planner, int avatarId, XYPos at, int outcome) {
+
+  if (outcome == -1) {
+    return(0);
+  }
+
+  PlannerRoute *ahead = &planner->ahead[avatarId][outcome];
+  PlannerRoute *route = &planner->routes[avatarId];
+
+  if (ahead->target == -1 || ahead->nSteps < 2 || ahead->expect.x != at.x || ahead->expect.y != at.y ||
+      !Unknown(planner, ahead->target) || Claimed(planner, avatarId, ahead->target)) {
+    return(0);
+  }
+
+  uint8_t *steps = route->steps;
+
+  route->steps = ahead->steps;
+  route->nSteps = ahead->nSteps;
+  route->next = 0;
+  route->target = ahead->target;
+  route->expect = ahead->expect;
+  ahead->steps = steps;
+
+  planner->aheadTaken++;
+  return(1);
+}
+
+
+/*
+ *
+ * CheckConnected - once known passages join every avatar to avatar 0,
+ *   fixes the meeting square where the turn holder stands
+ *
+ * Pseudocode: the map merges the squares on both sides of every edge it
+ * learns is open, so each avatar is two finds away from knowing whether it
+ * is joined. The others may be partway through a path, but the turn holder
+ * is not, so the meeting is its square.
+ *
+ */
+static void CheckConnected(Planner *planner, const XYPos *pos, int avatarId) {
+
+  for (int i = 1; i < planner->nAvatars; i++) {
+    if (!MazeMapJoined(planner->map, pos[i].x, pos[i].y, pos[0].x, pos[0].y)) {
+      return;
+    }
+  }
+
+  planner->connected = 1;
+  planner->meeting = planner->mode == PLANNER_RENDEZVOUS ? ChooseMeeting(planner, pos, avatarId) : pos[avatarId];
+  PathEngineRoot(planner->toMeeting, planner->meeting.x, planner->meeting.y);
+}
+
+
+/*
+ *
+ * ChooseMeeting - the square every avatar can reach by the earliest turn
+ *   (-p rendezvous)
+ *
+ * Pseudocode: work out where each avatar really starts from: one partway
+ * through a path has to play out the rest of it first, ending on the square
+ * before its try. With order = 1..n counting the avatars' turns from the
+ * turn holder's, an avatar offset + d moves from a square arrives on turn
+ * (offset + d - 1) * n + order. Keep the square whose last arrival is
+ * earliest.
+ *
+ * Returns the meeting square
+ *
+ */
+static XYPos ChooseMeeting(Planner *planner, const XYPos *pos, int avatarId) {
+
+  int n = planner->nAvatars;
+  int nSquares = planner->width * planner->height;
+
+  for (int square = 0; square < nSquares; square++) {
+    planner->latest[square] = 0;
+  }
+
+  XYPos starts[AM_MAX_AVATAR];
+  int offsets[AM_MAX_AVATAR];
+
+  for (int i = 0; i < n; i++) {
+
+    PlannerRoute *route = &planner->routes[i];
+    XYPos start = pos[i];
+    int offset = 0;
+
+
+    /* Find the avatar on the walk it was handed, then the walk's end */
+
+    if (i != avatarId && route->handed > 1) {
+
+      int first = route->next - route->handed, k, dx, dy;
+      XYPos walk = route->handedFrom;
+
+      for (k = 0; k < route->handed && (walk.x != pos[i].x || walk.y != pos[i].y); k++) {
+        Step(route->steps[first + k], &dx, &dy);
+        walk.x += dx;
+        walk.y += dy;
+      }
+
+      offset = route->handed - k;
+
+      for (; k < route->handed && first + k < route->nSteps - 1; k++) {
+        Step(route->steps[first + k], &dx, &dy);
+        start.x += dx;
+        start.y += dy;
+      }
+    }
+
+    starts[i] = start;
+    offsets[i] = offset;
+  }
+
+
+  /* Every avatar's distances through known passages in one flood */
+
+  FloodLoad(planner->distances, planner->map, FLOOD_KNOWN);
+  FloodRun(planner->distances, starts, n);
+
+  for (int i = 0; i < n; i++) {
+
+    const int *distance = &planner->distances->distance[(size_t) i * nSquares];
+    int order = (i - avatarId + n) % n + 1;
+
+    for (int square = 0; square < nSquares; square++) {
+
+      int moves = distance[square] + offsets[i];
+
+      if (distance[square] < 0) {
+        planner->latest[square] = INT_MAX;
+      }
+      else if (moves > 0 && planner->latest[square] != INT_MAX) {
+        int arrival = (moves - 1) * n + order;
+        if (arrival > planner->latest[square]) {
+          planner->latest[square] = arrival;
+        }
+      }
+    }
+  }
+
+  int best = pos[avatarId].y * planner->width + pos[avatarId].x;
+
+  for (int square = 0; square < nSquares; square++) {
+    if (planner->latest[square] < planner->latest[best]) {
+      best = square;
+    }
+  }
+
+  XYPos meeting;
+  meeting.x = best % planner->width;
+  meeting.y = best / planner->width;
+  return(meeting);
+}
+
+
+/*
+ *
+ * Converge - up to maxMoves steps along the shortest known way to the
+ *   meeting square; an avatar already there holds for maxMoves turns. An
+ *   avatar whose square is not joined to it yet (a path's try found it
+ *   after the meeting was fixed) waits for the edge to be settled.
+ *
+ * Returns the number of moves written
+ *
+ */
+static int Converge(Planner *planner, XYPos at, uint8_t *moves, int maxMoves) {
+
+  int nMoves = 0;
+
+  if (PathEngineDistance(planner->toMeeting, at.x, at.y) == 0) {
+    memset(moves, M_NULL_MOVE, maxMoves);
+    return(maxMoves);
+  }
+
+  while (nMoves < maxMoves) {
+
+    int direction = PathEngineNextStep(planner->toMeeting, at.x, at.y), dx, dy;
+
+    if (direction == M_NULL_MOVE) {
+      break;
+    }
+
+    moves[nMoves++] = direction;
+    Step(direction, &dx, &dy);
+    at.x += dx;
+    at.y += dy;
+  }
+
+  if (nMoves == 0) {
+    moves[nMoves++] = M_NULL_MOVE;
+  }
+  return(nMoves);
+}
+
+
+/*
+ *
+ * PlannerNew - sizes the search scratch and routes for the map
+ *
+ * Returns the planner, or NULL on failure
+ *
+ */
+Planner *PlannerNew(MazeMap *map, int nAvatars, int mode) {
+
+  Planner *planner = calloc(1, sizeof(Planner));
+  if (planner == NULL) {
+    return(NULL);
+  }
+
+  size_t nSquares = (size_t) map->width * map->height;
+
+  planner->map = map;
+  planner->nAvatars = nAvatars;
+  planner->mode = mode;
+  planner->width = map->width;
+  planner->height = map->height;
+  planner->toMeeting = PathEngineNew(map, PATH_KNOWN);
+  if (mode == PLANNER_RENDEZVOUS) {
+    planner->distances = FloodNew(map->width, map->height, nAvatars);
+    planner->latest = calloc(nSquares, sizeof(int));
+  }
+  pthread_mutex_init(&planner->lock, NULL);
+  pthread_mutex_init(&planner->aheadLock, NULL);
+
+  int failed = !ScratchNew(&planner->scratch, nSquares) || !ScratchNew(&planner->aheadScratch, nSquares) ||
+               planner->toMeeting == NULL || !MazeMapTrackRegions(map) ||
+               (mode == PLANNER_RENDEZVOUS && (planner->distances == NULL || planner->latest == NULL));
+
+  for (int i = 0; i < nAvatars; i++) {
+    planner->routes[i].target = -1;
+    planner->routes[i].tryDirection = NO_DIRECTION;
+    planner->routes[i].steps = calloc(nSquares + 1, sizeof(uint8_t));
+    failed = failed || planner->routes[i].steps == NULL;
+
+    for (int outcome = 0; outcome < 2; outcome++) {
+      planner->ahead[i][outcome].target = -1;
+      planner->ahead[i][outcome].steps = calloc(nSquares + 1, sizeof(uint8_t));
+      failed = failed || planner->ahead[i][outcome].steps == NULL;
+    }
+  }
+
+  if (failed) {
+    PlannerFree(planner);
+    return(NULL);
+  }
+  return(planner);
+}
+
+
+/*
+ *
+ * PlannerNextMoves - picks avatarId's moves from this turn on
+ *
+ * Pseudocode: first settle the try the avatar's route ended with, since on
+ * a path nobody else can tell how it went. Once everyone is connected, walk
+ * towards the meeting square. Otherwise keep following the current route
+ * while its frontier is still unknown and the avatar is where the route
+ * expects; if not, take the route searched ahead for how the try went, or
+ * search again. Hand out as much of the route as fits.
+ *
+ * Returns the number of moves written (at least 1)
+ *
+ */
+int PlannerNextMoves(Planner *planner, int avatarId, const AM_Message *turn, uint8_t *moves, int maxMoves) {
+
+  XYPos pos[AM_MAX_AVATAR];
+  int nMoves = 0;
+
+  for (int i = 0; i < planner->nAvatars; i++) {
+    pos[i].x = ntohl(turn->avatar_turn.Pos[i].x);
+    pos[i].y = ntohl(turn->avatar_turn.Pos[i].y);
+  }
+
+  pthread_mutex_lock(&planner->lock);
+
+  PlannerRoute *route = &planner->routes[avatarId];
+  XYPos at = pos[avatarId];
+  int outcome = -1;
+
+  if (route->tryDirection != NO_DIRECTION) {
+    int dx, dy;
+    Step(route->tryDirection, &dx, &dy);
+
+    if (at.x == route->tryFrom.x && at.y == route->tryFrom.y) {
+      MazeMapSet(planner->map, at.x, at.y, route->tryDirection, MAP_BLOCKED);
+      outcome = 0;
+    }
+    else if (at.x == route->tryFrom.x + dx && at.y == route->tryFrom.y + dy) {
+      MazeMapSet(planner->map, route->tryFrom.x, route->tryFrom.y, route->tryDirection, MAP_OPEN);
+      outcome = 1;
+    }
+    route->tryDirection = NO_DIRECTION;
+  }
+
+  if (!planner->connected) {
+    CheckConnected(planner, pos, avatarId);
+  }
+
+  if (planner->connected) {
+    route->target = -1;
+    route->handed = 0;
+    planner->ahead[avatarId][0].target = planner->ahead[avatarId][1].target = -1;
+    nMoves = Converge(planner, at, moves, maxMoves);
+    pthread_mutex_unlock(&planner->lock);
+    return(nMoves);
+  }
+
+
+  /* Still exploring: is the current route worth finishing? */
+
+  int current = route->target != -1 && route->next < route->nSteps &&
+                route->expect.x == at.x && route->expect.y == at.y;
+
+  if (current) {
+    current = Unknown(planner, route->target);
+  }
+
+  int found = current || TakeAhead(planner, avatarId, at, outcome);
+
+  if (!found) {
+    planner->searches++;
+    found = Search(planner, &planner->scratch, avatarId, pos, -1, MAP_UNKNOWN, route);
+  }
+
+  planner->ahead[avatarId][0].target = planner->ahead[avatarId][1].target = -1;
+
+  if (found) {
+
+    route->handedFrom = at;
+
+    while (nMoves < maxMoves && route->next < route->nSteps) {
+
+      int direction = route->steps[route->next++], dx, dy;
+
+      if (route->next == route->nSteps) {
+        route->tryFrom = route->expect;
+        route->tryDirection = direction;
+      }
+
+      Step(direction, &dx, &dy);
+      route->expect.x += dx;
+      route->expect.y += dy;
+      moves[nMoves++] = direction;
+    }
+  }
+
+  route->handed = nMoves;
+
+  if (nMoves == 0) {
+    moves[nMoves++] = M_NULL_MOVE;
+  }
+
+  pthread_mutex_unlock(&planner->lock);
+  return(nMoves);
+}
+
+
+/*
+ *
+ * PlannerThinkAhead - searches avatarId's next route for a blocked and for
+ *   a successful try while the other avatars take their turns
+ *
+ * Pseudocode: under the main lock, only note the pending try, and whether
+ * the whole route has been handed out (otherwise the next turn goes on
+ * with it). The searches then run on their own scratch under the second
+ * lock; the routes they write are only read by avatarId's own next turn.
+ *
+ */
+void PlannerThinkAhead(Planner *planner, int avatarId, const AM_Message *turn) {
+
+  XYPos pos[AM_MAX_AVATAR];
+  PlannerRoute *route = &planner->routes[avatarId];
+
+  for (int i = 0; i < planner->nAvatars; i++) {
+    pos[i].x = ntohl(turn->avatar_turn.Pos[i].x);
+    pos[i].y = ntohl(turn->avatar_turn.Pos[i].y);
+  }
+
+  pthread_mutex_lock(&planner->lock);
+
+  int pending = !planner->connected && route->tryDirection != NO_DIRECTION && route->next == route->nSteps;
+  XYPos tryFrom = route->tryFrom;
+  int tryDirection = route->tryDirection;
+
+  pthread_mutex_unlock(&planner->lock);
+
+  if (!pending) {
+    return;
+  }
+
+  long tried = EdgeCode(planner, tryFrom.x, tryFrom.y, tryDirection);
+  int dx, dy;
+  Step(tryDirection, &dx, &dy);
+
+  pthread_mutex_lock(&planner->aheadLock);
+
+  for (int outcome = 0; outcome < 2; outcome++) {
+    pos[avatarId].x = tryFrom.x + outcome * dx;
+    pos[avatarId].y = tryFrom.y + outcome * dy;
+    Search(planner, &planner->aheadScratch, avatarId, pos, tried, outcome ? MAP_OPEN : MAP_BLOCKED,
+           &planner->ahead[avatarId][outcome]);
+    planner->searchesAhead++;
+  }
+
+  pthread_mutex_unlock(&planner->aheadLock);
+}
+
+
+/*
+ *
+ * PlannerKeep - where each route is taking its avatar next, the square its
+ *   last try was made from and, once fixed, the meeting square: none of
+ *   them may be pruned away while an avatar is on its way
+ *
+ * Returns the number of squares written
+ *
+ */
+int PlannerKeep(Planner *planner, XYPos *keep) {
+
+  int nKeep = 0;
+
+  pthread_mutex_lock(&planner->lock);
+
+  for (int i = 0; i < planner->nAvatars; i++) {
+    PlannerRoute *route = &planner->routes[i];
+
+    if (route->target != -1 || route->tryDirection != NO_DIRECTION) {
+      keep[nKeep++] = route->expect;
+    }
+    if (route->tryDirection != NO_DIRECTION) {
+      keep[nKeep++] = route->tryFrom;
+    }
+  }
+  if (planner->connected) {
+    keep[nKeep++] = planner->meeting;
+  }
+
+  pthread_mutex_unlock(&planner->lock);
+  return(nKeep);
+}
+
+
+/*
+ *
+ * PlannerReset - no routes, claims or meeting square, as PlannerNew leaves
+ *   it; the scratch and route buffers are kept
+ *
+ */
+void PlannerReset(Planner *planner) {
+
+  for (int i = 0; i < planner->nAvatars; i++) {
+
+    PlannerRoute *routes[3] = { &planner->routes[i], &planner->ahead[i][0], &planner->ahead[i][1] };
+
+    for (int k = 0; k < 3; k++) {
+      uint8_t *steps = routes[k]->steps;
+      memset(routes[k], 0, sizeof(PlannerRoute));
+      routes[k]->steps = steps;
+      atomic_init(&routes[k]->target, -1);
+    }
+    planner->routes[i].tryDirection = NO_DIRECTION;
+  }
+
+  planner->connected = 0;
+  memset(&planner->meeting, 0, sizeof(XYPos));
+  PathEngineReset(planner->toMeeting);
+  planner->searches = 0;
+  planner->searchesAhead = 0;
+  planner->aheadTaken = 0;
+}
+
+
+/*
+ *
+ * PlannerFree - releases the planner and its scratch
+ *
+ */
+void PlannerFree(Planner *planner) {
+
+  if (planner == NULL) {
+    return;
+  }
+
+  for (int i = 0; i < AM_MAX_AVATAR; i++) {
+    free(planner->routes[i].steps);
+    free(planner->ahead[i][0].steps);
+    free(planner->ahead[i][1].steps);
+  }
+  free(planner->scratch.seen);
+  free(planner->scratch.queue);
+  free(planner->scratch.via);
+  free(planner->aheadScratch.seen);
+  free(planner->aheadScratch.queue);
+  free(planner->aheadScratch.via);
+  PathEngineFree(planner->toMeeting);
+  FloodFree(planner->distances);
+  free(planner->latest);
+  pthread_mutex_destroy(&planner->lock);
+  pthread_mutex_destroy(&planner->aheadLock);
+  free(planner);
+}
@@ -0,0 +1,143 @@
+/* ========================================================================== */
+/* File: amplanner.h
+ *
+ * Author: Troy Palmer and Sean Cann
+ * Date: 6.4.2015
+ *
+ * Cooperative frontier exploration over the shared maze map (-p frontier),
+ * as an alternative to each avatar following the right-hand wall on its own.
+ *
+ * A frontier is an unknown edge on the side of a square the avatar can
+ * already reach through known passages. Every mobile avatar heads for the
+ * nearest frontier (breadth-first over open edges, ties broken towards the
+ * other avatars) that no other avatar has claimed, and tries it. Its route
+ * is kept until that edge becomes known, by its own attempt or anyone
+ * else's, so a search only runs when the map has changed under the plan.
+ * Where the server grants AM_FEATURE_PATH the walk through known passages
+ * and the try at its end go out as one AM_AVATAR_PATH, so an avatar
+ * backtracking across the maze costs one round trip rather than one per
+ * square. Nobody else can tell how such a try went, so the avatar settles
+ * it in the map itself on its next turn.
+ *
+ * Once every avatar can reach avatar 0's square through known passages the
+ * exploring stops: the avatar whose turn it is parks where it stands and
+ * everyone else walks the known route to it. Whether known passages join
+ * two avatars is a lookup in the map's regions (amregion.h). The routes to
+ * the meeting square come from an incremental search (ampath.h) rooted
+ * there, which takes in edges learned after the meeting was fixed without
+ * measuring the maze again.
+ *
+ * With -p rendezvous the avatars do not gather on the turn holder but on
+ * the square the last of them can reach soonest. Moves are played one
+ * avatar at a time, so an avatar d moves from a square arrives about d * n
+ * turns later, sooner the earlier its turn comes after the holder's; an
+ * avatar still playing out a path is measured from where the path ends.
+ * Every avatar's distances come from one flood of the known passages
+ * (amflood.h) rather than a search from each of them.
+ *
+ * A route ends with a try whose outcome only the next broadcast tells, and
+ * the search for the route after it used to run on the avatar's next turn,
+ * with the server waiting. PlannerThinkAhead runs both searches as soon as
+ * the try is sent, one for a wall and one for a passage, while the other
+ * avatars take their turns; the turn then takes the one that matches, as
+ * long as its frontier is still unknown and unclaimed.
+ *
+ * The turn holder is the only caller of PlannerNextMoves at any time, but
+ * it may be a different thread on every turn, so the shared state sits
+ * behind a lock that is never contended. Searches ahead have scratch of
+ * their own behind a second lock, so they never hold up the turn holder.
+ *
+ */
+/* ========================================================================== */
+
+#ifndef AMPLANNER_H
+#define AMPLANNER_H
+
+// ---------------- Prerequisites e.g., Requires "math.h"
+#include <pthread.h>
+#include <stdatomic.h>                       // _Atomic
+#include <stdint.h>                          // uint8_t, uint32_t
+#include "amazing.h"
+#include "amflood.h"
+#include "ampath.h"
+#include "mazemap.h"
+
+// ---------------- Constants
+
+#define PLANNER_FRONTIER    0                // meet on the turn holder's square
+#define PLANNER_RENDEZVOUS  1                // meet where the last avatar arrives soonest
+
+// ---------------- Structures/Types
+
+/* One avatar's current plan: steps through known passages, then the try */
+typedef struct PlannerRoute {
+  _Atomic long target;                       // claimed frontier edge, -1 if none
+  XYPos expect;                              // where the avatar should be when asked next
+  XYPos tryFrom;                             // square the last try was made from
+  int tryDirection;                          // last try still to be settled, 0xff if none
+  XYPos handedFrom;                          // square the last moves handed out start on
+  int handed;                                // how many moves were handed out last
+  uint8_t *steps;
+  int nSteps;
+  int next;
+} PlannerRoute;
+
+/* Marks and queue for one breadth-first search at a time */
+typedef struct PlannerScratch {
+  uint32_t *seen;                            // stamped per search
+  uint32_t stamp;
+  int *queue;
+  uint8_t *via;                              // direction a search entered each square by
+} PlannerScratch;
+
+typedef struct Planner {
+  MazeMap *map;
+  int nAvatars;
+  int mode;                                  // PLANNER_FRONTIER or PLANNER_RENDEZVOUS
+  int width, height;
+  pthread_mutex_t lock;
+  PlannerRoute routes[AM_MAX_AVATAR];
+
+  int connected;                             // every avatar reaches avatar 0's square
+  XYPos meeting;
+  PathEngine *toMeeting;                     // known-passage distances to the meeting square
+  Flood *distances;                          // rendezvous: distances from every avatar
+  int *latest;                               // rendezvous: last arrival on each square
+
+  PlannerScratch scratch;                    // the turn holder's searches
+
+  pthread_mutex_t aheadLock;                 // searches between turns
+  PlannerScratch aheadScratch;
+  PlannerRoute ahead[AM_MAX_AVATAR][2];      // next route if the try is blocked [0] or goes through [1]
+
+  unsigned long searches;                    // frontier searches run on a turn
+  unsigned long searchesAhead;               // and between turns
+  unsigned long aheadTaken;                  // routes searched ahead that a turn went on to use
+} Planner;
+
+// ---------------- Prototypes/Macros
+
+/* Planner for nAvatars sharing map, meeting as mode says; NULL on failure */
+Planner *PlannerNew(MazeMap *map, int nAvatars, int mode);
+
+/* Writes the next moves (at most maxMoves; 1 unless the server plays
+ * AM_AVATAR_PATH) avatarId should make from the turn broadcast in turn and
+ * returns how many. An avatar at the meeting square gets maxMoves null moves */
+int PlannerNextMoves(Planner *planner, int avatarId, const AM_Message *turn, uint8_t *moves, int maxMoves);
+
+/* Searches ahead for avatarId's route after the try PlannerNextMoves just
+ * handed it, for either outcome; turn is the broadcast that was answered.
+ * Call once the moves are sent. Does nothing if no try is pending */
+void PlannerThinkAhead(Planner *planner, int avatarId, const AM_Message *turn);
+
+/* Writes the squares the planner is sending avatars to (at most
+ * 2 * nAvatars + 1) into keep and returns how many */
+int PlannerKeep(Planner *planner, XYPos *keep);
+
+/* As PlannerNew left it, for a map that has been reset (MazeMapReset).
+ * Call while no turn or search ahead is running */
+void PlannerReset(Planner *planner);
+
+void PlannerFree(Planner *planner);
+
+#endif // AMPLANNER_H
@@ -0,0 +1,270 @@
+/* ========================================================================== */
+/* File: amprune.c
+ *
+ * Author: Troy Palmer and Sean Cann
+ * Date: 6.4.2015
+ *
+ * Overview: the dead-end pruning described in amprune.h. Squares to look
+ * at go on a stack: both sides of every edge in the map's log, and last
+ * turn's kept squares. A square with three sides that read as walls (a
+ * side off the edge of the maze counts) and no keep on it gets its fourth
+ * side sealed, and the square across that side goes on the stack.
+ *
+ * Sealing logs the edge too, so the next update looks at it again and finds
+ * nothing left to do; that costs a few lookups and keeps the log reader
+ * simple.
+ *
+ */
+/* ========================================================================== */
+
+// ---------------- System includes
+
+#include <stdlib.h>
+#include <string.h>                          // memset
+
+// ---------------- Local includes
+
+#include "amprune.h"
+
+// ---------------- Constant definitions
+
+#define CHANGE_BATCH  256                    // log entries read at a time
+
+// ---------------- Private prototypes
+
+static int Neighbour(const Pruner *pruner, int square, int direction);
+static int Kept(const XYPos *keep, int nKeep, int square, int width);
+static int Seal(Pruner *pruner, int square, const XYPos *keep, int nKeep);
+
+/* ========================================================================== */
+
+
+/*
+ *
+ * Neighbour - the square across the side of square in direction
+ *
+ * Returns the neighbour, or -1 off the edge of the maze
+ *
+ */
+static int Neighbour(const Pruner *pruner, int square, int direction) {
+
+  int x = square % pruner->width, y = square / pruner->width;
+  int nx = x + (direction == M_EAST ? 1 : direction == M_WEST ? -1 : 0);
+  int ny = y + (direction == M_SOUTH ? 1 : direction == M_NORTH ? -1 : 0);
+
+  if (nx < 0 || ny < 0 || nx >= pruner->width || ny >= pruner->height) {
+    return(-1);
+  }
+  return ny * pruner->width + nx;
+}
+
+
+/*
+ *
+ * Kept - whether square is one of the nKeep squares in keep
+ *
+ */
+static int Kept(const XYPos *keep, int nKeep, int square, int width) {
+
+  for (int i = 0; i < nKeep; i++) {
+    if ((int) keep[i].y * width + (int) keep[i].x == square) {
+      return(1);
+    }
+  }
+  return(0);
+}
+
+
+/*
+ *
+ * Seal - closes square off if it is an unkept leaf
+ *
+ * Returns the square across the sealed side, or -1 if nothing was sealed
+ *
+ */
+static int Seal(Pruner *pruner, int square, const XYPos *keep, int nKeep) {
+
+  int x = square % pruner->width, y = square / pruner->width;
+  int walls = 0, way = -1, wayUnknown = 0;
+
+  for (int direction = 0; direction < 4; direction++) {
+
+    int state = MazeMapGet(pruner->map, x, y, direction);
+
+    if (Neighbour(pruner, square, direction) == -1 || state == MAP_BLOCKED) {
+      walls++;
+    }
+    else {
+      way = direction;
+      wayUnknown = (state == MAP_UNKNOWN);
+    }
+  }
+
+  if (walls != 3 || Kept(keep, nKeep, square, pruner->width) || !MazeMapSeal(pruner->map, x, y, way)) {
+    return(-1);
+  }
+
+  pruner->size[square] = 1;
+
+  for (int direction = 0; direction < 4; direction++) {
+    if (direction != way && MazeMapIsSealed(pruner->map, x, y, direction)) {
+      pruner->size[square] += pruner->size[Neighbour(pruner, square, direction)];
+    }
+  }
+
+  pruner->sealedSquares++;
+  pruner->sealedUnknown += wayUnknown;
+
+  return Neighbour(pruner, square, way);
+}
+
+
+/*
+ *
+ * PrunerNew - sizes the pruner for the map
+ *
+ * Returns the pruner, or NULL on failure
+ *
+ */
+Pruner *PrunerNew(MazeMap *map) {
+
+  Pruner *pruner = calloc(1, sizeof(Pruner));
+  if (pruner == NULL) {
+    return(NULL);
+  }
+
+  pruner->map = map;
+  pruner->width = map->width;
+  pruner->height = map->height;
+  pruner->size = calloc((size_t) map->width * map->height, sizeof(int));
+  pruner->stack = calloc(2 * CHANGE_BATCH + PRUNE_MAX_KEEP, sizeof(int));
+  pruner->changes = calloc(CHANGE_BATCH, sizeof(long));
+  pthread_mutex_init(&pruner->lock, NULL);
+
+  if (pruner->size == NULL || pruner->stack == NULL || pruner->changes == NULL || !MazeMapTrack(map)) {
+    PrunerFree(pruner);
+    return(NULL);
+  }
+  return(pruner);
+}
+
+
+/*
+ *
+ * PrunerUpdate - seals what the edges learned since the last call, and the
+ *   squares no longer kept, have turned into dead ends
+ *
+ * Pseudocode: push last call's kept squares, then each batch of logged
+ * edges' squares, and drain the stack after each: a square that is sealed
+ * pushes the square it led from, since that may be a leaf now.
+ *
+ * Returns the number of squares sealed
+ *
+ */
+int PrunerUpdate(Pruner *pruner, const XYPos *keep, int nKeep) {
+
+  int width = pruner->width, nStack = 0, nSealed = 0;
+  size_t n = 0;
+
+  if (nKeep > PRUNE_MAX_KEEP) {
+    nKeep = PRUNE_MAX_KEEP;
+  }
+
+  pthread_mutex_lock(&pruner->lock);
+
+  for (int i = 0; i < pruner->nKept; i++) {
+    pruner->stack[nStack++] = pruner->kept[i].y * width + pruner->kept[i].x;
+  }
+
+  do {
+    for (size_t i = 0; i < n; i++) {
+
+      int x, y, direction;
+      MazeMapEdgeSide(pruner->map, pruner->changes[i], &x, &y, &direction);
+
+      int ox = direction == M_WEST ? x - 1 : x;
+      int oy = direction == M_NORTH ? y - 1 : y;
+
+      if (x < width && y < pruner->height) {
+        pruner->stack[nStack++] = y * width + x;
+      }
+      if (ox >= 0 && oy >= 0) {
+        pruner->stack[nStack++] = oy * width + ox;
+      }
+    }
+
+    while (nStack > 0) {
+      int next = Seal(pruner, pruner->stack[--nStack], keep, nKeep);
+      if (next != -1) {
+        pruner->stack[nStack++] = next;
+        nSealed++;
+      }
+    }
+
+    n = MazeMapChanges(pruner->map, pruner->cursor, pruner->changes, CHANGE_BATCH);
+    pruner->cursor += n;
+
+  } while (n > 0);
+
+  for (int i = 0; i < nKeep; i++) {
+    pruner->kept[i] = keep[i];
+  }
+  pruner->nKept = nKeep;
+
+  pthread_mutex_unlock(&pruner->lock);
+  return(nSealed);
+}
+
+
+/*
+ *
+ * PrunerSealedBehind - size of the dead end a sealed side closes off
+ *
+ */
+int PrunerSealedBehind(Pruner *pruner, int x, int y, int direction) {
+
+  int behind = 0;
+
+  pthread_mutex_lock(&pruner->lock);
+
+  if (MazeMapIsSealed(pruner->map, x, y, direction)) {
+    int neighbour = Neighbour(pruner, y * pruner->width + x, direction);
+    behind = neighbour == -1 ? 0 : pruner->size[neighbour];
+  }
+
+  pthread_mutex_unlock(&pruner->lock);
+  return(behind);
+}
+
+
+/*
+ *
+ * PrunerReset - nothing sealed and nothing read from the map's log, as
+ *   PrunerNew leaves it
+ *
+ */
+void PrunerReset(Pruner *pruner) {
+
+  memset(pruner->size, 0, (size_t) pruner->width * pruner->height * sizeof(int));
+  pruner->cursor = 0;
+  pruner->nKept = 0;
+  pruner->sealedSquares = 0;
+  pruner->sealedUnknown = 0;
+}
+
+
+/*
+ *
+ * PrunerFree - releases the pruner
+ *
+ */
+void PrunerFree(Pruner *pruner) {
+
+  if (pruner != NULL) {
+    free(pruner->size);
+    free(pruner->stack);
+    free(pruner->changes);
+    pthread_mutex_destroy(&pruner->lock);
+    free(pruner);
+  }
+}
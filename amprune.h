@@ -0,0 +1,79 @@
+/* ========================================================================== */
+/* File: amprune.h
+ *
+ * Author: Troy Palmer and Sean Cann
+ * Date: 6.4.2015
+ *
+ * Dead-end pruning for the shared maze map. The maze is perfect, a tree, so
+ * a square with walls on three sides is a leaf: unless an avatar is on it,
+ * or something is headed for it, nobody ever needs to go there. Its fourth
+ * side is sealed (MazeMapSeal), which makes it read as a wall, and the
+ * square it led from may now be a leaf in turn, so whole dead-end branches
+ * close off one square at a time.
+ *
+ * A square is only ever sealed off from the rest, never in the middle of it,
+ * so the squares that are kept stay joined to each other by edges that are
+ * not sealed, and a wall follower on the pruned map still finds avatar 0.
+ *
+ * The pruner reads the map's change log (MazeMapTrack), so each turn it
+ * looks only at squares next to edges that were learned since the last
+ * turn, and at squares that were kept last turn but may not be now.
+ *
+ * Like the planner it is driven by the turn holder, a different thread on
+ * each turn, so its state sits behind a lock that is never contended.
+ *
+ */
+/* ========================================================================== */
+
+#ifndef AMPRUNE_H
+#define AMPRUNE_H
+
+// ---------------- Prerequisites e.g., Requires "math.h"
+#include <pthread.h>
+#include <stddef.h>                          // size_t
+#include "amazing.h"
+#include "mazemap.h"
+
+// ---------------- Constants
+
+#define PRUNE_MAX_KEEP  (3 * AM_MAX_AVATAR + 1)  // avatars, their route ends, the meeting
+
+// ---------------- Structures/Types
+
+typedef struct Pruner {
+  MazeMap *map;
+  int width, height;
+  pthread_mutex_t lock;
+
+  int *size;                                 // squares sealed off behind each sealed square, itself included
+  int *stack;                                // squares still to check
+  size_t cursor;                             // map log entries already looked at
+  long *changes;                             // scratch for reading the log
+
+  XYPos kept[PRUNE_MAX_KEEP];                // squares that could not be sealed last time
+  int nKept;
+
+  unsigned long sealedSquares;               // dead-end squares closed off
+  unsigned long sealedUnknown;               // of which the way in was still unknown
+} Pruner;
+
+// ---------------- Prototypes/Macros
+
+/* Pruner for map. Turns on the map's change log, so create it before the
+ * map is shared; NULL on failure */
+Pruner *PrunerNew(MazeMap *map);
+
+/* Seals every dead end the map now shows, except the nKeep squares in
+ * keep; returns the number of squares sealed */
+int PrunerUpdate(Pruner *pruner, const XYPos *keep, int nKeep);
+
+/* Squares sealed off behind the side of (x,y) in direction, 0 if that side
+ * is not sealed */
+int PrunerSealedBehind(Pruner *pruner, int x, int y, int direction);
+
+/* As PrunerNew left it, for a map that has been reset (MazeMapReset) */
+void PrunerReset(Pruner *pruner);
+
+void PrunerFree(Pruner *pruner);
+
+#endif // AMPRUNE_H
@@ -0,0 +1,511 @@
+/* ========================================================================== */
+/* File: amrecord.c
+ *
+ * Author: Troy Palmer and Sean Cann
+ * Date: 6.4.2015
+ *
+ * Overview: the frame recorder described in amrecord.h. A PNG frame is the
+ * wall bitmap with the avatars' numbers stamped on a copy of it, written as
+ * a one-bit greyscale image whose zlib stream is made of stored (not
+ * compressed) deflate blocks; at one bit a pixel an 800x800 frame is about
+ * 80 KB. Rows are kept in the bitmaps with their PNG filter byte in front,
+ * so a frame's rows go into the file as they are.
+ *
+ */
+/* ========================================================================== */
+
+// ---------------- System includes
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+// ---------------- Local includes
+
+#include "amrecord.h"
+
+// ---------------- Constant definitions
+
+#define STORED_BLOCK 65535                   // most bytes in a stored deflate block
+#define GLYPH_WIDTH      3
+#define GLYPH_HEIGHT     5
+
+// ---------------- Private variables
+
+/* Digits 0-9, a row of GLYPH_WIDTH bits (leftmost highest) per line */
+static const uint8_t glyphs[10][GLYPH_HEIGHT] = {
+  { 7, 5, 5, 5, 7 }, { 2, 6, 2, 2, 7 }, { 7, 1, 7, 4, 7 }, { 7, 1, 7, 1, 7 }, { 5, 5, 7, 1, 1 },
+  { 7, 4, 7, 1, 7 }, { 7, 4, 7, 5, 7 }, { 7, 1, 1, 1, 1 }, { 7, 5, 7, 5, 7 }, { 7, 5, 7, 1, 7 },
+};
+
+static uint32_t crcTable[256];
+
+// ---------------- Private prototypes
+
+static void Ink(const Recorder *recorder, uint8_t *bits, int x0, int y0, int x1, int y1);
+static void InkWall(Recorder *recorder, int x, int y, int direction);
+static void InkLabel(Recorder *recorder, int avatarId, int x, int y);
+static uint32_t Crc(uint32_t crc, const uint8_t *bytes, size_t n);
+static uint8_t *PutChunk(uint8_t *at, const char *type, size_t n);
+static void PutBig32(uint8_t *at, uint32_t value);
+static int WritePng(Recorder *recorder);
+static int PutVarint(Recorder *recorder, unsigned long value);
+static int WriteDelta(Recorder *recorder, const DrawFrame *frame);
+
+/* ========================================================================== */
+
+
+/*
+ *
+ * RecordParse - reads a -r argument
+ *
+ * Returns RECORD_WINDOW, RECORD_OFF, RECORD_PNG or RECORD_DELTA, or -1
+ *
+ */
+int RecordParse(const char *spec, const char **path) {
+
+  *path = NULL;
+
+  if (strcmp(spec, "window") == 0) {
+    return(RECORD_WINDOW);
+  }
+  if (strcmp(spec, "off") == 0) {
+    return(RECORD_OFF);
+  }
+  if (strncmp(spec, "png:", 4) == 0 && spec[4] != '\0') {
+    *path = spec + 4;
+    return(RECORD_PNG);
+  }
+  if (strncmp(spec, "delta:", 6) == 0 && spec[6] != '\0') {
+    *path = spec + 6;
+    return(RECORD_DELTA);
+  }
+  return(-1);
+}
+
+
+/*
+ *
+ * RecorderNew - white bitmaps and room for a whole PNG file, or an open
+ *   delta file with its header written
+ *
+ * Returns the recorder, or NULL on failure
+ *
+ */
+Recorder *RecorderNew(int kind, const char *path, const MazeMap *map, int nAvatars, int scale,
+                      int tickMillis) {
+
+  Recorder *recorder = calloc(1, sizeof(Recorder));
+  if (recorder == NULL) {
+    return(NULL);
+  }
+
+  recorder->kind = kind;
+  recorder->path = path;
+  recorder->map = map;
+  recorder->width = map->width;
+  recorder->height = map->height;
+  recorder->scale = scale < 1 ? 1 : scale;
+  recorder->lastEdge = 0;
+  clock_gettime(CLOCK_MONOTONIC, &recorder->lastFrame);
+
+  if (kind == RECORD_PNG) {
+
+    for (uint32_t n = 0; n < 256; n++) {
+      uint32_t crc = n;
+      for (int bit = 0; bit < 8; bit++) {
+        crc = (crc & 1) ? 0xedb88320u ^ (crc >> 1) : crc >> 1;
+      }
+      crcTable[n] = crc;
+    }
+
+    recorder->pixelWidth = recorder->width * recorder->scale;
+    recorder->pixelHeight = recorder->height * recorder->scale;
+    recorder->rowBytes = 1 + (recorder->pixelWidth + 7) / 8;
+
+    size_t raw = (size_t) recorder->pixelHeight * recorder->rowBytes;
+    size_t blocks = (raw + STORED_BLOCK - 1) / STORED_BLOCK;
+
+    recorder->pngBytes = 8 + (12 + 13) + (12 + 2 + raw + 5 * blocks + 4) + 12;
+    recorder->walls = malloc(raw);
+    recorder->image = malloc(raw);
+    recorder->png = malloc(recorder->pngBytes);
+
+    if ((mkdir(path, 0755) != 0 && errno != EEXIST) ||
+        recorder->walls == NULL || recorder->image == NULL || recorder->png == NULL) {
+      RecorderFree(recorder);
+      return(NULL);
+    }
+  }
+  else {
+    recorder->out = fopen(path, "wb");
+    if (recorder->out == NULL) {
+      RecorderFree(recorder);
+      return(NULL);
+    }
+
+    recorder->bytes = fwrite("AMDELTA1", 1, 8, recorder->out);
+    PutVarint(recorder, recorder->width);
+    PutVarint(recorder, recorder->height);
+    PutVarint(recorder, nAvatars);
+    PutVarint(recorder, tickMillis);
+  }
+  return(recorder);
+}
+
+
+/*
+ *
+ * Ink - blackens the pixels of bits in [x0,x1) x [y0,y1), clipped to the
+ *   image
+ *
+ */
+static void Ink(const Recorder *recorder, uint8_t *bits, int x0, int y0, int x1, int y1) {
+
+  x0 = x0 < 0 ? 0 : x0;
+  y0 = y0 < 0 ? 0 : y0;
+  x1 = x1 > recorder->pixelWidth ? recorder->pixelWidth : x1;
+  y1 = y1 > recorder->pixelHeight ? recorder->pixelHeight : y1;
+
+  for (int y = y0; y < y1; y++) {
+    uint8_t *row = bits + (size_t) y * recorder->rowBytes + 1;
+    for (int x = x0; x < x1; x++) {
+      row[x >> 3] &= ~(0x80 >> (x & 7));
+    }
+  }
+}
+
+
+/*
+ *
+ * InkWall - a wall on the north or west side of square (x,y) (which may be
+ *   the row or column just past the maze, for its south and east sides),
+ *   two pixels thick across the line between the squares and overlapping
+ *   its neighbours at the corners
+ *
+ */
+static void InkWall(Recorder *recorder, int x, int y, int direction) {
+
+  int size = recorder->scale;
+
+  if (direction == M_NORTH) {
+    Ink(recorder, recorder->walls, x * size - 1, y * size - 1, (x + 1) * size + 1, y * size + 1);
+  }
+  else {
+    Ink(recorder, recorder->walls, x * size - 1, y * size - 1, x * size + 1, (y + 1) * size + 1);
+  }
+}
+
+
+/*
+ *
+ * InkLabel - the avatar's number, as big as fits, in the middle of square
+ *   (x,y) of the frame's image and kept inside the square's walls
+ *
+ */
+static void InkLabel(Recorder *recorder, int avatarId, int x, int y) {
+
+  int size = recorder->scale;
+  int zoom = (size - 2) / GLYPH_HEIGHT > 1 ? (size - 2) / GLYPH_HEIGHT : 1;
+  int left = x * size + (size - GLYPH_WIDTH * zoom) / 2;
+  int top = y * size + (size - GLYPH_HEIGHT * zoom) / 2;
+  int inLeft = x * size + 1, inTop = y * size + 1;
+  int inRight = (x + 1) * size - 1, inBottom = (y + 1) * size - 1;
+  const uint8_t *glyph = glyphs[avatarId % 10];
+
+  for (int row = 0; row < GLYPH_HEIGHT; row++) {
+    for (int column = 0; column < GLYPH_WIDTH; column++) {
+      if (!(glyph[row] & (4 >> column))) {
+        continue;
+      }
+
+      int x0 = left + column * zoom, y0 = top + row * zoom;
+      int x1 = x0 + zoom, y1 = y0 + zoom;
+
+      Ink(recorder, recorder->image, x0 < inLeft ? inLeft : x0, y0 < inTop ? inTop : y0,
+          x1 > inRight ? inRight : x1, y1 > inBottom ? inBottom : y1);
+    }
+  }
+}
+
+
+/*
+ *
+ * Crc - the PNG (zlib) CRC-32 of bytes, carried on from crc
+ *
+ */
+static uint32_t Crc(uint32_t crc, const uint8_t *bytes, size_t n) {
+
+  crc = ~crc;
+  for (size_t i = 0; i < n; i++) {
+    crc = crcTable[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+  }
+  return(~crc);
+}
+
+
+static void PutBig32(uint8_t *at, uint32_t value) {
+
+  at[0] = value >> 24;
+  at[1] = value >> 16;
+  at[2] = value >> 8;
+  at[3] = value;
+}
+
+
+/*
+ *
+ * PutChunk - frames the n bytes of data already at at + 8 as a PNG chunk
+ *
+ * Returns where the next chunk goes
+ *
+ */
+static uint8_t *PutChunk(uint8_t *at, const char *type, size_t n) {
+
+  PutBig32(at, n);
+  memcpy(at + 4, type, 4);
+  PutBig32(at + 8 + n, Crc(0, at + 4, 4 + n));
+  return(at + 12 + n);
+}
+
+
+/*
+ *
+ * WritePng - the frame's image as the next file of the sequence
+ *
+ * Pseudocode:
+ *     signature, then IHDR: one-bit greyscale, not interlaced
+ *     IDAT: a zlib header, the image's rows (each with its filter byte) in
+ *         stored deflate blocks, the Adler-32 of the rows
+ *     IEND, and the whole file out in one write
+ *
+ * Returns 1 on success, 0 otherwise
+ *
+ */
+static int WritePng(Recorder *recorder) {
+
+  uint8_t *at = recorder->png;
+  size_t raw = (size_t) recorder->pixelHeight * recorder->rowBytes;
+
+  memcpy(at, "\x89PNG\r\n\x1a\n", 8);
+  at += 8;
+
+  PutBig32(at + 8, recorder->pixelWidth);
+  PutBig32(at + 12, recorder->pixelHeight);
+  memcpy(at + 16, "\x01\x00\x00\x00\x00", 5);          // depth 1, greyscale
+  at = PutChunk(at, "IHDR", 13);
+
+  uint8_t *data = at + 8, *stream = data;
+  uint32_t a = 1, b = 0;
+
+  *stream++ = 0x78;                                     // deflate, 32K window
+  *stream++ = 0x01;
+  for (size_t done = 0; done < raw; ) {
+    size_t n = raw - done < STORED_BLOCK ? raw - done : STORED_BLOCK;
+
+    *stream++ = done + n == raw;                        // last block?
+    *stream++ = n & 0xff;
+    *stream++ = n >> 8;
+    *stream++ = ~n & 0xff;
+    *stream++ = (~n >> 8) & 0xff;
+    memcpy(stream, recorder->image + done, n);
+
+    for (size_t i = 0; i < n; i++) {
+      a += stream[i];
+      b += a;
+      if ((i & 4095) == 4095) {                         // before b can overflow
+        a %= 65521;
+        b %= 65521;
+      }
+    }
+    a %= 65521;
+    b %= 65521;
+    stream += n;
+    done += n;
+  }
+  PutBig32(stream, (b << 16) | a);
+  stream += 4;
+  at = PutChunk(at, "IDAT", stream - data);
+  at = PutChunk(at, "IEND", 0);
+
+
+  /* Into the directory */
+
+  char name[4096];
+  snprintf(name, sizeof(name), "%s/frame-%06lu.png", recorder->path, recorder->frames);
+
+  FILE *file = fopen(name, "wb");
+  if (file == NULL) {
+    return(0);
+  }
+
+  size_t n = at - recorder->png;
+  int written = fwrite(recorder->png, 1, n, file) == n;
+
+  written = fclose(file) == 0 && written;
+  recorder->bytes += n;
+  return(written);
+}
+
+
+/*
+ *
+ * PutVarint - value to the delta file, seven bits a byte, low bits first
+ *
+ * Returns 1 on success, 0 otherwise
+ *
+ */
+static int PutVarint(Recorder *recorder, unsigned long value) {
+
+  do {
+    int byte = value & 0x7f;
+    value >>= 7;
+    if (putc(value != 0 ? byte | 0x80 : byte, recorder->out) == EOF) {
+      return(0);
+    }
+    recorder->bytes++;
+  } while (value != 0);
+  return(1);
+}
+
+
+/*
+ *
+ * WriteDelta - the frame as a delta record (amrecord.h)
+ *
+ * Returns 1 on success, 0 otherwise
+ *
+ */
+static int WriteDelta(Recorder *recorder, const DrawFrame *frame) {
+
+  struct timespec now;
+  int ok = 1, i;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  long millis = (now.tv_sec - recorder->lastFrame.tv_sec) * 1000 +
+                (now.tv_nsec - recorder->lastFrame.tv_nsec) / 1000000;
+  recorder->lastFrame = now;
+
+  ok = ok && PutVarint(recorder, millis < 0 ? 0 : millis);
+  ok = ok && PutVarint(recorder, frame->nEdges);
+
+  for (size_t e = 0; e < frame->nEdges && ok; e++) {
+
+    long edge = frame->edges[e], delta = edge - recorder->lastEdge;
+    unsigned long zigzag = delta >= 0 ? 2 * (unsigned long) delta : 2 * (unsigned long) -delta - 1;
+    int state = 0;
+
+    if (MazeMapEdgeGet(recorder->map, edge) == MAP_OPEN) {
+      state = 1;
+    }
+    else if (MazeMapEdgeSealed(recorder->map, edge)) {
+      state = 2;
+    }
+
+    ok = PutVarint(recorder, zigzag * 4 + state);
+    recorder->lastEdge = edge;
+  }
+
+
+  /* Avatars that moved, or every one seen in a full frame */
+
+  int moved[AM_MAX_AVATAR], nMoved = 0;
+
+  for (i = 0; i < frame->nAvatars; i++) {
+    if ((int) frame->pos[i].x >= 0 &&
+        (frame->full || frame->pos[i].x != frame->last[i].x || frame->pos[i].y != frame->last[i].y)) {
+      moved[nMoved++] = i;
+    }
+  }
+
+  ok = ok && PutVarint(recorder, nMoved);
+  for (i = 0; i < nMoved && ok; i++) {
+    ok = PutVarint(recorder, moved[i]) && PutVarint(recorder, frame->pos[moved[i]].x) &&
+         PutVarint(recorder, frame->pos[moved[i]].y);
+  }
+
+  return(ok && fflush(recorder->out) == 0);
+}
+
+
+/*
+ *
+ * RecordFrame - the drawing thread's frame, to disk
+ *
+ * Pseudocode:
+ *     delta: write what changed
+ *     PNG: a full frame redraws the wall bitmap from the map, any other
+ *         adds the walls learned since the last; then copy it, number the
+ *         avatars on the copy and write that
+ *
+ * Returns 1
+ *
+ */
+int RecordFrame(const DrawFrame *frame, void *context) {
+
+  Recorder *recorder = context;
+  int x, y, direction;
+
+  if (recorder->failed) {
+    return(1);
+  }
+
+  if (recorder->kind == RECORD_DELTA) {
+    recorder->failed = !WriteDelta(recorder, frame);
+    recorder->frames += !recorder->failed;
+    return(1);
+  }
+
+  size_t raw = (size_t) recorder->pixelHeight * recorder->rowBytes;
+
+  if (frame->full) {
+    memset(recorder->walls, 0xff, raw);
+    for (y = 0; y < recorder->pixelHeight; y++) {
+      recorder->walls[(size_t) y * recorder->rowBytes] = 0;      // filter: none
+    }
+
+    for (long edge = 0; edge < MazeMapEdges(recorder->map); edge++) {
+      if (MazeMapEdgeGet(recorder->map, edge) == MAP_BLOCKED) {
+        MazeMapEdgeSide(recorder->map, edge, &x, &y, &direction);
+        InkWall(recorder, x, y, direction);
+      }
+    }
+  }
+  else {
+    for (size_t e = 0; e < frame->nEdges; e++) {
+      if (MazeMapEdgeGet(recorder->map, frame->edges[e]) == MAP_BLOCKED) {
+        MazeMapEdgeSide(recorder->map, frame->edges[e], &x, &y, &direction);
+        InkWall(recorder, x, y, direction);
+      }
+    }
+  }
+
+  memcpy(recorder->image, recorder->walls, raw);
+  for (int i = 0; i < frame->nAvatars; i++) {
+    if ((int) frame->pos[i].x >= 0) {
+      InkLabel(recorder, i, frame->pos[i].x, frame->pos[i].y);
+    }
+  }
+
+  recorder->failed = !WritePng(recorder);
+  recorder->frames += !recorder->failed;
+  return(1);
+}
+
+
+void RecorderFree(Recorder *recorder) {
+
+  if (recorder == NULL) {
+    return;
+  }
+
+  if (recorder->out != NULL) {
+    fclose(recorder->out);
+  }
+  free(recorder->walls);
+  free(recorder->image);
+  free(recorder->png);
+  free(recorder);
+}
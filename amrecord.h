@@ -0,0 +1,105 @@
+/* ========================================================================== */
+/* File: amrecord.h
+ *
+ * Author: Troy Palmer and Sean Cann
+ * Date: 6.4.2015
+ *
+ * Frames of a run written to disk instead of a window, for runs with no
+ * display. A Recorder is a DrawFunction (amdraw.h): the drawing thread
+ * calls it at most once a tick with what changed, so avatars never wait on
+ * it and a slow disk only makes frames further apart.
+ *
+ * It writes one of two things:
+ *
+ *     png:DIR     DIR/frame-000000.png, DIR/frame-000001.png, ...: the maze
+ *                 as the window draws it, black walls and avatar numbers on
+ *                 white, one bit a pixel. No GTK, cairo or zlib: the walls
+ *                 are kept in a bitmap that each frame only adds the new
+ *                 walls to, and the PNG's data goes out uncompressed
+ *
+ *     delta:FILE  just the changes, a few bytes each. After the 8 bytes
+ *                 "AMDELTA1", all numbers are unsigned LEB128 varints:
+ *
+ *                     width height nAvatars tickMillis
+ *
+ *                 then for each frame
+ *
+ *                     millis        since the last frame (or the start)
+ *                     nEdges        edges learned since the last frame, each
+ *                                   zigzag(edge - previous edge) * 4 + state,
+ *                                   edge as in the map's log (mazemap.h) and
+ *                                   state 0 wall, 1 open, 2 sealed dead end
+ *                     nMoves        avatars that moved, each: id x y
+ *
+ *                 The first frame lists every avatar seen so far.
+ *
+ * Rendering can also be off (no drawing thread at all), or in a GTK window,
+ * which is the client's business (AMStartup.c) rather than this module's.
+ *
+ */
+/* ========================================================================== */
+
+#ifndef AMRECORD_H
+#define AMRECORD_H
+
+// ---------------- Prerequisites e.g., Requires "math.h"
+#include <stdint.h>                          // uint8_t
+#include <stdio.h>                           // FILE
+#include <time.h>                            // struct timespec
+#include "amdraw.h"
+#include "mazemap.h"
+
+// ---------------- Constants
+
+/* Where frames go, as returned by RecordParse */
+#define RECORD_WINDOW 0                      // a GTK window (AMStartup.c)
+#define RECORD_OFF    1                      // nowhere: no drawing thread
+#define RECORD_PNG    2                      // a PNG file per frame
+#define RECORD_DELTA  3                      // one file of changes
+
+// ---------------- Structures/Types
+
+typedef struct Recorder {
+  int kind;                                  // RECORD_PNG or RECORD_DELTA
+  const char *path;                          // directory of PNGs, or the delta file
+  const MazeMap *map;
+  int width, height;                         // squares
+  int scale;                                 // pixels to a square's side (PNG)
+
+  int pixelWidth, pixelHeight;               // PNG only from here...
+  int rowBytes;                              // 8 pixels a byte, a set bit white
+  uint8_t *walls;                            // every wall so far
+  uint8_t *image;                            // walls and avatar numbers: this frame
+  uint8_t *png;                              // the file being written
+  size_t pngBytes;
+
+  FILE *out;                                 // delta only from here...
+  long lastEdge;
+  struct timespec lastFrame;
+
+  unsigned long frames;                      // frames written
+  unsigned long long bytes;                  // bytes written
+  int failed;                                // a write failed: nothing more is written
+} Recorder;
+
+// ---------------- Prototypes/Macros
+
+/* "window", "off", "png:DIR" or "delta:FILE": returns RECORD_* and points
+ * path at DIR or FILE (NULL for the first two), or -1 if spec is none */
+int RecordParse(const char *spec, const char **path);
+
+/* A recorder of kind RECORD_PNG or RECORD_DELTA for map, writing to path
+ * (a PNG directory is made if missing) with squares scale pixels wide.
+ * Writes the delta file's header; NULL if path cannot be written */
+Recorder *RecorderNew(int kind, const char *path, const MazeMap *map, int nAvatars, int scale,
+                      int tickMillis);
+
+/* The DrawFunction: writes frame. Always returns 1; after a failed write it
+ * only sets failed */
+int RecordFrame(const DrawFrame *frame, void *context);
+
+/* Closes the delta file and frees the recorder. Call once the drawer has
+ * stopped */
+void RecorderFree(Recorder *recorder);
+
+#endif // AMRECORD_H
@@ -0,0 +1,189 @@
+/* ========================================================================== */
+/* File: amregion.c
+ *
+ * Author: Troy Palmer and Sean Cann
+ * Date: 6.4.2015
+ *
+ * Overview: the concurrent union-find described in amregion.h. A parent
+ * only ever moves from a square to an ancestor of it, so a find that races
+ * with other finds and unions still ends at a root; a union retries from
+ * the current roots whenever another thread linked one of them first.
+ *
+ */
+/* ========================================================================== */
+
+// ---------------- System includes
+
+#include <stdlib.h>
+
+// ---------------- Local includes
+
+#include "amregion.h"
+
+// ---------------- Private prototypes
+
+static uint32_t Priority(uint32_t square);
+
+/* ========================================================================== */
+
+
+/*
+ *
+ * Priority - a fixed pseudo-random order on squares (a 32-bit integer
+ *   hash): the root with the lower priority is linked under the other
+ *
+ */
+static uint32_t Priority(uint32_t square) {
+
+  square ^= square >> 16;
+  square *= 0x7feb352d;
+  square ^= square >> 15;
+  square *= 0x846ca68b;
+  square ^= square >> 16;
+  return(square);
+}
+
+
+/*
+ *
+ * RegionsNew - every square its own root
+ *
+ * Returns the regions, or NULL on failure
+ *
+ */
+Regions *RegionsNew(int nSquares) {
+
+  Regions *regions = calloc(1, sizeof(Regions));
+  if (regions == NULL) {
+    return(NULL);
+  }
+
+  regions->nSquares = nSquares;
+  regions->parent = calloc(nSquares, sizeof(uint32_t));
+
+  if (regions->parent == NULL) {
+    free(regions);
+    return(NULL);
+  }
+
+  for (int square = 0; square < nSquares; square++) {
+    atomic_init(&regions->parent[square], square);
+  }
+  atomic_init(&regions->merges, 0);
+  return(regions);
+}
+
+
+/*
+ *
+ * RegionsFind - follows parents to the root
+ *
+ * Pseudocode: at each step point the square at its grandparent (path
+ * splitting), then move on to the old parent. A lost race only means the
+ * pointer was already moved further up by someone else.
+ *
+ * Returns the root
+ *
+ */
+uint32_t RegionsFind(Regions *regions, uint32_t square) {
+
+  for (;;) {
+    uint32_t parent = atomic_load_explicit(&regions->parent[square], memory_order_acquire);
+    if (parent == square) {
+      return(square);
+    }
+
+    uint32_t grandparent = atomic_load_explicit(&regions->parent[parent], memory_order_acquire);
+    if (grandparent != parent) {
+      atomic_compare_exchange_weak_explicit(&regions->parent[square], &parent, grandparent,
+                                            memory_order_release, memory_order_relaxed);
+    }
+    square = parent;
+  }
+}
+
+
+/*
+ *
+ * RegionsUnion - links the lower priority root under the other
+ *
+ * Returns 1 if this call joined two regions, 0 if they were already one
+ *
+ */
+int RegionsUnion(Regions *regions, uint32_t a, uint32_t b) {
+
+  for (;;) {
+    a = RegionsFind(regions, a);
+    b = RegionsFind(regions, b);
+
+    if (a == b) {
+      return(0);
+    }
+
+    if (Priority(a) > Priority(b) || (Priority(a) == Priority(b) && a > b)) {
+      uint32_t swap = a;
+      a = b;
+      b = swap;
+    }
+
+    uint32_t expected = a;
+    if (atomic_compare_exchange_strong_explicit(&regions->parent[a], &expected, b, memory_order_acq_rel,
+                                                memory_order_acquire)) {
+      atomic_fetch_add_explicit(&regions->merges, 1, memory_order_relaxed);
+      return(1);
+    }
+  }
+}
+
+
+/*
+ *
+ * RegionsSame - whether a and b share a root
+ *
+ * Pseudocode: find both roots; equal means joined. Otherwise, if a's root
+ * is still a root the two were apart just then; if not, a union moved it
+ * in the meantime, so look again.
+ *
+ */
+int RegionsSame(Regions *regions, uint32_t a, uint32_t b) {
+
+  for (;;) {
+    a = RegionsFind(regions, a);
+    b = RegionsFind(regions, b);
+
+    if (a == b) {
+      return(1);
+    }
+    if (atomic_load_explicit(&regions->parent[a], memory_order_acquire) == a) {
+      return(0);
+    }
+  }
+}
+
+
+/*
+ *
+ * RegionsReset - every square back in a region of its own
+ *
+ */
+void RegionsReset(Regions *regions) {
+
+  for (int square = 0; square < regions->nSquares; square++) {
+    atomic_store_explicit(&regions->parent[square], square, memory_order_relaxed);
+  }
+  atomic_store(&regions->merges, 0);
+}
+
+
+/*
+ *
+ * RegionsFree - frees regions returned by RegionsNew
+ *
+ */
+void RegionsFree(Regions *regions) {
+
+  if (regions != NULL) {
+    free(regions->parent);
+    free(regions);
+  }
+}
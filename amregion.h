@@ -0,0 +1,59 @@
+/* ========================================================================== */
+/* File: amregion.h
+ *
+ * Author: Troy Palmer and Sean Cann
+ * Date: 6.4.2015
+ *
+ * Which squares known passages join, as a lock-free union-find. The map
+ * merges the two sides of every edge it learns is open (MazeMapSet), so
+ * "can avatar i already walk to avatar j?" is two finds rather than a
+ * search of the map.
+ *
+ * Each square holds the index of its parent, and a root is its own parent.
+ * Roots are linked with a compare-and-swap that only succeeds while the
+ * linked square is still a root, and a find shortens the path it walks
+ * (path splitting) with compare-and-swaps that may fail harmlessly, so any
+ * number of avatar threads can merge and look up at once. Which of two
+ * roots goes under the other is fixed by a hash of their indices, which
+ * keeps the trees shallow without storing ranks.
+ *
+ */
+/* ========================================================================== */
+
+#ifndef AMREGION_H
+#define AMREGION_H
+
+// ---------------- Prerequisites e.g., Requires "math.h"
+#include <stdatomic.h>                       // _Atomic
+#include <stdint.h>                          // uint32_t
+
+// ---------------- Structures/Types
+
+typedef struct Regions {
+  int nSquares;
+  _Atomic uint32_t *parent;
+  _Atomic unsigned long merges;              // unions that joined two regions
+} Regions;
+
+// ---------------- Prototypes/Macros
+
+/* nSquares squares, each in a region of its own; NULL on failure */
+Regions *RegionsNew(int nSquares);
+
+/* The root of square's region, as of some moment during the call */
+uint32_t RegionsFind(Regions *regions, uint32_t square);
+
+/* Joins the regions of a and b; returns 1 if they were apart */
+int RegionsUnion(Regions *regions, uint32_t a, uint32_t b);
+
+/* Returns 1 if a and b are in one region. Regions only ever grow, so a 1
+ * stays true; a 0 was true at some moment during the call */
+int RegionsSame(Regions *regions, uint32_t a, uint32_t b);
+
+/* Every square back in a region of its own. Not safe against concurrent
+ * merges or finds */
+void RegionsReset(Regions *regions);
+
+void RegionsFree(Regions *regions);
+
+#endif // AMREGION_H
@@ -0,0 +1,951 @@
+/* ========================================================================== */
+/* File: amsim.c
+ *
+ * Author: Troy Palmer and Sean Cann
+ * Date: 6.4.2015
+ *
+ * Overview: Offline simulator for judging navigation strategies without a
+ * server. Each maze is played in process: the avatars decide with the same
+ * code as the client (amnav.h), and the turns go round exactly as amserver
+ * hands them out, AM_AVATAR_PATH steps and all, with no sockets, threads
+ * or round trips. Many mazes can be played in a row, and the spread of
+ * moves-to-solve over them is printed at the end, so a change to a
+ * strategy can be judged over hundreds of mazes in seconds.
+ *
+ * Maze k is generated from seed + k with the avatars scattered as amserver
+ * scatters them, so "amsim -s 1 -r 5" plays the same five mazes as five
+ * runs of the client against "amserver -s 1", move for move.
+ *
+ * With -t the simulator runs a tournament instead: the same runs mazes for
+ * every strategy, every nAvatars from 2 to AM_MAX_AVATAR and every
+ * difficulty from 0 to AM_MAX_DIFFICULTY (or just the ones -p, -n and -d
+ * give), on a pool of threads. Each (strategy, nAvatars, difficulty) is a
+ * cell of the results table, and every maze of it a job. Each worker is
+ * handed a contiguous share of the jobs, which it takes from the front,
+ * and once its share is played it steals the back half of another
+ * worker's; both ends of a share live in one 64-bit word updated by
+ * compare-and-swap, so neither taking nor stealing ever waits. Jobs next
+ * to each other are mazes of one cell, so a worker mostly regenerates its
+ * maze in place (MazeRegenerate) and starts its navigator over
+ * (NavigatorReset) rather than allocating either. The results do not
+ * depend on the number of threads.
+ *
+ * Input/Command line options:
+ *
+ * 1. -n nAvatars: Number of avatars [2,AM_MAX_AVATAR] (default 3)
+ *
+ * 2. -d difficulty: [0,AM_MAX_DIFFICULTY], which sets the maze size
+ *    (default 5)
+ *
+ * 3. -s seed: Seed of the first maze (default 1)
+ *
+ * 4. -r runs: Number of mazes to play, seed, seed + 1, ... (default 1)
+ *
+ * 5. -f file: Play the maze saved in file (MazeSave) instead, with the
+ *    avatars scattered from seed + k on run k
+ *
+ * 6. -o file: Save the first maze played to file
+ *
+ * 7. -p strategy: follow (default), follow-left, frontier or rendezvous,
+ *    as in the client
+ *
+ * 8. -k, -w: Keep dead ends and wait for the turn, as in the client
+ *
+ * 9. -1: One move per turn, as with a server that does not grant
+ *    AM_FEATURE_PATH
+ *
+ * 10. -m maxMoves: Give up on a maze after this many moves
+ *     (default SIM_MAX_MOVES)
+ *
+ * 11. -q: Only print the summary, not a line per maze (with -t, not a
+ *     line per cell)
+ *
+ * 12. -t threads: Play a tournament on this many threads, 0 for one per
+ *     online CPU. -n, -d and -p, if given, narrow it to one nAvatars,
+ *     difficulty or strategy; -f and -o cannot be used with it
+ *
+ */
+/* ========================================================================== */
+
+// ---------------- System includes
+
+#include <stdatomic.h>                       // _Atomic
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <arpa/inet.h>                       // htonl
+
+// ---------------- Local includes
+
+#include "amazing.h"
+#include "amnav.h"
+#include "mazegen.h"
+
+// ---------------- Constant definitions
+
+#define SIM_MAX_MOVES  10000000              // default -m, far past what any strategy needs
+#define SIM_MAX_JOBS   0x7fffffffL           // mazes in a tournament, so a share fits 32 bits
+#define SIM_MAX_THREADS     256
+
+// ---------------- Structures/Types
+
+/* Where one simulated maze stands, as amserver's MazeSession keeps it */
+typedef struct Match {
+  const Maze *maze;
+  int nAvatars;
+  XYPos pos[AM_MAX_AVATAR];
+  uint8_t path[AM_MAX_AVATAR][AM_MAX_PATH];  // queued AM_AVATAR_PATH steps
+  int pathLength[AM_MAX_AVATAR];
+  int pathNext[AM_MAX_AVATAR];
+  int turnId;
+  long nMoves;
+  long nTurns;                               // AM_AVATAR_TURN broadcasts
+} Match;
+
+/* How every maze of a run is played */
+typedef struct SimOptions {
+  int nAvatars;
+  int strategy;                              // NAV_*
+  int prune;
+  int thinkAhead;
+  int maxPath;                               // moves per turn, AM_MAX_PATH or 1
+  long maxMoves;
+} SimOptions;
+
+/* What a thread keeps from one maze to the next */
+typedef struct Player {
+  Maze *maze;                                // regenerated in place while the size holds
+  Navigator *navigator;                      // started over while the maze's shape holds
+  Match match;
+  AvatarNav avatars[AM_MAX_AVATAR];
+} Player;
+
+/* One worker of a tournament, on a cache line of its own */
+typedef struct Worker {
+  _Alignas(64) _Atomic uint64_t share;       // jobs [low 32 bits, high 32 bits) still to play
+  struct Tournament *tournament;
+  int id;
+  pthread_t thread;
+  Player player;
+  long played;                               // jobs played, stolen ones included
+  long stolen;                               // jobs taken from other workers
+} Worker;
+
+/* Every job of a -t run and what came of it */
+typedef struct Tournament {
+  SimOptions options;                        // all but nAvatars and strategy
+  int strategies[NAV_STRATEGIES];
+  int nStrategies;
+  int firstAvatars, nAvatarCounts;
+  int firstDifficulty, nDifficulties;
+  unsigned long long seed;
+  long runs;                                 // mazes per cell
+  long nJobs;
+  long *moves;                               // per job, -1 if not solved
+  double *seconds;                           // per job, CPU time of its thread
+  int nWorkers;
+  Worker *workers;
+  _Atomic int failed;                        // a job could not be allocated
+} Tournament;
+
+// ---------------- Private prototypes
+
+static void MoveAvatar(Match *match, int avatarId, int direction);
+
+static int Solved(const Match *match);
+
+static int NextTurn(Match *match, long maxMoves);
+
+static Navigator *PlayerNavigator(Player *player, const Maze *maze, const SimOptions *options);
+
+static Maze *PlayerMaze(Player *player, int size, uint64_t seed);
+
+static void PlayerFree(Player *player);
+
+static inline int PlayMazeAs(Player *player, const Maze *maze, const SimOptions *options, long *played,
+                             long *turns, const int strategy);
+
+static int PlayMaze(Player *player, const Maze *maze, const SimOptions *options, long *played, long *turns);
+
+static long TakeJob(Worker *worker);
+
+static long StealJob(Worker *worker);
+
+static void *RunWorker(void *data);
+
+static int RunTournament(Tournament *tournament, const char *program, int quiet);
+
+static int CompareLong(const void *a, const void *b);
+
+static double NowSeconds(void);
+
+static double ThreadSeconds(void);
+
+/* ========================================================================== */
+
+
+/*
+ *
+ * MoveAvatar - takes one step for an avatar as amserver does: M_NULL_MOVE
+ *   and walls stay put, and a step into a wall drops the rest of a path
+ *
+ */
+static void MoveAvatar(Match *match, int avatarId, int direction) {
+
+  XYPos *pos = &match->pos[avatarId];
+
+  match->nMoves++;
+
+  if (direction == M_NULL_MOVE) {
+    return;
+  }
+
+  if (MazeIsOpen(match->maze, pos->x, pos->y, direction)) {
+    int dx, dy;
+    MazeStep(direction, &dx, &dy);
+    pos->x += dx;
+    pos->y += dy;
+  }
+  else {
+    match->pathLength[avatarId] = 0; // stop early on a failed step
+  }
+}
+
+
+/*
+ *
+ * Solved - whether every avatar shares a square
+ *
+ */
+static int Solved(const Match *match) {
+
+  for (int i = 1; i < match->nAvatars; i++) {
+    if (match->pos[i].x != match->pos[0].x || match->pos[i].y != match->pos[0].y) {
+      return(0);
+    }
+  }
+  return(1);
+}
+
+
+/*
+ *
+ * NextTurn - passes the turn on as amserver's NextTurn does: avatars with
+ *   queued path steps take them without being asked, and the first avatar
+ *   with nothing queued gets the turn
+ *
+ * Returns 1 while the maze is still running and 0 once it has ended
+ *
+ */
+static int NextTurn(Match *match, long maxMoves) {
+
+  for (;;) {
+
+    match->turnId = (match->turnId + 1) % match->nAvatars;
+    int avatarId = match->turnId;
+
+    if (match->pathLength[avatarId] == 0) {
+      match->nTurns++;
+      return(1);
+    }
+
+    int direction = match->path[avatarId][match->pathNext[avatarId]++];
+    match->pathLength[avatarId]--;
+
+    MoveAvatar(match, avatarId, direction);
+    if (Solved(match) || match->nMoves >= maxMoves) {
+      return(0);
+    }
+  }
+}
+
+
+/*
+ *
+ * PlayerNavigator - a navigator for maze: the player's last one started
+ *   over if it was made for the same size, avatars and strategy, else a
+ *   new one
+ *
+ * Returns the navigator, or NULL if it could not be allocated
+ *
+ */
+static Navigator *PlayerNavigator(Player *player, const Maze *maze, const SimOptions *options) {
+
+  Navigator *navigator = player->navigator;
+
+  if (navigator != NULL && navigator->width == maze->width && navigator->height == maze->height &&
+      navigator->nAvatars == options->nAvatars && navigator->strategy == options->strategy) {
+    NavigatorReset(navigator);
+    return(navigator);
+  }
+
+  NavigatorFree(navigator);
+  player->navigator = NavigatorNew(maze->width, maze->height, options->nAvatars, options->strategy,
+                                   options->prune, options->thinkAhead);
+  return(player->navigator);
+}
+
+
+/*
+ *
+ * PlayerMaze - the size x size maze seed gives, carved into the player's
+ *   last maze if that was the same size
+ *
+ * Returns the maze, or NULL if it could not be allocated
+ *
+ */
+static Maze *PlayerMaze(Player *player, int size, uint64_t seed) {
+
+  if (player->maze != NULL && player->maze->width == size && player->maze->height == size) {
+    return MazeRegenerate(player->maze, seed) ? player->maze : NULL;
+  }
+
+  MazeFree(player->maze);
+  player->maze = MazeGenerate(size, size, seed);
+  return(player->maze);
+}
+
+
+/*
+ *
+ * PlayerFree - frees what a player kept (not the player itself)
+ *
+ */
+static void PlayerFree(Player *player) {
+
+  NavigatorFree(player->navigator);
+  MazeFree(player->maze);
+  player->navigator = NULL;
+  player->maze = NULL;
+}
+
+
+/*
+ *
+ * PlayMazeAs - plays one maze from the first turn to the end, with the
+ *   strategy given as a constant so each move is a direct call into it
+ *
+ * Pseudocode: scatter the avatars and broadcast the first turn to avatar 0.
+ * The turn holder answers through NavigatorMove; its first move is played
+ * and the rest queued, then NavigatorSettle does what the client does once
+ * the move is sent, and the turn passes on.
+ *
+ * Returns 1 if solved, 0 if maxMoves ran out first and -1 if navigation
+ * could not be allocated; played and turns get the moves played and the
+ * broadcasts sent
+ *
+ */
+__attribute__((always_inline))
+static inline int PlayMazeAs(Player *player, const Maze *maze, const SimOptions *options, long *played,
+                             long *turns, const int strategy) {
+
+  Match *match = &player->match;
+  AvatarNav *avatars = player->avatars;
+  AM_Message turn;
+  uint8_t moves[AM_MAX_PATH];
+
+  Navigator *navigator = PlayerNavigator(player, maze, options);
+  if (navigator == NULL) {
+    return(-1);
+  }
+
+  memset(match, 0, sizeof(Match));
+  match->maze = maze;
+  match->nAvatars = options->nAvatars;
+  match->nTurns = 1;
+  MazeScatter(maze, match->nAvatars, match->pos);
+
+  for (int avatarId = 0; avatarId < match->nAvatars; avatarId++) {
+    NavigatorStart(navigator, &avatars[avatarId], avatarId);
+  }
+
+  memset(&turn, 0, sizeof(turn));
+  turn.type = htonl(AM_AVATAR_TURN);
+
+
+  /* One broadcast, one answer, until the avatars meet */
+
+  int running = 1;
+
+  while (running) {
+
+    int avatarId = match->turnId;
+
+    turn.avatar_turn.TurnId = htonl(avatarId);
+    for (int i = 0; i < match->nAvatars; i++) {
+      turn.avatar_turn.Pos[i].x = htonl(match->pos[i].x);
+      turn.avatar_turn.Pos[i].y = htonl(match->pos[i].y);
+    }
+
+    int nMoves = NavigatorMoveAs(navigator, &avatars[avatarId], &turn, moves, options->maxPath, strategy);
+
+    memcpy(match->path[avatarId], moves + 1, nMoves - 1);
+    match->pathLength[avatarId] = nMoves - 1;
+    match->pathNext[avatarId] = 0;
+    MoveAvatar(match, avatarId, moves[0]);
+
+    NavigatorSettleAs(navigator, &avatars[avatarId], &turn, strategy);
+
+    running = !Solved(match) && match->nMoves < options->maxMoves && NextTurn(match, options->maxMoves);
+  }
+
+  *played = match->nMoves;
+  *turns = match->nTurns;
+  return Solved(match);
+}
+
+
+/*
+ *
+ * PlayMaze - PlayMazeAs for the strategy in options, picked once a maze
+ *
+ */
+static int PlayMaze(Player *player, const Maze *maze, const SimOptions *options, long *played, long *turns) {
+
+  switch (options->strategy) {
+    case NAV_FOLLOW_LEFT:
+      return PlayMazeAs(player, maze, options, played, turns, NAV_FOLLOW_LEFT);
+    case NAV_FRONTIER:
+      return PlayMazeAs(player, maze, options, played, turns, NAV_FRONTIER);
+    case NAV_RENDEZVOUS:
+      return PlayMazeAs(player, maze, options, played, turns, NAV_RENDEZVOUS);
+    default:
+      return PlayMazeAs(player, maze, options, played, turns, NAV_FOLLOW);
+  }
+}
+
+
+/*
+ *
+ * TakeJob - the first job left in the worker's own share
+ *
+ * Returns the job, or -1 if the share is used up
+ *
+ */
+static long TakeJob(Worker *worker) {
+
+  uint64_t share = atomic_load_explicit(&worker->share, memory_order_acquire);
+
+  for (;;) {
+    uint64_t first = share & 0xffffffff, end = share >> 32;
+    if (first >= end) {
+      return(-1);
+    }
+    if (atomic_compare_exchange_weak_explicit(&worker->share, &share, (end << 32) | (first + 1),
+                                              memory_order_acq_rel, memory_order_acquire)) {
+      return((long) first);
+    }
+  }
+}
+
+
+/*
+ *
+ * StealJob - moves the back half of another worker's share (looking at
+ *   each in turn from the next one on) into this worker's, which is empty
+ *
+ * Pseudocode: a thief only ever lowers the end of a share and its owner
+ * only raises the start, each with a compare-and-swap of the whole word,
+ * so whoever swaps first wins and the other tries again with what it saw.
+ * Nobody touches an empty share, so the thief can then store its loot in
+ * its own without a swap.
+ *
+ * Returns the first stolen job, already taken, or -1 if there is none left
+ *
+ */
+static long StealJob(Worker *worker) {
+
+  Tournament *tournament = worker->tournament;
+
+  for (int k = 1; k < tournament->nWorkers; k++) {
+
+    Worker *victim = &tournament->workers[(worker->id + k) % tournament->nWorkers];
+    uint64_t share = atomic_load_explicit(&victim->share, memory_order_acquire);
+
+    for (;;) {
+
+      uint64_t first = share & 0xffffffff, end = share >> 32;
+      if (first >= end) {
+        break;
+      }
+
+      uint64_t take = (end - first + 1) / 2;
+      if (atomic_compare_exchange_weak_explicit(&victim->share, &share, ((end - take) << 32) | first,
+                                                memory_order_acq_rel, memory_order_acquire)) {
+        atomic_store_explicit(&worker->share, (end << 32) | (end - take + 1), memory_order_release);
+        worker->stolen += take;
+        return((long) (end - take));
+      }
+    }
+  }
+  return(-1);
+}
+
+
+/*
+ *
+ * RunWorker - plays jobs, its own and then stolen ones, until none are left
+ *
+ */
+static void *RunWorker(void *data) {
+
+  Worker *worker = data;
+  Tournament *tournament = worker->tournament;
+  SimOptions options = tournament->options;
+
+  for (long job = TakeJob(worker); job != -1 || (job = StealJob(worker)) != -1; job = TakeJob(worker)) {
+
+    long cell = job / tournament->runs, run = job % tournament->runs;
+    int difficulty = tournament->firstDifficulty + cell % tournament->nDifficulties;
+    cell /= tournament->nDifficulties;
+    options.nAvatars = tournament->firstAvatars + cell % tournament->nAvatarCounts;
+    options.strategy = tournament->strategies[cell / tournament->nAvatarCounts];
+
+    double started = ThreadSeconds();
+    long nMoves, turns;
+    int size = MAZE_SIZE_FOR_DIFFICULTY(difficulty);
+    Maze *maze = PlayerMaze(&worker->player, size, tournament->seed + run);
+    int solved = maze == NULL ? -1 : PlayMaze(&worker->player, maze, &options, &nMoves, &turns);
+
+    if (solved == -1) {
+      atomic_store(&tournament->failed, 1);
+      break;
+    }
+    tournament->moves[job] = solved ? nMoves : -1;
+    tournament->seconds[job] = ThreadSeconds() - started;
+    worker->played++;
+  }
+
+  PlayerFree(&worker->player);
+  return(NULL);
+}
+
+
+/*
+ *
+ * RunTournament - plays every job on the workers and prints the table
+ *
+ * Pseudocode: hand each worker an equal run of jobs and start them all;
+ * once they are joined, sort each cell's solved move counts for its mean,
+ * median and 95th percentile, print a line per cell, then the same over
+ * each strategy's cells, then the throughput and how much was stolen. The
+ * jobs' CPU time over the wall time is how many threads' worth of work the
+ * pool got done at once.
+ *
+ * Returns 0 on success, 1 if anything could not be allocated
+ *
+ */
+static int RunTournament(Tournament *tournament, const char *program, int quiet) {
+
+  int nWorkers = tournament->nWorkers;
+  long nJobs = tournament->nJobs, runs = tournament->runs;
+  long nCells = nJobs / runs;
+
+  tournament->moves = calloc(nJobs, sizeof(long));
+  tournament->seconds = calloc(nJobs, sizeof(double));
+  tournament->workers = aligned_alloc(64, nWorkers * sizeof(Worker));
+  long *sorted = calloc(nJobs, sizeof(long));
+
+  if (tournament->moves == NULL || tournament->seconds == NULL || tournament->workers == NULL ||
+      sorted == NULL) {
+    fprintf(stderr, "[%s] Error: Unable to allocate a tournament of %ld mazes.\n", program, nJobs);
+    return(1);
+  }
+
+  memset(tournament->workers, 0, nWorkers * sizeof(Worker));
+  atomic_init(&tournament->failed, 0);
+
+  double started = NowSeconds();
+
+  for (int w = 0; w < nWorkers; w++) {
+
+    Worker *worker = &tournament->workers[w];
+    uint64_t first = nJobs * w / nWorkers, end = nJobs * (w + 1) / nWorkers;
+
+    worker->tournament = tournament;
+    worker->id = w;
+    atomic_init(&worker->share, (end << 32) | first);
+  }
+  for (int w = 0; w < nWorkers; w++) {
+    if (pthread_create(&tournament->workers[w].thread, NULL, RunWorker, &tournament->workers[w]) != 0) {
+      fprintf(stderr, "[%s] Error: Unable to start worker %d.\n", program, w);
+      return(1);
+    }
+  }
+  for (int w = 0; w < nWorkers; w++) {
+    pthread_join(tournament->workers[w].thread, NULL);
+  }
+
+  double seconds = NowSeconds() - started;
+
+  if (atomic_load(&tournament->failed)) {
+    fprintf(stderr, "[%s] Error: Unable to allocate a maze or its navigation.\n", program);
+    return(1);
+  }
+
+
+  /* A line per cell, then per strategy, from the same jobs */
+
+  long totalMoves = 0, totalStolen = 0;
+  double busy = 0;
+
+  for (long job = 0; job < nJobs; job++) {
+    busy += tournament->seconds[job];
+    totalMoves += tournament->moves[job] > 0 ? tournament->moves[job] : 0;
+  }
+
+  printf("%-11s %3s %3s %7s %7s %12s %9s %9s %10s\n", "strategy", "n", "d", "mazes", "solved", "mean nMoves",
+         "p50", "p95", "ms/maze");
+
+  long cellsPerStrategy = nCells / tournament->nStrategies;
+
+  for (int pass = quiet ? 1 : 0; pass < 2; pass++) {
+
+    long group = pass == 0 ? 1 : cellsPerStrategy;
+
+    if (pass == 1 && !quiet) {
+      printf("\n");
+    }
+
+    for (long cell = 0; cell < nCells; cell += group) {
+
+      long nSolved = 0, sum = 0;
+      double time = 0;
+
+      for (long job = cell * runs; job < (cell + group) * runs; job++) {
+        time += tournament->seconds[job];
+        if (tournament->moves[job] >= 0) {
+          sorted[nSolved++] = tournament->moves[job];
+          sum += tournament->moves[job];
+        }
+      }
+      qsort(sorted, nSolved, sizeof(long), CompareLong);
+
+      const char *name = NavigatorStrategies[tournament->strategies[cell / cellsPerStrategy]];
+      char avatars[16], difficulty[16];
+
+      snprintf(avatars, sizeof(avatars), "%ld",
+               tournament->firstAvatars + (cell / tournament->nDifficulties) % tournament->nAvatarCounts);
+      snprintf(difficulty, sizeof(difficulty), "%ld", tournament->firstDifficulty + cell % tournament->nDifficulties);
+
+      if (pass == 1 && tournament->nAvatarCounts > 1) {
+        snprintf(avatars, sizeof(avatars), "all");
+      }
+      if (pass == 1 && tournament->nDifficulties > 1) {
+        snprintf(difficulty, sizeof(difficulty), "all");
+      }
+
+      if (nSolved > 0) {
+        printf("%-11s %3s %3s %7ld %7ld %12.1f %9ld %9ld %10.3f\n", name, avatars, difficulty, group * runs,
+               nSolved, (double) sum / nSolved, sorted[(nSolved - 1) / 2], sorted[(nSolved * 95 + 99) / 100 - 1],
+               time * 1e3 / (group * runs));
+      }
+      else {
+        printf("%-11s %3s %3s %7ld %7ld %12s %9s %9s %10.3f\n", name, avatars, difficulty, group * runs, 0L,
+               "-", "-", "-", time * 1e3 / (group * runs));
+      }
+    }
+  }
+
+  for (int w = 0; w < nWorkers; w++) {
+    totalStolen += tournament->workers[w].stolen;
+  }
+
+  printf("[%s]: %ld mazes on %d threads in %.3f s: %.1f mazes/s, %.2f million moves/s, %.2fx the rate "
+         "of one thread; %ld mazes stolen\n", program, nJobs, nWorkers, seconds, nJobs / seconds, totalMoves / seconds / 1e6,
+         busy / seconds, totalStolen);
+
+  free(sorted);
+  free(tournament->moves);
+  free(tournament->seconds);
+  free(tournament->workers);
+  return(0);
+}
+
+
+/*
+ *
+ * CompareLong - qsort order for move counts
+ *
+ */
+static int CompareLong(const void *a, const void *b) {
+
+  long x = *(const long *) a, y = *(const long *) b;
+  return (x > y) - (x < y);
+}
+
+
+/*
+ *
+ * NowSeconds - monotonic clock reading in seconds
+ *
+ */
+static double NowSeconds(void) {
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+
+/*
+ *
+ * ThreadSeconds - CPU time the calling thread has used, in seconds, so a
+ *   job's time does not count other threads sharing its core
+ *
+ */
+static double ThreadSeconds(void) {
+
+  struct timespec now;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+
+int main(int argc, char* argv[]) {
+
+
+  /* Argument Checking */
+
+  char *program = argv[0];
+
+  SimOptions options = { 3, NAV_FOLLOW, 1, 1, AM_MAX_PATH, SIM_MAX_MOVES };
+  int difficulty = 5;
+  unsigned long long seed = 1;
+  long runs = 1;
+  char *mazeFile = NULL;
+  char *saveFile = NULL;
+  int quiet = 0;
+  int threads = -1;                          // -t, -1 for no tournament
+  int pinned = 0;                            // which of -n, -d, -p were given
+
+  int ch;
+  char *end;
+  long val;
+
+  while ((ch = getopt(argc, argv, "n:d:s:r:f:o:p:kw1m:qt:")) != -1)
+    switch(ch)
+    {
+      case 'n':
+        val = strtol(optarg, &end, 0);
+        if (val <= 1 || val > AM_MAX_AVATAR || strlen(end) != 0) {
+          fprintf(stderr, "[%s] Usage: [-n nAvatars] requires an integer from 2 to %d.\n", program, AM_MAX_AVATAR);
+          return(1);
+        }
+        options.nAvatars = val;
+        pinned |= 1;
+        break;
+
+      case 'd':
+        val = strtol(optarg, &end, 0);
+        if (val < 0 || val > AM_MAX_DIFFICULTY || strlen(end) != 0) {
+          fprintf(stderr, "[%s] Usage: [-d difficulty] requires an integer from 0 to %d.\n", program, AM_MAX_DIFFICULTY);
+          return(1);
+        }
+        difficulty = val;
+        pinned |= 2;
+        break;
+
+      case 's':
+        seed = strtoull(optarg, &end, 0);
+        if (strlen(end) != 0) {
+          fprintf(stderr, "[%s] Usage: [-s seed] requires an integer.\n", program);
+          return(1);
+        }
+        break;
+
+      case 'r':
+        runs = strtol(optarg, &end, 0);
+        if (runs <= 0 || strlen(end) != 0) {
+          fprintf(stderr, "[%s] Usage: [-r runs] requires a positive integer.\n", program);
+          return(1);
+        }
+        break;
+
+      case 'f':
+        mazeFile = optarg;
+        break;
+
+      case 'o':
+        saveFile = optarg;
+        break;
+
+      case 'p':
+        options.strategy = NavigatorParse(optarg);
+        if (options.strategy == -1) {
+          fprintf(stderr, "[%s] Usage: [-p strategy] requires follow, follow-left, frontier or rendezvous.\n", program);
+          return(1);
+        }
+        pinned |= 4;
+        break;
+
+      case 'k':
+        options.prune = 0;
+        break;
+
+      case 'w':
+        options.thinkAhead = 0;
+        break;
+
+      case '1':
+        options.maxPath = 1;
+        break;
+
+      case 'm':
+        options.maxMoves = strtol(optarg, &end, 0);
+        if (options.maxMoves <= 0 || strlen(end) != 0) {
+          fprintf(stderr, "[%s] Usage: [-m maxMoves] requires a positive integer.\n", program);
+          return(1);
+        }
+        break;
+
+      case 'q':
+        quiet = 1;
+        break;
+
+      case 't':
+        val = strtol(optarg, &end, 0);
+        if (val < 0 || val > SIM_MAX_THREADS || strlen(end) != 0) {
+          fprintf(stderr, "[%s] Usage: [-t threads] requires an integer from 0 to %d.\n", program, SIM_MAX_THREADS);
+          return(1);
+        }
+        threads = val;
+        break;
+
+      default:
+        fprintf(stderr, "[%s] Usage: [-n nAvatars] [-d difficulty] [-s seed] [-r runs] [-f file] [-o file]"
+                " [-p strategy] [-k] [-w] [-1] [-m maxMoves] [-q] [-t threads]\n", program);
+        return(1);
+    }
+
+
+
+  /* A tournament over every strategy, nAvatars and difficulty not pinned */
+
+  if (threads != -1) {
+
+    if (mazeFile != NULL || saveFile != NULL) {
+      fprintf(stderr, "[%s] Usage: [-t threads] cannot be used with -f or -o.\n", program);
+      return(1);
+    }
+
+    Tournament tournament;
+    memset(&tournament, 0, sizeof(tournament));
+
+    tournament.options = options;
+    tournament.seed = seed;
+    tournament.runs = runs;
+    tournament.nWorkers = threads > 0 ? threads : (int) sysconf(_SC_NPROCESSORS_ONLN);
+    tournament.nWorkers = tournament.nWorkers > 0 ? tournament.nWorkers : 1;
+    tournament.firstAvatars = (pinned & 1) ? options.nAvatars : 2;
+    tournament.nAvatarCounts = (pinned & 1) ? 1 : AM_MAX_AVATAR - 1;
+    tournament.firstDifficulty = (pinned & 2) ? difficulty : 0;
+    tournament.nDifficulties = (pinned & 2) ? 1 : AM_MAX_DIFFICULTY + 1;
+
+    for (int strategy = 0; strategy < NAV_STRATEGIES; strategy++) {
+      if (!(pinned & 4) || strategy == options.strategy) {
+        tournament.strategies[tournament.nStrategies++] = strategy;
+      }
+    }
+
+    long nCells = (long) tournament.nStrategies * tournament.nAvatarCounts * tournament.nDifficulties;
+    if (runs > SIM_MAX_JOBS / nCells) {
+      fprintf(stderr, "[%s] Usage: [-r runs] allows at most %ld mazes per cell with -t.\n", program,
+              SIM_MAX_JOBS / nCells);
+      return(1);
+    }
+    tournament.nJobs = nCells * runs;
+
+    return RunTournament(&tournament, program, quiet);
+  }
+
+  long *solvedMoves = calloc(runs, sizeof(long));
+  if (solvedMoves == NULL) {
+    fprintf(stderr, "[%s] Error: Unable to allocate results for %ld runs.\n", program, runs);
+    return(1);
+  }
+
+
+  /* Play every maze in turn */
+
+  long nSolved = 0, nFailed = 0, totalMoves = 0, totalTurns = 0, solvedTotal = 0;
+  double started = NowSeconds();
+  Player player;
+
+  memset(&player, 0, sizeof(player));
+
+  for (long run = 0; run < runs; run++) {
+
+    int size = MAZE_SIZE_FOR_DIFFICULTY(difficulty);
+    Maze *maze = mazeFile != NULL ? MazeLoad(mazeFile, seed + run) : PlayerMaze(&player, size, seed + run);
+
+    if (maze == NULL) {
+      fprintf(stderr, "[%s] Error: Unable to %s maze %ld.\n", program, mazeFile != NULL ? "load" : "generate", run);
+      return(1);
+    }
+
+    if (run == 0 && saveFile != NULL && !MazeSave(maze, saveFile)) {
+      fprintf(stderr, "[%s] Error: Unable to save the maze to %s.\n", program, saveFile);
+      return(1);
+    }
+
+    long nMoves, turns;
+    int solved = PlayMaze(&player, maze, &options, &nMoves, &turns);
+    uint32_t hash = MazeHash(maze) ^ (options.nAvatars << 8) ^ difficulty;
+
+    if (solved == -1) {
+      fprintf(stderr, "[%s] Error: Unable to allocate navigation for maze %ld.\n", program, run);
+      return(1);
+    }
+
+    if (solved) {
+      solvedMoves[nSolved++] = nMoves;
+      solvedTotal += nMoves;
+    }
+    else {
+      nFailed++;
+    }
+    totalMoves += nMoves;
+    totalTurns += turns;
+
+    if (!quiet) {
+      if (solved) {
+        printf("Maze %ld (seed %llu): solved nAvatars=%d difficulty=%d nMoves=%ld Hash=%u (%ld turns sent)\n",
+               run, seed + run, options.nAvatars, difficulty, nMoves, hash, turns);
+      }
+      else {
+        printf("Maze %ld (seed %llu): not solved in %ld moves\n", run, seed + run, options.maxMoves);
+      }
+    }
+
+    if (mazeFile != NULL) {
+      MazeFree(maze);
+    }
+  }
+
+  double seconds = NowSeconds() - started;
+  PlayerFree(&player);
+
+
+  /* Summary */
+
+  printf("[%s]: %ld mazes played, %ld solved, %ld not solved in %.3f s\n", program, runs, nSolved, nFailed, seconds);
+
+  if (nSolved > 0) {
+    qsort(solvedMoves, nSolved, sizeof(long), CompareLong);
+    printf("[%s]: nMoves mean %.1f, min %ld, median %ld, 95th %ld, max %ld; mean turns sent %.1f\n", program,
+           (double) solvedTotal / nSolved, solvedMoves[0], solvedMoves[(nSolved - 1) / 2],
+           solvedMoves[(nSolved * 95 + 99) / 100 - 1], solvedMoves[nSolved - 1], (double) totalTurns / runs);
+  }
+  printf("[%s]: %.2f million moves/s, %.2f million turns/s\n", program,
+         totalMoves / seconds / 1e6, totalTurns / seconds / 1e6);
+
+  free(solvedMoves);
+  return(0);
+}
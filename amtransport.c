@@ -0,0 +1,730 @@
+/* ========================================================================== */
+/* File: amtransport.c
+ *
+ * Author: Troy Palmer and Sean Cann
+ * Date: 6.4.2015
+ *
+ * Overview: TCP, AF_UNIX and shared-memory implementations of the Transport
+ * calls in amtransport.h. The two socket kinds are plain send/recv on a file
+ * descriptor. The shared-memory kind copies bytes through an ShmRing: the
+ * producer advances head, the consumer advances tail, and whichever side
+ * finds the ring empty (or full) sleeps in FUTEX_WAIT on the counter the
+ * other side moves next. Wakeups are only issued when a sleeper has flagged
+ * itself, so a busy connection makes no futex calls at all.
+ *
+ * The futex words live in a MAP_SHARED memfd mapping, so the shared (not
+ * FUTEX_PRIVATE_FLAG) futex operations are used.
+ *
+ */
+/* ========================================================================== */
+
+// ---------------- System includes
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>                         // bcopy
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <linux/futex.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>                     // TCP_NODELAY
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+
+// ---------------- Local includes
+
+#include "amtransport.h"
+
+// ---------------- Private prototypes
+
+static int FutexWait(_Atomic uint32_t *word, uint32_t expected, int timeoutMs);
+
+static void FutexWake(_Atomic uint32_t *word);
+
+static size_t RingPush(ShmRing *ring, const void *buffer, size_t length, int fd);
+
+static ssize_t RingPop(ShmRing *ring, void *buffer, size_t length, int fd);
+
+static int PeerGone(int fd);
+
+static int SendHello(int fd, char hello);
+
+static int AttachShm(Transport *transport, int fd);
+
+static int OfferShm(Transport *transport, int fd, ShmHub *hub);
+
+/* ========================================================================== */
+
+
+/*
+ *
+ * FutexWait, FutexWake - sleep while *word == expected / wake every sleeper
+ *
+ * FutexWait returns 0 when woken (or the word had already changed) and -1 on
+ * timeout
+ *
+ */
+static int FutexWait(_Atomic uint32_t *word, uint32_t expected, int timeoutMs) {
+
+  struct timespec timeout = { timeoutMs / 1000, (timeoutMs % 1000) * 1000000L };
+
+  if (syscall(SYS_futex, word, FUTEX_WAIT, expected, &timeout, NULL, 0) == -1 && errno == ETIMEDOUT) {
+    return(-1);
+  }
+  return(0);
+}
+
+static void FutexWake(_Atomic uint32_t *word) {
+
+  syscall(SYS_futex, word, FUTEX_WAKE, 0x7fffffff, NULL, NULL, 0);
+}
+
+
+/*
+ *
+ * PeerGone - checks the handshake socket of a shm connection for hangup
+ *
+ * Returns 1 if the other process closed its end (or exited)
+ *
+ */
+static int PeerGone(int fd) {
+
+  struct pollfd pfd = { fd, POLLIN, 0 };
+
+  if (fd == -1 || poll(&pfd, 1, 0) <= 0) {
+    return(0);
+  }
+  char byte;
+  return (pfd.revents & (POLLHUP | POLLERR)) || recv(fd, &byte, 1, MSG_DONTWAIT | MSG_PEEK) == 0;
+}
+
+
+/*
+ *
+ * RingPush - copies as much of buffer as fits, sleeping while the ring is full
+ *
+ * Returns the number of bytes written, or 0 if the consumer went away
+ *
+ */
+static size_t RingPush(ShmRing *ring, const void *buffer, size_t length, int fd) {
+
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  uint32_t tail = atomic_load(&ring->tail);
+
+  while (head - tail == SHM_RING_BYTES) {
+    atomic_store(&ring->tailWaiter, 1);
+    if ((tail = atomic_load(&ring->tail)) != head - SHM_RING_BYTES) {
+      break;
+    }
+    if (atomic_load(&ring->closed) || (FutexWait(&ring->tail, tail, SHM_POLL_MS) == -1 && PeerGone(fd))) {
+      return(0);
+    }
+    tail = atomic_load(&ring->tail);
+  }
+
+  size_t space = SHM_RING_BYTES - (head - tail);
+  size_t n = length < space ? length : space;
+  size_t offset = head % SHM_RING_BYTES;
+  size_t first = n < SHM_RING_BYTES - offset ? n : SHM_RING_BYTES - offset;
+
+  memcpy(ring->data + offset, buffer, first);
+  memcpy(ring->data, (const unsigned char *) buffer + first, n - first);
+
+  atomic_store(&ring->head, head + n);
+  if (atomic_exchange(&ring->headWaiter, 0)) {
+    FutexWake(&ring->head);
+  }
+  return(n);
+}
+
+
+/*
+ *
+ * RingPop - copies out up to length bytes, sleeping while the ring is empty
+ *
+ * Returns the number of bytes read, or 0 once the producer closed the ring
+ * (or its process went away) and everything it wrote has been read
+ *
+ */
+static ssize_t RingPop(ShmRing *ring, void *buffer, size_t length, int fd) {
+
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  uint32_t head = atomic_load(&ring->head);
+
+  while (head == tail) {
+    if (atomic_load(&ring->closed)) {
+      return(0);
+    }
+    atomic_store(&ring->headWaiter, 1);
+    if ((head = atomic_load(&ring->head)) != tail) {
+      break;
+    }
+    if (FutexWait(&ring->head, head, SHM_POLL_MS) == -1 && PeerGone(fd)) {
+      return(0);
+    }
+    head = atomic_load(&ring->head);
+  }
+
+  size_t n = head - tail < length ? head - tail : length;
+  size_t offset = tail % SHM_RING_BYTES;
+  size_t first = n < SHM_RING_BYTES - offset ? n : SHM_RING_BYTES - offset;
+
+  memcpy(buffer, ring->data + offset, first);
+  memcpy((unsigned char *) buffer + first, ring->data, n - first);
+
+  atomic_store(&ring->tail, tail + n);
+  if (atomic_exchange(&ring->tailWaiter, 0)) {
+    FutexWake(&ring->tail);
+  }
+  return(n);
+}
+
+
+/*
+ *
+ * TransportParse, TransportName - between TRANSPORT_* kinds and their names
+ *
+ */
+int TransportParse(const char *name) {
+
+  if (strcmp(name, "tcp") == 0) {
+    return(TRANSPORT_TCP);
+  }
+  if (strcmp(name, "unix") == 0) {
+    return(TRANSPORT_UNIX);
+  }
+  if (strcmp(name, "shm") == 0) {
+    return(TRANSPORT_SHM);
+  }
+  return(-1);
+}
+
+const char *TransportName(int kind) {
+
+  return kind == TRANSPORT_SHM ? "shm" : kind == TRANSPORT_UNIX ? "unix" : "tcp";
+}
+
+
+/*
+ *
+ * TransportSocketPath - AF_UNIX path standing in for a TCP port number
+ *
+ */
+void TransportSocketPath(char *path, size_t length, int port) {
+
+  snprintf(path, length, "/tmp/amazing-%d.sock", port);
+}
+
+
+/*
+ *
+ * SendHello - sends the one byte that opens every AF_UNIX connection
+ *
+ * Returns 1 on success and 0 on failure
+ *
+ */
+static int SendHello(int fd, char hello) {
+
+  return send(fd, &hello, 1, MSG_NOSIGNAL) == 1;
+}
+
+
+/*
+ *
+ * AttachShm - receives the region memfd and slot index from the server and
+ *   maps the region
+ *
+ * Returns 1 on success and 0 on failure
+ *
+ */
+static int AttachShm(Transport *transport, int fd) {
+
+  uint32_t slot;
+  char control[CMSG_SPACE(sizeof(int))];
+  struct iovec iov = { &slot, sizeof(slot) };
+  struct msghdr msg;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  if (recvmsg(fd, &msg, MSG_WAITALL) != sizeof(slot)) {
+    return(0);
+  }
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS || (slot = ntohl(slot)) >= SHM_SLOTS) {
+    return(0);
+  }
+
+  int memfd;
+  memcpy(&memfd, CMSG_DATA(cmsg), sizeof(int));
+
+  ShmRegion *region = mmap(NULL, sizeof(ShmRegion), PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+  close(memfd);
+  if (region == MAP_FAILED) {
+    return(0);
+  }
+
+  transport->region = region;
+  transport->in = &region->slots[slot].toClient;
+  transport->out = &region->slots[slot].toServer;
+  transport->doorbell = &region->doorbell;
+  transport->doorbellWaiter = &region->doorbellWaiter;
+  return(1);
+}
+
+
+/*
+ *
+ * TransportConnect - opens a client connection of the given kind to port
+ *
+ * Pseudocode: TCP connects to server:port with Nagle off. Unix and shm
+ * connect to the AF_UNIX socket for port and send the hello byte; shm then
+ * waits for the server's memfd and maps the ring pair it was given.
+ *
+ * Returns 1 on success and 0 on failure
+ *
+ */
+int TransportConnect(Transport *transport, int kind, struct hostent *server, int port) {
+
+  memset(transport, 0, sizeof(Transport));
+  transport->kind = kind;
+  transport->fd = -1;
+
+  if (kind == TRANSPORT_TCP) {
+
+    struct sockaddr_in addr;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) {
+      return(0);
+    }
+
+    bzero((char *) &addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    bcopy((char *) server->h_addr_list[0], (char *) &addr.sin_addr.s_addr, server->h_length);
+
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+      close(fd);
+      return(0);
+    }
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    transport->fd = fd;
+    return(1);
+  }
+
+  struct sockaddr_un addr;
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1) {
+    return(0);
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  TransportSocketPath(addr.sun_path, sizeof(addr.sun_path), port);
+
+  if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+      !SendHello(fd, kind == TRANSPORT_SHM ? TRANSPORT_HELLO_SHM : TRANSPORT_HELLO_UNIX) ||
+      (kind == TRANSPORT_SHM && !AttachShm(transport, fd))) {
+    close(fd);
+    return(0);
+  }
+
+  transport->fd = fd;
+  return(1);
+}
+
+
+/*
+ *
+ * TransportListen - opens a listening socket for port; TCP port 0 picks a
+ *   free port, which is stored in boundPort
+ *
+ * Returns the listening descriptor, or -1 on failure
+ *
+ */
+int TransportListen(int kind, int port, int *boundPort) {
+
+  int fd;
+
+  if (kind == TRANSPORT_TCP) {
+
+    struct sockaddr_in addr;
+    socklen_t addrLength = sizeof(addr);
+    int one = 1;
+
+    if ((fd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+      return(-1);
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+        listen(fd, SOMAXCONN) == -1 ||
+        getsockname(fd, (struct sockaddr *) &addr, &addrLength) == -1) {
+      close(fd);
+      return(-1);
+    }
+    if (boundPort != NULL) {
+      *boundPort = ntohs(addr.sin_port);
+    }
+    return(fd);
+  }
+
+  struct sockaddr_un addr;
+
+  if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+    return(-1);
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  TransportSocketPath(addr.sun_path, sizeof(addr.sun_path), port);
+  unlink(addr.sun_path);
+
+  if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 || listen(fd, SOMAXCONN) == -1) {
+    close(fd);
+    return(-1);
+  }
+  if (boundPort != NULL) {
+    *boundPort = port;
+  }
+  return(fd);
+}
+
+
+/*
+ *
+ * OfferShm - reserves a ring pair in the hub's region (creating the region
+ *   on first use) and passes its memfd and slot index over fd
+ *
+ * Returns 1 on success and 0 on failure
+ *
+ */
+static int OfferShm(Transport *transport, int fd, ShmHub *hub) {
+
+  if (hub == NULL || hub->nSlots == SHM_SLOTS) {
+    return(0);
+  }
+
+  if (hub->region == NULL) {
+    int memfd = memfd_create("amazing-shm", MFD_CLOEXEC);
+    if (memfd == -1) {
+      return(0);
+    }
+    ShmRegion *region = MAP_FAILED;
+    if (ftruncate(memfd, sizeof(ShmRegion)) == 0) {
+      region = mmap(NULL, sizeof(ShmRegion), PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    }
+    if (region == MAP_FAILED) {
+      close(memfd);
+      return(0);
+    }
+    hub->region = region;
+    hub->memfd = memfd;
+  }
+
+  uint32_t slot = htonl(hub->nSlots);
+  char control[CMSG_SPACE(sizeof(int))];
+  struct iovec iov = { &slot, sizeof(slot) };
+  struct msghdr msg;
+
+  memset(&msg, 0, sizeof(msg));
+  memset(control, 0, sizeof(control));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &hub->memfd, sizeof(int));
+
+  if (sendmsg(fd, &msg, MSG_NOSIGNAL) != sizeof(slot)) {
+    return(0);
+  }
+
+  transport->in = &hub->region->slots[hub->nSlots].toServer;
+  transport->out = &hub->region->slots[hub->nSlots].toClient;
+  hub->nSlots++;
+  return(1);
+}
+
+
+/*
+ *
+ * TransportAccept - accepts one connection from listenfd; on an AF_UNIX
+ *   listener the client's hello decides between unix and shm
+ *
+ * Returns 1 on success and 0 on failure
+ *
+ */
+int TransportAccept(Transport *transport, int listenfd, int kind, ShmHub *hub) {
+
+  memset(transport, 0, sizeof(Transport));
+  transport->fd = -1;
+
+  int fd = accept(listenfd, NULL, NULL);
+  if (fd == -1) {
+    return(0);
+  }
+  return TransportGreet(transport, fd, kind, hub);
+}
+
+
+/*
+ *
+ * TransportGreet - the rest of TransportAccept once fd is accepted: TCP
+ *   needs nothing but TCP_NODELAY, AF_UNIX reads the client's hello
+ *
+ * Returns 1 on success and 0 on failure (fd closed)
+ *
+ */
+int TransportGreet(Transport *transport, int fd, int kind, ShmHub *hub) {
+
+  memset(transport, 0, sizeof(Transport));
+  transport->fd = -1;
+
+  if (kind == TRANSPORT_TCP) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    TransportFromSocket(transport, TRANSPORT_TCP, fd);
+    return(1);
+  }
+
+  char hello;
+  if (recv(fd, &hello, 1, MSG_WAITALL) != 1 ||
+      (hello != TRANSPORT_HELLO_UNIX && hello != TRANSPORT_HELLO_SHM)) {
+    close(fd);
+    return(0);
+  }
+
+  if (hello == TRANSPORT_HELLO_UNIX) {
+    TransportFromSocket(transport, TRANSPORT_UNIX, fd);
+    return(1);
+  }
+
+  if (!OfferShm(transport, fd, hub)) {
+    close(fd);
+    return(0);
+  }
+  transport->kind = TRANSPORT_SHM;
+  transport->fd = fd;
+  return(1);
+}
+
+
+/*
+ *
+ * TransportFromSocket - wraps a connected socket of the given kind
+ *
+ */
+void TransportFromSocket(Transport *transport, int kind, int fd) {
+
+  memset(transport, 0, sizeof(Transport));
+  transport->kind = kind;
+  transport->fd = fd;
+}
+
+
+/*
+ *
+ * TransportSend - one send (socket) or ring push (shm); a client's shm push
+ *   also rings the server's doorbell
+ *
+ * Returns the number of bytes sent, or -1 on failure (errno set for sockets)
+ *
+ */
+ssize_t TransportSend(Transport *transport, const void *buffer, size_t length) {
+
+  if (transport->kind != TRANSPORT_SHM) {
+    return send(transport->fd, buffer, length, MSG_NOSIGNAL);
+  }
+
+  size_t n = RingPush(transport->out, buffer, length, transport->fd);
+  if (n == 0) {
+    errno = EPIPE;
+    return(-1);
+  }
+
+  if (transport->doorbell != NULL) {
+    atomic_fetch_add(transport->doorbell, 1);
+    if (atomic_exchange(transport->doorbellWaiter, 0)) {
+      FutexWake(transport->doorbell);
+    }
+  }
+  return(n);
+}
+
+
+/*
+ *
+ * TransportSendAll - sends a whole buffer, resuming after short sends and
+ *   signals
+ *
+ * Returns 1 on success and 0 on failure
+ *
+ */
+int TransportSendAll(Transport *transport, const void *buffer, size_t length) {
+
+  const unsigned char *next = buffer;
+
+  while (length > 0) {
+    ssize_t n = TransportSend(transport, next, length);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return(0);
+    }
+    next += n;
+    length -= n;
+  }
+
+  return(1);
+}
+
+
+/*
+ *
+ * TransportRecv - one recv (socket) or ring pop (shm)
+ *
+ * Returns the number of bytes read, 0 on close, or -1 on error with errno
+ * set (EAGAIN for a non-blocking socket with no data)
+ *
+ */
+ssize_t TransportRecv(Transport *transport, void *buffer, size_t length) {
+
+  if (transport->kind != TRANSPORT_SHM) {
+    return recv(transport->fd, buffer, length, 0);
+  }
+  return RingPop(transport->in, buffer, length, transport->fd);
+}
+
+
+/*
+ *
+ * TransportReadable - whether a shm connection has unread bytes (or has been
+ *   closed, which TransportRecv also reports without blocking)
+ *
+ * Returns 1 if so and 0 otherwise; always 0 for sockets
+ *
+ */
+int TransportReadable(Transport *transport) {
+
+  if (transport->kind != TRANSPORT_SHM) {
+    return(0);
+  }
+  return atomic_load(&transport->in->head) != atomic_load(&transport->in->tail) ||
+         atomic_load(&transport->in->closed);
+}
+
+
+/*
+ *
+ * TransportWrite - FrameEncode followed by TransportSendAll
+ *
+ * Returns 1 on success and 0 on failure
+ *
+ */
+int TransportWrite(Transport *transport, FrameCodec *codec, const AM_Message *message) {
+
+  unsigned char frame[FRAME_MAX_BYTES];
+  size_t length = FrameEncode(codec, message, frame);
+
+  return TransportSendAll(transport, frame, length);
+}
+
+
+/*
+ *
+ * TransportClose - closes the socket; a shm connection first marks its
+ *   outgoing ring closed and wakes the reader so it sees end of stream
+ *
+ */
+void TransportClose(Transport *transport) {
+
+  if (transport->kind == TRANSPORT_SHM && transport->out != NULL) {
+    atomic_store(&transport->out->closed, 1);
+    FutexWake(&transport->out->head);
+    if (transport->doorbell != NULL) {
+      atomic_fetch_add(transport->doorbell, 1);
+      FutexWake(transport->doorbell);
+    }
+  }
+  if (transport->region != NULL) {
+    munmap(transport->region, sizeof(ShmRegion));
+  }
+  if (transport->fd != -1) {
+    close(transport->fd);
+  }
+  memset(transport, 0, sizeof(Transport));
+  transport->fd = -1;
+}
+
+
+/*
+ *
+ * ShmHubWait - sleeps until any client rings the doorbell
+ *
+ * Pseudocode: snapshot the doorbell, return at once if a ring already holds
+ * data, else flag ourselves as a sleeper and FUTEX_WAIT on the snapshot.
+ *
+ * Returns 1 if a ring may have data and 0 on timeout
+ *
+ */
+int ShmHubWait(ShmHub *hub, int timeoutMs) {
+
+  if (hub->region == NULL) {
+    return(0);
+  }
+
+  ShmRegion *region = hub->region;
+  uint32_t bell = atomic_load(&region->doorbell);
+
+  for (int i = 0; i < hub->nSlots; i++) {
+    ShmRing *ring = &region->slots[i].toServer;
+    if (atomic_load(&ring->head) != atomic_load(&ring->tail)) {
+      return(1);
+    }
+  }
+
+  atomic_store(&region->doorbellWaiter, 1);
+  if (atomic_load(&region->doorbell) != bell) {
+    return(1);
+  }
+  return FutexWait(&region->doorbell, bell, timeoutMs) == 0;
+}
+
+
+/*
+ *
+ * ShmHubClose - releases the region once the session's connections are gone
+ *
+ */
+void ShmHubClose(ShmHub *hub) {
+
+  if (hub->region != NULL) {
+    munmap(hub->region, sizeof(ShmRegion));
+    close(hub->memfd);
+  }
+  hub->region = NULL;
+  hub->memfd = -1;
+  hub->nSlots = 0;
+}
@@ -0,0 +1,147 @@
+/* ========================================================================== */
+/* File: amtransport.h
+ *
+ * Author: Troy Palmer and Sean Cann
+ * Date: 6.4.2015
+ *
+ * Pluggable byte transports underneath the AM_Message framing, so a client
+ * and a maze server on the same machine can skip the TCP loopback stack.
+ *
+ * TRANSPORT_TCP    AF_INET stream socket (the original behaviour)
+ * TRANSPORT_UNIX   AF_UNIX stream socket at TransportSocketPath(port)
+ * TRANSPORT_SHM    a pair of single-producer/single-consumer byte rings in
+ *                  a shared memory region, with futex wakeups
+ *
+ * Unix and shared-memory connections both start on the AF_UNIX socket: the
+ * client sends one hello byte (TRANSPORT_HELLO_UNIX or TRANSPORT_HELLO_SHM).
+ * For shared memory the server answers with the region's memfd (passed with
+ * SCM_RIGHTS) and the index of the ring pair reserved for the connection;
+ * the socket then only serves to notice a peer that goes away.
+ *
+ */
+/* ========================================================================== */
+
+#ifndef AMTRANSPORT_H
+#define AMTRANSPORT_H
+
+// ---------------- Prerequisites e.g., Requires "math.h"
+#include <stdatomic.h>                       // _Atomic
+#include <stddef.h>                          // size_t
+#include <stdint.h>                          // uint32_t
+#include <sys/types.h>                       // ssize_t
+#include <netdb.h>                           // struct hostent
+#include "amazing.h"
+#include "amframe.h"                         // FrameCodec
+
+// ---------------- Constants
+
+#define TRANSPORT_TCP        0
+#define TRANSPORT_UNIX       1
+#define TRANSPORT_SHM        2
+
+#define TRANSPORT_HELLO_UNIX 'U'
+#define TRANSPORT_HELLO_SHM  'S'
+
+#define SHM_RING_BYTES    4096               // per direction, per connection
+#define SHM_SLOTS           20               // ring pairs per region
+#define SHM_POLL_MS       1000               // futex wait slice between liveness checks
+
+// ---------------- Structures/Types
+
+/* One direction of a shared-memory connection. head and tail count bytes
+ * ever produced/consumed; the *Waiter flags tell the other side to issue a
+ * futex wake after it moves the counter the sleeper is waiting on.
+ */
+typedef struct ShmRing {
+  _Atomic uint32_t head;
+  _Atomic uint32_t headWaiter;
+  _Atomic uint32_t closed;
+  char pad0[52];
+  _Atomic uint32_t tail;
+  _Atomic uint32_t tailWaiter;
+  char pad1[56];
+  unsigned char data[SHM_RING_BYTES];
+} ShmRing;
+
+/* Shared region: a ring pair per connection plus a doorbell that every
+ * client rings, so one server thread can sleep on all of its connections.
+ */
+typedef struct ShmRegion {
+  _Atomic uint32_t doorbell;
+  _Atomic uint32_t doorbellWaiter;
+  char pad[56];
+  struct {
+    ShmRing toServer;
+    ShmRing toClient;
+  } slots[SHM_SLOTS];
+} ShmRegion;
+
+/* Server-side owner of a region, created on the first shm connection */
+typedef struct ShmHub {
+  ShmRegion *region;
+  int memfd;
+  int nSlots;
+} ShmHub;
+
+/* A connected transport; fd is the socket (the handshake socket for shm) */
+typedef struct Transport {
+  int kind;
+  int fd;
+  ShmRing *in;
+  ShmRing *out;
+  _Atomic uint32_t *doorbell;                // rung on send (client side only)
+  _Atomic uint32_t *doorbellWaiter;
+  ShmRegion *region;                         // client mapping, unmapped on close
+} Transport;
+
+// ---------------- Prototypes/Macros
+
+/* "tcp", "unix" or "shm" to a TRANSPORT_* kind; -1 if unknown */
+int TransportParse(const char *name);
+
+const char *TransportName(int kind);
+
+/* AF_UNIX path used for a management or maze port number */
+void TransportSocketPath(char *path, size_t length, int port);
+
+/* Client: connects to port on server with the given kind; 1 on success */
+int TransportConnect(Transport *transport, int kind, struct hostent *server, int port);
+
+/* Server: listening socket for port (TCP, or AF_UNIX at its path) */
+int TransportListen(int kind, int port, int *boundPort);
+
+/* Server: accepts from listenfd and completes the hello; 1 on success */
+int TransportAccept(Transport *transport, int listenfd, int kind, ShmHub *hub);
+
+/* Server: completes the hello on fd, already accepted from a listener of
+ * kind, so a thread other than the accepting one can wait for it; on
+ * failure fd is closed. 1 on success */
+int TransportGreet(Transport *transport, int fd, int kind, ShmHub *hub);
+
+/* Wraps an already connected socket */
+void TransportFromSocket(Transport *transport, int kind, int fd);
+
+/* Sends up to length bytes; returns bytes sent, or -1 on failure */
+ssize_t TransportSend(Transport *transport, const void *buffer, size_t length);
+
+/* Sends all length bytes; 1 on success */
+int TransportSendAll(Transport *transport, const void *buffer, size_t length);
+
+/* Blocks for at least one byte; returns bytes read, 0 on close, -1 on error */
+ssize_t TransportRecv(Transport *transport, void *buffer, size_t length);
+
+/* 1 if TransportRecv would return without blocking (shm only) */
+int TransportReadable(Transport *transport);
+
+/* Encodes message for codec and sends it */
+int TransportWrite(Transport *transport, FrameCodec *codec, const AM_Message *message);
+
+void TransportClose(Transport *transport);
+
+/* Server: sleeps until a client rings the doorbell or timeoutMs passes;
+ * returns 1 if some connection may have data */
+int ShmHubWait(ShmHub *hub, int timeoutMs);
+
+void ShmHubClose(ShmHub *hub);
+
+#endif // AMTRANSPORT_H
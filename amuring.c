@@ -0,0 +1,381 @@
+/* ========================================================================== */
+/* File: amuring.c
+ *
+ * Author: Troy Palmer and Sean Cann
+ * Date: 6.4.2015
+ *
+ * Overview: io_uring_setup/io_uring_enter/io_uring_register wrappers and the
+ * submission/completion ring bookkeeping described in amuring.h. The kernel
+ * and this process share the ring indices, so tails we publish are stored
+ * with release ordering and the kernel's are loaded with acquire ordering.
+ *
+ */
+/* ========================================================================== */
+
+// ---------------- System includes
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+// ---------------- Local includes
+
+#include "amuring.h"
+
+// ---------------- Private prototypes
+
+static struct io_uring_sqe *NextSqe(Uring *ring);
+
+static void Publish(Uring *ring);
+
+static int ProbeMultishot(Uring *ring);
+
+/* ========================================================================== */
+
+
+/*
+ *
+ * UringInit - creates the ring, maps its queues, registers URING_BUFFERS
+ *   provided receive buffers as buffer group 0 and checks that a multishot
+ *   recv works
+ *
+ * Returns 1 on success and 0 if io_uring (or a feature it needs) is missing
+ *
+ */
+int UringInit(Uring *ring) {
+
+  struct io_uring_params params;
+
+  memset(ring, 0, sizeof(Uring));
+  memset(&params, 0, sizeof(params));
+
+  ring->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+  if (ring->fd == -1) {
+    return(0);
+  }
+  ring->sqEntries = params.sq_entries;
+
+
+  /* Map the submission and completion queues and the SQE array */
+
+  ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring->cqRingSize > ring->sqRingSize) {
+      ring->sqRingSize = ring->cqRingSize;
+    }
+    ring->cqRingSize = ring->sqRingSize;
+  }
+
+  ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQ_RING);
+  ring->cqRing = (params.features & IORING_FEAT_SINGLE_MMAP) ? ring->sqRing :
+                 mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_CQ_RING);
+  ring->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+
+  if (ring->sqRing == MAP_FAILED || ring->cqRing == MAP_FAILED || ring->sqes == MAP_FAILED) {
+    UringClose(ring);
+    return(0);
+  }
+
+  unsigned char *sq = ring->sqRing, *cq = ring->cqRing;
+  ring->sqHead = (unsigned *) (sq + params.sq_off.head);
+  ring->sqTail = (unsigned *) (sq + params.sq_off.tail);
+  ring->sqMask = (unsigned *) (sq + params.sq_off.ring_mask);
+  ring->sqArray = (unsigned *) (sq + params.sq_off.array);
+  ring->cqHead = (unsigned *) (cq + params.cq_off.head);
+  ring->cqTail = (unsigned *) (cq + params.cq_off.tail);
+  ring->cqMask = (unsigned *) (cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+
+  /* Provided buffer ring: the kernel picks a free buffer for each recv */
+
+  ring->bufRing = mmap(NULL, URING_BUFFERS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  ring->buffers = mmap(NULL, URING_BUFFERS * URING_BUFFER_BYTES, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (ring->bufRing == MAP_FAILED || ring->buffers == MAP_FAILED) {
+    UringClose(ring);
+    return(0);
+  }
+
+  struct io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uint64_t) (uintptr_t) ring->bufRing;
+  reg.ring_entries = URING_BUFFERS;
+  reg.bgid = 0;
+
+  if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+    UringClose(ring);
+    return(0);
+  }
+
+  for (int i = 0; i < URING_BUFFERS; i++) {
+    UringRecycle(ring, i);
+  }
+
+  if (!ProbeMultishot(ring)) {
+    UringClose(ring);
+    return(0);
+  }
+
+  return(1);
+}
+
+
+/*
+ *
+ * ProbeMultishot - posts a multishot recv on a socketpair holding one byte
+ *   and end of stream. Buffer rings came in Linux 5.19 but multishot recv
+ *   only in 6.0, and a kernel in between accepts the registration, then
+ *   fails every such recv with -EINVAL
+ *
+ * Pseudocode: write the byte and close the writing end first, so the recv
+ * completes straight away: the byte (still armed), then end of stream. A
+ * negative result on either means no multishot recv. Buffers used go back
+ * to the ring, and the enter calls made are not counted.
+ *
+ * Returns 1 if multishot recv works, 0 otherwise
+ *
+ */
+static int ProbeMultishot(Uring *ring) {
+
+  int pair[2];
+  char byte = 0;
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == -1) {
+    return(0);
+  }
+
+  int sent = send(pair[1], &byte, 1, MSG_NOSIGNAL) == 1;
+  close(pair[1]);
+
+  int works = sent && UringRecvMultishot(ring, pair[0], UINT64_MAX);
+  int armed = works;
+
+  while (armed) {
+
+    if (UringSubmit(ring, 1) == -1) {
+      works = 0;
+      break;
+    }
+
+    UringCompletion completion;
+
+    while (armed && UringNext(ring, &completion)) {
+      if (completion.bufferId >= 0) {
+        UringRecycle(ring, completion.bufferId);
+      }
+      works = works && completion.res >= 0;
+      armed = completion.more;
+    }
+  }
+
+  close(pair[0]);
+  ring->enterCalls = 0;
+  return(works);
+}
+
+
+/*
+ *
+ * NextSqe - claims the next submission queue entry, flushing the queue to
+ *   the kernel first if it is full
+ *
+ * Returns a zeroed SQE, or NULL if the queue could not be flushed
+ *
+ */
+static struct io_uring_sqe *NextSqe(Uring *ring) {
+
+  unsigned tail = *ring->sqTail;
+
+  if (tail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE) == ring->sqEntries && UringSubmit(ring, 0) == -1) {
+    return(NULL);
+  }
+
+  unsigned index = tail & *ring->sqMask;
+  struct io_uring_sqe *sqe = &ring->sqes[index];
+
+  memset(sqe, 0, sizeof(*sqe));
+  ring->sqArray[index] = index;
+  return(sqe);
+}
+
+
+/*
+ *
+ * Publish - hands a filled SQE to the kernel's view of the queue
+ *
+ */
+static void Publish(Uring *ring) {
+
+  __atomic_store_n(ring->sqTail, *ring->sqTail + 1, __ATOMIC_RELEASE);
+  ring->pending++;
+}
+
+
+/*
+ *
+ * UringRecvMultishot - queues a recv on fd that stays armed (reporting
+ *   IORING_CQE_F_MORE) and fills a provided buffer per arrival
+ *
+ * Returns 1 on success and 0 if no SQE was available
+ *
+ */
+int UringRecvMultishot(Uring *ring, int fd, uint64_t userData) {
+
+  struct io_uring_sqe *sqe = NextSqe(ring);
+  if (sqe == NULL) {
+    return(0);
+  }
+
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = fd;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = 0;
+  sqe->user_data = userData;
+  Publish(ring);
+  return(1);
+}
+
+
+/*
+ *
+ * UringSend - queues a send; MSG_WAITALL has the kernel finish short sends
+ *
+ * Returns 1 on success and 0 if no SQE was available
+ *
+ */
+int UringSend(Uring *ring, int fd, const void *buffer, size_t length, uint64_t userData) {
+
+  struct io_uring_sqe *sqe = NextSqe(ring);
+  if (sqe == NULL) {
+    return(0);
+  }
+
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t) (uintptr_t) buffer;
+  sqe->len = length;
+  sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+  sqe->user_data = userData;
+  Publish(ring);
+  return(1);
+}
+
+
+/*
+ *
+ * UringSubmit - one io_uring_enter that submits every queued SQE and, if
+ *   minComplete > 0, waits for that many completions
+ *
+ * Returns the number of SQEs submitted, or -1 on failure
+ *
+ */
+int UringSubmit(Uring *ring, unsigned minComplete) {
+
+  for (;;) {
+    int submitted = syscall(__NR_io_uring_enter, ring->fd, ring->pending, minComplete,
+                            minComplete > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    ring->enterCalls++;
+
+    if (submitted >= 0) {
+      ring->pending -= submitted;
+      return(submitted);
+    }
+    if (errno != EINTR) {
+      return(-1);
+    }
+  }
+}
+
+
+/*
+ *
+ * UringNext - pops one completion off the completion queue
+ *
+ * Returns 1 if completion was filled in and 0 if the queue was empty
+ *
+ */
+int UringNext(Uring *ring, UringCompletion *completion) {
+
+  unsigned head = *ring->cqHead;
+
+  if (head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)) {
+    return(0);
+  }
+
+  struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cqMask];
+
+  completion->userData = cqe->user_data;
+  completion->res = cqe->res;
+  completion->flags = cqe->flags;
+  completion->more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+  completion->bufferId = -1;
+  completion->buffer = NULL;
+
+  if (cqe->flags & IORING_CQE_F_BUFFER) {
+    completion->bufferId = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    completion->buffer = ring->buffers + (size_t) completion->bufferId * URING_BUFFER_BYTES;
+  }
+
+  __atomic_store_n(ring->cqHead, head + 1, __ATOMIC_RELEASE);
+  return(1);
+}
+
+
+/*
+ *
+ * UringRecycle - appends a receive buffer to the provided buffer ring
+ *
+ */
+void UringRecycle(Uring *ring, int bufferId) {
+
+  unsigned short tail = ring->bufRing->tail;
+  struct io_uring_buf *buf = &ring->bufRing->bufs[tail & (URING_BUFFERS - 1)];
+
+  buf->addr = (uint64_t) (uintptr_t) (ring->buffers + (size_t) bufferId * URING_BUFFER_BYTES);
+  buf->len = URING_BUFFER_BYTES;
+  buf->bid = bufferId;
+
+  __atomic_store_n(&ring->bufRing->tail, (unsigned short) (tail + 1), __ATOMIC_RELEASE);
+}
+
+
+/*
+ *
+ * UringClose - unmaps everything and closes the ring
+ *
+ */
+void UringClose(Uring *ring) {
+
+  if (ring->sqes != NULL && ring->sqes != MAP_FAILED) {
+    munmap(ring->sqes, ring->sqEntries * sizeof(struct io_uring_sqe));
+  }
+  if (ring->cqRing != NULL && ring->cqRing != MAP_FAILED && ring->cqRing != ring->sqRing) {
+    munmap(ring->cqRing, ring->cqRingSize);
+  }
+  if (ring->sqRing != NULL && ring->sqRing != MAP_FAILED) {
+    munmap(ring->sqRing, ring->sqRingSize);
+  }
+  if (ring->bufRing != NULL && ring->bufRing != MAP_FAILED) {
+    munmap(ring->bufRing, URING_BUFFERS * sizeof(struct io_uring_buf));
+  }
+  if (ring->buffers != NULL && ring->buffers != MAP_FAILED) {
+    munmap(ring->buffers, URING_BUFFERS * URING_BUFFER_BYTES);
+  }
+  if (ring->fd >= 0) {
+    close(ring->fd);
+  }
+  memset(ring, 0, sizeof(Uring));
+  ring->fd = -1;
+}
@@ -0,0 +1,89 @@
+/* ========================================================================== */
+/* File: amuring.h
+ *
+ * Author: Troy Palmer and Sean Cann
+ * Date: 6.4.2015
+ *
+ * Minimal io_uring driver for the client's event loop, on the raw system
+ * calls (no liburing). Receives are multishot: one IORING_OP_RECV per socket
+ * stays armed and delivers every arrival into a buffer picked from a ring of
+ * provided buffers, which is handed back to the kernel without a system
+ * call. Sends are queued as SQEs and go out together with the next
+ * UringSubmit, so one io_uring_enter covers the moves of every session that
+ * became ready in the same pass.
+ *
+ * UringInit fails cleanly (returns 0) on kernels or sandboxes without
+ * io_uring, provided buffer rings (Linux 5.19) or multishot recv (6.0),
+ * so callers can fall back to epoll. A 5.19 kernel registers the buffer
+ * ring but fails every multishot recv, so UringInit tries one first.
+ *
+ */
+/* ========================================================================== */
+
+#ifndef AMURING_H
+#define AMURING_H
+
+// ---------------- Prerequisites e.g., Requires "math.h"
+#include <stddef.h>                          // size_t
+#include <stdint.h>                          // uint64_t
+#include <linux/io_uring.h>
+
+// ---------------- Constants
+
+#define URING_ENTRIES       64               // submission queue size
+#define URING_BUFFERS       64               // provided receive buffers (power of 2)
+#define URING_BUFFER_BYTES 1024              // bytes per receive buffer
+
+// ---------------- Structures/Types
+
+/* One reaped completion; buffer is set for a recv that filled one */
+typedef struct UringCompletion {
+  uint64_t userData;
+  int res;
+  unsigned flags;
+  int more;                                  // multishot request still armed
+  int bufferId;                              // -1 if none
+  unsigned char *buffer;
+} UringCompletion;
+
+/* A ring and its mappings */
+typedef struct Uring {
+  int fd;
+  unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+  unsigned *cqHead, *cqTail, *cqMask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  unsigned sqEntries;
+  unsigned pending;                          // SQEs queued since the last enter
+  void *sqRing, *cqRing;
+  size_t sqRingSize, cqRingSize;
+  struct io_uring_buf_ring *bufRing;         // provided buffer ring, group 0
+  unsigned char *buffers;
+  unsigned long enterCalls;                  // io_uring_enter system calls made
+} Uring;
+
+// ---------------- Prototypes/Macros
+
+/* Sets up a ring with provided buffers and checks multishot recv; 1 on
+ * success, 0 if unsupported */
+int UringInit(Uring *ring);
+
+/* Queues a multishot recv on fd into the provided buffers */
+int UringRecvMultishot(Uring *ring, int fd, uint64_t userData);
+
+/* Queues a send of length bytes; buffer must stay valid until it completes */
+int UringSend(Uring *ring, int fd, const void *buffer, size_t length, uint64_t userData);
+
+/* Submits everything queued and waits for at least minComplete completions,
+ * in one io_uring_enter; returns -1 on failure */
+int UringSubmit(Uring *ring, unsigned minComplete);
+
+/* Pops the next completion; 1 if there was one */
+int UringNext(Uring *ring, UringCompletion *completion);
+
+/* Gives a recv buffer back to the kernel once its bytes have been used */
+void UringRecycle(Uring *ring, int bufferId);
+
+void UringClose(Uring *ring);
+
+#endif // AMURING_H
@@ -0,0 +1,353 @@
+/* ========================================================================== */
+/* File: mazegen.c
+ *
+ * Author: Troy Palmer and Sean Cann
+ * Date: 6.4.2015
+ *
+ * Overview: Generates "perfect" mazes (exactly one path between any two
+ * squares) with an iterative randomized depth-first search. All randomness
+ * comes from a seeded splitmix64 generator so a maze can be rebuilt exactly.
+ *
+ */
+/* ========================================================================== */
+
+// ---------------- System includes
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>                          // memset
+
+// ---------------- Local includes
+
+#include "amazing.h"
+#include "mazegen.h"
+
+/* ========================================================================== */
+
+
+/*
+ *
+ * MazeRngNext - advances the generator and returns 64 random bits
+ *
+ */
+uint64_t MazeRngNext(MazeRng *rng) {
+
+  uint64_t z = (rng->state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+
+/*
+ *
+ * MazeRngRange - returns a value in [0, bound)
+ *
+ */
+uint32_t MazeRngRange(MazeRng *rng, uint32_t bound) {
+
+  return (uint32_t)(((MazeRngNext(rng) >> 32) * bound) >> 32);
+}
+
+
+/*
+ *
+ * MazeStep - converts an M_* direction into an (x,y) offset
+ *
+ */
+void MazeStep(int direction, int *dx, int *dy) {
+
+  *dx = 0;
+  *dy = 0;
+
+  if (direction == M_NORTH) {
+    *dy = -1;
+  }
+  else if (direction == M_SOUTH) {
+    *dy = 1;
+  }
+  else if (direction == M_EAST) {
+    *dx = 1;
+  }
+  else if (direction == M_WEST) {
+    *dx = -1;
+  }
+}
+
+
+/*
+ *
+ * MazeGenerate - a fully walled grid carved into a perfect maze
+ *   (MazeRegenerate)
+ *
+ * Returns the new maze, or NULL if memory could not be allocated
+ *
+ */
+Maze *MazeGenerate(int width, int height, uint64_t seed) {
+
+  if (width <= 0 || height <= 0) {
+    return NULL;
+  }
+
+  Maze *maze = calloc(1, sizeof(Maze));
+
+  if (maze == NULL || (maze->cells = calloc(width * height, sizeof(uint8_t))) == NULL) {
+    free(maze);
+    return NULL;
+  }
+
+  maze->width = width;
+  maze->height = height;
+
+  if (!MazeRegenerate(maze, seed)) {
+    MazeFree(maze);
+    return NULL;
+  }
+  return maze;
+}
+
+
+/*
+ *
+ * MazeRegenerate - carves a new maze from seed into an existing one's
+ *   cells, as MazeGenerate would for a maze of that size
+ *
+ * Pseudocode: push a random start square; while the stack is non-empty look
+ * at the top square, pick a random unvisited neighbour, knock down the wall
+ * between them and push it, or pop if every neighbour is visited. A square
+ * other than the start has been visited once any of its sides is open, so
+ * the cells double as the visited marks; only the stack needs scratch, and
+ * it is kept with the maze for next time.
+ *
+ * Returns 1 on success, 0 if the stack cannot be allocated
+ *
+ */
+int MazeRegenerate(Maze *maze, uint64_t seed) {
+
+  int width = maze->width, height = maze->height;
+
+  if (maze->stack == NULL && (maze->stack = malloc(sizeof(int) * width * height)) == NULL) {
+    return 0;
+  }
+
+  int *stack = maze->stack;
+  uint8_t *visited = maze->cells;
+
+  memset(maze->cells, 0, (size_t) width * height);
+  maze->seed = seed;
+
+  MazeRng rng = { seed };
+
+  int top = 0;
+  int start = MazeRngRange(&rng, width * height);
+  stack[top++] = start;
+
+  while (top > 0) {
+
+    int cell = stack[top - 1];
+    int x = cell % width;
+    int y = cell / width;
+
+    /* Collect the unvisited neighbours */
+
+    int options[M_NUM_DIRECTIONS];
+    int nOptions = 0;
+
+    for (int direction = 0; direction < M_NUM_DIRECTIONS; direction++) {
+      int dx, dy;
+      MazeStep(direction, &dx, &dy);
+      int nx = x + dx;
+      int ny = y + dy;
+      int next = ny * width + nx;
+      if (nx >= 0 && nx < width && ny >= 0 && ny < height && !visited[next] && next != start) {
+        options[nOptions++] = direction;
+      }
+    }
+
+    if (nOptions == 0) {
+      top--;
+      continue;
+    }
+
+    /* Knock down the wall on both sides */
+
+    int direction = options[MazeRngRange(&rng, nOptions)];
+    int dx, dy;
+    MazeStep(direction, &dx, &dy);
+    int next = (y + dy) * width + (x + dx);
+
+    maze->cells[cell] |= 1 << direction;
+    maze->cells[next] |= 1 << (M_NUM_DIRECTIONS - 1 - direction); // W<->E, N<->S
+
+    stack[top++] = next;
+  }
+
+  return 1;
+}
+
+
+/*
+ *
+ * MazeScatter - places the avatars on squares drawn from a generator
+ *   seeded apart from the one that carved the maze
+ *
+ */
+void MazeScatter(const Maze *maze, int nAvatars, XYPos *pos) {
+
+  MazeRng rng = { maze->seed ^ 0xA5A5A5A5A5A5A5A5ULL };
+
+  for (int i = 0; i < nAvatars; i++) {
+    pos[i].x = MazeRngRange(&rng, maze->width);
+    pos[i].y = MazeRngRange(&rng, maze->height);
+  }
+}
+
+
+/*
+ *
+ * MazeLoad - reads a maze written by MazeSave
+ *
+ * Pseudocode: read the dimensions, then a hex digit per square row by row;
+ * every open side must be open from the square across it too and no side
+ * may open off the edge of the maze.
+ *
+ * Returns the maze, or NULL if the file is missing, short or inconsistent
+ *
+ */
+Maze *MazeLoad(const char *path, uint64_t seed) {
+
+  FILE *file = fopen(path, "r");
+  int width, height;
+
+  if (file == NULL) {
+    return NULL;
+  }
+  if (fscanf(file, "%d %d", &width, &height) != 2 || width <= 0 || height <= 0) {
+    fclose(file);
+    return NULL;
+  }
+
+  Maze *maze = calloc(1, sizeof(Maze));
+
+  if (maze == NULL || (maze->cells = calloc(width * height, sizeof(uint8_t))) == NULL) {
+    free(maze);
+    fclose(file);
+    return NULL;
+  }
+
+  maze->width = width;
+  maze->height = height;
+  maze->seed = seed;
+
+  int ok = 1;
+
+  for (int i = 0; ok && i < width * height; i++) {
+    unsigned int sides;
+    ok = fscanf(file, " %1x", &sides) == 1;
+    maze->cells[i] = sides;
+  }
+  fclose(file);
+
+
+  /* Both sides of every edge must agree */
+
+  for (int y = 0; ok && y < height; y++) {
+    for (int x = 0; ok && x < width; x++) {
+      for (int direction = 0; direction < M_NUM_DIRECTIONS; direction++) {
+        int dx, dy;
+        MazeStep(direction, &dx, &dy);
+        int open = (maze->cells[y * width + x] >> direction) & 1;
+        if (open && !MazeIsOpen(maze, x + dx, y + dy, M_NUM_DIRECTIONS - 1 - direction)) {
+          ok = 0;
+        }
+      }
+    }
+  }
+
+  if (!ok) {
+    MazeFree(maze);
+    return NULL;
+  }
+  return maze;
+}
+
+
+/*
+ *
+ * MazeSave - writes the dimensions and a hex digit per square
+ *
+ * Returns 1 if the whole maze was written and 0 otherwise
+ *
+ */
+int MazeSave(const Maze *maze, const char *path) {
+
+  FILE *file = fopen(path, "w");
+
+  if (file == NULL) {
+    return 0;
+  }
+
+  fprintf(file, "%d %d\n", maze->width, maze->height);
+
+  for (int y = 0; y < maze->height; y++) {
+    for (int x = 0; x < maze->width; x++) {
+      fprintf(file, "%x", maze->cells[y * maze->width + x]);
+    }
+    fprintf(file, "\n");
+  }
+
+  return fclose(file) == 0;
+}
+
+
+/*
+ *
+ * MazeIsOpen - looks up one side of a square; the outer boundary is closed
+ *
+ * Returns 1 if the side is open and 0 if it is a wall
+ *
+ */
+int MazeIsOpen(const Maze *maze, int x, int y, int direction) {
+
+  if (x < 0 || x >= maze->width || y < 0 || y >= maze->height ||
+      direction < 0 || direction >= M_NUM_DIRECTIONS) {
+    return 0;
+  }
+
+  return (maze->cells[y * maze->width + x] >> direction) & 1;
+}
+
+
+/*
+ *
+ * MazeHash - FNV-1a over the dimensions and every square's open sides
+ *
+ */
+uint32_t MazeHash(const Maze *maze) {
+
+  uint32_t hash = 2166136261u;
+
+  hash = (hash ^ (uint32_t)maze->width) * 16777619u;
+  hash = (hash ^ (uint32_t)maze->height) * 16777619u;
+
+  for (int i = 0; i < maze->width * maze->height; i++) {
+    hash = (hash ^ maze->cells[i]) * 16777619u;
+  }
+
+  return hash;
+}
+
+
+/*
+ *
+ * MazeFree - releases a maze
+ *
+ */
+void MazeFree(Maze *maze) {
+
+  if (maze != NULL) {
+    free(maze->cells);
+    free(maze->stack);
+    free(maze);
+  }
+}
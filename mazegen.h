@@ -0,0 +1,86 @@
+/* ========================================================================== */
+/* File: mazegen.h
+ *
+ * Author: Troy Palmer and Sean Cann
+ * Date: 6.4.2015
+ *
+ * Seeded perfect maze generator shared by the local maze server and the
+ * offline simulator. The same seed and dimensions always yield the same
+ * maze, and the same starting squares, so runs can be repeated.
+ *
+ * A maze can also be saved to and loaded from a text file: a line with the
+ * width and height, then one line per row with a hex digit per square, the
+ * digit being that square's open-side bits (see Maze below).
+ *
+ */
+/* ========================================================================== */
+
+#ifndef MAZEGEN_H
+#define MAZEGEN_H
+
+// ---------------- Prerequisites e.g., Requires "math.h"
+#include <stdint.h>                          // uint8_t, uint64_t
+#include "amazing.h"                         // XYPos
+
+// ---------------- Constants
+
+/* Maze dimensions for a given difficulty: 10x10 at 0 up to 100x100 at 9 */
+#define MAZE_SIZE_FOR_DIFFICULTY(d) (10 + 10 * (d))
+
+// ---------------- Structures/Types
+
+/* Generated maze. cells[y * width + x] holds one bit per open side, with
+ * bit (1 << direction) set when the side in that M_* direction is open.
+ */
+typedef struct Maze {
+  int width;
+  int height;
+  uint64_t seed;
+  uint8_t *cells;
+  int *stack;                                // MazeRegenerate's scratch, NULL until needed
+} Maze;
+
+/* Small deterministic PRNG (splitmix64) so mazes match across platforms */
+typedef struct MazeRng {
+  uint64_t state;
+} MazeRng;
+
+// ---------------- Prototypes/Macros
+
+/* Returns the next 64 random bits from rng */
+uint64_t MazeRngNext(MazeRng *rng);
+
+/* Returns a uniformly distributed value in [0, bound) */
+uint32_t MazeRngRange(MazeRng *rng, uint32_t bound);
+
+/* Builds a width x height perfect maze from seed. Returns NULL on failure */
+Maze *MazeGenerate(int width, int height, uint64_t seed);
+
+/* Carves the maze seed gives into maze's cells, keeping its size and
+ * allocations; returns 0 if its scratch cannot be allocated */
+int MazeRegenerate(Maze *maze, uint64_t seed);
+
+/* Writes the starting squares of nAvatars avatars, drawn from the maze's
+ * seed, into pos */
+void MazeScatter(const Maze *maze, int nAvatars, XYPos *pos);
+
+/* Reads a maze saved by MazeSave, with seed for MazeScatter. Returns NULL
+ * if the file cannot be read or does not hold a consistent maze */
+Maze *MazeLoad(const char *path, uint64_t seed);
+
+/* Writes maze to path; returns 1 on success and 0 otherwise */
+int MazeSave(const Maze *maze, const char *path);
+
+/* Returns 1 if the side of (x,y) in direction is open, 0 otherwise */
+int MazeIsOpen(const Maze *maze, int x, int y, int direction);
+
+/* Returns the (x,y) step for direction in dx and dy */
+void MazeStep(int direction, int *dx, int *dy);
+
+/* Returns a hash identifying the maze layout */
+uint32_t MazeHash(const Maze *maze);
+
+/* Frees a maze returned by MazeGenerate */
+void MazeFree(Maze *maze);
+
+#endif // MAZEGEN_H
@@ -0,0 +1,466 @@
+/* ========================================================================== */
+/* File: mazemap.c
+ *
+ * Author: Troy Palmer and Sean Cann
+ * Date: 6.4.2015
+ *
+ * Overview: Bit-packed wall map (see mazemap.h). An M_* direction at (x,y)
+ * is turned into the index of the one edge it names; that index picks a
+ * word and a 2-bit field inside it, so both lookups and updates are a shift
+ * and a mask.
+ *
+ * Writers race only on whole words: MazeMapSet retries its compare-and-swap
+ * until either its edge is in the word or another writer got there first.
+ * Lookups are plain atomic loads and never wait for a writer.
+ *
+ * Only the writer whose swap learned or sealed an edge appends it to the
+ * log, so each change is logged once. A writer reserves a slot with a
+ * fetch-and-add and then fills it, so a reader can see a slot counted but
+ * not yet written; slots hold edge + 1 and a reader stops at the first 0,
+ * picking the rest up next time.
+ *
+ * The union of an open edge's two squares is made by the same writer, after
+ * its swap, so a region never joins squares across an edge not yet open.
+ *
+ */
+/* ========================================================================== */
+
+// ---------------- System includes
+
+#include <stdlib.h>
+#include <string.h>                          // memset
+
+// ---------------- Local includes
+
+#include "amazing.h"
+#include "mazemap.h"
+
+// ---------------- Constant definitions
+
+#define EDGES_PER_WORD 32
+
+/* Stored codes: 0 so a zeroed map is all unknown */
+#define CODE_UNKNOWN 0
+#define CODE_BLOCKED 1
+#define CODE_OPEN    2
+#define CODE_SEALED  3
+
+// ---------------- Private prototypes
+
+static long EdgeIndex(const MazeMap *map, int x, int y, int direction);
+static void LogEdge(MazeMap *map, long edge);
+static unsigned EdgeCode(const MazeMap *map, long edge);
+
+/* ========================================================================== */
+
+
+/*
+ *
+ * EdgeIndex - the edge on the side of (x,y) in direction, numbered 2 per
+ *   square: 2k is the north edge of square k and 2k + 1 its west edge
+ *
+ * Returns the index, or -1 outside the maze or for a non-compass direction
+ *
+ */
+static long EdgeIndex(const MazeMap *map, int x, int y, int direction) {
+
+  if (x < 0 || y < 0 || x >= map->width || y >= map->height) {
+    return(-1);
+  }
+
+  switch (direction) {
+    case M_NORTH:
+      return 2L * ((long) y * map->stride + x);
+    case M_SOUTH:
+      return 2L * ((long) (y + 1) * map->stride + x);
+    case M_WEST:
+      return 2L * ((long) y * map->stride + x) + 1;
+    case M_EAST:
+      return 2L * ((long) y * map->stride + x + 1) + 1;
+    default:
+      return(-1);
+  }
+}
+
+
+/*
+ *
+ * MazeMapNew - allocates an all-unknown map for a width x height maze
+ *
+ * Returns the map, or NULL on failure
+ *
+ */
+MazeMap *MazeMapNew(int width, int height) {
+
+  if (width <= 0 || height <= 0) {
+    return(NULL);
+  }
+
+  MazeMap *map = calloc(1, sizeof(MazeMap));
+  if (map == NULL) {
+    return(NULL);
+  }
+
+  size_t nEdges = 2 * (size_t) (width + 1) * (height + 1);
+
+  map->width = width;
+  map->height = height;
+  map->stride = width + 1;
+  map->nWords = (nEdges + EDGES_PER_WORD - 1) / EDGES_PER_WORD;
+  map->words = calloc(map->nWords, sizeof(uint64_t));
+
+  if (map->words == NULL) {
+    free(map);
+    return(NULL);
+  }
+  return(map);
+}
+
+
+/*
+ *
+ * MazeMapGet - what is known about one side of a square
+ *
+ * Returns MAP_UNKNOWN, MAP_BLOCKED or MAP_OPEN
+ *
+ */
+int MazeMapGet(const MazeMap *map, int x, int y, int direction) {
+
+  return MazeMapEdgeGet(map, EdgeIndex(map, x, y, direction));
+}
+
+
+/*
+ *
+ * MazeMapSet - records one side of a square (and so of its neighbour)
+ *
+ * Pseudocode: load the edge's word; if the edge is already known, stop,
+ * else try to swap in the word with the new code. A failed swap reloads
+ * the word (some other edge in it, or this one, changed) and tries again.
+ *
+ * Returns 1 if the edge went from unknown to state, and 0 if it was already
+ * known, is outside the maze or state is MAP_UNKNOWN
+ *
+ */
+int MazeMapSet(MazeMap *map, int x, int y, int direction, int state) {
+
+  long edge = EdgeIndex(map, x, y, direction);
+  if (edge == -1 || (state != MAP_OPEN && state != MAP_BLOCKED)) {
+    return(0);
+  }
+
+  uint64_t code = state == MAP_OPEN ? CODE_OPEN : CODE_BLOCKED;
+  int shift = 2 * (edge % EDGES_PER_WORD);
+  _Atomic uint64_t *word = &map->words[edge / EDGES_PER_WORD];
+  uint64_t old = atomic_load_explicit(word, memory_order_relaxed);
+
+  do {
+    if ((old >> shift) & 3) {
+      return(0);
+    }
+  } while (!atomic_compare_exchange_weak_explicit(word, &old, old | (code << shift),
+                                                  memory_order_release, memory_order_relaxed));
+
+  if (state == MAP_OPEN && map->regions != NULL) {
+    int nx = x + (direction == M_EAST ? 1 : direction == M_WEST ? -1 : 0);
+    int ny = y + (direction == M_SOUTH ? 1 : direction == M_NORTH ? -1 : 0);
+
+    if (nx >= 0 && ny >= 0 && nx < map->width && ny < map->height) {
+      RegionsUnion(map->regions, y * map->width + x, ny * map->width + nx);
+    }
+  }
+
+  LogEdge(map, edge);
+  return(1);
+}
+
+
+/*
+ *
+ * MazeMapSeal - closes off an edge that leads only into a dead end
+ *
+ * Pseudocode: as MazeMapSet, but an open edge may be replaced too; only a
+ * wall or an edge already sealed is left alone.
+ *
+ * Returns 1 if the edge was sealed by this call, 0 otherwise
+ *
+ */
+int MazeMapSeal(MazeMap *map, int x, int y, int direction) {
+
+  long edge = EdgeIndex(map, x, y, direction);
+  if (edge == -1) {
+    return(0);
+  }
+
+  int shift = 2 * (edge % EDGES_PER_WORD);
+  _Atomic uint64_t *word = &map->words[edge / EDGES_PER_WORD];
+  uint64_t old = atomic_load_explicit(word, memory_order_relaxed);
+
+  do {
+    unsigned code = (old >> shift) & 3;
+    if (code == CODE_BLOCKED || code == CODE_SEALED) {
+      return(0);
+    }
+  } while (!atomic_compare_exchange_weak_explicit(word, &old, old | ((uint64_t) CODE_SEALED << shift),
+                                                  memory_order_release, memory_order_relaxed));
+
+  LogEdge(map, edge);
+  return(1);
+}
+
+
+/*
+ *
+ * MazeMapIsSealed - whether a side reads as blocked because it was sealed
+ *
+ */
+int MazeMapIsSealed(const MazeMap *map, int x, int y, int direction) {
+
+  return MazeMapEdgeSealed(map, EdgeIndex(map, x, y, direction));
+}
+
+
+/*
+ *
+ * LogEdge - appends an edge that just changed to the log, if there is one
+ *
+ */
+static void LogEdge(MazeMap *map, long edge) {
+
+  if (map->log != NULL) {
+    size_t slot = atomic_fetch_add_explicit(&map->nLogged, 1, memory_order_relaxed);
+    atomic_store_explicit(&map->log[slot], (uint32_t) edge + 1, memory_order_release);
+  }
+}
+
+
+/*
+ *
+ * MazeMapTrack - allocates the learned-edge log, two slots per edge
+ *
+ * Returns 1 on success (or if the map was already tracked), 0 otherwise
+ *
+ */
+int MazeMapTrack(MazeMap *map) {
+
+  if (map->log == NULL) {
+    map->log = calloc(2 * map->nWords * EDGES_PER_WORD, sizeof(uint32_t));
+    atomic_init(&map->nLogged, 0);
+  }
+  return(map->log != NULL);
+}
+
+
+/*
+ *
+ * MazeMapTrackRegions - sets up one region per square
+ *
+ * Returns 1 on success (or if regions were already tracked), 0 otherwise
+ *
+ */
+int MazeMapTrackRegions(MazeMap *map) {
+
+  if (map->regions == NULL) {
+    map->regions = RegionsNew(map->width * map->height);
+  }
+  return(map->regions != NULL);
+}
+
+
+/*
+ *
+ * MazeMapJoined - whether two squares are in one region of known passages
+ *
+ */
+int MazeMapJoined(MazeMap *map, int x1, int y1, int x2, int y2) {
+
+  if (map->regions == NULL || x1 < 0 || y1 < 0 || x1 >= map->width || y1 >= map->height ||
+      x2 < 0 || y2 < 0 || x2 >= map->width || y2 >= map->height) {
+    return(0);
+  }
+  return RegionsSame(map->regions, y1 * map->width + x1, y2 * map->width + x2);
+}
+
+
+/*
+ *
+ * MazeMapChanges - edges learned since slot from of the log
+ *
+ * Returns how many were copied, stopping at max, at the end of the log or at
+ * a slot that has been reserved but not written yet
+ *
+ */
+size_t MazeMapChanges(const MazeMap *map, size_t from, long *edges, size_t max) {
+
+  if (map->log == NULL) {
+    return(0);
+  }
+
+  size_t end = atomic_load_explicit(&map->nLogged, memory_order_acquire);
+  size_t n = 0;
+
+  for (size_t slot = from; slot < end && n < max; slot++) {
+    uint32_t entry = atomic_load_explicit(&map->log[slot], memory_order_acquire);
+    if (entry == 0) {
+      break;
+    }
+    edges[n++] = (long) entry - 1;
+  }
+  return(n);
+}
+
+
+/*
+ *
+ * MazeMapEdgeSide - undoes EdgeIndex for a logged edge
+ *
+ */
+void MazeMapEdgeSide(const MazeMap *map, long edge, int *x, int *y, int *direction) {
+
+  long square = edge / 2;
+
+  *x = square % map->stride;
+  *y = square / map->stride;
+  *direction = edge % 2 == 0 ? M_NORTH : M_WEST;
+}
+
+
+/*
+ *
+ * EdgeCode - the stored code of an edge by its index
+ *
+ * Returns CODE_*, CODE_UNKNOWN for an index outside the map
+ *
+ */
+static unsigned EdgeCode(const MazeMap *map, long edge) {
+
+  if (edge < 0 || edge >= MazeMapEdges(map)) {
+    return(CODE_UNKNOWN);
+  }
+
+  uint64_t word = atomic_load_explicit(&map->words[edge / EDGES_PER_WORD], memory_order_acquire);
+  return (word >> (2 * (edge % EDGES_PER_WORD))) & 3;
+}
+
+
+/*
+ *
+ * MazeMapEdgeGet - what is known about an edge by its index, so a logged
+ *   edge on the south or east border reads the same as from inside
+ *
+ * Returns MAP_UNKNOWN, MAP_BLOCKED or MAP_OPEN
+ *
+ */
+int MazeMapEdgeGet(const MazeMap *map, long edge) {
+
+  unsigned code = EdgeCode(map, edge);
+
+  return code == CODE_OPEN ? MAP_OPEN : code == CODE_UNKNOWN ? MAP_UNKNOWN : MAP_BLOCKED;
+}
+
+
+/*
+ *
+ * MazeMapEdgeSealed - MazeMapIsSealed by edge index
+ *
+ */
+int MazeMapEdgeSealed(const MazeMap *map, long edge) {
+
+  return EdgeCode(map, edge) == CODE_SEALED;
+}
+
+
+/*
+ *
+ * MazeMapRowMasks - which sides of row y's squares lead on, as bitsets
+ *
+ * Pseudocode: the east edges of a row are the west edges of the squares
+ * beside them and its south edges the north edges of the row below, so
+ * both are read in one pass along the edge words, each word loaded once.
+ * Bit x of east is the edge between (x,y) and (x+1,y), bit x of south the
+ * one between (x,y) and (x,y+1); the outside of the maze is never passable.
+ *
+ */
+void MazeMapRowMasks(const MazeMap *map, int y, int optimistic, uint64_t *east, uint64_t *south) {
+
+  int nWords = (map->width + 63) / 64;
+  long loaded[2] = { -1, -1 };
+  uint64_t words[2] = { 0, 0 };
+
+  for (int w = 0; w < nWords; w++) {
+    east[w] = south[w] = 0;
+  }
+
+  for (int x = 0; x < map->width; x++) {
+
+    long edges[2] = { 2L * ((long) y * map->stride + x + 1) + 1, 2L * ((long) (y + 1) * map->stride + x) };
+    uint64_t *masks[2] = { east, south };
+
+    for (int side = 0; side < 2; side++) {
+
+      if (edges[side] / EDGES_PER_WORD != loaded[side]) {
+        loaded[side] = edges[side] / EDGES_PER_WORD;
+        words[side] = atomic_load_explicit(&map->words[loaded[side]], memory_order_acquire);
+      }
+
+      unsigned code = (words[side] >> (2 * (edges[side] % EDGES_PER_WORD))) & 3;
+      if (code == CODE_OPEN || (optimistic && code == CODE_UNKNOWN)) {
+        masks[side][x / 64] |= 1ULL << (x % 64);
+      }
+    }
+  }
+
+  east[(map->width - 1) / 64] &= ~(1ULL << ((map->width - 1) % 64));
+  if (y == map->height - 1) {
+    for (int w = 0; w < nWords; w++) {
+      south[w] = 0;
+    }
+  }
+}
+
+
+/*
+ *
+ * MazeMapBytes - size of the edge words
+ *
+ */
+size_t MazeMapBytes(const MazeMap *map) {
+
+  return map->nWords * sizeof(uint64_t);
+}
+
+
+/*
+ *
+ * MazeMapReset - every edge unknown again, keeping the map's allocations;
+ *   the log and regions, if tracked, start over empty
+ *
+ */
+void MazeMapReset(MazeMap *map) {
+
+  memset(map->words, 0, map->nWords * sizeof(uint64_t));
+
+  if (map->log != NULL) {
+    memset(map->log, 0, 2 * map->nWords * EDGES_PER_WORD * sizeof(uint32_t));
+    atomic_store(&map->nLogged, 0);
+  }
+  if (map->regions != NULL) {
+    RegionsReset(map->regions);
+  }
+}
+
+
+/*
+ *
+ * MazeMapFree - frees a map returned by MazeMapNew
+ *
+ */
+void MazeMapFree(MazeMap *map) {
+
+  if (map != NULL) {
+    free(map->words);
+    free(map->log);
+    RegionsFree(map->regions);
+    free(map);
+  }
+}
@@ -0,0 +1,136 @@
+/* ========================================================================== */
+/* File: mazemap.h
+ *
+ * Author: Troy Palmer and Sean Cann
+ * Date: 6.4.2015
+ *
+ * The client's knowledge of the maze walls, sized from MazeWidth/MazeHeight
+ * in AM_INIT_OK. Every edge between two squares (and every edge on the
+ * outside of the maze) is stored exactly once, in 2 bits:
+ *
+ *     square (x,y) owns its north edge and its west edge
+ *     south of (x,y) is north of (x,y+1), east of (x,y) is west of (x+1,y)
+ *
+ * so the map holds (width+1) * (height+1) squares' worth of edges, 32 edges
+ * to a 64-bit word: 4 bits a square against the 16 bytes a square (with
+ * every interior wall stored twice) of the old fixed 1000x1000
+ * MazeSquareData array. A 100x100 maze takes about 5 KB instead of 16 MB.
+ *
+ * One map is shared by every avatar thread, the event loops and the drawing
+ * code without a lock. Words are read with atomic loads and updated with
+ * compare-and-swap, and an edge only ever goes from unknown to blocked or
+ * open, so a reader sees either the old or the new code of an edge and a
+ * wall found by one avatar is visible to the rest on their next lookup.
+ *
+ * An unknown or open edge can also be sealed (amprune.h): it leads only
+ * into a dead end nobody needs, so it reads as MAP_BLOCKED from then on and
+ * every planner, search and wall follower stays out without knowing about
+ * dead ends. MazeMapIsSealed tells a sealed edge from a real wall.
+ *
+ * A map can also keep a log of the edges it learns, in the order they were
+ * learned (MazeMapTrack), so an incremental search can pick up just the
+ * edges that changed since it last looked instead of rereading the maze.
+ * Every edge is learned once and sealed at most once, so the log never holds
+ * more than twice the number of edges and never wraps.
+ *
+ * It can also keep track of which squares known passages join
+ * (MazeMapTrackRegions, amregion.h): every edge learned open merges the
+ * regions on its two sides, and MazeMapJoined asks whether two squares are
+ * in one region without searching the map.
+ *
+ */
+/* ========================================================================== */
+
+#ifndef MAZEMAP_H
+#define MAZEMAP_H
+
+// ---------------- Prerequisites e.g., Requires "math.h"
+#include <stdatomic.h>                       // _Atomic
+#include <stddef.h>                          // size_t
+#include <stdint.h>                          // uint64_t
+#include "amregion.h"
+
+// ---------------- Constants
+
+/* What is known about an edge, as returned by MazeMapGet */
+#define MAP_UNKNOWN  -1
+#define MAP_BLOCKED   0
+#define MAP_OPEN      1
+
+// ---------------- Structures/Types
+
+typedef struct MazeMap {
+  int width;
+  int height;
+  int stride;                                // squares per row, width + 1
+  size_t nWords;
+  _Atomic uint64_t *words;                   // 2 bits per edge, 0 = unknown
+  _Atomic uint32_t *log;                     // learned edges + 1, 0 until written; NULL if untracked
+  _Atomic size_t nLogged;
+  Regions *regions;                          // squares joined by open edges; NULL if untracked
+} MazeMap;
+
+// ---------------- Prototypes/Macros
+
+/* Allocates a map of a width x height maze with every edge unknown; NULL on failure */
+MazeMap *MazeMapNew(int width, int height);
+
+/* Returns MAP_UNKNOWN, MAP_BLOCKED or MAP_OPEN for the side of (x,y) in an
+ * M_* direction (MAP_BLOCKED if sealed); MAP_UNKNOWN outside the maze */
+int MazeMapGet(const MazeMap *map, int x, int y, int direction);
+
+/* Records the side of (x,y) in direction, which is also the opposite side
+ * of the neighbouring square. Only an unknown edge is changed; returns 1 if
+ * this call was the one that learned it */
+int MazeMapSet(MazeMap *map, int x, int y, int direction, int state);
+
+/* Seals an unknown or open edge; returns 1 if this call sealed it */
+int MazeMapSeal(MazeMap *map, int x, int y, int direction);
+
+/* Returns 1 if the side of (x,y) in direction has been sealed */
+int MazeMapIsSealed(const MazeMap *map, int x, int y, int direction);
+
+/* Starts logging learned edges. Call before the map is shared; returns 0 if
+ * the log cannot be allocated */
+int MazeMapTrack(MazeMap *map);
+
+/* Copies up to max edges learned since the first from logged ones into
+ * edges and returns how many; from + the result is where to start next */
+size_t MazeMapChanges(const MazeMap *map, size_t from, long *edges, size_t max);
+
+/* The square owning a logged edge and the side of it (M_NORTH or M_WEST)
+ * the edge is; the square is one past the maze for its south/east border */
+void MazeMapEdgeSide(const MazeMap *map, long edge, int *x, int *y, int *direction);
+
+/* The number of edge indexes, border edges and unused slots included:
+ * every logged edge is below it */
+#define MazeMapEdges(map) (2L * (map)->stride * ((map)->height + 1))
+
+/* MazeMapGet and MazeMapIsSealed for an edge by its index, as logged; these
+ * read the south and east borders, which MazeMapEdgeSide places outside */
+int MazeMapEdgeGet(const MazeMap *map, long edge);
+int MazeMapEdgeSealed(const MazeMap *map, long edge);
+
+/* Starts merging the squares on both sides of every edge learned open.
+ * Call before the map is shared; returns 0 on failure */
+int MazeMapTrackRegions(MazeMap *map);
+
+/* Returns 1 if open edges already known join (x1,y1) and (x2,y2), 0 if
+ * not (or regions are not tracked) */
+int MazeMapJoined(MazeMap *map, int x1, int y1, int x2, int y2);
+
+/* Bitsets of the squares in row y whose east (and south) side can be
+ * crossed, (width + 63) / 64 words each: known open edges only, or with
+ * optimistic every edge not known to be blocked. Used by amflood.h */
+void MazeMapRowMasks(const MazeMap *map, int y, int optimistic, uint64_t *east, uint64_t *south);
+
+/* Bytes of edge storage */
+size_t MazeMapBytes(const MazeMap *map);
+
+/* Forgets every edge (and the log and regions) so the map can be used for
+ * another maze of the same size. Call while nobody else is using it */
+void MazeMapReset(MazeMap *map);
+
+void MazeMapFree(MazeMap *map);
+
+#endif // MAZEMAP_H